@@ -0,0 +1,914 @@
+/*
+  build: Part of Atari/MidwayGamesWest filesystem using libfuse: Filesystem in Userspace
+
+  Copyright (C) 2025  Dave Shepperd <mgwfs@dshepperd.com>
+
+  This program can be distributed under the terms of the GNU GPLv2.
+  See the file COPYING.
+
+ mgwfs-build makes a new image from a host directory in one pass, without
+ mounting anything. The whole layout is worked out before anything is
+ written: each copy region (FSYS_COPY_ALG()) gets its home block, then the
+ file headers of every inode packed together, then index.sys, freemap.sys and
+ the directories, then the file data, each copy of each file in one piece
+ where it fits. Files go down boot files first, then any listed in an --order
+ file, then the rest in the order a depth first walk of the tree would read
+ them. Since every region is laid out in the same order, the host files are
+ read once and each region is written front to back a megabyte at a time.
+ Copies that don't fit in their own region carry on in the free space of the
+ others (see bdLayout()).
+
+ Build: see Makefile target 'mgwfs-build'.
+*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE (1)
+#endif
+
+#include "mgwfs.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <time.h>
+
+#define BD_CHUNK_BYTES		(MGWFS_MAX_IO_SIZE)	/* most written at a time to a region */
+#define BD_FREEMAP_SECTORS	(16)		/* room for freemap.sys to grow into */
+#define BD_MAX_BOOT			(4)			/* boot, boot1, boot2 and boot3 in the home block */
+#define BD_MAX_NAME			(254)		/* a directory entry's name length is a byte, including the NUL */
+#define BD_FIRST_INODE		(FSYS_INDEX_JOURNAL+1)
+
+typedef struct
+{
+	char *hostPath;				/* where it comes from on the host; NULL for built ones */
+	char *path;					/* from the top, without a leading '/' */
+	const char *name;			/* last part of path, as it goes in its directory */
+	int parent;					/* inode of its directory */
+	int firstChild, lastChild, nextSibling;
+	int copies;
+	int placed;					/* already in the layout order */
+	uint8_t *data;				/* contents of index.sys, freemap.sys and directories */
+	FsysHeader hdr;
+	IndexSys_t fh;
+} BdInode_t;
+
+typedef struct
+{
+	int fd;
+	uint32_t lba;				/* where buf goes */
+	uint32_t used;				/* bytes in buf */
+	uint8_t *buf;
+	const FsysRetPtr *rp;		/* next piece of the copy being written */
+	uint32_t left;				/* bytes left in the current piece */
+} BdStream_t;
+
+typedef struct
+{
+	const char *image;
+	uint32_t sizeInSectors, maxHb;
+	int copies, verbose;
+	uint32_t now;
+	BdInode_t *inodes;
+	int numInodes, maxInodes;
+	int *order;					/* inodes in the order their data is laid down */
+	int numOrder;
+	int boot[BD_MAX_BOOT];
+	int numBoot;
+	uint32_t regionEnd[FSYS_MAX_ALTS], cursor[FSYS_MAX_ALTS];
+	BdStream_t streams[FSYS_MAX_ALTS];
+	FsysHomeBlock homeBlk;
+	int errors;
+	uint64_t bytes;
+	int files, dirs;
+} Bd_t;
+
+static const char *Prog = "mgwfs-build";
+
+static BdInode_t *bdAdd(Bd_t *bd)
+{
+	BdInode_t *ip;
+
+	if ( bd->numInodes >= bd->maxInodes )
+	{
+		bd->maxInodes = bd->maxInodes ? bd->maxInodes*2 : 1024;
+		bd->inodes = (BdInode_t *)realloc(bd->inodes, bd->maxInodes*sizeof(BdInode_t));
+		if ( !bd->inodes )
+		{
+			fprintf(stderr, "%s: Out of memory\n", Prog);
+			exit(1);
+		}
+	}
+	ip = bd->inodes + bd->numInodes++;
+	memset(ip, 0, sizeof(BdInode_t));
+	return ip;
+}
+
+static void bdLink(Bd_t *bd, int dirIdx, int idx)
+{
+	BdInode_t *dir = bd->inodes + dirIdx;
+
+	bd->inodes[idx].parent = dirIdx;
+	if ( dir->lastChild )
+		bd->inodes[dir->lastChild].nextSibling = idx;
+	else
+		dir->firstChild = idx;
+	dir->lastChild = idx;
+}
+
+static int cmpName(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/* Add everything in a host directory to the image, depth first and sorted by
+ * name so the same tree always makes the same image. */
+static void bdScan(Bd_t *bd, int dirIdx)
+{
+	DIR *dp;
+	struct dirent *de;
+	char **names=NULL;
+	int numNames=0, maxNames=0, ii;
+
+	dp = opendir(bd->inodes[dirIdx].hostPath);
+	if ( !dp )
+	{
+		fprintf(stderr, "%s: Unable to read directory '%s': %s\n", Prog, bd->inodes[dirIdx].hostPath, strerror(errno));
+		++bd->errors;
+		return;
+	}
+	while ( (de = readdir(dp)) )
+	{
+		if ( !strcmp(de->d_name, ".") || !strcmp(de->d_name, "..") )
+			continue;
+		if ( numNames >= maxNames )
+		{
+			maxNames = maxNames ? maxNames*2 : 64;
+			names = (char **)realloc(names, maxNames*sizeof(char *));
+		}
+		if ( !names || !(names[numNames++] = strdup(de->d_name)) )
+		{
+			fprintf(stderr, "%s: Out of memory\n", Prog);
+			exit(1);
+		}
+	}
+	closedir(dp);
+	if ( numNames )
+		qsort(names, numNames, sizeof(char *), cmpName);
+	for (ii=0; ii < numNames; ++ii)
+	{
+		BdInode_t *ip, *dir = bd->inodes + dirIdx;
+		struct stat st;
+		char *hostPath, *path;
+		int idx;
+
+		if (    asprintf(&hostPath, "%s/%s", dir->hostPath, names[ii]) < 0
+			 || asprintf(&path, "%s%s%s", dir->path, dir->path[0] ? "/" : "", names[ii]) < 0
+		   )
+		{
+			fprintf(stderr, "%s: Out of memory\n", Prog);
+			exit(1);
+		}
+		if ( lstat(hostPath, &st) < 0 )
+		{
+			fprintf(stderr, "%s: Unable to stat '%s': %s\n", Prog, hostPath, strerror(errno));
+			++bd->errors;
+			free(hostPath);
+			free(path);
+			continue;
+		}
+		if ( !S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode) )
+		{
+			fprintf(stderr, "%s: Skipped '%s': only directories and regular files go in an image\n", Prog, hostPath);
+			free(hostPath);
+			free(path);
+			continue;
+		}
+		if ( strlen(names[ii]) > BD_MAX_NAME )
+		{
+			fprintf(stderr, "%s: Skipped '%s': names can be at most %d characters\n", Prog, hostPath, BD_MAX_NAME);
+			free(hostPath);
+			free(path);
+			continue;
+		}
+		if ( S_ISREG(st.st_mode) && (uint64_t)st.st_size > 0x7FFFFFFFull )
+		{
+			fprintf(stderr, "%s: Skipped '%s': files can be at most 2GB\n", Prog, hostPath);
+			free(hostPath);
+			free(path);
+			continue;
+		}
+		idx = bd->numInodes;
+		ip = bdAdd(bd);
+		ip->hostPath = hostPath;
+		ip->path = path;
+		ip->name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+		ip->copies = bd->copies;
+		ip->hdr.id = FSYS_ID_HEADER;
+		ip->hdr.generation = 1;
+		ip->hdr.ctime = bd->now;
+		ip->hdr.mtime = (uint32_t)st.st_mtime;
+		bdLink(bd, dirIdx, idx);
+		if ( S_ISDIR(st.st_mode) )
+		{
+			ip->hdr.type = FSYS_TYPE_DIR;
+			++bd->dirs;
+			bdScan(bd, idx);
+		}
+		else
+		{
+			ip->hdr.type = FSYS_TYPE_FILE;
+			ip->hdr.size = (uint32_t)st.st_size;
+			++bd->files;
+		}
+	}
+	for (ii=0; ii < numNames; ++ii)
+		free(names[ii]);
+	free(names);
+}
+
+static int bdFind(Bd_t *bd, const char *path)
+{
+	int idx;
+
+	while ( *path == '/' )
+		++path;
+	for (idx=BD_FIRST_INODE; idx < bd->numInodes; ++idx)
+	{
+		if ( !strcmp(bd->inodes[idx].path, path) )
+			return idx;
+	}
+	return 0;
+}
+
+static void bdOrder(Bd_t *bd, int idx)
+{
+	if ( !bd->inodes[idx].placed )
+	{
+		bd->inodes[idx].placed = 1;
+		bd->order[bd->numOrder++] = idx;
+	}
+}
+
+/* Put the names in an --order file (one path in the image per line) next in
+ * the layout, in the order listed. */
+static int bdOrderFile(Bd_t *bd, const char *fileName)
+{
+	FILE *fp;
+	char line[4096];
+	int lineNo=0;
+
+	fp = fopen(fileName, "r");
+	if ( !fp )
+	{
+		fprintf(stderr, "%s: Unable to open '%s': %s\n", Prog, fileName, strerror(errno));
+		return 1;
+	}
+	while ( fgets(line, sizeof(line), fp) )
+	{
+		char *cp = line + strcspn(line, "\r\n");
+		int idx;
+
+		++lineNo;
+		*cp = 0;
+		if ( !line[0] || line[0] == '#' )
+			continue;
+		idx = bdFind(bd, line);
+		if ( !idx || bd->inodes[idx].hdr.type != FSYS_TYPE_FILE )
+		{
+			fprintf(stderr, "%s: %s:%d: '%s' is not a file in the tree. Ignored\n", Prog, fileName, lineNo, line);
+			continue;
+		}
+		bdOrder(bd, idx);
+	}
+	fclose(fp);
+	return 0;
+}
+
+static uint8_t *bdDirEntry(uint8_t *ptr, int fid, int generation, const char *name)
+{
+	int len = strlen(name) + 1;
+
+	*ptr++ = fid;
+	*ptr++ = fid >> 8;
+	*ptr++ = fid >> 16;
+	*ptr++ = generation;
+	*ptr++ = len;
+	memcpy(ptr, name, len);
+	return ptr + len;
+}
+
+/* Directory contents the way writeDirectory() packs them: "..", "." and each
+ * child (3 byte fid, generation, name length with its NUL, name), ending with
+ * a fid and generation of 0. */
+static void bdDirectory(Bd_t *bd, int dirIdx)
+{
+	BdInode_t *dir = bd->inodes + dirIdx;
+	uint8_t *ptr;
+	uint32_t size;
+	int idx;
+
+	size = (5 + 3) + (5 + 2) + 4;
+	for (idx=dir->firstChild; idx; idx = bd->inodes[idx].nextSibling)
+		size += 5 + strlen(bd->inodes[idx].name) + 1;
+	dir->data = (uint8_t *)calloc(1, size);
+	if ( !dir->data )
+	{
+		fprintf(stderr, "%s: Out of memory\n", Prog);
+		exit(1);
+	}
+	ptr = bdDirEntry(dir->data, dir->parent, bd->inodes[dir->parent].hdr.generation, "..");
+	ptr = bdDirEntry(ptr, dirIdx, dir->hdr.generation, ".");
+	for (idx=dir->firstChild; idx; idx = bd->inodes[idx].nextSibling)
+		ptr = bdDirEntry(ptr, idx, bd->inodes[idx].hdr.generation, bd->inodes[idx].name);
+	dir->hdr.size = size;	/* the trailing fid of 0 is already zero */
+}
+
+/* Take 'sectors' from the front of what's left of copy region 'alt' */
+static uint32_t bdTake(Bd_t *bd, int alt, uint32_t sectors)
+{
+	uint32_t lba = bd->cursor[alt];
+
+	bd->cursor[alt] += sectors;
+	return lba;
+}
+
+/* Put as much of what's left of copy 'alt' of 'ip' as will go in what's left
+ * of copy region 'region', as that copy's next retrieval pointer. Returns the
+ * number of sectors still to be placed. A region never gives a copy more than
+ * one piece, so a copy can't run out of retrieval pointers. */
+static uint32_t bdPlace(Bd_t *bd, BdInode_t *ip, int alt, int region, uint32_t need)
+{
+	FsysRetPtr *rp = ip->hdr.pointers[alt];
+	uint32_t room = bd->regionEnd[region] - bd->cursor[region];
+	int ptr;
+
+	if ( !room )
+		return need;
+	if ( room > need )
+		room = need;
+	for (ptr=0; rp[ptr].nblocks; ++ptr)
+		;
+	rp[ptr].start = bdTake(bd, region, room);
+	rp[ptr].nblocks = room;
+	return need - room;
+}
+
+/* Work out where everything goes. Returns 0 if it all fits.
+ *
+ * The copy regions only cover the first FSYS_HB_RANGE sectors, after which the
+ * last one runs to the end of the disk, so on a big disk the first two fill up
+ * long before the last one does. Each copy is put in its own region in order
+ * until the region is full, the copy that fills it taking whatever is left at
+ * the end. Once every region's own copies are down, the rest of each copy goes
+ * in the free space of the following regions (like mgwfsFindFree() taking the
+ * first free piece past the region's start), then the ones before it, in
+ * order, and picks up another retrieval pointer each time it has to move on. */
+static int bdLayout(Bd_t *bd)
+{
+	int alt, ii, jj, idx, pending[FSYS_MAX_ALTS];
+	uint32_t need, left[FSYS_MAX_ALTS], missing=0;
+
+	for (ii=0; ii < bd->numOrder; ++ii)
+	{
+		BdInode_t *ip = bd->inodes + bd->order[ii];
+
+		if ( !ip->hdr.clusters )
+			ip->hdr.clusters = (ip->hdr.size + BYTES_PER_SECTOR-1)/BYTES_PER_SECTOR;
+	}
+	for (alt=0; alt < FSYS_MAX_ALTS; ++alt)
+	{
+		bd->cursor[alt] = FSYS_COPY_ALG(alt, bd->maxHb);
+		bd->regionEnd[alt] = alt < FSYS_MAX_ALTS-1 ? FSYS_COPY_ALG(alt+1, bd->maxHb) : bd->sizeInSectors;
+		bdTake(bd, alt, 1);	/* home block, at FSYS_HB_ALG(alt, maxHb) */
+		for (idx=0; idx < bd->numInodes; ++idx)
+		{
+			if ( idx != FSYS_INDEX_JOURNAL )
+				bd->inodes[idx].fh.lba[alt] = bdTake(bd, alt, 1);
+		}
+		if ( bd->cursor[alt] > bd->regionEnd[alt] )
+		{
+			fprintf(stderr, "%s: The file headers alone need %u sectors but copy region %d of the image only has %u. Use a bigger image\n",
+					Prog, bd->cursor[alt] - FSYS_COPY_ALG(alt, bd->maxHb), alt, bd->regionEnd[alt] - FSYS_COPY_ALG(alt, bd->maxHb));
+			return 1;
+		}
+		pending[alt] = bd->numOrder;
+		left[alt] = 0;
+		for (ii=0; ii < bd->numOrder; ++ii)
+		{
+			BdInode_t *ip = bd->inodes + bd->order[ii];
+
+			if ( alt >= ip->copies || !ip->hdr.clusters )
+				continue;
+			if ( (left[alt] = bdPlace(bd, ip, alt, alt, ip->hdr.clusters)) )
+			{
+				pending[alt] = ii;
+				break;
+			}
+		}
+	}
+	for (alt=0; alt < FSYS_MAX_ALTS; ++alt)
+	{
+		for (ii=pending[alt]; ii < bd->numOrder; ++ii)
+		{
+			BdInode_t *ip = bd->inodes + bd->order[ii];
+
+			if ( alt >= ip->copies || !ip->hdr.clusters )
+				continue;
+			need = ii == pending[alt] ? left[alt] : ip->hdr.clusters;
+			for (jj=1; need && jj < FSYS_MAX_ALTS; ++jj)
+				need = bdPlace(bd, ip, alt, (alt+jj)%FSYS_MAX_ALTS, need);
+			missing += need;
+		}
+	}
+	if ( missing )
+	{
+		fprintf(stderr, "%s: The image is %u sectors (%u KB) too small. Use a bigger image%s\n",
+				Prog, missing, (missing+1)/2, bd->copies > 1 ? " or fewer --copies" : "");
+		return 1;
+	}
+	return 0;
+}
+
+/* index.sys lists the header LBAs of every inode; the journal slot is empty */
+static void bdIndex(Bd_t *bd)
+{
+	IndexSys_t *entries = (IndexSys_t *)bd->inodes[FSYS_INDEX_INDEX].data;
+	int idx;
+
+	for (idx=0; idx < bd->numInodes; ++idx)
+	{
+		if ( idx == FSYS_INDEX_JOURNAL )
+			entries[idx].lba[0] = FSYS_EMPTYLBA_BIT;
+		else
+			entries[idx] = bd->inodes[idx].fh;
+	}
+}
+
+/* freemap.sys is whatever is left at the end of each copy region */
+static void bdFreemap(Bd_t *bd)
+{
+	FsysRetPtr *rp = (FsysRetPtr *)bd->inodes[FSYS_INDEX_FREE].data;
+	int alt, num=0;
+
+	for (alt=0; alt < FSYS_MAX_ALTS; ++alt)
+	{
+		if ( bd->cursor[alt] < bd->regionEnd[alt] )
+		{
+			rp[num].start = bd->cursor[alt];
+			rp[num].nblocks = bd->regionEnd[alt] - bd->cursor[alt];
+			++num;
+		}
+	}
+	bd->inodes[FSYS_INDEX_FREE].hdr.size = (num+1)*sizeof(FsysRetPtr);
+}
+
+static void bdHomeBlock(Bd_t *bd)
+{
+	FsysHomeBlock *hb = &bd->homeBlk;
+	uint32_t sum=0, *wp = (uint32_t *)hb;
+	int ii;
+
+	memset(hb, 0, sizeof(FsysHomeBlock));
+	hb->id = FSYS_ID_HOME;
+	hb->hb_minor = FSYS_VERSION_HB_MINOR;
+	hb->hb_major = FSYS_VERSION_HB_MAJOR;
+	hb->hb_size = sizeof(FsysHomeBlock);
+	hb->fh_minor = FSYS_VERSION_FH_MINOR;
+	hb->fh_major = FSYS_VERSION_FH_MAJOR;
+	hb->fh_size = sizeof(FsysHeader);
+	hb->fh_ptrs = FSYS_MAX_FHPTRS;
+	hb->efh_minor = FSYS_VERSION_EFH_MINOR;
+	hb->efh_major = FSYS_VERSION_EFH_MAJOR;
+	hb->rp_minor = FSYS_VERSION_RP_MINOR;
+	hb->rp_major = FSYS_VERSION_RP_MAJOR;
+	hb->rp_size = sizeof(FsysRetPtr);
+	hb->cluster = 1;
+	hb->maxalts = FSYS_MAX_ALTS;
+	hb->def_extend = FSYS_DEFAULT_EXTEND;
+	hb->ctime = hb->mtime = bd->now;
+	hb->features = hb->options = FSYS_OPTIONS;
+	memcpy(hb->index, bd->inodes[FSYS_INDEX_INDEX].fh.lba, sizeof(hb->index));
+	for (ii=0; ii < bd->numBoot; ++ii)
+	{
+		uint32_t *boot = ii == 0 ? hb->boot : ii == 1 ? hb->boot1 : ii == 2 ? hb->boot2 : hb->boot3;
+
+		memcpy(boot, bd->inodes[bd->boot[ii]].fh.lba, sizeof(IndexSys_t));
+	}
+	hb->max_lba = bd->sizeInSectors;
+	hb->hb_range = FSYS_HB_RANGE;
+	for (ii=0; ii < (int)(sizeof(FsysHomeBlock)/sizeof(uint32_t)); ++ii)
+		sum += wp[ii];
+	hb->chksum = -sum;
+}
+
+static int bdFlush(Bd_t *bd, BdStream_t *sp)
+{
+	if ( sp->used )
+	{
+		ssize_t sts = pwrite(sp->fd, sp->buf, sp->used, (off_t)sp->lba*BYTES_PER_SECTOR);
+
+		if ( sts != (ssize_t)sp->used )
+		{
+			fprintf(stderr, "%s: Failed to write %u bytes at sector 0x%X of '%s': %s\n",
+					Prog, sp->used, sp->lba, bd->image, sts < 0 ? strerror(errno) : "short write");
+			++bd->errors;
+			return 1;
+		}
+		sp->lba += sp->used/BYTES_PER_SECTOR;
+		sp->used = 0;
+	}
+	return 0;
+}
+
+/* Add bytes to the end of a region; NULL src adds zeros */
+static void bdPut(Bd_t *bd, BdStream_t *sp, const void *src, uint32_t bytes)
+{
+	while ( bytes )
+	{
+		uint32_t amt = BD_CHUNK_BYTES - sp->used;
+
+		if ( amt > bytes )
+			amt = bytes;
+		if ( src )
+		{
+			memcpy(sp->buf + sp->used, src, amt);
+			src = (const uint8_t *)src + amt;
+		}
+		else
+			memset(sp->buf + sp->used, 0, amt);
+		sp->used += amt;
+		bytes -= amt;
+		if ( sp->used == BD_CHUNK_BYTES )
+			bdFlush(bd, sp);
+	}
+}
+
+/* Pad a region out to the next sector */
+static void bdPad(Bd_t *bd, BdStream_t *sp)
+{
+	if ( (sp->used % BYTES_PER_SECTOR) )
+		bdPut(bd, sp, NULL, BYTES_PER_SECTOR - sp->used%BYTES_PER_SECTOR);
+}
+
+static uint32_t bdWhere(const BdStream_t *sp)
+{
+	return sp->lba + sp->used/BYTES_PER_SECTOR;
+}
+
+/* Add bytes to the copy being written to a region, moving on to the copy's
+ * next retrieval pointer each time one fills up; NULL src adds zeros */
+static void bdPutCopy(Bd_t *bd, BdStream_t *sp, const uint8_t *src, uint32_t bytes)
+{
+	while ( bytes )
+	{
+		uint32_t amt = bytes;
+
+		if ( !sp->left )
+		{
+			/* A piece that isn't where the last one ended starts a new write */
+			if ( bdWhere(sp) != sp->rp->start )
+			{
+				bdFlush(bd, sp);
+				sp->used = 0;
+				sp->lba = sp->rp->start;
+			}
+			sp->left = sp->rp->nblocks*BYTES_PER_SECTOR;
+			++sp->rp;
+		}
+		if ( amt > sp->left )
+			amt = sp->left;
+		bdPut(bd, sp, src, amt);
+		if ( src )
+			src += amt;
+		sp->left -= amt;
+		bytes -= amt;
+	}
+}
+
+/* Lay one inode's data into each of its copies. Files come off the host a
+ * chunk at a time and each chunk goes to every copy. */
+static void bdData(Bd_t *bd, BdInode_t *ip, uint8_t *buf)
+{
+	uint32_t done=0;
+	int alt, fd=-1;
+
+	for (alt=0; alt < ip->copies && ip->hdr.clusters; ++alt)
+	{
+		bd->streams[alt].rp = ip->hdr.pointers[alt];
+		bd->streams[alt].left = 0;
+	}
+	if ( ip->data )
+	{
+		for (alt=0; alt < ip->copies; ++alt)
+		{
+			bdPutCopy(bd, bd->streams + alt, ip->data, ip->hdr.size);
+			bdPutCopy(bd, bd->streams + alt, NULL, ip->hdr.clusters*BYTES_PER_SECTOR - ip->hdr.size);
+		}
+		return;
+	}
+	if ( ip->hdr.size && (fd = open(ip->hostPath, O_RDONLY)) < 0 )
+	{
+		fprintf(stderr, "%s: Unable to open '%s': %s\n", Prog, ip->hostPath, strerror(errno));
+		++bd->errors;
+	}
+	while ( done < ip->hdr.size )
+	{
+		uint32_t want = ip->hdr.size - done;
+		ssize_t got = 0;
+
+		if ( want > BD_CHUNK_BYTES )
+			want = BD_CHUNK_BYTES;
+		if ( fd >= 0 && (got = read(fd, buf, want)) <= 0 )
+		{
+			fprintf(stderr, "%s: '%s' %s at %u of %u bytes. The rest will be zeros\n",
+					Prog, ip->hostPath, got < 0 ? strerror(errno) : "ended", done, ip->hdr.size);
+			++bd->errors;
+			close(fd);
+			fd = -1;
+		}
+		if ( fd < 0 )
+		{
+			memset(buf, 0, want);
+			got = want;
+		}
+		for (alt=0; alt < ip->copies; ++alt)
+			bdPutCopy(bd, bd->streams + alt, buf, got);
+		done += got;
+		bd->bytes += got;
+	}
+	if ( fd >= 0 )
+		close(fd);
+	for (alt=0; alt < ip->copies; ++alt)
+		bdPutCopy(bd, bd->streams + alt, NULL, ip->hdr.clusters*BYTES_PER_SECTOR - ip->hdr.size);
+	if ( bd->verbose && ip->hdr.type == FSYS_TYPE_FILE )
+		printf("%s (%u bytes at 0x%X)\n", ip->path, ip->hdr.size, ip->hdr.pointers[0][0].start);
+}
+
+static int bdWrite(Bd_t *bd)
+{
+	uint8_t sector[BYTES_PER_SECTOR], *buf;
+	int alt, idx, ii;
+
+	buf = (uint8_t *)malloc(BD_CHUNK_BYTES);
+	for (alt=0; buf && alt < FSYS_MAX_ALTS; ++alt)
+	{
+		BdStream_t *sp = bd->streams + alt;
+
+		sp->lba = FSYS_HB_ALG(alt, bd->maxHb);
+		if ( !(sp->buf = (uint8_t *)malloc(BD_CHUNK_BYTES)) )
+			break;
+		bdPut(bd, sp, &bd->homeBlk, sizeof(FsysHomeBlock));
+		bdPad(bd, sp);
+		for (idx=0; idx < bd->numInodes; ++idx)
+		{
+			if ( idx == FSYS_INDEX_JOURNAL )
+				continue;
+			memset(sector, 0, sizeof(sector));
+			memcpy(sector, &bd->inodes[idx].hdr, sizeof(FsysHeader));
+			bdPut(bd, sp, sector, sizeof(sector));
+		}
+	}
+	if ( alt < FSYS_MAX_ALTS )
+	{
+		fprintf(stderr, "%s: Out of memory\n", Prog);
+		return 1;
+	}
+	for (ii=0; ii < bd->numOrder; ++ii)
+		bdData(bd, bd->inodes + bd->order[ii], buf);
+	for (alt=0; alt < FSYS_MAX_ALTS; ++alt)
+	{
+		bdFlush(bd, bd->streams + alt);
+		free(bd->streams[alt].buf);
+	}
+	free(buf);
+	return bd->errors;
+}
+
+/* Sizes are bytes, with an optional K, M or G */
+static uint32_t bdSize(const char *str)
+{
+	char *end;
+	uint64_t bytes = strtoull(str, &end, 0);
+
+	switch (toupper(*end))
+	{
+	case 'G':
+		bytes *= 1024;
+		/* fall through */
+	case 'M':
+		bytes *= 1024;
+		/* fall through */
+	case 'K':
+		bytes *= 1024;
+		++end;
+		break;
+	}
+	if ( *end || bytes/BYTES_PER_SECTOR > 0xFFFFFFFFull )
+		return 0;
+	return bytes/BYTES_PER_SECTOR;
+}
+
+static void usage(FILE *fp)
+{
+	fprintf(fp,
+		"Usage: %s [options] <directory> <image> <size>\n"
+		"  make a new mgwfs image holding everything in <directory>.\n"
+		"  <size> is in bytes, or with a K, M or G after it.\n"
+		"\n"
+		"Options:\n"
+		" -b <path>         Mark this file (path in the image) as the boot file. Up to %d, for boot through boot3\n"
+		" -c or --copies=n  Number of copies of each file and directory (1 through %d, default 1)\n"
+		" -h or --help      This message\n"
+		" -o or --order=<file> Lay these files (paths in the image, one per line) down first, in this order\n"
+		" -v                List each file as it's written\n"
+		"\n"
+		"Example:\n"
+		"  %s -c 2 -b os/bootme.img game/ game.img 2G\n"
+		, Prog, BD_MAX_BOOT, FSYS_MAX_ALTS, Prog);
+}
+
+typedef enum
+{
+	OPT_HELP=1,
+	OPT_COPIES,
+	OPT_ORDER,
+	OPT_MAX
+} BdOptions_t;
+
+static const struct option LongOptions[] =
+{
+	{ "help", no_argument, NULL, OPT_HELP },
+	{ "copies", required_argument, NULL, OPT_COPIES },
+	{ "order", required_argument, NULL, OPT_ORDER },
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char *argv[])
+{
+	static Bd_t bd;
+	const char *bootNames[BD_MAX_BOOT], *orderFile=NULL;
+	struct timespec start, end;
+	struct stat st;
+	BdInode_t *ip;
+	int optArg, ii, idx, fd, numInodes, isBlk;
+	double secs;
+
+	if ( argc > 0 && argv[0][0] )
+		Prog = argv[0];
+	bd.copies = 1;
+	while ( (optArg = getopt_long(argc, argv, "b:c:ho:v", LongOptions, NULL)) >= 0 )
+	{
+		switch (optArg)
+		{
+		case 'b':
+			if ( bd.numBoot >= BD_MAX_BOOT )
+			{
+				fprintf(stderr, "%s: At most %d boot files\n", Prog, BD_MAX_BOOT);
+				return 1;
+			}
+			bootNames[bd.numBoot++] = optarg;
+			break;
+		case OPT_COPIES:
+		case 'c':
+			bd.copies = atoi(optarg);
+			if ( bd.copies < 1 || bd.copies > FSYS_MAX_ALTS )
+			{
+				fprintf(stderr, "%s: --copies '%s' can only be 1 through %d\n", Prog, optarg, FSYS_MAX_ALTS);
+				return 1;
+			}
+			break;
+		case OPT_HELP:
+		case 'h':
+			usage(stdout);
+			return 1;
+		case OPT_ORDER:
+		case 'o':
+			orderFile = optarg;
+			break;
+		case 'v':
+			bd.verbose = 1;
+			break;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+	if ( argc - optind != 3 )
+	{
+		usage(stderr);
+		return 1;
+	}
+	bd.image = argv[optind+1];
+	bd.sizeInSectors = bdSize(argv[optind+2]);
+	bd.maxHb = bd.sizeInSectors < FSYS_HB_RANGE ? bd.sizeInSectors : FSYS_HB_RANGE;
+	if ( bd.maxHb < FSYS_MAX_ALTS*2*256 )
+	{
+		fprintf(stderr, "%s: Size '%s' is not understood or is too small (at least %dK)\n",
+				Prog, argv[optind+2], FSYS_MAX_ALTS*2*256*BYTES_PER_SECTOR/1024);
+		return 1;
+	}
+	if ( stat(argv[optind], &st) < 0 || !S_ISDIR(st.st_mode) )
+	{
+		fprintf(stderr, "%s: '%s' is not a directory\n", Prog, argv[optind]);
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bd.now = (uint32_t)time(NULL);
+	/* The inodes with fixed numbers: index.sys, freemap.sys, the root and the (empty) journal */
+	for (idx=0; idx < BD_FIRST_INODE; ++idx)
+	{
+		ip = bdAdd(&bd);
+		ip->path = "";
+		ip->copies = FSYS_MAX_ALTS;
+		ip->hdr.id = idx == FSYS_INDEX_INDEX ? FSYS_ID_INDEX : FSYS_ID_HEADER;
+		ip->hdr.generation = 1;
+		ip->hdr.ctime = ip->hdr.mtime = bd.now;
+		ip->hdr.type = idx == FSYS_INDEX_INDEX ? FSYS_TYPE_INDEX : idx == FSYS_INDEX_ROOT ? FSYS_TYPE_DIR : FSYS_TYPE_FILE;
+	}
+	bd.inodes[FSYS_INDEX_ROOT].hostPath = argv[optind];
+	bd.inodes[FSYS_INDEX_ROOT].parent = FSYS_INDEX_ROOT;
+	bd.inodes[FSYS_INDEX_ROOT].hdr.mtime = (uint32_t)st.st_mtime;
+	bd.inodes[FSYS_INDEX_JOURNAL].copies = 0;
+	bdScan(&bd, FSYS_INDEX_ROOT);
+	numInodes = bd.numInodes;
+	bd.order = (int *)calloc(numInodes, sizeof(int));
+	/* index.sys gets half again as many entries as there are inodes, so the
+	 * first files made on a --rw mount don't have to grow it. */
+	ip = bd.inodes + FSYS_INDEX_INDEX;
+	ip->hdr.size = numInodes*sizeof(IndexSys_t);
+	ip->hdr.clusters = ((numInodes + numInodes/2 + 16)*sizeof(IndexSys_t) + BYTES_PER_SECTOR-1)/BYTES_PER_SECTOR;
+	ip->data = (uint8_t *)calloc(ip->hdr.clusters, BYTES_PER_SECTOR);
+	ip = bd.inodes + FSYS_INDEX_FREE;
+	ip->hdr.clusters = BD_FREEMAP_SECTORS;
+	ip->data = (uint8_t *)calloc(ip->hdr.clusters, BYTES_PER_SECTOR);
+	if ( !bd.order || !bd.inodes[FSYS_INDEX_INDEX].data || !ip->data )
+	{
+		fprintf(stderr, "%s: Out of memory\n", Prog);
+		return 1;
+	}
+	for (idx=FSYS_INDEX_ROOT; idx < numInodes; ++idx)
+	{
+		if ( bd.inodes[idx].hdr.type == FSYS_TYPE_DIR )
+			bdDirectory(&bd, idx);
+	}
+	/* What a mount reads goes first (index.sys, freemap.sys, the directories),
+	 * then the boot files, the --order files and the rest in tree order. */
+	bdOrder(&bd, FSYS_INDEX_INDEX);
+	bdOrder(&bd, FSYS_INDEX_FREE);
+	for (idx=FSYS_INDEX_ROOT; idx < numInodes; ++idx)
+	{
+		if ( bd.inodes[idx].hdr.type == FSYS_TYPE_DIR )
+			bdOrder(&bd, idx);
+	}
+	for (ii=0; ii < bd.numBoot; ++ii)
+	{
+		idx = bdFind(&bd, bootNames[ii]);
+		if ( !idx || bd.inodes[idx].hdr.type != FSYS_TYPE_FILE )
+		{
+			fprintf(stderr, "%s: Boot file '%s' is not a file in '%s'\n", Prog, bootNames[ii], argv[optind]);
+			return 1;
+		}
+		bd.boot[ii] = idx;
+		bdOrder(&bd, idx);
+	}
+	if ( orderFile && bdOrderFile(&bd, orderFile) )
+		return 1;
+	for (idx=BD_FIRST_INODE; idx < numInodes; ++idx)
+		bdOrder(&bd, idx);
+	if ( bdLayout(&bd) )
+		return 1;
+	bdIndex(&bd);
+	bdFreemap(&bd);
+	bdHomeBlock(&bd);
+	/* A regular file is started over so everything not written reads as zeros.
+	 * A disk is used as it is; only what freemap.sys says is in use matters. */
+	isBlk = stat(bd.image, &st) == 0 && S_ISBLK(st.st_mode);
+	if ( isBlk )
+		fd = open(bd.image, O_WRONLY);
+	else
+		fd = open(bd.image, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if ( fd < 0 )
+	{
+		fprintf(stderr, "%s: Unable to open '%s': %s\n", Prog, bd.image, strerror(errno));
+		return 1;
+	}
+	if ( !isBlk && ftruncate(fd, (off_t)bd.sizeInSectors*BYTES_PER_SECTOR) < 0 )
+	{
+		fprintf(stderr, "%s: Unable to make '%s' %u sectors: %s\n", Prog, bd.image, bd.sizeInSectors, strerror(errno));
+		return 1;
+	}
+	for (ii=0; ii < FSYS_MAX_ALTS; ++ii)
+		bd.streams[ii].fd = fd;
+	bdWrite(&bd);
+	if ( fsync(fd) < 0 || close(fd) < 0 )
+	{
+		fprintf(stderr, "%s: Failed to finish writing '%s': %s\n", Prog, bd.image, strerror(errno));
+		++bd.errors;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+	fprintf(stderr, "%s: %d files, %d directories, %" PRIu64 " bytes in %.3f secs (%.1f MB/s). Free: %u of %u sectors\n",
+			Prog, bd.files, bd.dirs, bd.bytes, secs, secs > 0 ? bd.bytes/secs/1e6 : 0.0,
+			(bd.regionEnd[0] - bd.cursor[0]) + (bd.regionEnd[1] - bd.cursor[1]) + (bd.regionEnd[2] - bd.cursor[2]),
+			bd.sizeInSectors);
+	return bd.errors ? 1 : 0;
+}
@@ -0,0 +1,531 @@
+/*
+  checksum: Part of Atari/MidwayGamesWest filesystem using libfuse: Filesystem in Userspace
+
+  Copyright (C) 2025  Dave Shepperd <mgwfs@dshepperd.com>
+
+  This program can be distributed under the terms of the GNU GPLv2.
+  See the file COPYING.
+
+ The diags/checksums file holds, for each file, the 32 bit sum (modulo 2^32)
+ of the file's contents taken as native 32 bit words. This computes that sum
+ with the widest vector unit the CPU has. Addition modulo 2^32 doesn't care
+ about order, so summing in vector lanes and adding the lanes up at the end
+ gives exactly the same answer as the one word at a time loop.
+
+ Compile the microbenchmark with:
+ make cksumbench
+
+*/
+#ifndef STANDALONE_CHECKSUM
+	#define STANDALONE_CHECKSUM (0)
+#endif
+#include "mgwfs.h"
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+	#define CKSUM_X86 (1)
+#elif defined(__aarch64__)
+	#include <arm_neon.h>
+	#define CKSUM_NEON (1)
+#endif
+
+typedef uint32_t (*ChecksumFn_t)(const uint32_t *ptr, size_t words);
+
+typedef struct
+{
+	const char *name;
+	ChecksumFn_t func;
+	int (*supported)(void);
+} ChecksumKernel_t;
+
+static uint32_t checksumScalar(const uint32_t *ptr, size_t words)
+{
+	uint32_t cksum=0;
+
+	while ( words > 0 )
+	{
+		cksum += *ptr++;
+		--words;
+	}
+	return cksum;
+}
+
+static int alwaysSupported(void)
+{
+	return 1;
+}
+
+#if CKSUM_X86
+/* Four independent accumulators so the adds don't wait on each other */
+static uint32_t checksumSSE2(const uint32_t *ptr, size_t words)
+{
+	__m128i acc0 = _mm_setzero_si128(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+	uint32_t lanes[4];
+
+	for ( ; words >= 16; words -= 16, ptr += 16 )
+	{
+		acc0 = _mm_add_epi32(acc0, _mm_loadu_si128((const __m128i *)(ptr+0)));
+		acc1 = _mm_add_epi32(acc1, _mm_loadu_si128((const __m128i *)(ptr+4)));
+		acc2 = _mm_add_epi32(acc2, _mm_loadu_si128((const __m128i *)(ptr+8)));
+		acc3 = _mm_add_epi32(acc3, _mm_loadu_si128((const __m128i *)(ptr+12)));
+	}
+	acc0 = _mm_add_epi32(_mm_add_epi32(acc0, acc1), _mm_add_epi32(acc2, acc3));
+	_mm_storeu_si128((__m128i *)lanes, acc0);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + checksumScalar(ptr, words);
+}
+
+static int sse2Supported(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("avx2")))
+static uint32_t checksumAVX2(const uint32_t *ptr, size_t words)
+{
+	__m256i acc0 = _mm256_setzero_si256(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+	__m128i sum;
+	uint32_t lanes[4];
+
+	for ( ; words >= 32; words -= 32, ptr += 32 )
+	{
+		acc0 = _mm256_add_epi32(acc0, _mm256_loadu_si256((const __m256i *)(ptr+0)));
+		acc1 = _mm256_add_epi32(acc1, _mm256_loadu_si256((const __m256i *)(ptr+8)));
+		acc2 = _mm256_add_epi32(acc2, _mm256_loadu_si256((const __m256i *)(ptr+16)));
+		acc3 = _mm256_add_epi32(acc3, _mm256_loadu_si256((const __m256i *)(ptr+24)));
+	}
+	acc0 = _mm256_add_epi32(_mm256_add_epi32(acc0, acc1), _mm256_add_epi32(acc2, acc3));
+	sum = _mm_add_epi32(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1));
+	_mm_storeu_si128((__m128i *)lanes, sum);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + checksumScalar(ptr, words);
+}
+
+static int avx2Supported(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+#endif	/* CKSUM_X86 */
+
+#if CKSUM_NEON
+static uint32_t checksumNEON(const uint32_t *ptr, size_t words)
+{
+	uint32x4_t acc0 = vdupq_n_u32(0), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+
+	for ( ; words >= 16; words -= 16, ptr += 16 )
+	{
+		acc0 = vaddq_u32(acc0, vld1q_u32(ptr+0));
+		acc1 = vaddq_u32(acc1, vld1q_u32(ptr+4));
+		acc2 = vaddq_u32(acc2, vld1q_u32(ptr+8));
+		acc3 = vaddq_u32(acc3, vld1q_u32(ptr+12));
+	}
+	acc0 = vaddq_u32(vaddq_u32(acc0, acc1), vaddq_u32(acc2, acc3));
+	return vaddvq_u32(acc0) + checksumScalar(ptr, words);
+}
+#endif	/* CKSUM_NEON */
+
+/* Best first. The scalar loop is always last and always supported. */
+static const ChecksumKernel_t Kernels[] =
+{
+#if CKSUM_X86
+	{ "avx2", checksumAVX2, avx2Supported },
+	{ "sse2", checksumSSE2, sse2Supported },
+#endif
+#if CKSUM_NEON
+	{ "neon", checksumNEON, alwaysSupported },
+#endif
+	{ "scalar", checksumScalar, alwaysSupported }
+};
+
+static const ChecksumKernel_t *bestKernel;
+
+/*
+ * Pick the checksum kernel for this CPU. Call once at startup, before any
+ * threads that might checksum are running.
+ */
+const char *checksumInit(void)
+{
+	int ii;
+
+	if ( !bestKernel )
+	{
+		for (ii=0; ii < n_elts(Kernels)-1; ++ii)
+		{
+			if ( Kernels[ii].supported() )
+				break;
+		}
+		bestKernel = Kernels + ii;
+	}
+	return bestKernel->name;
+}
+
+/*
+ * Return the checksum of 'bytes' bytes at 'buf'. Like the original scalar
+ * loop, a size that isn't a multiple of 4 includes the whole last word, so
+ * the caller has to have made the 1 to 3 bytes past the end deterministic
+ * (see checksumFile() in fuse.c).
+ */
+uint32_t checksumBuffer(const void *buf, int bytes)
+{
+	if ( bytes <= 0 )
+		return 0;
+	if ( !bestKernel )
+		checksumInit();
+	return bestKernel->func((const uint32_t *)buf, ((size_t)bytes + 3) / 4);
+}
+
+/*
+ * The checksum cache remembers each file's checksum along with the size,
+ * mtime and generation its header had at the time. Data written through
+ * writeWholeFile() refreshes the entry (and restamps mtime); anything that
+ * rewrites a file's sectors some other way (copy_file_range()'s disk to disk
+ * copy) must call checksumCacheForget(). Otherwise a matching header means
+ * the data on disk hasn't changed.
+ */
+int checksumCacheGet(MgwfsSuper_t *ourSuper, const MgwfsInode_t *inode, uint32_t *cksum)
+{
+	const MgwfsCksumCache_t *ent;
+	const FsysHeader *hdr = inode->fsHeader;
+
+	if ( (int)inode->inode_no >= ourSuper->numCksumCache )
+		return 0;
+	ent = ourSuper->cksumCache + inode->inode_no;
+	if ( !ent->valid || ent->size != hdr->size || ent->mtime != hdr->mtime || ent->generation != hdr->generation )
+		return 0;
+	*cksum = ent->cksum;
+	return 1;
+}
+
+void checksumCachePut(MgwfsSuper_t *ourSuper, const MgwfsInode_t *inode, uint32_t cksum)
+{
+	MgwfsCksumCache_t *ent;
+	int idx = inode->inode_no;
+
+	if ( idx >= ourSuper->numCksumCache )
+	{
+		MgwfsCksumCache_t *newCache;
+		int newNum = ourSuper->numInodesAvailable > idx ? ourSuper->numInodesAvailable : idx + 1;
+
+		newCache = (MgwfsCksumCache_t *)realloc(ourSuper->cksumCache, newNum*sizeof(MgwfsCksumCache_t));
+		if ( !newCache )
+			return;			/* it's only a cache */
+		memset(newCache + ourSuper->numCksumCache, 0, (newNum - ourSuper->numCksumCache)*sizeof(MgwfsCksumCache_t));
+		ourSuper->cksumCache = newCache;
+		ourSuper->numCksumCache = newNum;
+	}
+	ent = ourSuper->cksumCache + idx;
+	ent->size = inode->fsHeader->size;
+	ent->mtime = inode->fsHeader->mtime;
+	ent->generation = inode->fsHeader->generation;
+	ent->cksum = cksum;
+	ent->valid = 1;
+}
+
+/* Slot 'idx' was freed, handed to a new file or had its data rewritten behind the cache's back */
+void checksumCacheForget(MgwfsSuper_t *ourSuper, int idx)
+{
+	if ( idx < ourSuper->numCksumCache )
+		ourSuper->cksumCache[idx].valid = 0;
+}
+
+void checksumCacheFree(MgwfsSuper_t *ourSuper)
+{
+	free(ourSuper->cksumCache);
+	ourSuper->cksumCache = NULL;
+	ourSuper->numCksumCache = 0;
+}
+
+#define CKSUM_CHUNK_SIZE	(1024*1024)	/* bytes read from the disk at a time (multiple of BYTES_PER_SECTOR) */
+#define CKSUM_MAX_WORKERS	(16)		/* more threads than this won't get any more out of one disk */
+
+typedef struct
+{
+	MgwfsSuper_t *super;
+	ChecksumJob_t *jobs;
+	int numJobs;
+	int nextJob;			/* next job to hand out; taken with an atomic add */
+	int maxBad;				/* stop handing out jobs once this many have gone wrong (0 = never) */
+	int numBad;				/* jobs that failed or didn't come out as expected; atomic add */
+} ChecksumPool_t;
+
+/*
+ * Checksum 'job' straight off the disk, following its retrieval pointers
+ * CKSUM_CHUNK_SIZE bytes at a time through 'chunk', so no file is ever held
+ * in memory whole. While a chunk is being read, the kernel is told to start
+ * on the one after it. Every chunk but the last is a multiple of 4 bytes,
+ * so the chunk sums add up to the same thing as one sum over the file.
+ * The reads are added up in job->io rather than handed to ioCount(), since
+ * this runs on the worker threads.
+ */
+static int checksumExtents(MgwfsSuper_t *ourSuper, ChecksumJob_t *job, uint8_t *chunk)
+{
+	const FsysRetPtr *retPtr = job->retPtr;
+	uint32_t remaining = job->size, cksum = 0;
+	uint64_t extLeft = 0;
+	off64_t pos = 0;
+	int ptrIdx = 0;
+
+	while ( remaining )
+	{
+		uint32_t len, want, rdLen, sector;
+
+		if ( !extLeft )
+		{
+			if ( ptrIdx >= FSYS_MAX_FHPTRS || !retPtr[ptrIdx].start || !retPtr[ptrIdx].nblocks )
+				return -EIO;		/* ran out of retrieval pointers before the end of the file */
+			pos = ((off64_t)retPtr[ptrIdx].start + ourSuper->baseSector) * BYTES_PER_SECTOR;
+			extLeft = (uint64_t)retPtr[ptrIdx].nblocks * BYTES_PER_SECTOR;
+			++ptrIdx;
+		}
+		len = extLeft < CKSUM_CHUNK_SIZE ? extLeft : CKSUM_CHUNK_SIZE;
+		want = remaining < len ? remaining : len;
+		rdLen = (want + BYTES_PER_SECTOR - 1) & ~(BYTES_PER_SECTOR - 1);
+		if ( remaining > want && extLeft > len )
+			posix_fadvise(ourSuper->fd, pos + len, extLeft - len < CKSUM_CHUNK_SIZE ? extLeft - len : CKSUM_CHUNK_SIZE, POSIX_FADV_WILLNEED);
+		if ( pread64(ourSuper->fd, chunk, rdLen, pos) != (ssize_t)rdLen )
+			return -EIO;
+		sector = pos / BYTES_PER_SECTOR - ourSuper->baseSector;
+		if ( !job->io.calls )
+			job->io.sector = sector;
+		else if ( sector == job->io.nextSector )
+			++job->io.sequential;
+		++job->io.calls;
+		job->io.sectors += rdLen / BYTES_PER_SECTOR;
+		job->io.nextSector = sector + rdLen / BYTES_PER_SECTOR;
+		/* Like checksumBuffer(), the last word of a ragged file is summed
+		 * whole; what's past EOF in it counts as zero. */
+		if ( (want & 3) )
+			memset(chunk + want, 0, 4 - (want & 3));
+		cksum += checksumBuffer(chunk, want);
+		pos += len;
+		extLeft -= len;
+		remaining -= want;
+	}
+	job->cksum = cksum;
+	return 0;
+}
+
+static void *checksumWorker(void *arg)
+{
+	ChecksumPool_t *pool = (ChecksumPool_t *)arg;
+	uint8_t *chunk = NULL;
+	int idx;
+
+	while ( (!pool->maxBad || __atomic_load_n(&pool->numBad, __ATOMIC_RELAXED) < pool->maxBad)
+			&& (idx = __atomic_fetch_add(&pool->nextJob, 1, __ATOMIC_RELAXED)) < pool->numJobs )
+	{
+		ChecksumJob_t *job = pool->jobs + idx;
+
+		job->started = 1;
+		if ( job->sts > 0 )
+			continue;
+		if ( !job->sts && !job->cached )
+		{
+			if ( job->data )
+				job->cksum = checksumBuffer(job->data, job->size);
+			else if ( !chunk && !(chunk = (uint8_t *)malloc(CKSUM_CHUNK_SIZE)) )
+				job->sts = -ENOMEM;
+			else
+				job->sts = checksumExtents(pool->super, job, chunk);
+		}
+		if ( pool->maxBad && (job->sts || job->cksum != job->expected) )
+			__atomic_fetch_add(&pool->numBad, 1, __ATOMIC_RELAXED);
+	}
+	free(chunk);
+	return NULL;
+}
+
+/*
+ * Checksum all of 'jobs' using a pool of worker threads (this thread being
+ * one of them). Each job's cksum and sts are filled in; jobs that already
+ * have a non-zero sts are left alone. If 'useCache' is set, files whose
+ * checksum cache entry is still good aren't read at all, and what is read
+ * off the disk goes back into the cache. If 'maxBad' is set, no more jobs are
+ * handed out once that many have failed (including ones given a negative sts
+ * beforehand) or come out different from their 'expected'; the ones that
+ * were taken have 'started' set. The disk is only read with pread(), so the
+ * image file's offset isn't disturbed. Returns the number of threads that
+ * did the work.
+ */
+int checksumFiles(MgwfsSuper_t *ourSuper, ChecksumJob_t *jobs, int numJobs, int useCache, int maxBad)
+{
+	pthread_t threads[CKSUM_MAX_WORKERS];
+	ChecksumPool_t pool;
+	long numWorkers;
+	int ii, started;
+
+	numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+	if ( numWorkers > CKSUM_MAX_WORKERS )
+		numWorkers = CKSUM_MAX_WORKERS;
+	if ( numWorkers > numJobs )
+		numWorkers = numJobs;
+	if ( numWorkers < 1 )
+		numWorkers = 1;
+	checksumInit();			/* before the workers can race to pick the kernel */
+	for (ii=0; ii < numJobs; ++ii)
+	{
+		memset(&jobs[ii].io, 0, sizeof(jobs[ii].io));
+		jobs[ii].started = 0;
+	}
+	if ( useCache )
+	{
+		for (ii=0; ii < numJobs; ++ii)
+		{
+			/* An in memory copy may not be on the disk yet, so it's never cached */
+			if ( !jobs[ii].sts && !jobs[ii].data )
+			{
+				jobs[ii].cached = checksumCacheGet(ourSuper, getInode(ourSuper, jobs[ii].inode), &jobs[ii].cksum);
+				perfCount(jobs[ii].cached ? MGWFS_CTR_CKSUM_HITS : MGWFS_CTR_CKSUM_MISSES, 1);
+			}
+		}
+	}
+	pool.super = ourSuper;
+	pool.jobs = jobs;
+	pool.numJobs = numJobs;
+	pool.nextJob = 0;
+	pool.maxBad = maxBad;
+	pool.numBad = 0;
+	for (started=0; started < numWorkers-1; ++started)
+	{
+		if ( pthread_create(threads + started, NULL, checksumWorker, &pool) )
+			break;			/* make do with what we've got */
+	}
+	checksumWorker(&pool);
+	for (ii=0; ii < started; ++ii)
+		pthread_join(threads[ii], NULL);
+	/* Only now, with the workers gone, can their reads be counted */
+	for (ii=0; ii < numJobs; ++ii)
+		ioCountRun(ourSuper, MGWFS_IO_DATA, MGWFS_IO_READ, &jobs[ii].io);
+	if ( useCache )
+	{
+		for (ii=0; ii < numJobs; ++ii)
+		{
+			if ( !jobs[ii].sts && !jobs[ii].data && !jobs[ii].cached )
+				checksumCachePut(ourSuper, getInode(ourSuper, jobs[ii].inode), jobs[ii].cksum);
+		}
+	}
+	return started + 1;
+}
+
+#if STANDALONE_CHECKSUM
+#include <time.h>
+
+uint64_t perfCounters[MGWFS_CTR_NUM];
+
+void ioCountRun(const MgwfsSuper_t *ourSuper, int purpose, int dir, const MgwfsIoRun_t *run)
+{
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int help_em(const char *title)
+{
+	printf("%s [-s size][-i iterations]\n"
+		   "Where:\n"
+		   "-s size         = bytes to checksum per pass (default=64MB)\n"
+		   "-i iterations   = number of passes to time (default=20)\n"
+		   , title);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int ii, jj, opt, iterations=20, errors=0;
+	size_t size=64*1024*1024, words, allocWords;
+	uint32_t *buff, expected, got;
+	volatile uint32_t sink;		/* keeps the timed calls from being optimized away */
+	char *endp;
+	double start, elapsed;
+
+	while ( (opt = getopt(argc, argv, "s:i:")) != -1 )
+	{
+		switch (opt)
+		{
+		case 's':
+			endp = NULL;
+			size = strtoul(optarg, &endp, 0);
+			if ( !endp || *endp || size < 4 || size > 0x7FFFFFF0 )
+			{
+				fprintf(stderr, "Bad argument for -s: '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'i':
+			endp = NULL;
+			iterations = strtoul(optarg, &endp, 0);
+			if ( !endp || *endp || iterations < 1 )
+			{
+				fprintf(stderr, "Bad argument for -i: '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			return help_em(argv[0]);
+		}
+	}
+	words = (size + 3) / 4;
+	allocWords = (words < 512 ? 512 : words) + 16;	/* room for the ragged length checks below */
+	buff = (uint32_t *)malloc(allocWords * sizeof(uint32_t));
+	if ( !buff )
+	{
+		fprintf(stderr, "Out of memory allocating %ld bytes\n", allocWords * sizeof(uint32_t));
+		return 1;
+	}
+	srandom(1);
+	for (ii=0; ii < (int)allocWords; ++ii)
+		buff[ii] = (uint32_t)random() ^ ((uint32_t)random() << 16);
+	printf("Selected kernel: %s\n", checksumInit());
+	/* Every kernel has to match the scalar loop exactly, at every length
+	 * (including the ragged ones) and start offset. */
+	for (ii=0; ii < n_elts(Kernels); ++ii)
+	{
+		if ( !Kernels[ii].supported() )
+		{
+			printf("%-8s not supported on this CPU\n", Kernels[ii].name);
+			continue;
+		}
+		for (jj=0; jj < 4; ++jj)
+		{
+			int len;
+
+			for (len=0; len < 1031; ++len)
+			{
+				expected = checksumScalar(buff + jj, (len + 3) / 4);
+				got = Kernels[ii].func(buff + jj, (len + 3) / 4);
+				if ( got != expected )
+				{
+					if ( errors < 10 )
+						printf("%-8s MISMATCH at offset %d, %d bytes: 0x%08X, expected 0x%08X\n",
+							   Kernels[ii].name, jj, len, got, expected);
+					++errors;
+				}
+			}
+		}
+		expected = checksumScalar(buff, words);
+		got = Kernels[ii].func(buff, words);
+		if ( got != expected )
+		{
+			printf("%-8s MISMATCH on %ld bytes: 0x%08X, expected 0x%08X\n", Kernels[ii].name, size, got, expected);
+			++errors;
+		}
+		got = Kernels[ii].func(buff, words);	/* warm up */
+		start = now();
+		for (jj=0; jj < iterations; ++jj)
+			got += Kernels[ii].func(buff, words);
+		elapsed = now() - start;
+		sink = got;
+		printf("%-8s %8.2f GB/s (cs 0x%08X)\n", Kernels[ii].name,
+			   elapsed > 0 ? (double)size * iterations / elapsed / 1e9 : 0.0, expected);
+		(void)sink;
+	}
+	free(buff);
+	if ( errors )
+		printf("%d mismatches\n", errors);
+	return errors ? 1 : 0;
+}
+#endif	/* STANDALONE_CHECKSUM */
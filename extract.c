@@ -0,0 +1,647 @@
+/*
+  extract: Part of Atari/MidwayGamesWest filesystem using libfuse: Filesystem in Userspace
+
+  Copyright (C) 2025  Dave Shepperd <mgwfs@dshepperd.com>
+
+  This program can be distributed under the terms of the GNU GPLv2.
+  See the file COPYING.
+
+ mgwfs-extract copies every file out of an image without mounting it, into
+ a host directory or as a tar stream on stdout. The image is loaded the way
+ a mount loads it (getHomeBlock(), getFileHeader() on each index.sys entry,
+ unpackDir() from the root), then the files are read straight through their
+ retrieval pointers in the order their first copy sits on the disk, so the
+ image is read front to back in big pieces instead of one file at a time in
+ directory order. If a piece of the first copy can't be read the other
+ copies are tried.
+
+ Writing to a directory, the reads are handed to a pool of threads that do
+ the host side writes, so reading the image and writing the files overlap.
+ A tar stream has to come out in order, so it's written as it's read.
+
+ Build: see Makefile target 'mgwfs-extract'.
+*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE (1)
+#endif
+
+#include "mgwfs.h"
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#define EX_CHUNK_SECTORS	(MGWFS_MAX_IO_SIZE/BYTES_PER_SECTOR)	/* most read at a time */
+#define EX_MAX_WORKERS		(8)
+#define EX_BUFFERS(workers)	((workers)*2+2)		/* chunks that can be in flight */
+
+typedef struct
+{
+	MgwfsInode_t *inode;
+	char *path;					/* from the top, without a leading '/' */
+	uint32_t lba;				/* where its first copy starts, to sort on */
+	int fd;						/* host file while it's being written */
+	int chunksLeft;				/* writes still to do; the one that does the last closes fd */
+} ExFile_t;
+
+typedef struct
+{
+	ExFile_t *file;
+	off_t offset;
+	uint32_t bytes;
+	uint8_t *buf;
+} ExChunk_t;
+
+typedef struct
+{
+	MgwfsSuper_t super;
+	const char *image;
+	const char *dest;			/* NULL to write tar to stdout */
+	int verbose;
+	ExFile_t *files, *dirs;
+	int numFiles, maxFiles, numDirs, maxDirs;
+	/* The write pool: a ring of chunks to write and a stack of free buffers */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	ExChunk_t *queue;
+	int qHead, qCount, qSize;
+	uint8_t **freeBufs;
+	int numFree;
+	int done;
+	int errors;
+	uint64_t bytes, reads;
+} Ex_t;
+
+static const char *Prog = "mgwfs-extract";
+
+static uint32_t getLe(uint8_t *ptr)
+{
+	return (ptr[3]<<24)|(ptr[2]<<16)|(ptr[1]<<8)|ptr[0];
+}
+
+/*
+ * Load the image the way main() does for a read only mount: the home block,
+ * index.sys, every file header and then the directory tree under the root.
+ * Returns 0 or -1.
+ */
+static int exLoad(Ex_t *ex)
+{
+	MgwfsSuper_t *super = &ex->super;
+	MgwfsInode_t *inode;
+	BootSector_t boot;
+	struct stat st;
+	off64_t maxHb, sizeInSectors;
+	uint32_t ckSum;
+	int ii;
+
+	super->logFile = stderr;
+	super->errFile = stderr;
+	if ( stat(ex->image, &st) < 0 || (super->fd = open(ex->image, O_RDONLY)) < 0 )
+	{
+		fprintf(stderr, "%s: Unable to open '%s': %s\n", Prog, ex->image, strerror(errno));
+		return -1;
+	}
+	sizeInSectors = st.st_size/BYTES_PER_SECTOR;
+	if ( pread(super->fd, &boot, sizeof(boot), 0) != sizeof(boot) )
+	{
+		fprintf(stderr, "%s: Failed to read the boot sector of '%s'\n", Prog, ex->image);
+		return -1;
+	}
+	for (ii=0; ii < 4; ++ii)
+	{
+		if ( boot.parts[ii].status == 0x80 && boot.parts[ii].type == 0x8f )
+		{
+			super->baseSector = getLe(boot.parts[ii].abs_sect);
+			sizeInSectors = getLe(boot.parts[ii].num_sects);
+			break;
+		}
+	}
+	maxHb = sizeInSectors > FSYS_HB_RANGE ? FSYS_HB_RANGE : sizeInSectors;
+	super->maxHb = maxHb;
+	for (ii=0; ii < FSYS_MAX_ALTS; ++ii)
+		super->homeLbas[ii] = FSYS_HB_ALG(ii, maxHb);
+	if ( !getHomeBlock(super, maxHb, sizeInSectors, &ckSum) )
+		return -1;
+	if ( !getFileHeader("index.sys", super, FSYS_ID_INDEX, (IndexSys_t *)super->homeBlk.index, &super->indexSysHdr) )
+		return -1;
+	super->numInodesAvailable = (super->indexSysHdr.clusters * 512) / (FSYS_MAX_ALTS * sizeof(uint32_t));
+	super->indexSys = (IndexSys_t *)calloc(super->indexSysHdr.clusters * 512, 1);
+	if ( !super->indexSys
+		 || readWholeFile("index.sys", super, (uint8_t *)super->indexSys, super->indexSysHdr.size, super->indexSysHdr.pointers[0], MGWFS_IO_INDEX) < 0 )
+	{
+		fprintf(stderr, "%s: Failed to read index.sys\n", Prog);
+		return -1;
+	}
+	if ( !(inode = newInode(super, FSYS_INDEX_INDEX)) )
+		return -1;
+	memcpy(inode->fsHeader, &super->indexSysHdr, sizeof(FsysHeader));
+	for (ii=1; ii < super->numInodesAvailable; ++ii)
+	{
+		IndexSys_t *lbas = super->indexSys + ii;
+		char tmpName[32];
+
+		if ( !lbas->lba[0] )
+			break;
+		if ( (lbas->lba[0] & FSYS_EMPTYLBA_BIT) )
+			continue;
+		if ( !(inode = newInode(super, ii)) )
+		{
+			fprintf(stderr, "%s: Out of memory\n", Prog);
+			return -1;
+		}
+		snprintf(tmpName, sizeof(tmpName), "Inode %d", ii);
+		if ( !getFileHeader(tmpName, super, FSYS_ID_HEADER, lbas, inode->fsHeader) )
+			return -1;
+		inode->mode = inode->fsHeader->type == FSYS_TYPE_DIR ? S_IFDIR | 0555 : S_IFREG | 0444;
+		memcpy(inode->fhSectors.lba, lbas, sizeof(IndexSys_t));
+	}
+	super->numInodesUsed = ii;
+	inode = getInode(super, FSYS_INDEX_ROOT);
+	if ( !inode )
+	{
+		fprintf(stderr, "%s: There is no root directory\n", Prog);
+		return -1;
+	}
+	inode->idxParentInode = FSYS_INDEX_ROOT;
+	return unpackDir(super, inode, 0) ? -1 : 0;
+}
+
+static ExFile_t *exAdd(ExFile_t **list, int *num, int *max)
+{
+	if ( *num >= *max )
+	{
+		*max = *max ? *max*2 : 1024;
+		*list = (ExFile_t *)realloc(*list, *max*sizeof(ExFile_t));
+		if ( !*list )
+		{
+			fprintf(stderr, "%s: Out of memory\n", Prog);
+			exit(1);
+		}
+	}
+	memset(*list + *num, 0, sizeof(ExFile_t));
+	return *list + (*num)++;
+}
+
+/* List every directory (parents first) and file under 'dirIdx' */
+static void exCollect(Ex_t *ex, int dirIdx, const char *dirPath, int nest)
+{
+	MgwfsInode_t *dir = getInode(&ex->super, dirIdx), *child;
+	int idx;
+
+	if ( nest > MGWFS_MAX_NEST_LEVEL )
+		return;
+	for (idx=dir->idxChildTop; idx && (child = getInode(&ex->super, idx)); idx=child->idxNextInode)
+	{
+		ExFile_t *ef;
+		char *path, *cp;
+
+		if ( asprintf(&path, "%s%s%s", dirPath, *dirPath ? "/" : "", child->fileName) < 0 )
+		{
+			fprintf(stderr, "%s: Out of memory\n", Prog);
+			exit(1);
+		}
+		/* A name is one path component, whatever the image says */
+		for (cp=path+strlen(dirPath)+(*dirPath ? 1 : 0); *cp; ++cp)
+		{
+			if ( *cp == '/' )
+				*cp = '_';
+		}
+		if ( S_ISDIR(child->mode) )
+		{
+			ef = exAdd(&ex->dirs, &ex->numDirs, &ex->maxDirs);
+			ef->inode = child;
+			ef->path = path;
+			exCollect(ex, idx, path, nest+1);
+		}
+		else
+		{
+			ef = exAdd(&ex->files, &ex->numFiles, &ex->maxFiles);
+			ef->inode = child;
+			ef->path = path;
+			ef->lba = child->fsHeader->pointers[0][0].nblocks ? child->fsHeader->pointers[0][0].start : 0;
+		}
+	}
+}
+
+static int cmpFileLba(const void *a, const void *b)
+{
+	const ExFile_t *fa = (const ExFile_t *)a, *fb = (const ExFile_t *)b;
+
+	return fa->lba < fb->lba ? -1 : fa->lba > fb->lba;
+}
+
+/* Read 'sectors' sectors 'offset' sectors into one copy of a file */
+static int exReadCopy(Ex_t *ex, const FsysRetPtr *rp, uint32_t offset, uint32_t sectors, uint8_t *dst)
+{
+	int rpIdx;
+
+	for (rpIdx=0; sectors && rpIdx < FSYS_MAX_FHPTRS && rp->nblocks > 0; ++rpIdx, ++rp)
+	{
+		uint32_t cnt;
+		ssize_t want;
+
+		if ( offset >= (uint32_t)rp->nblocks )
+		{
+			offset -= rp->nblocks;
+			continue;
+		}
+		cnt = rp->nblocks - offset < sectors ? rp->nblocks - offset : sectors;
+		want = (ssize_t)cnt*BYTES_PER_SECTOR;
+		if ( pread(ex->super.fd, dst, want, ((off64_t)rp->start + offset + ex->super.baseSector)*BYTES_PER_SECTOR) != want )
+			return -EIO;
+		++ex->reads;
+		dst += want;
+		sectors -= cnt;
+		offset = 0;
+	}
+	return sectors ? -ENODATA : 0;
+}
+
+/* The same from the first copy that can supply them */
+static int exRead(Ex_t *ex, ExFile_t *ef, uint32_t offset, uint32_t sectors, uint8_t *dst)
+{
+	const FsysHeader *fhp = ef->inode->fsHeader;
+	int altIdx, sts = -ENODATA;
+
+	for (altIdx=0; altIdx < FSYS_MAX_ALTS && fhp->pointers[altIdx][0].nblocks; ++altIdx)
+	{
+		if ( !(sts = exReadCopy(ex, fhp->pointers[altIdx], offset, sectors, dst)) )
+		{
+			if ( altIdx )
+				fprintf(stderr, "%s: Read sectors %u-%u of '%s' from copy %d\n", Prog, offset, offset+sectors-1, ef->path, altIdx);
+			break;
+		}
+	}
+	return sts;
+}
+
+static time_t exMtime(const MgwfsInode_t *inode)
+{
+	return inode->fsHeader->mtime ? inode->fsHeader->mtime : inode->fsHeader->ctime;
+}
+
+static void exSetTime(int fd, const char *path, const MgwfsInode_t *inode)
+{
+	struct timespec times[2];
+
+	times[0].tv_sec = times[1].tv_sec = exMtime(inode);
+	times[0].tv_nsec = times[1].tv_nsec = 0;
+	if ( fd >= 0 )
+		futimens(fd, times);
+	else
+		utimensat(AT_FDCWD, path, times, 0);
+}
+
+static void *exWorker(void *arg)
+{
+	Ex_t *ex = (Ex_t *)arg;
+
+	pthread_mutex_lock(&ex->mutex);
+	while ( 1 )
+	{
+		ExChunk_t chunk;
+		ExFile_t *ef;
+
+		while ( !ex->qCount && !ex->done )
+			pthread_cond_wait(&ex->cond, &ex->mutex);
+		if ( !ex->qCount )
+			break;
+		chunk = ex->queue[ex->qHead];
+		ex->qHead = (ex->qHead + 1) % ex->qSize;
+		--ex->qCount;
+		pthread_mutex_unlock(&ex->mutex);
+		ef = chunk.file;
+		if ( pwrite(ef->fd, chunk.buf, chunk.bytes, chunk.offset) != (ssize_t)chunk.bytes )
+		{
+			fprintf(stderr, "%s: Failed to write '%s': %s\n", Prog, ef->path, strerror(errno));
+			__atomic_fetch_add(&ex->errors, 1, __ATOMIC_RELAXED);
+		}
+		if ( __atomic_sub_fetch(&ef->chunksLeft, 1, __ATOMIC_ACQ_REL) == 0 )
+		{
+			exSetTime(ef->fd, NULL, ef->inode);
+			close(ef->fd);
+		}
+		pthread_mutex_lock(&ex->mutex);
+		ex->freeBufs[ex->numFree++] = chunk.buf;
+		pthread_cond_broadcast(&ex->cond);
+	}
+	pthread_mutex_unlock(&ex->mutex);
+	return NULL;
+}
+
+static uint8_t *exGetBuffer(Ex_t *ex)
+{
+	uint8_t *buf;
+
+	pthread_mutex_lock(&ex->mutex);
+	while ( !ex->numFree )
+		pthread_cond_wait(&ex->cond, &ex->mutex);
+	buf = ex->freeBufs[--ex->numFree];
+	pthread_mutex_unlock(&ex->mutex);
+	return buf;
+}
+
+static void exQueue(Ex_t *ex, ExFile_t *ef, off_t offset, uint32_t bytes, uint8_t *buf)
+{
+	ExChunk_t *chunk;
+
+	pthread_mutex_lock(&ex->mutex);
+	chunk = ex->queue + (ex->qHead + ex->qCount) % ex->qSize;
+	chunk->file = ef;
+	chunk->offset = offset;
+	chunk->bytes = bytes;
+	chunk->buf = buf;
+	++ex->qCount;
+	pthread_cond_broadcast(&ex->cond);
+	pthread_mutex_unlock(&ex->mutex);
+}
+
+/* Write a ustar header (and a GNU long name ahead of it if the name won't fit) */
+static int exTarHeader(const char *path, int type, uint32_t size, time_t mtime)
+{
+	uint8_t hdr[BYTES_PER_SECTOR];
+	size_t len = strlen(path);
+	const char *split = NULL;
+	unsigned sum=0;
+	int ii;
+
+	if ( len > 100 )
+	{
+		/* ustar holds up to 155 more in front if there's a '/' to split at */
+		for (split=path+len-101; split < path+len-1 && split - path <= 155 && *split != '/'; ++split)
+			;
+		if ( split >= path+len-1 || split - path > 155 || split == path )
+		{
+			split = NULL;
+			if ( exTarHeader("././@LongLink", 'L', len+1, 0) )
+				return -1;
+			for (ii=0; ii <= (int)len; ii += BYTES_PER_SECTOR)
+			{
+				memset(hdr, 0, sizeof(hdr));
+				memcpy(hdr, path + ii, len + 1 - ii < BYTES_PER_SECTOR ? len + 1 - ii : BYTES_PER_SECTOR);
+				if ( fwrite(hdr, sizeof(hdr), 1, stdout) != 1 )
+					return -1;
+			}
+		}
+	}
+	memset(hdr, 0, sizeof(hdr));
+	if ( split )
+	{
+		memcpy(hdr + 345, path, split - path);
+		memcpy(hdr, split + 1, len - (split - path) - 1);
+	}
+	else
+		memcpy(hdr, path, len > 100 ? 100 : len);
+	snprintf((char *)hdr + 100, 8, "%07o", type == '5' ? 0755 : 0644);
+	snprintf((char *)hdr + 108, 8, "%07o", 0);
+	snprintf((char *)hdr + 116, 8, "%07o", 0);
+	snprintf((char *)hdr + 124, 12, "%011o", size);
+	snprintf((char *)hdr + 136, 12, "%011lo", (unsigned long)mtime);
+	hdr[156] = type;
+	memcpy(hdr + 257, "ustar", 6);
+	memcpy(hdr + 263, "00", 2);
+	memset(hdr + 148, ' ', 8);
+	for (ii=0; ii < BYTES_PER_SECTOR; ++ii)
+		sum += hdr[ii];
+	snprintf((char *)hdr + 148, 8, "%06o", sum);
+	return fwrite(hdr, sizeof(hdr), 1, stdout) == 1 ? 0 : -1;
+}
+
+/* Read every file in disk order and write it to the tar stream or hand it to the pool */
+static void exFiles(Ex_t *ex, uint8_t *tarBuf)
+{
+	int ii;
+
+	for (ii=0; ii < ex->numFiles; ++ii)
+	{
+		ExFile_t *ef = ex->files + ii;
+		uint32_t size = ef->inode->fsHeader->size;
+		uint32_t sectors = (size + BYTES_PER_SECTOR - 1)/BYTES_PER_SECTOR, offset;
+
+		if ( ex->verbose )
+			fprintf(stderr, "%s (%u bytes at 0x%X)\n", ef->path, size, ef->lba);
+		if ( !ex->dest )
+		{
+			if ( exTarHeader(ef->path, '0', size, exMtime(ef->inode)) )
+				break;
+		}
+		else
+		{
+			ef->fd = open(ef->path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+			if ( ef->fd < 0 )
+			{
+				fprintf(stderr, "%s: Unable to create '%s': %s\n", Prog, ef->path, strerror(errno));
+				++ex->errors;
+				continue;
+			}
+			ef->chunksLeft = (sectors + EX_CHUNK_SECTORS - 1)/EX_CHUNK_SECTORS;
+			if ( !ef->chunksLeft )
+			{
+				exSetTime(ef->fd, NULL, ef->inode);
+				close(ef->fd);
+				continue;
+			}
+		}
+		for (offset=0; offset < sectors; offset += EX_CHUNK_SECTORS)
+		{
+			uint32_t cnt = sectors - offset < EX_CHUNK_SECTORS ? sectors - offset : EX_CHUNK_SECTORS;
+			uint32_t bytes = offset + cnt < sectors ? cnt*BYTES_PER_SECTOR : size - offset*BYTES_PER_SECTOR;
+			uint8_t *buf = ex->dest ? exGetBuffer(ex) : tarBuf;
+
+			if ( exRead(ex, ef, offset, cnt, buf) )
+			{
+				/* Keep the file's size and the tar stream's framing; the hole reads as 0s */
+				fprintf(stderr, "%s: Failed to read sectors %u-%u of '%s' from any copy\n", Prog, offset, offset+cnt-1, ef->path);
+				memset(buf, 0, cnt*BYTES_PER_SECTOR);
+				++ex->errors;
+			}
+			ex->bytes += bytes;
+			if ( ex->dest )
+				exQueue(ex, ef, (off_t)offset*BYTES_PER_SECTOR, bytes, buf);
+			else
+			{
+				memset(buf + bytes, 0, cnt*BYTES_PER_SECTOR - bytes);
+				if ( fwrite(buf, cnt*BYTES_PER_SECTOR, 1, stdout) != 1 )
+				{
+					fprintf(stderr, "%s: Failed to write the tar stream: %s\n", Prog, strerror(errno));
+					++ex->errors;
+					return;
+				}
+			}
+		}
+	}
+}
+
+static void usage(FILE *fp)
+{
+	fprintf(fp,
+		"Usage: %s [options] <image> [<directory>]\n"
+		"  copy every file out of an mgwfs image without mounting it.\n"
+		"\n"
+		"Options:\n"
+		" -h or --help      This message\n"
+		" -j <workers>      Threads writing files to <directory> (default: one per CPU, at most %d)\n"
+		" -v                List each file as it's copied\n"
+		" --tar             Write a tar stream to stdout instead of to a directory\n"
+		"\n"
+		"Examples:\n"
+		"  %s game.img /tmp/game\n"
+		"  %s --tar game.img | gzip > game.tar.gz\n"
+		, Prog, EX_MAX_WORKERS, Prog, Prog);
+}
+
+typedef enum
+{
+	OPT_HELP=1,
+	OPT_TAR,
+	OPT_MAX
+} ExOptions_t;
+
+static const struct option LongOptions[] =
+{
+	{ "help", no_argument, NULL, OPT_HELP },
+	{ "tar", no_argument, NULL, OPT_TAR },
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char *argv[])
+{
+	static Ex_t ex;
+	pthread_t threads[EX_MAX_WORKERS];
+	struct timespec start, end;
+	uint8_t *tarBuf=NULL;
+	long numWorkers=0;
+	int optArg, tar=0, ii, started=0;
+	double secs;
+
+	if ( argc > 0 && argv[0][0] )
+		Prog = argv[0];
+	while ( (optArg = getopt_long(argc, argv, "hj:v", LongOptions, NULL)) >= 0 )
+	{
+		switch (optArg)
+		{
+		case OPT_HELP:
+		case 'h':
+			usage(stdout);
+			return 1;
+		case 'j':
+			numWorkers = atoi(optarg);
+			break;
+		case 'v':
+			ex.verbose = 1;
+			break;
+		case OPT_TAR:
+			tar = 1;
+			break;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+	if ( optind >= argc || argc - optind != (tar ? 1 : 2) )
+	{
+		usage(stderr);
+		return 1;
+	}
+	ex.image = argv[optind];
+	ex.dest = tar ? NULL : argv[optind+1];
+	if ( tar && isatty(STDOUT_FILENO) )
+	{
+		fprintf(stderr, "%s: Not writing a tar stream to a terminal\n", Prog);
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ( exLoad(&ex) )
+		return 1;
+	exCollect(&ex, FSYS_INDEX_ROOT, "", 0);
+	qsort(ex.files, ex.numFiles, sizeof(ExFile_t), cmpFileLba);
+	if ( tar )
+	{
+		tarBuf = (uint8_t *)malloc(EX_CHUNK_SECTORS*BYTES_PER_SECTOR);
+		if ( !tarBuf || setvbuf(stdout, NULL, _IOFBF, MGWFS_MAX_IO_SIZE) )
+		{
+			fprintf(stderr, "%s: Out of memory\n", Prog);
+			return 1;
+		}
+		for (ii=0; ii < ex.numDirs; ++ii)
+		{
+			char *dirName;
+
+			if ( asprintf(&dirName, "%s/", ex.dirs[ii].path) < 0 || exTarHeader(dirName, '5', 0, exMtime(ex.dirs[ii].inode)) )
+				break;
+			free(dirName);
+		}
+		exFiles(&ex, tarBuf);
+		/* Two empty records end the archive */
+		memset(tarBuf, 0, 2*BYTES_PER_SECTOR);
+		if ( fwrite(tarBuf, 2*BYTES_PER_SECTOR, 1, stdout) != 1 || fflush(stdout) )
+		{
+			fprintf(stderr, "%s: Failed to write the tar stream: %s\n", Prog, strerror(errno));
+			++ex.errors;
+		}
+		free(tarBuf);
+	}
+	else
+	{
+		if ( (mkdir(ex.dest, 0755) < 0 && errno != EEXIST) || chdir(ex.dest) < 0 )
+		{
+			fprintf(stderr, "%s: Unable to use '%s': %s\n", Prog, ex.dest, strerror(errno));
+			return 1;
+		}
+		for (ii=0; ii < ex.numDirs; ++ii)
+		{
+			if ( mkdir(ex.dirs[ii].path, 0755) < 0 && errno != EEXIST )
+			{
+				fprintf(stderr, "%s: Unable to create '%s': %s\n", Prog, ex.dirs[ii].path, strerror(errno));
+				++ex.errors;
+			}
+		}
+		if ( numWorkers <= 0 )
+			numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+		if ( numWorkers > EX_MAX_WORKERS )
+			numWorkers = EX_MAX_WORKERS;
+		if ( numWorkers < 1 )
+			numWorkers = 1;
+		pthread_mutex_init(&ex.mutex, NULL);
+		pthread_cond_init(&ex.cond, NULL);
+		ex.qSize = EX_BUFFERS(numWorkers);
+		ex.queue = (ExChunk_t *)calloc(ex.qSize, sizeof(ExChunk_t));
+		ex.freeBufs = (uint8_t **)calloc(ex.qSize, sizeof(uint8_t *));
+		for (ii=0; ex.queue && ex.freeBufs && ii < ex.qSize; ++ii)
+		{
+			if ( (ex.freeBufs[ex.numFree] = (uint8_t *)malloc(EX_CHUNK_SECTORS*BYTES_PER_SECTOR)) )
+				++ex.numFree;
+		}
+		if ( !ex.numFree )
+		{
+			fprintf(stderr, "%s: Out of memory\n", Prog);
+			return 1;
+		}
+		for (started=0; started < numWorkers; ++started)
+		{
+			if ( pthread_create(threads + started, NULL, exWorker, &ex) )
+				break;
+		}
+		if ( !started )
+		{
+			fprintf(stderr, "%s: Unable to start any threads\n", Prog);
+			return 1;
+		}
+		exFiles(&ex, NULL);
+		pthread_mutex_lock(&ex.mutex);
+		ex.done = 1;
+		pthread_cond_broadcast(&ex.cond);
+		pthread_mutex_unlock(&ex.mutex);
+		for (ii=0; ii < started; ++ii)
+			pthread_join(threads[ii], NULL);
+		/* Writing the files changed their directories' times, so those go last, deepest first */
+		for (ii=ex.numDirs-1; ii >= 0; --ii)
+			exSetTime(-1, ex.dirs[ii].path, ex.dirs[ii].inode);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+	fprintf(stderr, "%d files, %d directories, %" PRIu64 " bytes in %.3f secs (%.1f MB/s), %" PRIu64 " reads, %d writers%s\n",
+			ex.numFiles, ex.numDirs, ex.bytes, secs, secs > 0 ? ex.bytes/secs/1e6 : 0.0, ex.reads, started,
+			ex.errors ? ", with errors" : "");
+	return ex.errors ? 1 : 0;
+}
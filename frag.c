@@ -0,0 +1,167 @@
+/*
+  frag: Part of Atari/MidwayGamesWest filesystem using libfuse: Filesystem in Userspace
+
+  Copyright (C) 2025  Dave Shepperd <mgwfs@dshepperd.com>
+
+  This program can be distributed under the terms of the GNU GPLv2.
+  See the file COPYING.
+
+ How fragmented an image is, for MGWFS_IOC_FRAG and mgwfs --frag: the
+ sizes of the free pieces and where they are, which files are in the most
+ pieces and how much seeking reading all of them would take. It only looks
+ at the freemap and the file headers already in memory; nothing is read
+ from the disk. fragShow() in fragshow.c prints the result.
+
+*/
+#include "mgwfs.h"
+
+_Static_assert(FSYS_MAX_ALTS <= MGWFS_IO_MAX_REGIONS, "MgwfsIoctlFrag_t has no room for all the regions");
+
+/* Histogram bucket for a piece of 'sectors' sectors */
+static int fragBucket(uint32_t sectors)
+{
+	int bucket=0;
+
+	while ( sectors > 1 && bucket < MGWFS_FRAG_BUCKETS-1 )
+	{
+		sectors >>= 1;
+		++bucket;
+	}
+	return bucket;
+}
+
+static int cmpRetPtrStart(const void *a, const void *b)
+{
+	const FsysRetPtr *ra = (const FsysRetPtr *)a, *rb = (const FsysRetPtr *)b;
+
+	return ra->start < rb->start ? -1 : ra->start > rb->start;
+}
+
+/* Is 'a' worse than 'b'? More pieces first, then more seeking between them. */
+static int fragWorse(const MgwfsFragFile_t *a, const MgwfsFragFile_t *b)
+{
+	if ( a->rps != b->rps )
+		return a->rps > b->rps;
+	return a->seekSectors > b->seekSectors;
+}
+
+/* Keep fr->top[] sorted worst first with only the worst MGWFS_FRAG_TOP_FILES */
+static void fragRank(MgwfsIoctlFrag_t *fr, const MgwfsFragFile_t *ff, MgwfsInode_t *inode)
+{
+	int ii;
+
+	for (ii=fr->numTop; ii > 0 && fragWorse(ff, fr->top + ii - 1); --ii)
+	{
+		if ( ii < MGWFS_FRAG_TOP_FILES )
+			fr->top[ii] = fr->top[ii-1];
+	}
+	if ( ii >= MGWFS_FRAG_TOP_FILES )
+		return;
+	fr->top[ii] = *ff;
+	buildBootFNPath(fr->top[ii].path, MAX_FRAG_PATH-1, inode);
+	if ( fr->numTop < MGWFS_FRAG_TOP_FILES )
+		++fr->numTop;
+}
+
+/* Fill in *fr. Returns 0 or -ENOMEM. */
+int fragReport(MgwfsSuper_t *ourSuper, MgwfsIoctlFrag_t *fr)
+{
+	FreeMap_t *freeMapPtr = &ourSuper->freeMap;
+	const FsysRetPtr *src;
+	FsysRetPtr *pieces;
+	uint64_t start = perfNow();
+	uint32_t regionStart[FSYS_MAX_ALTS+1], lastEnd=0;
+	size_t numPieces=0, maxPieces;
+	int ii, region, altIdx, rpIdx;
+
+	memset(fr, 0, sizeof(*fr));
+	fr->version = MGWFS_FRAG_VERSION;
+	fr->numBuckets = MGWFS_FRAG_BUCKETS;
+	fr->numRegions = FSYS_MAX_ALTS;
+	for (region=0; region < FSYS_MAX_ALTS; ++region)
+		fr->regionStart[region] = regionStart[region] = region ? FSYS_COPY_ALG(region, ourSuper->maxHb) : 0;
+	regionStart[FSYS_MAX_ALTS] = 0xFFFFFFFF;
+	/* The free space */
+	src = FREEMAP_RP_PTR(freeMapPtr);
+	for (ii=0; ii < freeMapPtr->freeMapEntriesUsed && src->nblocks; ++ii, ++src)
+	{
+		uint32_t end = src->start + src->nblocks;
+
+		++fr->freePieces;
+		fr->freeSectors += src->nblocks;
+		++fr->freeHist[fragBucket(src->nblocks)];
+		fr->freeHistSectors[fragBucket(src->nblocks)] += src->nblocks;
+		/* A piece that straddles a region boundary counts in both */
+		for (region=0; region < FSYS_MAX_ALTS; ++region)
+		{
+			uint32_t lo = src->start > regionStart[region] ? src->start : regionStart[region];
+			uint32_t hi = end < regionStart[region+1] ? end : regionStart[region+1];
+
+			if ( lo >= hi )
+				continue;
+			fr->regionFree[region] += hi - lo;
+			if ( hi - lo > fr->regionLargest[region] )
+				fr->regionLargest[region] = hi - lo;
+		}
+	}
+	/* The files. The first copy of each is what a read would use. */
+	maxPieces = (size_t)ourSuper->numInodesUsed*FSYS_MAX_FHPTRS;
+	pieces = (FsysRetPtr *)malloc(maxPieces*sizeof(FsysRetPtr));
+	if ( !pieces )
+		return -ENOMEM;
+	for (ii=0; ii < ourSuper->numInodesUsed; ++ii)
+	{
+		MgwfsInode_t *inode = getInode(ourSuper, ii);
+		MgwfsFragFile_t ff;
+		int fragmented=0;
+
+		if ( !inode || !inode->fsHeader )
+			continue;
+		memset(&ff, 0, sizeof(ff));
+		ff.inode = ii;
+		ff.sectors = inode->fsHeader->clusters;
+		for (altIdx=0; altIdx < FSYS_MAX_ALTS && inode->fsHeader->pointers[altIdx][0].nblocks; ++altIdx)
+		{
+			const FsysRetPtr *rp = inode->fsHeader->pointers[altIdx];
+
+			++ff.copies;
+			for (rpIdx=0; rpIdx < FSYS_MAX_FHPTRS && rp[rpIdx].nblocks; ++rpIdx)
+			{
+				if ( rpIdx )
+					ff.seekSectors += rp[rpIdx].start > rp[rpIdx-1].start + rp[rpIdx-1].nblocks ?
+						rp[rpIdx].start - (rp[rpIdx-1].start + rp[rpIdx-1].nblocks) :
+						(rp[rpIdx-1].start + rp[rpIdx-1].nblocks) - rp[rpIdx].start;
+				if ( altIdx )
+					continue;
+				if ( rp[rpIdx].start != lastEnd )
+				{
+					++fr->scanSeeks;
+					fr->scanSeekSectors += rp[rpIdx].start > lastEnd ? rp[rpIdx].start - lastEnd : lastEnd - rp[rpIdx].start;
+				}
+				lastEnd = rp[rpIdx].start + rp[rpIdx].nblocks;
+				pieces[numPieces++] = rp[rpIdx];
+			}
+			ff.rps += rpIdx;
+			if ( rpIdx > 1 )
+				fragmented = 1;
+			if ( rpIdx > (int)fr->maxRps )
+				fr->maxRps = rpIdx;
+		}
+		++fr->numFiles;
+		fr->filesFragmented += fragmented;
+		if ( ff.rps > ff.copies )
+			fragRank(fr, &ff, inode);
+	}
+	/* The same pieces read in the order they are on the disk */
+	fr->totalPieces = numPieces;
+	qsort(pieces, numPieces, sizeof(FsysRetPtr), cmpRetPtrStart);
+	for (lastEnd=0, ii=0; ii < (int)numPieces; ++ii)
+	{
+		if ( pieces[ii].start != lastEnd )
+			++fr->sortedSeeks;
+		lastEnd = pieces[ii].start + pieces[ii].nblocks;
+	}
+	free(pieces);
+	fr->usecs = (perfNow() - start)/1000;
+	return 0;
+}
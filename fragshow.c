@@ -0,0 +1,59 @@
+/*
+  fragshow: Part of Atari/MidwayGamesWest filesystem using libfuse: Filesystem in Userspace
+
+  Copyright (C) 2025  Dave Shepperd <mgwfs@dshepperd.com>
+
+  This program can be distributed under the terms of the GNU GPLv2.
+  See the file COPYING.
+
+ Prints the fragmentation report from MGWFS_IOC_FRAG. It only needs the
+ ioctl ABI header, so both mgwfsctl and mgwfs (for --frag) link it.
+
+*/
+#include <inttypes.h>
+#include "mgwfsctl.h"
+
+void fragShow(FILE *fp, const MgwfsIoctlFrag_t *fr)
+{
+	uint32_t ii;
+
+	fprintf(fp, "Free space: %" PRIu64 " sectors in %" PRIu32 " pieces\n", fr->freeSectors, fr->freePieces);
+	fprintf(fp, "%-20s %10s %12s %8s\n", "piece size (sectors)", "pieces", "sectors", "share");
+	for (ii=0; ii < fr->numBuckets && ii < MGWFS_FRAG_BUCKETS; ++ii)
+	{
+		char range[32];
+
+		if ( !fr->freeHist[ii] )
+			continue;
+		if ( ii == MGWFS_FRAG_BUCKETS-1 )
+			snprintf(range, sizeof(range), "%u-", 1U<<ii);
+		else
+			snprintf(range, sizeof(range), "%u-%u", 1U<<ii, (2U<<ii)-1);
+		fprintf(fp, "%-20s %10" PRIu32 " %12" PRIu64 " %7.1f%%\n", range, fr->freeHist[ii], fr->freeHistSectors[ii],
+				fr->freeSectors ? 100.0*fr->freeHistSectors[ii]/fr->freeSectors : 0.0);
+	}
+	fprintf(fp, "\n%-20s %12s %14s\n", "copy region", "free", "largest piece");
+	for (ii=0; ii < fr->numRegions && ii < MGWFS_IO_MAX_REGIONS; ++ii)
+	{
+		char name[32];
+
+		snprintf(name, sizeof(name), "copy %u (0x%X-)", ii, fr->regionStart[ii]);
+		fprintf(fp, "%-20s %12" PRIu64 " %14" PRIu32 "\n", name, fr->regionFree[ii], fr->regionLargest[ii]);
+	}
+	fprintf(fp, "\nFiles: %" PRIu32 ", %" PRIu32 " with a copy in more than one piece, at most %" PRIu32 " pieces in one copy\n",
+			fr->numFiles, fr->filesFragmented, fr->maxRps);
+	fprintf(fp, "Reading the first copy of every file: %" PRIu64 " pieces, %" PRIu64 " seeks in inode order (%.1f MB skipped over), %" PRIu64 " in disk order\n",
+			fr->totalPieces, fr->scanSeeks, fr->scanSeekSectors*512/1e6, fr->sortedSeeks);
+	if ( fr->numTop )
+	{
+		fprintf(fp, "\n%8s %6s %6s %10s %14s  %s\n", "inode", "copies", "pieces", "sectors", "seek sectors", "path");
+		for (ii=0; ii < fr->numTop && ii < MGWFS_FRAG_TOP_FILES; ++ii)
+		{
+			const MgwfsFragFile_t *ff = fr->top + ii;
+
+			fprintf(fp, "%8" PRIu32 " %6" PRIu32 " %6" PRIu32 " %10" PRIu32 " %14" PRIu64 "  %.*s\n",
+					ff->inode, ff->copies, ff->rps, ff->sectors, ff->seekSectors, MAX_FRAG_PATH, ff->path);
+		}
+	}
+	fprintf(fp, "(%.2f msecs to work out)\n", fr->usecs/1000.0);
+}
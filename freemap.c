@@ -39,6 +39,212 @@ void mgwfsDumpFreeMap(MgwfsSuper_t *ourSuper, const char *title, const FreeMap_t
 		fprintf(ourSuper->logFile,"mgwfs_dumpfree(): %s %3d: <empty>\n", title, ii);
 }
 
+/*
+ * Allocation policies. Each one picks which free map entry, and where in it,
+ * a request for numSectors sectors at or after minSector should come from.
+ * They return the entry's index and set *startPtr, or return -1 if no entry
+ * has that much in one piece. Extending a file's last retrieval pointer and
+ * the fallbacks (trying again from anywhere, then settling for the biggest
+ * piece there is) are the same for all of them; see mgwfsFindFree().
+ */
+
+/* Sectors of *src at or after minSector, and where they start */
+static uint32_t usableSectors(const FsysRetPtr *src, uint32_t minSector, uint32_t *fromPtr)
+{
+	uint32_t end = src->start + src->nblocks;
+
+	*fromPtr = minSector > src->start ? minSector : src->start;
+	return *fromPtr < end ? end - *fromPtr : 0;
+}
+
+/* Which FSYS_COPY_ALG() region of the disk minSector is in */
+static int allocRegion(const MgwfsSuper_t *ourSuper, uint32_t minSector)
+{
+	int region;
+
+	for (region=FSYS_MAX_ALTS-1; region > 0; --region)
+	{
+		if ( minSector >= FSYS_COPY_ALG(region, ourSuper->maxHb) )
+			break;
+	}
+	return region;
+}
+
+/* The original: an entry of exactly the right size if there is one right at
+ * minSector, else the first one with room. */
+static int chooseFirstFit(MgwfsSuper_t *ourSuper, uint32_t minSector, int numSectors, uint32_t *startPtr)
+{
+	FreeMap_t *freeMapPtr = &ourSuper->freeMap;
+	FsysRetPtr *src;
+	uint32_t from;
+	int ii;
+
+	src = FREEMAP_RP_PTR(freeMapPtr);
+	for ( ii = 0; ii < freeMapPtr->freeMapEntriesUsed && src->start; ++ii, ++src )
+	{
+		if ( src->nblocks == numSectors && (!minSector || minSector == src->start) )
+		{
+			*startPtr = src->start;
+			return ii;
+		}
+	}
+	src = FREEMAP_RP_PTR(freeMapPtr);
+	for ( ii = 0; ii < freeMapPtr->freeMapEntriesUsed && src->start; ++ii, ++src )
+	{
+		if ( usableSectors(src, minSector, &from) >= numSectors )
+		{
+			*startPtr = from;
+			return ii;
+		}
+	}
+	return -1;
+}
+
+/* First fit, but starting where the last allocation in this copy region
+ * left off, so files created one after another land one after another. The
+ * cursor only looks as far as the end of its region; past that it wraps back
+ * to the start of the region rather than spilling into the next one while
+ * there are holes left behind it. */
+static int chooseNextFit(MgwfsSuper_t *ourSuper, uint32_t minSector, int numSectors, uint32_t *startPtr)
+{
+	FreeMap_t *freeMapPtr = &ourSuper->freeMap;
+	FsysRetPtr *src;
+	uint32_t from, cursor, regionEnd;
+	int ii, region;
+
+	region = allocRegion(ourSuper, minSector);
+	cursor = ourSuper->allocCursor[region];
+	regionEnd = region < FSYS_MAX_ALTS-1 ? FSYS_COPY_ALG(region+1, ourSuper->maxHb) : 0xFFFFFFFF;
+	if ( cursor > minSector && cursor < regionEnd )
+	{
+		src = FREEMAP_RP_PTR(freeMapPtr);
+		for ( ii = 0; ii < freeMapPtr->freeMapEntriesUsed && src->start; ++ii, ++src )
+		{
+			if ( usableSectors(src, cursor, &from) >= numSectors && from + numSectors <= regionEnd )
+			{
+				*startPtr = from;
+				return ii;
+			}
+		}
+	}
+	/* Nothing between the cursor and the end of the region; wrap back to the start of the region */
+	return chooseFirstFit(ourSuper, minSector, numSectors, startPtr);
+}
+
+/* The smallest piece that will do, so big pieces stay big */
+static int chooseBestFit(MgwfsSuper_t *ourSuper, uint32_t minSector, int numSectors, uint32_t *startPtr)
+{
+	FreeMap_t *freeMapPtr = &ourSuper->freeMap;
+	FsysRetPtr *src;
+	uint32_t from, avail, bestAvail=0;
+	int ii, bestIdx=-1;
+
+	src = FREEMAP_RP_PTR(freeMapPtr);
+	for ( ii = 0; ii < freeMapPtr->freeMapEntriesUsed && src->start; ++ii, ++src )
+	{
+		avail = usableSectors(src, minSector, &from);
+		if ( avail >= numSectors && (bestIdx < 0 || avail < bestAvail) )
+		{
+			bestIdx = ii;
+			bestAvail = avail;
+			*startPtr = from;
+			if ( avail == numSectors )
+				break;
+		}
+	}
+	return bestIdx;
+}
+
+/* Headers and small files go best fit into the end of whatever piece they
+ * fit best, big files go next fit from the front. That keeps the small stuff
+ * out of the long runs the big files want. */
+static int choosePool(MgwfsSuper_t *ourSuper, uint32_t minSector, int numSectors, uint32_t *startPtr)
+{
+	int ii;
+
+	if ( numSectors > MGWFS_SMALL_ALLOC )
+		return chooseNextFit(ourSuper, minSector, numSectors, startPtr);
+	ii = chooseBestFit(ourSuper, minSector, numSectors, startPtr);
+	if ( ii >= 0 )
+	{
+		FreeMap_t *freeMapPtr = &ourSuper->freeMap;
+		const FsysRetPtr *src = FREEMAP_RP_PTR(freeMapPtr) + ii;
+		*startPtr = src->start + src->nblocks - numSectors;
+	}
+	return ii;
+}
+
+const MgwfsAllocPolicy_t AllocPolicies[MGWFS_ALLOC_NUM] =
+{
+	[MGWFS_ALLOC_FIRST] = { "first", chooseFirstFit },
+	[MGWFS_ALLOC_NEXT] = { "next", chooseNextFit },
+	[MGWFS_ALLOC_BEST] = { "best", chooseBestFit },
+	[MGWFS_ALLOC_POOL] = { "pool", choosePool },
+};
+
+/* Index into AllocPolicies[] of the one called 'name', or -1 */
+int mgwfsAllocPolicy(const char *name)
+{
+	int ii;
+
+	for (ii=0; ii < MGWFS_ALLOC_NUM; ++ii)
+	{
+		if ( !strcmp(name, AllocPolicies[ii].name) )
+			return ii;
+	}
+	return -1;
+}
+
+/* Take numSectors sectors starting at 'start' out of free map entry 'idx'.
+ * Returns 0 if that would split the entry and there's no room for another. */
+static int takeSectors(MgwfsSuper_t *ourSuper, int idx, uint32_t start, int numSectors, MgwfsFoundFreeMap_t *stuff)
+{
+	FreeMap_t *freeMapPtr = &ourSuper->freeMap;
+	FsysRetPtr *src = FREEMAP_RP_PTR(freeMapPtr) + idx;
+	uint32_t end = src->start + src->nblocks;
+
+	if ( start != src->start && start + numSectors != end )
+	{
+		if ( freeMapPtr->freeMapEntriesUsed >= freeMapPtr->freeMapEntriesAvail )
+		{
+			/* Technically we could just expand the map file. But for ease here, we just say, sorry, no room */
+			fprintf(ourSuper->logFile,"Failed to  allocate %d sectors. Out of freeMapEntries. Used=%d, available=%d\n",
+					numSectors, freeMapPtr->freeMapEntriesUsed, freeMapPtr->freeMapEntriesAvail);
+			if ( ourSuper->logFile != stderr )
+			{
+				fprintf(stderr,"Failed to  allocate %d sectors. Out of freeMapEntries. Used=%d, available=%d\n",
+						numSectors, freeMapPtr->freeMapEntriesUsed, freeMapPtr->freeMapEntriesAvail);
+			}
+			return 0;
+		}
+		/* make room for one more after this one */
+		memmove(src + 2, src + 1, (freeMapPtr->freeMapEntriesUsed - idx - 1) * sizeof(FsysRetPtr));
+		/* Leave start as is but reduce size of area in front */
+		src[1].start = start + numSectors;
+		src[1].nblocks = end - (start + numSectors);
+		src->nblocks = start - src->start;
+		++freeMapPtr->freeMapEntriesUsed;
+	}
+	else
+	{
+		if ( start == src->start )
+			src->start += numSectors;
+		if ( (src->nblocks -= numSectors) <= 0 )
+		{
+			/* used it all up, so it comes out of the map completely */
+			memmove(src, src + 1, (freeMapPtr->freeMapEntriesUsed - idx - 1) * sizeof(FsysRetPtr));
+			--freeMapPtr->freeMapEntriesUsed;
+			memset(FREEMAP_RP_PTR(freeMapPtr) + freeMapPtr->freeMapEntriesUsed, 0, sizeof(FsysRetPtr));
+		}
+	}
+	stuff->result.start = start;
+	stuff->result.nblocks = numSectors;
+	stuff->actual = stuff->result;
+	freeMapPtr->sectorsFree -= numSectors;
+	freeMapPtr->sectorsUsed += numSectors;
+	return 1;
+}
+
 /**
 * mgwfsFindFree - allocate sectors
 * 
@@ -54,7 +260,11 @@ void mgwfsDumpFreeMap(MgwfsSuper_t *ourSuper, const char *title, const FreeMap_t
 * * dirty           - ignored
 * @param numSectors - number of sectors to allocate
 * @param flags      - bit mask of 0 or more of
-* *                   FREEM_FLAG_xxx
+* *                   FREEM_FLAG_xxx. With FREEM_FLAG_CONTIG only
+* *                   a single piece of all numSectors will do.
+*
+* Where a new piece comes from is up to ourSuper->allocPolicy (see
+* AllocPolicies[] above).
 *
 * On Exit:
 * @return 0 on error, 1 on success
@@ -63,13 +273,13 @@ void mgwfsDumpFreeMap(MgwfsSuper_t *ourSuper, const char *title, const FreeMap_t
 * * hint          - unchanged
 * * minSector     - unchanged
 */
-int mgwfsFindFree(MgwfsSuper_t *ourSuper, MgwfsFoundFreeMap_t *stuff, int numSectors, uint32_t flags)
+static int doFindFree(MgwfsSuper_t *ourSuper, MgwfsFoundFreeMap_t *stuff, int numSectors, uint32_t flags)
 {
 	if ( stuff )
 	{
 		int ii, leastDiff, leastDiffIdx;
-		FsysRetPtr *src, *src1;
-		uint32_t minSector;
+		FsysRetPtr *src;
+		uint32_t minSector, start;
 		FreeMap_t *freeMapPtr = &ourSuper->freeMap;
 		
 		/* assume nothing to report */
@@ -96,7 +306,11 @@ int mgwfsFindFree(MgwfsSuper_t *ourSuper, MgwfsFoundFreeMap_t *stuff, int numSec
 				{
 					int num = numSectors;
 					if ( num > src->nblocks )
+					{
+						if ( (flags&FREEM_FLAG_CONTIG) )
+							break;		/* not all of it; look for one piece elsewhere */
 						num = src->nblocks;	/* limit the max sectors to add */
+					}
 					/* we found a connecting section */
 					/* we can just extend the provided hinted retrieval */
 					freeMapPtr->sectorsFree -= num;
@@ -109,7 +323,7 @@ int mgwfsFindFree(MgwfsSuper_t *ourSuper, MgwfsFoundFreeMap_t *stuff, int numSec
 					if ( (src->nblocks -= num) <= 0 )
 					{
 						/* remove the existing section completely */
-						memmove(src, src + 1, (freeMapPtr->freeMapEntriesUsed - ii) * sizeof(FsysRetPtr));
+						memmove(src, src + 1, (freeMapPtr->freeMapEntriesUsed - ii - 1) * sizeof(FsysRetPtr));
 						memset(FREEMAP_RP_PTR(freeMapPtr) + freeMapPtr->freeMapEntriesUsed - 1, 0, sizeof(FsysRetPtr));
 						--freeMapPtr->freeMapEntriesUsed;
 					}
@@ -127,134 +341,32 @@ int mgwfsFindFree(MgwfsSuper_t *ourSuper, MgwfsFoundFreeMap_t *stuff, int numSec
 				snprintf(txt, sizeof(txt), "from at least minSector=0x%08X", minSector);
 			else
 				strncpy(txt,"from anywhere",sizeof(txt));
-			fprintf(ourSuper->logFile,"mgwfsFindFree(): Looking for 0x%X (%d) sector%s %s\n",
-					numSectors, numSectors, numSectors == 1 ? "" : "s", txt);
+			fprintf(ourSuper->logFile,"mgwfsFindFree(): Looking for 0x%X (%d) sector%s %s (%s fit)\n",
+					numSectors, numSectors, numSectors == 1 ? "" : "s", txt, AllocPolicies[ourSuper->allocPolicy].name);
 			mgwfsDumpFreeMap(ourSuper,"mgwfsFindFree()",freeMapPtr);
 		}
-		src = FREEMAP_RP_PTR(freeMapPtr);
-		for ( ii = 0; ii < freeMapPtr->freeMapEntriesUsed; ++ii, ++src )
+		ii = AllocPolicies[ourSuper->allocPolicy].choose(ourSuper, minSector, numSectors, &start);
+		if ( ii >= 0 )
 		{
-			if ( !src->start )
-				break;
-			if ( minSector && minSector >= src->start + src->nblocks )
-				continue;
-			if ( src->nblocks == numSectors )
-			{
-				if ( minSector && minSector != src->start )
-					continue;
-				/* we found a section with the requested number of sectors exactly */
-				/* we can just clip off all of the new sectors from the current section */
-				stuff->result.start = src->start;
-				stuff->result.nblocks = numSectors;
-				stuff->actual.start = src->start;
-				stuff->actual.nblocks = numSectors;
-				freeMapPtr->sectorsFree -= numSectors;
-				freeMapPtr->sectorsUsed += numSectors;
-				return 1;   /* something changed */
-			}
-		}
-		src = FREEMAP_RP_PTR(freeMapPtr);
-		for ( ii = 0; ii < freeMapPtr->freeMapEntriesUsed; ++ii, ++src )
-		{
-			if ( !src->start )
-				break;
-			if ( minSector && minSector >= src->start+src->nblocks )
-				continue;
-			if ( minSector && minSector >= src->start )
-			{
-				uint32_t tnblocks;
-				tnblocks = src->nblocks - (minSector - src->start);
-				if ( tnblocks >= numSectors )
-				{
-					/* we found a section with at least the requested number of sectors */
-					stuff->result.start = minSector;
-					stuff->result.nblocks = numSectors;
-					stuff->actual = stuff->result;
-					freeMapPtr->sectorsFree -= numSectors;
-					freeMapPtr->sectorsUsed += numSectors;
-					if ( minSector == src->start )
-					{
-						/* we can just clip off the new sectors from the current section */
-						src->start += numSectors;
-						src->nblocks -= numSectors;
-					}
-					else
-					{
-						if ( minSector + numSectors != src->start + src->nblocks )
-						{
-							if ( freeMapPtr->freeMapEntriesUsed >= freeMapPtr->freeMapEntriesAvail )
-							{
-								/* Technically we could just expand the map file. But for ease here, we just say, sorry, no room */
-								fprintf(ourSuper->logFile,"Failed to  allocate %d sectors. Out of freeMapEntries. Used=%d, available=%d\n",
-										numSectors, freeMapPtr->freeMapEntriesUsed, freeMapPtr->freeMapEntriesAvail);
-								if ( ourSuper->logFile != stderr )
-								{
-									fprintf(stderr,"Failed to  allocate %d sectors. Out of freeMapEntries. Used=%d, available=%d\n",
-											numSectors, freeMapPtr->freeMapEntriesUsed, freeMapPtr->freeMapEntriesAvail);
-								}
-								return 0;
-							}
-							/* we have to insert an entry */
-							src1 = src + 1;
-							/* make room for one more */
-							memmove(src1, src, (freeMapPtr->freeMapEntriesUsed - ii - 1) * sizeof(FsysRetPtr));
-							/* Leave start as is but reduce size of area in front */
-							src1->start = minSector+numSectors;
-							src1->nblocks = (src->start + src->nblocks) - (minSector+numSectors);
-							src->nblocks = minSector-src->start;
-							++freeMapPtr->freeMapEntriesUsed;
-						}
-						else
-						{
-							src->nblocks -= numSectors;
-						}
-					}
-					if ( (flags&FREEM_FLAG_MARK_DIRTY) )
-						addToDirty("mgwfsFindFree():", ourSuper, FSYS_INDEX_FREE);
-					return 1;   /* something changed */
-				}
-			}
-			else
+			if ( !takeSectors(ourSuper, ii, start, numSectors, stuff) )
+				return 0;
+			/* Only move the cursor of the region that was asked for, and only
+			 * if this landed in it (not after a retry from anywhere, or when
+			 * the region had no room and it came from a later one). */
+			if ( minSector && allocRegion(ourSuper, start) == allocRegion(ourSuper, minSector) )
+				ourSuper->allocCursor[allocRegion(ourSuper, minSector)] = start + numSectors;
+			if ( (flags&FREEM_FLAG_MARK_DIRTY) )
+				addToDirty("mgwfsFindFree():", ourSuper, FSYS_INDEX_FREE);
+			if ( (ourSuper->verbose & VERBOSE_FREE) )
 			{
-				if ( src->nblocks >= numSectors )
-				{
-					/* we found a section with at least the requested number of sectors */
-					/* we can just clip off the new sectors from the current section */
-					stuff->result.start = src->start;
-					stuff->result.nblocks = numSectors;
-					freeMapPtr->sectorsFree -= numSectors;
-					freeMapPtr->sectorsUsed += numSectors;
-					stuff->actual = stuff->result;
-					src->start += numSectors;
-					if ( (src->nblocks -= numSectors) <= 0 )
-					{
-						int entriesToMove;
-						// We ate the whole thing. So shift the lot
-						/* remove the found section completely */
-						entriesToMove = src - FREEMAP_RP_PTR(freeMapPtr);
-						entriesToMove = (freeMapPtr->freeMapEntriesUsed - entriesToMove - 1);
-						if ( entriesToMove < 0 )
-							entriesToMove = 0;
-						memmove(src, src + 1, entriesToMove*sizeof(FsysRetPtr));
-						--freeMapPtr->freeMapEntriesUsed;
-						memset(FREEMAP_RP_PTR(freeMapPtr) + freeMapPtr->freeMapEntriesUsed, 0, sizeof(FsysRetPtr));
-						if ( (flags&FREEM_FLAG_MARK_DIRTY) )
-							addToDirty("mgwfsFindFree():", ourSuper, FSYS_INDEX_FREE);
-					}
-					if ( (flags & FREEM_FLAG_MARK_DIRTY) )
-						addToDirty("mgwfsFindFree():", ourSuper, FSYS_INDEX_FREE);
-					if ( (ourSuper->verbose & VERBOSE_FREE) )
-					{
-						fprintf(ourSuper->logFile, "mgwfs_findfree(): returned 0x%08X-0x%08X (0x%X nblocks).\n",
-								stuff->result.start,
-								stuff->result.start+stuff->result.nblocks-1,
-								stuff->result.nblocks
-								);
-						mgwfsDumpFreeMap(ourSuper,"mgwfsFindFree()",freeMapPtr);
-					}
-					return 1;   /* something changed */
-				}
+				fprintf(ourSuper->logFile, "mgwfs_findfree(): returned 0x%08X-0x%08X (0x%X nblocks).\n",
+						stuff->result.start,
+						stuff->result.start+stuff->result.nblocks-1,
+						stuff->result.nblocks
+						);
+				mgwfsDumpFreeMap(ourSuper,"mgwfsFindFree()",freeMapPtr);
 			}
+			return 1;   /* something changed */
 		}
 		if ( minSector )
 		{
@@ -264,6 +376,8 @@ int mgwfsFindFree(MgwfsSuper_t *ourSuper, MgwfsFoundFreeMap_t *stuff, int numSec
 			stuff->minSector = 0;
 			return mgwfsFindFree(ourSuper,stuff,numSectors, flags);
 		}
+		if ( (flags&FREEM_FLAG_CONTIG) )
+			return 0;		/* no single piece is big enough */
 		src = FREEMAP_RP_PTR(freeMapPtr);
 		leastDiffIdx = 0;
 		leastDiff = 0x00FFFFFF;
@@ -292,7 +406,7 @@ int mgwfsFindFree(MgwfsSuper_t *ourSuper, MgwfsFoundFreeMap_t *stuff, int numSec
 			freeMapPtr->sectorsUsed += src->nblocks;
 			stuff->actual = stuff->result;
 			/* remove the found section completely */
-			memmove(src, src + 1, (freeMapPtr->freeMapEntriesUsed - leastDiffIdx) * sizeof(FsysRetPtr));
+			memmove(src, src + 1, (freeMapPtr->freeMapEntriesUsed - leastDiffIdx - 1) * sizeof(FsysRetPtr));
 			memset(FREEMAP_RP_PTR(freeMapPtr) + freeMapPtr->freeMapEntriesUsed - 1, 0, sizeof(FsysRetPtr));
 			if ( (flags&FREEM_FLAG_MARK_DIRTY) )
 				addToDirty("mgwfsFindFree():", ourSuper, FSYS_INDEX_FREE);
@@ -303,6 +417,27 @@ int mgwfsFindFree(MgwfsSuper_t *ourSuper, MgwfsFoundFreeMap_t *stuff, int numSec
 	return 0;
 }
 
+int mgwfsFindFree(MgwfsSuper_t *ourSuper, MgwfsFoundFreeMap_t *stuff, int numSectors, uint32_t flags)
+{
+	uint64_t start = perfNow();
+	int sts = doFindFree(ourSuper, stuff, numSectors, flags);
+	perfDone(MGWFS_PERF_FINDFREE, start);
+	return sts;
+}
+
+/* Total of the free sectors in the freemap */
+uint32_t mgwfsFreeSectorCount(const MgwfsSuper_t *ourSuper)
+{
+	const FreeMap_t *freeMap = &ourSuper->freeMap;
+	const FsysRetPtr *rp = FREEMAP_RP_PTR(freeMap);
+	uint32_t total=0;
+	int ii;
+
+	for (ii=0; rp && ii < freeMap->freeMapEntriesUsed && rp->nblocks; ++ii, ++rp)
+		total += rp->nblocks;
+	return total;
+}
+
 #define HANDLE_FREE_OVERLAPS (0)
 #define MAX_ENT_TST (16)
 #define str(xx) #xx
@@ -462,10 +597,10 @@ int mgwfsFreeSectors(MgwfsSuper_t *ourSuper, FsysRetPtr *retp, uint32_t flags)
 #endif
 		}
 		/* Did not find anything so we need to insert a new entry at entry ii */
-		if ( ii >= freeMapPtr->freeMapEntriesAvail )
+		if ( freeMapPtr->freeMapEntriesUsed >= freeMapPtr->freeMapEntriesAvail )
 		{
-			fprintf(ourSuper->errFile,"mgwsFreeSectors(): No room to add new free entry. ii=%d, freeMapEntriesAvail=%d\n",
-					ii, freeMapPtr->freeMapEntriesAvail);
+			fprintf(ourSuper->errFile,"mgwsFreeSectors(): No room to add new free entry for 0x%08X-0x%08X (0x%X). ii=%d, freeMapEntriesAvail=%d\n",
+					retp->start, retp->start + retp->nblocks - 1, retp->nblocks, ii, freeMapPtr->freeMapEntriesAvail);
 			return 0;
 		}
 		src = FREEMAP_RP_PTR(freeMapPtr) + ii;
@@ -505,6 +640,8 @@ void addToDirty(const char *title, MgwfsSuper_t *super, int idx)
 {
 }
 
+MgwfsPerfOp_t perfOps[MGWFS_PERF_NUM_OPS];
+
 #define MAXHB (0x3000+1024*16)
 
 static const FsysRetPtr SampleFreeMapData[] =
@@ -525,18 +662,228 @@ static FreeMap_t SampleFreeMap;
 
 static int help_em(const char *title)
 {
-	printf("%s [-v][-c count][-C num][-m min][-s sector][-r sector[,num]] numSectors\n"
+	printf("%s [-v][-p policy][-c count][-C num][-m min][-s sector][-r sector[,num]] numSectors\n"
+		   "%s [-p policy] -b files\n"
 		   "Where:\n"
+		   "-b files        = run the allocation benchmark making this many files (all policies unless -p)\n"
 		   "-c count        = specify the count of alt sections to get (1 to 3)\n"
 		   "-C num          = specify initial size of free list (default=7)\n"
 		   "-m min          = specify the minimum sector to look for\n"
+		   "-p policy       = allocation policy: first, next, best or pool (default=best)\n"
 		   "-r sector[,num[,sector,num][,sector[,num]...]] = specify a list of RP's to return\n"
 		   "-s sector[,num] = specify a hint RP\n"
 		   "-v              = set verbose mode\n"
-		   , title);
+		   , title, title);
 	return 1;
 }
 
+/*
+ * -b: allocation benchmark. Fills a 1.5GB volume to about 70% with files of
+ * a mix of sizes, each with FSYS_MAX_ALTS header sectors and BENCH_COPIES
+ * copies of its data placed the way allocateRPSectors() does it, then keeps
+ * deleting a random file and creating another until 'files' files have been
+ * made. Reports how fragmented the files and the free map ended up and how
+ * long mgwfsFindFree() took.
+ */
+#define BENCH_SECTORS	(3*1024*1024)
+#define BENCH_ENTRIES	(65536)
+#define BENCH_COPIES	(2)
+#define BENCH_MAX_FILES	(200000)
+
+typedef struct
+{
+	FsysRetPtr hdrs[FSYS_MAX_ALTS];
+	FsysRetPtr rps[BENCH_COPIES][FSYS_MAX_FHPTRS];
+	int sectors;
+} BenchFile_t;
+
+static uint32_t benchSeed = 12345;
+
+static uint32_t benchRand(void)
+{
+	benchSeed = benchSeed*1103515245 + 12345;
+	return (benchSeed >> 8) & 0xFFFFFF;
+}
+
+/* Mostly small files, some medium ones and a few big ones */
+static int benchSize(void)
+{
+	uint32_t pick = benchRand()%100;
+
+	if ( pick < 60 )
+		return 1 + benchRand()%MGWFS_SMALL_ALLOC;
+	if ( pick < 90 )
+		return MGWFS_SMALL_ALLOC + 1 + benchRand()%512;
+	return 529 + benchRand()%20000;
+}
+
+static void benchFree(MgwfsSuper_t *super, BenchFile_t *bf)
+{
+	int ii, jj;
+
+	for (ii=0; ii < FSYS_MAX_ALTS; ++ii)
+		mgwfsFreeSectors(super, bf->hdrs + ii, 0);
+	for (ii=0; ii < BENCH_COPIES; ++ii)
+		for (jj=0; jj < FSYS_MAX_FHPTRS && bf->rps[ii][jj].nblocks; ++jj)
+			mgwfsFreeSectors(super, &bf->rps[ii][jj], 0);
+	memset(bf, 0, sizeof(*bf));
+}
+
+static int benchCreate(MgwfsSuper_t *super, BenchFile_t *bf)
+{
+	MgwfsFoundFreeMap_t found;
+	int ii, copy, rpIdx, have;
+
+	memset(bf, 0, sizeof(*bf));
+	bf->sectors = benchSize();
+	for (ii=0; ii < FSYS_MAX_ALTS; ++ii)
+	{
+		memset(&found, 0, sizeof(found));
+		found.minSector = FSYS_HB_ALG(ii, super->maxHb);
+		if ( !mgwfsFindFree(super, &found, 1, 0) )
+			return 0;
+		bf->hdrs[ii] = found.result;
+	}
+	for (copy=0; copy < BENCH_COPIES; ++copy)
+	{
+		FsysRetPtr *rps = bf->rps[copy];
+
+		memset(&found, 0, sizeof(found));
+		found.minSector = FSYS_COPY_ALG(copy, super->maxHb);
+		if ( mgwfsFindFree(super, &found, bf->sectors, FREEM_FLAG_CONTIG) )
+		{
+			rps[0] = found.result;
+			continue;
+		}
+		for (rpIdx=0, have=0; have < bf->sectors; )
+		{
+			found.minSector = FSYS_COPY_ALG(copy, super->maxHb);
+			if ( rpIdx )
+				found.hint = rps[rpIdx-1];
+			if ( !mgwfsFindFree(super, &found, bf->sectors - have, 0) )
+				return 0;
+			if ( rpIdx && found.result.start == rps[rpIdx-1].start )
+			{
+				have += found.result.nblocks - rps[rpIdx-1].nblocks;
+				rps[rpIdx-1] = found.result;
+				continue;
+			}
+			if ( rpIdx >= FSYS_MAX_FHPTRS )
+			{
+				mgwfsFreeSectors(super, &found.result, 0);
+				return 0;
+			}
+			rps[rpIdx++] = found.result;
+			have += found.result.nblocks;
+		}
+	}
+	return 1;
+}
+
+static int benchAlloc(int policy, int files)
+{
+	MgwfsSuper_t super;
+	FsysRetPtr *map;
+	BenchFile_t *live;
+	int numLive=0, made=0, failed=0, ii, jj, copy;
+	int bigFiles=0, bigOneRp=0, maxRps=0;
+	uint64_t bigRps=0, used=0, copySectors[BENCH_COPIES], ownSectors[BENCH_COPIES];
+	MgwfsPerfOp_t *pp = perfOps + MGWFS_PERF_FINDFREE;
+
+	memset(&super, 0, sizeof(super));
+	super.logFile = stdout;
+	super.errFile = stderr;
+	super.maxHb = BENCH_SECTORS;
+	super.allocPolicy = policy;
+	map = (FsysRetPtr *)calloc(BENCH_ENTRIES, sizeof(FsysRetPtr));
+	live = (BenchFile_t *)calloc(BENCH_MAX_FILES, sizeof(BenchFile_t));
+	if ( !map || !live )
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	map[0].start = 0x100;
+	map[0].nblocks = BENCH_SECTORS - 0x100;
+	super.freeMap.rwBuff.buff = (uint8_t *)map;
+	super.freeMap.rwBuff.buffSize = BENCH_ENTRIES*sizeof(FsysRetPtr);
+	super.freeMap.freeMapEntriesAvail = BENCH_ENTRIES;
+	super.freeMap.freeMapEntriesUsed = 1;
+	super.freeMap.sectorsFree = map[0].nblocks;
+	memset(pp, 0, sizeof(*pp));
+	benchSeed = 12345;
+	while ( made < files )
+	{
+		/* Up to about 70% full, then delete one for each one made */
+		if ( numLive && (super.freeMap.sectorsUsed > BENCH_SECTORS/10*7 || numLive >= BENCH_MAX_FILES) )
+		{
+			ii = benchRand()%numLive;
+			benchFree(&super, live + ii);
+			live[ii] = live[--numLive];
+		}
+		if ( benchCreate(&super, live + numLive) )
+			++numLive;
+		else
+		{
+			benchFree(&super, live + numLive);
+			++failed;
+		}
+		++made;
+	}
+	/* How much of each copy ended up in its own copy region */
+	memset(copySectors, 0, sizeof(copySectors));
+	memset(ownSectors, 0, sizeof(ownSectors));
+	for (ii=0; ii < numLive; ++ii)
+	{
+		for (copy=0; copy < BENCH_COPIES; ++copy)
+		{
+			uint32_t lo = FSYS_COPY_ALG(copy, super.maxHb);
+			uint32_t hi = copy < FSYS_MAX_ALTS-1 ? FSYS_COPY_ALG(copy+1, super.maxHb) : BENCH_SECTORS;
+
+			for (jj=0; jj < FSYS_MAX_FHPTRS && live[ii].rps[copy][jj].nblocks; ++jj)
+			{
+				const FsysRetPtr *rp = &live[ii].rps[copy][jj];
+				uint32_t from = rp->start > lo ? rp->start : lo;
+				uint32_t to = rp->start + rp->nblocks < hi ? rp->start + rp->nblocks : hi;
+
+				copySectors[copy] += rp->nblocks;
+				if ( to > from )
+					ownSectors[copy] += to - from;
+			}
+		}
+	}
+	for (ii=0; ii < numLive; ++ii)
+	{
+		if ( live[ii].sectors <= MGWFS_SMALL_ALLOC )
+			continue;
+		++bigFiles;
+		for (copy=0; copy < BENCH_COPIES; ++copy)
+		{
+			for (jj=0; jj < FSYS_MAX_FHPTRS && live[ii].rps[copy][jj].nblocks; ++jj)
+				;
+			bigRps += jj;
+			if ( jj == 1 )
+				++bigOneRp;
+			if ( jj > maxRps )
+				maxRps = jj;
+		}
+	}
+	used = super.freeMap.sectorsUsed;
+	printf("%-6s %8d files made, %6d failed, %6d live, %3d%% full. Files over %d sectors: %5.2f RPs/copy avg, %3d max, %5.1f%% in one piece. "
+		   "Free map entries %5d. mgwfsFindFree() %6.0f ns avg\n",
+		   AllocPolicies[policy].name, made, failed, numLive, (int)(used*100/BENCH_SECTORS), MGWFS_SMALL_ALLOC,
+		   bigFiles ? (double)bigRps/(bigFiles*BENCH_COPIES) : 0.0, maxRps,
+		   bigFiles ? bigOneRp*100.0/(bigFiles*BENCH_COPIES) : 0.0,
+		   super.freeMap.freeMapEntriesUsed,
+		   pp->calls ? (double)pp->totalNsecs/pp->calls : 0.0);
+	printf("%-6s copy data in its own region:", "");
+	for (copy=0; copy < BENCH_COPIES; ++copy)
+		printf(" copy %d %5.1f%%", copy, copySectors[copy] ? ownSectors[copy]*100.0/copySectors[copy] : 0.0);
+	printf("\n");
+	free(map);
+	free(live);
+	return 0;
+}
+
 #define MAX_RESULTS (10*FSYS_MAX_ALTS)
 #define MAX_NUM_RET_RPS (4)
 
@@ -544,6 +891,7 @@ int main(int argc, char **argv)
 {
 	int ii, opt, alts=1, resIdx, done=0, allocChange;
 	int minSector, numRetRps, numSectors, allocated, numInit=n_elts(SampleFreeMapData)-2;
+	int policy=-1, benchFiles=0;
 	char *endp, *nxtRp;
 	FsysRetPtr rpReturn[MAX_NUM_RET_RPS];
 	FreeMap_t *freeMapPtr, resultsMap, actualsMap;
@@ -579,10 +927,28 @@ int main(int argc, char **argv)
 	super.maxHb = MAXHB;
 	numRetRps = 0;
 	minSector = 0;
-	while ( (opt = getopt(argc, argv, "c:C:m:r:s:v")) != -1 )
+	while ( (opt = getopt(argc, argv, "b:c:C:m:p:r:s:v")) != -1 )
 	{
 		switch (opt)
 		{
+		case 'b':
+			endp = NULL;
+			benchFiles = strtoul(optarg, &endp, 0);
+			if ( !endp || *endp || benchFiles < 1 )
+			{
+				fprintf(stderr, "Bad argument for -b: '%s'\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'p':
+			if ( (policy = mgwfsAllocPolicy(optarg)) < 0 )
+			{
+				fprintf(stderr, "Bad argument for -p: '%s'. Can only be first, next, best or pool\n", optarg);
+				return 1;
+			}
+			break;
+
 		case 'c':
 			endp = NULL;
 			alts = strtoul(optarg, &endp, 0);
@@ -674,6 +1040,15 @@ int main(int argc, char **argv)
 		}
 	}
 /*	printf("argc=%d, optind=%d\n", argc, optind); */
+	if ( benchFiles )
+	{
+		if ( policy >= 0 )
+			return benchAlloc(policy, benchFiles);
+		for (ii=0; ii < MGWFS_ALLOC_NUM; ++ii)
+			benchAlloc(ii, benchFiles);
+		return 0;
+	}
+	super.allocPolicy = policy >= 0 ? policy : MGWFS_ALLOC_DEFAULT;
 	if ( argc - optind < 1 )
 		return help_em(argv[0]);
 	if ( alts > 1 && found.minSector )
@@ -21,6 +21,15 @@ void fuse_destroy_mutex(void)
 }
 #endif
 
+/* How long the kernel may trust names and attributes it got from us. Nothing
+ * can change a read only mount, so there they can be kept (nearly) forever.
+ * On a --rw mount the kernel sees most changes go by, but not the ones made
+ * as a side effect (a parent directory's size, a file rewritten by an ioctl),
+ * so those stay short and the changes we know of are invalidated explicitly
+ * (see invalidatePath()). */
+#define RO_CACHE_SECS	(86400.0)
+#define RW_CACHE_SECS	(1.0)
+
 static void *mgwfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
 {
 	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
@@ -28,22 +37,120 @@ static void *mgwfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
 		fprintf(ourSuper.logFile, "FUSE mgwfs_init()\n");
 		fflush(ourSuper.logFile);
 	}
-	cfg->kernel_cache = 1;
+	if ( options.read_write )
+	{
+		cfg->entry_timeout = RW_CACHE_SECS;
+		cfg->attr_timeout = RW_CACHE_SECS;
+		cfg->negative_timeout = 0;	/* a create by ioctl can't invalidate a negative entry */
+		cfg->auto_cache = 1;		/* drop cached pages if a file's size or mtime changes */
+		/* Let the kernel gather writes in its page cache and hand them over
+		 * in big pieces. Every file is held whole in memory until it is
+		 * closed anyway, so nothing is lost by the kernel holding it too. It
+		 * then keeps the size and mtime of open files itself and sends the
+		 * mtime back with utimens when the file is flushed. */
+		if ( (conn->capable & FUSE_CAP_WRITEBACK_CACHE) )
+			conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+		conn->max_write = MGWFS_MAX_IO_SIZE;
+		conn->max_read = MGWFS_MAX_IO_SIZE;		/* has to match -omax_read (see main()) */
+		conn->max_readahead = MGWFS_MAX_IO_SIZE;	/* the kernel may lower this */
+	}
+	else
+	{
+		cfg->entry_timeout = RO_CACHE_SECS;
+		cfg->attr_timeout = RO_CACHE_SECS;
+		cfg->negative_timeout = RO_CACHE_SECS;
+		cfg->kernel_cache = 1;
+#ifdef FUSE_CAP_READDIRPLUS_AUTO
+		/* Always send attributes with the directory entries so 'ls -l' and
+		 * 'find -ls' don't need a getattr for each name. */
+		if ( (conn->capable & FUSE_CAP_READDIRPLUS) )
+		{
+			conn->want |= FUSE_CAP_READDIRPLUS;
+			conn->want &= ~FUSE_CAP_READDIRPLUS_AUTO;
+		}
+#endif
+	}
+	logStart(&ourSuper);
+	perfReset();		/* count from the mount on */
 	return NULL;
 }
 
+/* Tell the kernel to forget the attributes and pages it has for 'path'. Only
+ * needed on --rw mounts. Errors are ignored; if the kernel doesn't have the
+ * path cached there is nothing to forget. */
+static void invalidatePath(const char *path)
+{
+	struct fuse_context *ctx;
+
+	if ( !options.read_write )
+		return;
+	ctx = fuse_get_context();
+	if ( ctx && ctx->fuse )
+		fuse_invalidate_path(ctx->fuse, path);
+}
+
+/* Same for the directory 'path' lives in; its size, link count and mtime
+ * change when names are added to or removed from it. */
+static void invalidateParent(const char *path)
+{
+	char parent[PATH_MAX];
+	const char *slash = strrchr(path, '/');
+	int len;
+
+	if ( !slash )
+		return;
+	len = slash - path;
+	if ( !len )
+		len = 1;			/* the root */
+	if ( len >= (int)sizeof(parent) )
+		return;
+	memcpy(parent, path, len);
+	parent[len] = 0;
+	invalidatePath(parent);
+}
+
+/* The attributes of an inode, the same for getattr and readdirplus */
+static void inodeToStat(const MgwfsInode_t *inode, struct stat *stbuf)
+{
+	int wFlags = options.read_write ? 0220 : 0;
+	uint32_t size = inode->fsHeader->size, clusters = inode->fsHeader->clusters;
+
+	memset(stbuf, 0, sizeof(struct stat));
+	if ( S_ISDIR(inode->mode) )
+	{
+		stbuf->st_mode = S_IFDIR | wFlags | 0555;
+		stbuf->st_nlink = 2 + inode->numInodes;
+	}
+	else
+	{
+		stbuf->st_mode = S_IFREG | wFlags | 0444;
+		stbuf->st_nlink = 1;
+		/* While it is open the shared buffer is the current contents; the
+		 * header only catches up when the file is written out. */
+		if ( inode->openRefs && inode->rwb.buff && inode->rwb.buffErr >= 0 )
+		{
+			size = inode->rwb.buffUsed;
+			if ( (size+BYTES_PER_SECTOR-1)/BYTES_PER_SECTOR > clusters )
+				clusters = (size+BYTES_PER_SECTOR-1)/BYTES_PER_SECTOR;
+		}
+	}
+	stbuf->st_blksize = BYTES_PER_SECTOR;
+	stbuf->st_blocks = clusters;
+	stbuf->st_ino = inode->inode_no;
+	stbuf->st_ctime = inode->fsHeader->ctime;
+	stbuf->st_mtime = inode->fsHeader->mtime;
+	stbuf->st_size = size;
+	stbuf->st_gid = getgid();
+	stbuf->st_uid = getuid();
+}
+
 static int mgwfs_getattr(const char *path, struct stat *stbuf,
 			 struct fuse_file_info *fi)
 {
 	int idx, ret=0;
-	int wFlags = options.read_write ? 0220 : 0;
-	MgwfsInode_t *inode;
 	
 	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
-	{
-		fprintf(ourSuper.logFile, "FUSE mgwfs_getattr(path='%s',stbuf)\n", path);
-		fflush(ourSuper.logFile);
-	}
+		LOG_EVENT(LOG_EV_GETATTR, path);
 	if ( options.read_write )
 		updateAllMetaData("mgwfs_getattr()",&ourSuper);
 	memset(stbuf, 0, sizeof(struct stat));
@@ -61,33 +168,10 @@ static int mgwfs_getattr(const char *path, struct stat *stbuf,
 		else
 			ret = -ENOENT;
 		if ( ret < 0 )
-		{
-			fprintf(ourSuper.logFile, "FUSE mgwfs_getattr() returned -ENOENT because '%s' could not be found\n", path);
-			fflush(ourSuper.logFile);
-		}
+			LOG_EVENT(LOG_EV_GETATTR_ENOENT, path);
 	}
 	if ( !ret )
-	{
-		inode = ourSuper.inodeList[idx];
-		if ( S_ISDIR(inode->mode) )
-		{
-			stbuf->st_mode = S_IFDIR | wFlags | 0555;
-			stbuf->st_nlink = 2 + inode->numInodes;
-		}
-		else
-		{
-			stbuf->st_mode = S_IFREG | wFlags | 0444;
-			stbuf->st_nlink = 1;
-		}
-		stbuf->st_blksize = BYTES_PER_SECTOR;
-		stbuf->st_blocks = inode->fsHeader.clusters;
-		stbuf->st_ino = inode->inode_no;
-		stbuf->st_ctime = inode->fsHeader.ctime;
-		stbuf->st_mtime = inode->fsHeader.mtime;
-		stbuf->st_size = inode->fsHeader.size;
-		stbuf->st_gid = getgid();
-		stbuf->st_uid = getuid();
-	}
+		inodeToStat(getInode(&ourSuper, idx), stbuf);
 	UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
 	return ret;
 }
@@ -101,63 +185,49 @@ static int mgwfs_readdir(const char *path,
 {
 	MgwfsInode_t *inode;
 	int idx, fRet;
+	struct stat stbuf, *stp = NULL;
+	enum fuse_fill_dir_flags fillFlags = 0;
 	
 	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
-	{
-		fprintf(ourSuper.logFile, "FUSE mgwfs_readdir(path='%s',buf=%p,offset=%ld,fi,flags=0x%X)\n", path, buf, offset,flags);
-		fflush(ourSuper.logFile);
-	}
+		LOG_EVENT(LOG_EV_READDIR, path, (long)buf, offset, flags);
 	if ( options.read_write )
 		updateAllMetaData("mgwfs_readdir()",&ourSuper);
 	LOCK_IT("rdMutex",&ourSuper,&rdMutex);
 	idx = findInode(&ourSuper,FSYS_INDEX_ROOT,path);
 	if (!idx)
 	{
-		fprintf(ourSuper.logFile, "FUSE mgwfs_readdir() returned -ENOENT because '%s' could not be found\n", path);
-		fflush(ourSuper.logFile);
+		LOG_EVENT(LOG_EV_READDIR_ENOENT, path);
 		UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
 		return -ENOENT;
 	}
-	inode = ourSuper.inodeList[idx];
+	inode = getInode(&ourSuper, idx);
 	if ( !S_ISDIR(inode->mode) )
 	{
-		fprintf(ourSuper.logFile, "FUSE mgwfs_readdir() returned -ENOENT because '%s' (inode %d) is not a directory\n", path, idx);
-		fflush(ourSuper.logFile);
+		LOG_EVENT(LOG_EV_READDIR_NOTDIR, path, idx);
 		UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
 		return -ENOENT;
 	}
-	filler(buf, ".", NULL, 0, FUSE_FILL_DIR_PLUS);
-	filler(buf, "..", NULL, 0, FUSE_FILL_DIR_PLUS);
+	/* Only hand over attributes when the kernel asked for them (readdirplus) */
+	if ( (flags & FUSE_READDIR_PLUS) )
+	{
+		stp = &stbuf;
+		fillFlags = FUSE_FILL_DIR_PLUS;
+	}
+	if ( stp )
+		inodeToStat(inode, stp);
+	filler(buf, ".", stp, 0, fillFlags);
+	if ( stp && inode->idxParentInode )
+		inodeToStat(getInode(&ourSuper, inode->idxParentInode), stp);
+	filler(buf, "..", stp, 0, fillFlags);
 	idx = inode->idxChildTop;
 	while ( idx )
 	{
-		struct stat stbuf;
-		inode = ourSuper.inodeList[idx];
-		memset(&stbuf, 0, sizeof(struct stat));
-		if ( S_ISDIR(inode->mode) )
-		{
-			stbuf.st_mode = S_IFDIR | (options.read_write ? 0775 : 0555);
-			stbuf.st_nlink = 2 + inode->numInodes;
-		}
-		else
-		{
-			stbuf.st_mode = S_IFREG | (options.read_write ? 0664 : 0444);
-			stbuf.st_nlink = 1;
-		}
-		stbuf.st_blksize = BYTES_PER_SECTOR;
-		stbuf.st_blocks = inode->fsHeader.clusters;
-		stbuf.st_ino = inode->inode_no;
-		stbuf.st_ctime = inode->fsHeader.ctime;
-		stbuf.st_mtime = inode->fsHeader.mtime;
-		stbuf.st_size = inode->fsHeader.size;
-		stbuf.st_gid = getgid();
-		stbuf.st_uid = getuid();
-		fRet = filler(buf, inode->fileName, &stbuf, 0, FUSE_FILL_DIR_PLUS);
+		inode = getInode(&ourSuper, idx);
+		if ( stp )
+			inodeToStat(inode, stp);
+		fRet = filler(buf, inode->fileName, stp, 0, fillFlags);
 		if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
-		{
-			fprintf(ourSuper.logFile, "FUSE mgwfs_readdir(): Uploaded inode %d '%s'. Next=%d. fRet=%d\n", idx, inode->fileName, inode->idxNextInode, fRet );
-			fflush(ourSuper.logFile);
-		}
+			LOG_EVENT(LOG_EV_READDIR_ENTRY, inode->fileName, idx, inode->idxNextInode, fRet);
 		if ( fRet )
 			break;
 		idx = inode->idxNextInode;
@@ -166,6 +236,25 @@ static int mgwfs_readdir(const char *path,
 	return 0;
 }
 
+/*
+ * Read the whole file into the inode's buffer if it isn't there already.
+ * mgwfs_open() does this for the first handle; copy_file_range() drops the
+ * buffer of a file it filled on disk, so anything touching that file again
+ * while it's still open comes through here too.
+ */
+static int loadFileBuffer(const char *title, MgwfsInode_t *inode)
+{
+	if ( inode->rwb.buff )
+		return inode->rwb.buffErr;
+	inode->rwb.buffSize = inode->fsHeader->clusters*BYTES_PER_SECTOR;
+	inode->rwb.buff = (uint8_t *)malloc(inode->rwb.buffSize);
+	inode->rwb.buffErr = readWholeFile(title, &ourSuper, inode->rwb.buff, inode->fsHeader->size, inode->fsHeader->pointers[0], ioPurposeOf(inode));
+	if ( inode->rwb.buffErr >= 0 )
+		inode->rwb.buffUsed = inode->rwb.buffErr;
+	perfCount(MGWFS_CTR_OPEN_LOADED, 1);
+	return inode->rwb.buffErr < 0 ? inode->rwb.buffErr : 0;
+}
+
 static int mgwfs_open(const char *path, struct fuse_file_info *fi)
 {
 	MgwfsInode_t *inode;
@@ -174,7 +263,7 @@ static int mgwfs_open(const char *path, struct fuse_file_info *fi)
 	int retVal = -EINVAL;
 	
 	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
-		fprintf(ourSuper.logFile, "FUSE mgwfs_open(path='%s',fi->fh=%ld, fi->flags=0x%X)\n", path, fi->fh, fi->flags);
+		LOG_EVENT(LOG_EV_OPEN, path, fi->fh, fi->flags);
 	if ( options.read_write )
 		updateAllMetaData("mgwfs_open()",&ourSuper);
 	do
@@ -186,7 +275,7 @@ static int mgwfs_open(const char *path, struct fuse_file_info *fi)
 			if ( idx )
 			{
 				if ( (ourSuper.verbose & VERBOSE_FUSE_CMD) )
-					fprintf(ourSuper.logFile, "FUSE mgwfs_open() returned -EEXIST because '%s' (inode %d) already exists.\n", path, idx);
+					LOG_EVENT(LOG_EV_OPEN_EEXIST, path, idx);
 				retVal = -EEXIST;
 				break;
 			}
@@ -216,15 +305,15 @@ static int mgwfs_open(const char *path, struct fuse_file_info *fi)
 			}
 			if ( !canOpen )
 			{
-				fprintf(ourSuper.logFile, "FUSE mgwfs_open() returned -ENOENT because '%s' could not be found\n", path);
+				LOG_EVENT(LOG_EV_OPEN_ENOENT, path);
 				retVal = -ENOENT;
 				break;
 			}
 		}
-		inode = ourSuper.inodeList[idx];
+		inode = getInode(&ourSuper, idx);
 		if ( S_ISDIR(inode->mode) && (fi->flags & (O_RDWR | O_TRUNC | O_APPEND | O_WRONLY | O_CREAT )) )
 		{
-			fprintf(ourSuper.logFile, "FUSE mgwfs_open() returned -EINVAL because '%s' (inode %d) is a directory\n", path, idx);
+			LOG_EVENT(LOG_EV_OPEN_EISDIR, path, idx);
 			retVal = -EINVAL;
 			break;
 		}
@@ -232,43 +321,55 @@ static int mgwfs_open(const char *path, struct fuse_file_info *fi)
 		++fhp->instances;
 		fhp->inode = idx;
 		fhp->openFlags = fi->flags;
+		fhp->offset = 0;
 		fi->fh = fhp->index;
 		retVal = 0;
 		retVal = fileOpen("FUSE mgwfs_open()", path, &ourSuper, fhp);
-		inode->rwb.buffSize = inode->fsHeader.clusters*BYTES_PER_SECTOR;
-		inode->rwb.buff = (uint8_t *)malloc(inode->rwb.buffSize);
-		/* Read the whole file into a local buffer */
-		inode->rwb.buffErr = readWholeFile("FUSE mgwfs_open():", &ourSuper, inode->rwb.buff, inode->fsHeader.size, inode->fsHeader.pointers[0]);
+		if ( !inode->openRefs || !inode->rwb.buff )
+		{
+			/* First one in reads the whole file into a buffer that every
+			 * later handle on this inode shares until the last one closes. */
+			if ( inode->rwb.buff )
+				free(inode->rwb.buff);
+			memset(&inode->rwb,0,sizeof(inode->rwb));
+			loadFileBuffer("FUSE mgwfs_open():", inode);
+		}
+		else
+			perfCount(MGWFS_CTR_OPEN_SHARED, 1);
+		++inode->openRefs;
 		if ( inode->rwb.buffErr >= 0 )
 		{
-			inode->rwb.buffUsed = inode->rwb.buffErr;
 			if ( (fi->flags&(O_WRONLY|O_RDWR)) )
 			{
 				if ( (fi->flags & O_TRUNC) )
+				{
 					inode->rwb.buffUsed = 0;
+					inode->flags |= MGWFS_INODE_DATA_DIRTY;
+				}
 				if ( (fi->flags & O_APPEND) )
-					inode->rwb.buffOffset = inode->rwb.buffUsed;
+					fhp->offset = inode->rwb.buffUsed;
 			}
+			if ( !options.read_write )
+				fi->keep_cache = 1;		/* nothing can have changed since it was last cached */
 			if ((ourSuper.verbose&VERBOSE_FUSE_CMD))
 			{
-				fprintf(ourSuper.logFile, "FUSE mgwfs_open(%s,0x%X) returned success on open, inode %d and FHidx %d, rwBuff=%p, rwBuffUsed=%d, rwBuffOffset=%ld, rwBuffSize=%d\n"
+				LOG_EVENT(LOG_EV_OPEN_OK
 						,path
 						,fhp->openFlags
 						,idx
 						,fhp->index
-						,inode->rwb.buff
 						,inode->rwb.buffUsed
-						,inode->rwb.buffOffset
+						,fhp->offset
 						,inode->rwb.buffSize
+						,inode->openRefs
 						 );
 			}
 		}
 		else
 		{
-			fprintf(ourSuper.logFile, "FUSE mgwfs_open('%s') readFile() returned error %d.\n", path, inode->rwb.buffErr );
+			LOG_EVENT(LOG_EV_OPEN_READERR, path, inode->rwb.buffErr);
 		}
 	} while (0);
-	fflush(ourSuper.logFile);
 	UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
 	return retVal;
 }
@@ -286,19 +387,21 @@ static int mgwfs_read(const char *path, char *buf, size_t size, off_t offset,
 		size_t cpyAmt;
 		
 		fhp = getFuseFHidx(&ourSuper, fi->fh);
-		inode = ourSuper.inodeList[fhp->inode];
 		if ( !fhp )
 		{
-			fprintf(ourSuper.logFile, "FUSE mgwfs_read('%s', %ld, 0x%lX): not opened. Returned -EIO\n"
+			LOG_EVENT(LOG_EV_READ_NOTOPEN
 					,path
 					,size
 					,offset
 					);
 			break;
 		}
-		if ( inode->rwb.buffErr < 0 )
+		inode = getInode(&ourSuper, fhp->inode);
+		if ( inode )
+			loadFileBuffer("FUSE mgwfs_read():", inode);
+		if ( inode && inode->rwb.buffErr < 0 )
 		{
-			fprintf(ourSuper.logFile, "FUSE mgwfs_read('%s', %ld, 0x%lX): Found rwBuffErr=%d\n"
+			LOG_EVENT(LOG_EV_READ_BUFFERR
 					,path
 					,size
 					,offset
@@ -307,10 +410,10 @@ static int mgwfs_read(const char *path, char *buf, size_t size, off_t offset,
 			retVal = inode->rwb.buffErr;
 			break;
 		}
-		inode = ourSuper.inodeList[fhp->inode];
+		inode = getInode(&ourSuper, fhp->inode);
 		if ( !inode )
 		{
-			fprintf(ourSuper.logFile, "FUSE mgwfs_read('%s', %ld, 0x%lX): No inode found. Returned -EIO\n"
+			LOG_EVENT(LOG_EV_READ_NOINODE
 					,path
 					,size
 					,offset
@@ -319,16 +422,15 @@ static int mgwfs_read(const char *path, char *buf, size_t size, off_t offset,
 		}
 		if ( (ourSuper.verbose & VERBOSE_FUSE_CMD) )
 		{
-			fprintf(ourSuper.logFile, "FUSE mgwfs_read('%s', %ld, 0x%lX): fhp->rwBuffUsed=%d, rwBuffOffset=%ld, rwBuffSize=%d, rwBuffErr=%d\n"
+			LOG_EVENT(LOG_EV_READ
 					,path
 					,size
 					,offset
 					,inode->rwb.buffUsed
-					,inode->rwb.buffOffset
+					,fhp->offset
 					,inode->rwb.buffSize
 					,inode->rwb.buffErr
 					);
-			fflush(ourSuper.logFile);
 		}
 		cpyAmt = 0;
 		if ( inode->rwb.buffUsed > 0 )
@@ -341,7 +443,7 @@ static int mgwfs_read(const char *path, char *buf, size_t size, off_t offset,
 				cpyAmt = inode->rwb.buffUsed-adjOffset;
 			if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
 			{
-				fprintf(ourSuper.logFile, "FUSE mgwfs_read('%s', %ld, 0x%lX) cpyAmt=%ld, adjOffset=%ld, rwBuffUsed=%d\n",
+				LOG_EVENT(LOG_EV_READ_COPY,
 						path,
 						size,
 						offset,
@@ -352,13 +454,12 @@ static int mgwfs_read(const char *path, char *buf, size_t size, off_t offset,
 			if ( cpyAmt > 0 )
 			{
 				memcpy(buf, inode->rwb.buff + adjOffset, cpyAmt);
-				inode->rwb.buffOffset += cpyAmt;
+				fhp->offset = adjOffset + cpyAmt;
 			}
 		}
 		retVal = cpyAmt;
+		perfCount(MGWFS_CTR_BYTES_READ, cpyAmt);
 	} while (0);
-	if ( retVal < 0 )
-		fflush(ourSuper.logFile);
 	UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
 	return retVal;
 }
@@ -367,10 +468,7 @@ static int mgwfs_release(const char *path, struct fuse_file_info *fi)
 {
 	int sts=0;
 	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
-	{
-		fprintf(ourSuper.logFile, "FUSE mgwfs_release(path='%s',fi->fh=%ld\n", path, fi->fh);
-		fflush(ourSuper.logFile);
-	}
+		LOG_EVENT(LOG_EV_RELEASE, path, fi->fh);
 	if ( fi->fh )
 	{
 		FuseFH_t *fhp;
@@ -379,6 +477,9 @@ static int mgwfs_release(const char *path, struct fuse_file_info *fi)
 		fhp = getFuseFHidx(&ourSuper,fi->fh);
 		if ( fhp && --fhp->instances <= 0 )
 		{
+			MgwfsInode_t *inode = getInode(&ourSuper, fhp->inode);
+			if ( inode && inode->openRefs > 0 )
+				--inode->openRefs;
 			sts = fileClose("mgwfs_release():",&ourSuper,fhp);
 			freeFuseFHidx(&ourSuper, fi->fh);
 			fi->fh = 0;
@@ -393,29 +494,19 @@ static int mgwfs_release(const char *path, struct fuse_file_info *fi)
 
 static int mgwfs_statfs(const char *path, struct statvfs *stp)
 {
-	FsysRetPtr *rp;
-	FreeMap_t *freeMap = &ourSuper.freeMap;
 	uint64_t big;
 	
 	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
-	{
-		fprintf(ourSuper.logFile, "FUSE mgwfs_statfs('%s',%p\n", path, stp);
-		fflush(ourSuper.logFile);
-	}
+		LOG_EVENT(LOG_EV_STATFS, path, (long)stp);
 	if ( options.read_write )
 		updateAllMetaData("mgwfs_statfs()",&ourSuper);
 	stp->f_type = ANON_INODE_FS_MAGIC;
 	stp->f_bsize = BLOCK_SIZE; //BYTES_PER_SECTOR;
 	big = ourSuper.homeBlk.max_lba;
 	stp->f_blocks = (big*BYTES_PER_SECTOR)/BLOCK_SIZE;
-	stp->f_bfree = 0;
-	rp = (FsysRetPtr *)freeMap->rwBuff.buff;
-	while ( rp && rp < (FsysRetPtr *)freeMap->rwBuff.buff + freeMap->freeMapEntriesUsed && rp->nblocks )
-	{
-		stp->f_bfree += rp->nblocks;
-		++rp;
-	}
-	big = stp->f_bfree;
+	/* What's been promised to files not yet written out isn't free either */
+	big = mgwfsFreeSectorCount(&ourSuper);
+	big = big > ourSuper.sectorsReserved ? big - ourSuper.sectorsReserved : 0;
 	stp->f_bfree = (big*BYTES_PER_SECTOR)/BLOCK_SIZE;
 	stp->f_bavail = stp->f_bfree;
 	stp->f_files = ourSuper.numInodesUsed;
@@ -452,7 +543,7 @@ static int detachInode(MgwfsSuper_t *super, int idx, const char *path)
 	int ii, jj, verbLen=0;
 	char verbBuff[200];
 
-	curr = super->inodeList[idx];
+	curr = getInode(super, idx);
 	// Need to remove the filename from the directory to which this file is listed
 	/* Assume no pointers */
 	parent = NULL;
@@ -461,13 +552,13 @@ static int detachInode(MgwfsSuper_t *super, int idx, const char *path)
 	addToDirty("detachInode():", super,curr->idxParentInode);
 	/* Get pointer to previous inode if there is one */
 	if ( curr->idxPrevInode )
-		prev = super->inodeList[curr->idxPrevInode];
+		prev = getInode(super, curr->idxPrevInode);
 	/* Get pointer to next inode if there is one */
 	if ( curr->idxNextInode )
-		next = super->inodeList[curr->idxNextInode];
+		next = getInode(super, curr->idxNextInode);
 	/* If there's no previous, then point to the parent */
 	if ( !prev )
-		parent = super->inodeList[curr->idxParentInode];
+		parent = getInode(super, curr->idxParentInode);
 	/* If there's a next, then its previous gets our previous */
 	if ( next )
 		next->idxPrevInode = curr->idxPrevInode;
@@ -513,7 +604,7 @@ static int detachInode(MgwfsSuper_t *super, int idx, const char *path)
 	// Need to free the sectors assigned to this file
 	for (ii=0; ii < FSYS_MAX_ALTS; ++ii)
 	{
-		rp = curr->fsHeader.pointers[ii];
+		rp = curr->fsHeader->pointers[ii];
 		for ( jj = 0; rp->nblocks && jj < FSYS_MAX_FHPTRS; ++jj, ++rp )
 		{
 			if ( verbLen )
@@ -555,8 +646,7 @@ static int detachInode(MgwfsSuper_t *super, int idx, const char *path)
 		fprintf(super->logFile, "%s\n", verbBuff);
 	/* Keep the inode's own header-LBA copy consistent with the now-empty
 	 * index.sys slot (index.sys is rebuilt from inode->fhSectors). */
-	super->inodeList[idx] = NULL;
-	free(curr);
+	releaseInode(super, curr);
 	addToDirty("detachInode():", super,FSYS_INDEX_INDEX);
 	addToDirty("detachInode():", super,FSYS_INDEX_FREE);
 	return 0;
@@ -568,22 +658,19 @@ static int mgwfs_unlink(const char *path)
 	MgwfsSuper_t *super = &ourSuper;
 
 	if ( (super->verbose&VERBOSE_FUSE_CMD) )
-	{
-		fprintf(super->logFile, "FUSE mgwfs_unlink('%s')\n", path );
-		fflush(super->logFile);
-	}
+		LOG_EVENT(LOG_EV_UNLINK, path);
 	LOCK_IT("rdMutex",&ourSuper,&rdMutex);
 	idx = findInode(&ourSuper,FSYS_INDEX_ROOT,path);
 	if ( !idx )
 	{
 		if ( (super->verbose&VERBOSE_FUSE_CMD) )
-			fprintf(super->logFile, "FUSE mgwfs_unlink('%s') returned ENOENT\n", path );
+			LOG_EVENT(LOG_EV_UNLINK_ENOENT, path);
 		retVal = -ENOENT;
 	}
-	else if ( S_ISDIR(super->inodeList[idx]->mode) )
+	else if ( S_ISDIR(getInode(super, idx)->mode) )
 	{
 		if ( (super->verbose&VERBOSE_FUSE_CMD) )
-			fprintf(super->logFile, "FUSE mgwfs_unlink() returned -EINVAL because '%s' (inode %d) is a directory\n", path, idx);
+			LOG_EVENT(LOG_EV_UNLINK_EISDIR, path, idx);
 		retVal = -EINVAL;
 	}
 	else
@@ -591,8 +678,9 @@ static int mgwfs_unlink(const char *path)
 		retVal = detachInode(super, idx, path);
 	}
 	updateAllMetaData("mgwfs_unlink()", &ourSuper);
-	fflush(super->logFile);
 	UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
+	if ( !retVal )
+		invalidateParent(path);
 	return retVal;
 }
 
@@ -613,6 +701,8 @@ static off_t addToBuff(RwBuff_t *rwb, const char *path, off_t off)
 		rwb->buffSize = bytes;
 		memset(rwb->buff+rwb->buffUsed,0,rwb->buffSize-rwb->buffUsed);
 	}
+	else if ( off > rwb->buffUsed )
+		memset(rwb->buff+rwb->buffUsed,0,off-rwb->buffUsed);
 	if ( off > rwb->buffUsed )
 		rwb->buffUsed = off;
 	rwb->buffOffset = off;
@@ -630,98 +720,89 @@ static int mgwfs_write (const char *path, const char *buf, size_t size, off_t of
 		LOCK_IT("rdMutex",&ourSuper,&rdMutex);
 		if ( !fi->fh )
 		{
-			fprintf(ourSuper.logFile, "FUSE mgwfs_write('%s',%p,%ld,0x%lX,%ld) returned -EPERM because has not been open()'d\n", path, buf, size, offset, fi->fh);
+			LOG_EVENT(LOG_EV_WRITE_NOTOPEN, path, (long)buf, size, offset, fi->fh);
 			cpyAmt = -EPERM;
 			break;
 		}
 		fhp = getFuseFHidx(&ourSuper,fi->fh);
-		inode = ourSuper.inodeList[fhp->inode];
-		if ( inode->fsHeader.type == FSYS_TYPE_DIR )
+		inode = getInode(&ourSuper, fhp->inode);
+		if ( inode->fsHeader->type == FSYS_TYPE_DIR )
 		{
-			fprintf(ourSuper.logFile, "FUSE mgwfs_write('%s') returned -EISDIR because writes to a directory are not allowed\n",
-					path);
+			LOG_EVENT(LOG_EV_WRITE_EISDIR, path);
 			cpyAmt = -EISDIR;
 			break;
 		}
+		if ( (cpyAmt = loadFileBuffer("FUSE mgwfs_write():", inode)) < 0 )
+			break;
 		if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
 		{
-			fprintf(ourSuper.logFile, "FUSE mgwfs_write('%s',%p,%ld,0x%lX,%ld): Before: rwBuff=%p, rwBuffUsed=%d, rwBuffOffset=%ld, rwBuffSize=%d\n"
+			LOG_EVENT(LOG_EV_WRITE_BEFORE
 					,path
-					,buf
+					,(long)buf
 					,size
 					,offset
 					,fi->fh
-					,inode->rwb.buff
+					,(long)inode->rwb.buff
 					,inode->rwb.buffUsed
-					,inode->rwb.buffOffset
+					,fhp->offset
 					,inode->rwb.buffSize
 					);
-			fflush(ourSuper.logFile);
 		}
 		/* Reserve the on-disk data sectors now, while we can still report a
-		 * shortfall to the caller as ENOSPC, rather than deferring allocation
-		 * to write-back where the failure would be lost. allocateRPSectors()
-		 * only grows the file (it no-ops when the new end fits within the
-		 * sectors already reserved), so plain overwrites don't re-allocate. We
-		 * do this before touching the in-memory buffer so a failure leaves the
-		 * file unchanged. */
-		{
-			int neededSectors = (offset + size + BYTES_PER_SECTOR - 1) / BYTES_PER_SECTOR;
-			if ( neededSectors > (int)inode->fsHeader.clusters )
-			{
-				cpyAmt = allocateRPSectors("mgwfs_write()", &ourSuper, inode, &inode->rwb, neededSectors);
-				if ( cpyAmt < 0 )		/* -ENOSPC */
-					break;
-			}
-		}
+		 * shortfall to the caller as ENOSPC, rather than finding out at
+		 * write-back where the failure would be lost. The sectors themselves
+		 * are only picked when the file is written out (see reserveSectors()).
+		 * Plain overwrites inside what the file already has reserve nothing.
+		 * We do this before touching the in-memory buffer so a failure leaves
+		 * the file unchanged. */
+		cpyAmt = reserveSectors("mgwfs_write()", &ourSuper, inode, (offset + size + BYTES_PER_SECTOR - 1) / BYTES_PER_SECTOR);
+		if ( cpyAmt < 0 )		/* -ENOSPC */
+			break;
 		if ( size + offset > inode->rwb.buffSize )
 		{
-			off_t currOffset = inode->rwb.buffOffset;
 			cpyAmt = addToBuff(&inode->rwb,path,offset+size);
 			if ( cpyAmt < 0 )
 				break;
-			inode->rwb.buffOffset = currOffset;
+		}
+		else if ( offset > inode->rwb.buffUsed )
+		{
+			/* Writing past EOF within the buffer leaves a hole of zeros */
+			memset(inode->rwb.buff + inode->rwb.buffUsed, 0, offset - inode->rwb.buffUsed);
 		}
 		cpyAmt = size;
-		memcpy(inode->rwb.buff + inode->rwb.buffOffset, buf, cpyAmt);
+		memcpy(inode->rwb.buff + offset, buf, cpyAmt);
 		if ( (ourSuper.verbose&(VERBOSE_FUSE_CMD|VERBOSE_WRITES)) )
 		{
+			/* Show the first few bytes as one hex number */
 			int idx, bcnt = cpyAmt;
-			if ( bcnt > 5 )
-				bcnt = 5;
-			fprintf(ourSuper.logFile, "FUSE mgwfs_write('%s'): added (%d bytes)"
-					,path
-					,cpyAmt
-					);
+			long lead=0;
+			if ( bcnt > (int)sizeof(long) )
+				bcnt = sizeof(long);
 			for (idx=0; idx < bcnt; ++idx)
-				fprintf(ourSuper.logFile, " %02X", buf[idx]);
-			fprintf(ourSuper.logFile,"%s at offset %ld\n"
-					,bcnt != cpyAmt ? "..." : ""
-					,inode->rwb.buffOffset
-					);
-			fflush(ourSuper.logFile);
+				lead = (lead<<8) | (uint8_t)buf[idx];
+			LOG_EVENT(LOG_EV_WRITE_ADDED, path, cpyAmt, offset, bcnt, lead);
 		}
-		inode->rwb.buffOffset += cpyAmt;
-		if ( inode->rwb.buffOffset > inode->rwb.buffUsed )
-			inode->rwb.buffUsed = inode->rwb.buffOffset;
+		fhp->offset = offset + cpyAmt;
+		if ( fhp->offset > inode->rwb.buffUsed )
+			inode->rwb.buffUsed = fhp->offset;
+		inode->flags |= MGWFS_INODE_DATA_DIRTY;
+		perfCount(MGWFS_CTR_BYTES_WRITTEN, cpyAmt);
 		if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
 		{
-			fprintf(ourSuper.logFile, "FUSE mgwfs_write('%s',%p,%ld,0x%lX,%ld): After:  rwBuff=%p, rwBuffUsed=%d, rwBuffOffset=%ld, rwBuffSize=%d\n"
+			LOG_EVENT(LOG_EV_WRITE_AFTER
 					,path
-					,buf
+					,(long)buf
 					,size
 					,offset
 					,fi->fh
-					,inode->rwb.buff
+					,(long)inode->rwb.buff
 					,inode->rwb.buffUsed
-					,inode->rwb.buffOffset
+					,fhp->offset
 					,inode->rwb.buffSize
 					);
-			fflush(ourSuper.logFile);
 		}
 	} while (0);
 	UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
-	fflush(ourSuper.logFile);
 	return cpyAmt;
 }
 
@@ -732,7 +813,7 @@ static int mgwfs_flush(const char *path, struct fuse_file_info *fi)
 	
 	if ( !fi->fh )
 	{
-		fprintf(ourSuper.logFile, "FUSE mgwfs_flush('%s',%ld) returned -EPERM because has not been open()'d\n", path, fi->fh);
+		LOG_EVENT(LOG_EV_FLUSH_NOTOPEN, path, fi->fh);
 		return -EPERM;
 	}
 	LOCK_IT("rdMutex",&ourSuper,&rdMutex);
@@ -740,19 +821,18 @@ static int mgwfs_flush(const char *path, struct fuse_file_info *fi)
 	if ( fhp )
 	{
 		MgwfsInode_t *inode;
-		inode = ourSuper.inodeList[fhp->inode];
+		inode = getInode(&ourSuper, fhp->inode);
 		sts = fileFlush("mgwfs_flush()", &ourSuper, fhp);
 		if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
 		{
-			fprintf(ourSuper.logFile, "FUSE mgwfs_flush('%s',%ld): rwBuff=%p, rwBuffUsed=%d, rwBuffOffset=%ld, rwBuffSize=%d\n"
+			LOG_EVENT(LOG_EV_FLUSH
 					,path
 					,fi->fh
-					,inode->rwb.buff
+					,(long)inode->rwb.buff
 					,inode->rwb.buffUsed
-					,inode->rwb.buffOffset
+					,fhp->offset
 					,inode->rwb.buffSize
 					);
-			fflush(ourSuper.logFile);
 		}
 	}
 	else
@@ -764,10 +844,7 @@ static int mgwfs_flush(const char *path, struct fuse_file_info *fi)
 static int mgwfs_fsync(const char *path, int arg, struct fuse_file_info *fi)
 {
 	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
-	{
-		fprintf(ourSuper.logFile, "FUSE mgwfs_fsync(path='%s', fi->fh=%ld\n", path, fi->fh );
-		fflush(ourSuper.logFile);
-	}
+		LOG_EVENT(LOG_EV_FSYNC, path, fi->fh);
 	if ( options.read_write )
 		updateAllMetaData("FUSE mgwfs_fsync()", &ourSuper);
 	return 0;
@@ -775,6 +852,7 @@ static int mgwfs_fsync(const char *path, int arg, struct fuse_file_info *fi)
 
 static void mgwfs_destroy(void *private_data)
 {
+	logStop(&ourSuper);		/* write out everything queued before going synchronous */
 	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
 	{
 		fprintf(ourSuper.logFile, "FUSE mgwfs_destroy(), pd=%p, &ourSuper=%p\n", private_data, &ourSuper );
@@ -794,11 +872,11 @@ static void unlinkFromParent(MgwfsSuper_t *super, MgwfsInode_t *curr)
 	MgwfsInode_t *prev=NULL, *next=NULL, *parent=NULL;
 
 	if ( curr->idxPrevInode )
-		prev = super->inodeList[curr->idxPrevInode];
+		prev = getInode(super, curr->idxPrevInode);
 	if ( curr->idxNextInode )
-		next = super->inodeList[curr->idxNextInode];
+		next = getInode(super, curr->idxNextInode);
 	if ( !prev )
-		parent = super->inodeList[curr->idxParentInode];
+		parent = getInode(super, curr->idxParentInode);
 	if ( next )
 		next->idxPrevInode = curr->idxPrevInode;
 	if ( prev )
@@ -816,7 +894,7 @@ static void insertIntoParent(MgwfsSuper_t *super, MgwfsInode_t *parent, MgwfsIno
 	child->idxNextInode = parent->idxChildTop;
 	if ( parent->idxChildTop )
 	{
-		MgwfsInode_t *first = super->inodeList[parent->idxChildTop];
+		MgwfsInode_t *first = getInode(super, parent->idxChildTop);
 		if ( first )
 			first->idxPrevInode = child->inode_no;
 	}
@@ -854,7 +932,7 @@ static int mgwfs_rename (const char *oldName, const char *newName, unsigned int
 			retVal = -ENOENT;
 			break;
 		}
-		oldInode = super->inodeList[oldIdx];
+		oldInode = getInode(super, oldIdx);
 		/* If the target already exists, either reject (NOREPLACE) or remove it
 		 * so the new name is free. We don't support replacing a directory. */
 		newIdx = findInode(super, FSYS_INDEX_ROOT, newName);
@@ -867,7 +945,7 @@ static int mgwfs_rename (const char *oldName, const char *newName, unsigned int
 				break;
 			}
 #endif
-			if ( S_ISDIR(super->inodeList[newIdx]->mode) )
+			if ( S_ISDIR(getInode(super, newIdx)->mode) )
 			{
 				retVal = -EISDIR;
 				break;
@@ -897,7 +975,7 @@ static int mgwfs_rename (const char *oldName, const char *newName, unsigned int
 			retVal = -ENOENT;
 			break;
 		}
-		newParent = super->inodeList[newParentIdx];
+		newParent = getInode(super, newParentIdx);
 		if ( !S_ISDIR(newParent->mode) )
 		{
 			retVal = -ENOTDIR;
@@ -906,11 +984,13 @@ static int mgwfs_rename (const char *oldName, const char *newName, unsigned int
 		/* Detach from the old directory, rename, and attach to the new one. The
 		 * name lives only in the directory entries, so marking both directories
 		 * dirty is what makes the change persist. */
+		if ( setInodeName(super, oldInode, baseName, strlen(baseName)) < 0 )
+		{
+			retVal = -ENOMEM;
+			break;
+		}
 		addToDirty("mgwfs_rename(): old parent", super, oldInode->idxParentInode);
 		unlinkFromParent(super, oldInode);
-		strncpy(oldInode->fileName, baseName, sizeof(oldInode->fileName)-1);
-		oldInode->fileName[sizeof(oldInode->fileName)-1] = 0;
-		oldInode->fnLen = strlen(oldInode->fileName);
 		insertIntoParent(super, newParent, oldInode);
 		addToDirty("mgwfs_rename(): new parent", super, newParent->inode_no);
 		/* A moved directory's synthesized ".." comes from idxParentInode, so it
@@ -920,9 +1000,14 @@ static int mgwfs_rename (const char *oldName, const char *newName, unsigned int
 		retVal = 0;
 	} while ( 0 );
 	free(parentPath);
-	fflush(super->logFile);
 	UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
 	updateAllMetaData("mgwfs_rename()",&ourSuper);
+	if ( !retVal )
+	{
+		invalidateParent(oldName);
+		invalidateParent(newName);
+		invalidatePath(newName);
+	}
 	return retVal;
 }
 
@@ -935,10 +1020,7 @@ static int mgwfs_mkdir(const char *path, mode_t mode)
 	const char *baseName, *slash;
 
 	if ( (super->verbose&VERBOSE_FUSE_CMD) )
-	{
-		fprintf(super->logFile, "FUSE mgwfs_mkdir('%s',0x%X)\n", path, mode);
-		fflush(super->logFile);
-	}
+		LOG_EVENT(LOG_EV_MKDIR, path, mode);
 	if ( !options.read_write )
 		return -EROFS;
 	LOCK_IT("rdMutex",&ourSuper,&rdMutex);
@@ -980,7 +1062,7 @@ static int mgwfs_mkdir(const char *path, mode_t mode)
 			retVal = -ENOENT;
 			break;
 		}
-		parent = super->inodeList[parentIdx];
+		parent = getInode(super, parentIdx);
 		if ( !S_ISDIR(parent->mode) )
 		{
 			retVal = -ENOTDIR;
@@ -993,10 +1075,13 @@ static int mgwfs_mkdir(const char *path, mode_t mode)
 			retVal = -ENOSPC;
 			break;
 		}
-		strncpy(inode->fileName, baseName, sizeof(inode->fileName)-1);
-		inode->fileName[sizeof(inode->fileName)-1] = 0;
-		inode->fnLen = strlen(inode->fileName);
-		inode->fsHeader.type = FSYS_TYPE_DIR;
+		if ( setInodeName(super, inode, baseName, strlen(baseName)) < 0 )
+		{
+			markInodeUnused(super, &inode);
+			retVal = -ENOMEM;
+			break;
+		}
+		inode->fsHeader->type = FSYS_TYPE_DIR;
 		inode->mode = S_IFDIR | 0775;
 		/* Reserve the directory's data sectors now, at mkdir time, so an
 		 * out-of-space condition is reported here as ENOSPC rather than being
@@ -1009,7 +1094,7 @@ static int mgwfs_mkdir(const char *path, mode_t mode)
 		 * header sectors findUnusedInode() reserved plus whatever we just got)
 		 * fully undoes the inode. */
 #define MKDIR_DATA_PREALLOC (20)	/* sectors (per copy); ~10KB, far beyond any real directory */
-		if ( allocateRPSectors("mgwfs_mkdir()", super, inode, &inode->rwb, MKDIR_DATA_PREALLOC) < 0 )
+		if ( allocateRPSectors("mgwfs_mkdir()", super, inode, &inode->rwb, MKDIR_DATA_PREALLOC, FREEM_FLAG_CONTIG) < 0 )
 		{
 			markInodeUnused(super, &inode);
 			retVal = -ENOSPC;
@@ -1025,10 +1110,11 @@ static int mgwfs_mkdir(const char *path, mode_t mode)
 	} while ( 0 );
 	free(parentPath);
 	if ( (super->verbose&VERBOSE_FUSE_CMD) )
-		fprintf(super->logFile, "FUSE mgwfs_mkdir('%s') returned %d\n", path, retVal);
-	fflush(super->logFile);
+		LOG_EVENT(LOG_EV_MKDIR_DONE, path, retVal);
 	UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
 	updateAllMetaData("mgwfs_mkdir()",&ourSuper);
+	if ( !retVal )
+		invalidateParent(path);
 	return retVal;
 }
 
@@ -1039,10 +1125,7 @@ static int mgwfs_rmdir(const char *path)
 	MgwfsInode_t *inode;
 
 	if ( (super->verbose&VERBOSE_FUSE_CMD) )
-	{
-		fprintf(super->logFile, "FUSE mgwfs_rmdir('%s')\n", path);
-		fflush(super->logFile);
-	}
+		LOG_EVENT(LOG_EV_RMDIR, path);
 	if ( !options.read_write )
 		return -EROFS;
 	LOCK_IT("rdMutex",&ourSuper,&rdMutex);
@@ -1059,7 +1142,7 @@ static int mgwfs_rmdir(const char *path)
 			retVal = -EBUSY;
 			break;
 		}
-		inode = super->inodeList[idx];
+		inode = getInode(super, idx);
 		if ( !S_ISDIR(inode->mode) )
 		{
 			retVal = -ENOTDIR;
@@ -1076,10 +1159,11 @@ static int mgwfs_rmdir(const char *path)
 		retVal = detachInode(super, idx, path);
 	} while ( 0 );
 	if ( (super->verbose&VERBOSE_FUSE_CMD) )
-		fprintf(super->logFile, "FUSE mgwfs_rmdir('%s') returned %d\n", path, retVal);
-	fflush(super->logFile);
+		LOG_EVENT(LOG_EV_RMDIR_DONE, path, retVal);
 	UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
 	updateAllMetaData("mgwfs_rmdir()",&ourSuper);
+	if ( !retVal )
+		invalidateParent(path);
 	return retVal;
 }
 
@@ -1097,12 +1181,11 @@ static int mgwfs_create(const char *path, mode_t fMode, struct fuse_file_info *f
 		fhp->inode = idx;
 		fhp->openFlags = fi->flags;
 		fi->fh = fhp->index;
+		++getInode(&ourSuper, idx)->openRefs;
+		invalidateParent(path);
 	}
 	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
-	{
-		fprintf(ourSuper.logFile, "FUSE mgwfs_create('%s',0x%X,%ld), idx=%d, sts=%d\n", path, fMode, fi->fh, idx, sts);
-		fflush(ourSuper.logFile);
-	}
+		LOG_EVENT(LOG_EV_CREATE, path, fMode, fi->fh, idx, sts);
 	return sts;
 }
 
@@ -1110,12 +1193,12 @@ static off_t moveOffset(const char *path, FuseFH_t *fhp, off_t off)
 {
 	MgwfsInode_t *inode;
 	
-	inode = ourSuper.inodeList[fhp->inode];
+	inode = getInode(&ourSuper, fhp->inode);
 	if ( off < 0 )
 		off = 0;
 	if ( off <= inode->rwb.buffUsed )
 	{
-		inode->rwb.buffOffset = off;
+		fhp->offset = off;
 		return off;
 	}
 	if ( !(fhp->openFlags & (O_RDWR | O_WRONLY)) )
@@ -1123,11 +1206,14 @@ static off_t moveOffset(const char *path, FuseFH_t *fhp, off_t off)
 		/* read only, cannot go past EOF */
 		if ( off >= inode->rwb.buffUsed )
 			off = inode->rwb.buffUsed;
-		inode->rwb.buffOffset = off;
+		fhp->offset = off;
 		return off;
 	}
 	/* r/w or wo, maybe add to end of file */
-	return addToBuff(&inode->rwb,path,off);
+	off = addToBuff(&inode->rwb,path,off);
+	if ( off >= 0 )
+		fhp->offset = off;
+	return off;
 }
 
 static off_t lseek_locked(const char *path, off_t off, int whence, struct fuse_file_info *fi)
@@ -1135,31 +1221,17 @@ static off_t lseek_locked(const char *path, off_t off, int whence, struct fuse_f
 	off_t newOff, sts = -EIO;
 
 	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
-	{
-		static const char *Seeks[] = { "SEEK_SET", "SEEK_CUR", "SEEK_END" };
-		const char *sp;
-		char tmp[32];
-		int idx = whence;
-		
-		if ( idx >= n_elts(Seeks) )
-		{
-			snprintf(tmp,sizeof(tmp),"SEEK_%d",idx);
-			sp = tmp;
-		}
-		else
-			sp = Seeks[whence];
-		fprintf(ourSuper.logFile, "FUSE lseek_locked(%s,%ld,%s,%ld)\n", path, off, sp, fi->fh);
-		fflush(ourSuper.logFile);
-	}
+		LOG_EVENT(LOG_EV_LSEEK, path, off, whence, fi->fh);
 	if ( fi->fh )
 	{
 		FuseFH_t *fhp;
 		MgwfsInode_t *inode;
 		
 		fhp = getFuseFHidx(&ourSuper,fi->fh);
-		inode = ourSuper.inodeList[fhp->inode];
-		if ( fhp )
+		inode = getInode(&ourSuper, fhp->inode);
+		if ( fhp && (sts = loadFileBuffer("FUSE mgwfs_lseek():", inode)) >= 0 )
 		{
+			sts = -EIO;
 			switch (whence)
 			{
 			case SEEK_SET:
@@ -1167,7 +1239,7 @@ static off_t lseek_locked(const char *path, off_t off, int whence, struct fuse_f
 				break;
 
 			case SEEK_CUR:
-				newOff = inode->rwb.buffOffset+off;
+				newOff = fhp->offset+off;
 				sts = moveOffset(path,fhp,newOff);
 				break;
 
@@ -1198,10 +1270,7 @@ static int mgwfs_truncate(const char *path, off_t offset, struct fuse_file_info
 	int sts = options.read_write ? -EPERM : -EIO;
 
 	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
-	{
-		fprintf(ourSuper.logFile, "FUSE mgwfs_truncate(%s,0x%lX,%ld)\n", path, offset, fi->fh );
-		fflush(ourSuper.logFile);
-	}
+		LOG_EVENT(LOG_EV_TRUNCATE, path, offset, fi->fh);
 	if ( options.read_write && fi->fh )
 	{
 		FuseFH_t *fhp;
@@ -1209,14 +1278,22 @@ static int mgwfs_truncate(const char *path, off_t offset, struct fuse_file_info
 		
 		LOCK_IT("rdMutex",&ourSuper,&rdMutex);
 		fhp = getFuseFHidx(&ourSuper, fi->fh);
-		inode = ourSuper.inodeList[fhp->inode];
-		if ( (fhp->openFlags & (O_RDWR|O_WRONLY)) )
+		inode = getInode(&ourSuper, fhp->inode);
+		if ( (fhp->openFlags & (O_RDWR|O_WRONLY)) && (sts = loadFileBuffer("FUSE mgwfs_truncate():", inode)) >= 0 )
 		{
-			sts = moveOffset(path,fhp,offset);
+			/* Truncating doesn't move any handle's file position */
+			sts = offset;
+			if ( offset > inode->rwb.buffUsed )
+			{
+				sts = reserveSectors("mgwfs_truncate()", &ourSuper, inode, (offset + BYTES_PER_SECTOR - 1) / BYTES_PER_SECTOR);
+				if ( sts >= 0 )
+					sts = addToBuff(&inode->rwb,path,offset);
+			}
 			if ( sts >= 0 )
 			{
 				inode->rwb.buffUsed = offset;
-				inode->rwb.buffOffset = offset;
+				inode->flags |= MGWFS_INODE_DATA_DIRTY;
+				sts = 0;
 			}
 		}
 		UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
@@ -1224,13 +1301,195 @@ static int mgwfs_truncate(const char *path, off_t offset, struct fuse_file_info
 	return sts;
 }
 
+/*
+ * Reserve the disk space for a file up front. Tools that know how big a file
+ * will end up (rsync --preallocate, the asset packer) get each copy in one
+ * piece in its own copy region, instead of it growing a write at a time and
+ * using up retrieval pointers on the fragments. Only plain allocation and
+ * FALLOC_FL_KEEP_SIZE are supported; there are no holes to punch.
+ */
+static int mgwfs_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fi)
+{
+	FuseFH_t *fhp;
+	MgwfsInode_t *inode;
+	off_t end = offset + length;
+	int sts=0;
+
+	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
+		LOG_EVENT(LOG_EV_FALLOCATE, path, mode, offset, length, fi ? (long)fi->fh : 0);
+	if ( !options.read_write )
+		return -EROFS;
+	if ( (mode & ~FALLOC_FL_KEEP_SIZE) )
+		return -EOPNOTSUPP;
+	if ( offset < 0 || length <= 0 )
+		return -EINVAL;
+	if ( end > INT32_MAX )
+		return -EFBIG;
+	if ( !fi || !fi->fh )
+		return -EBADF;
+	LOCK_IT("rdMutex",&ourSuper,&rdMutex);
+	do
+	{
+		int neededSectors;
+
+		fhp = getFuseFHidx(&ourSuper, fi->fh);
+		inode = fhp ? getInode(&ourSuper, fhp->inode) : NULL;
+		if ( !inode || !(fhp->openFlags & (O_RDWR|O_WRONLY)) )
+		{
+			sts = -EBADF;
+			break;
+		}
+		if ( S_ISDIR(inode->mode) )
+		{
+			sts = -EISDIR;
+			break;
+		}
+		if ( (sts = loadFileBuffer("FUSE mgwfs_fallocate():", inode)) < 0 )
+			break;
+		neededSectors = (end + BYTES_PER_SECTOR - 1) / BYTES_PER_SECTOR;
+		if ( neededSectors > (int)inode->fsHeader->clusters )
+		{
+			sts = allocateRPSectors("mgwfs_fallocate()", &ourSuper, inode, &inode->rwb, neededSectors, FREEM_FLAG_CONTIG);
+			if ( sts < 0 )		/* -ENOSPC */
+				break;
+		}
+		if ( !(mode & FALLOC_FL_KEEP_SIZE) && end > inode->rwb.buffUsed )
+		{
+			sts = addToBuff(&inode->rwb, path, end);
+			if ( sts < 0 )
+				break;
+		}
+		/* The header has to go out with the new retrieval pointers */
+		inode->flags |= MGWFS_INODE_DATA_DIRTY;
+		sts = 0;
+	} while ( 0 );
+	UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
+	return sts;
+}
+
+/*
+ * Copy a range from one open file to another. Copying a whole file into an
+ * empty one (which is what cp does) is done disk to disk: the destination
+ * gets its sectors allocated, the source's sectors are copied into each of
+ * its copies with copy_file_range(2) on the image itself, and the
+ * destination's buffer is dropped rather than filled, so neither the data
+ * nor a second buffer of it ever passes through here. Anything else is
+ * copied between the two files' buffers the way a write would.
+ */
+static ssize_t mgwfs_copy_file_range(const char *path_in, struct fuse_file_info *fi_in, off_t offset_in,
+									 const char *path_out, struct fuse_file_info *fi_out, off_t offset_out,
+									 size_t size, int flags)
+{
+	FuseFH_t *inFhp, *outFhp;
+	MgwfsInode_t *src, *dst;
+	ssize_t sts=0;
+
+	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
+		LOG_EVENT(LOG_EV_COPY_FILE_RANGE, path_in, fi_in ? (long)fi_in->fh : 0, offset_in, fi_out ? (long)fi_out->fh : 0, offset_out, size, flags);
+	if ( !options.read_write )
+		return -EROFS;
+	if ( flags || offset_in < 0 || offset_out < 0 )
+		return -EINVAL;
+	if ( !fi_in || !fi_in->fh || !fi_out || !fi_out->fh )
+		return -EBADF;
+	LOCK_IT("rdMutex",&ourSuper,&rdMutex);
+	do
+	{
+		uint32_t srcSize, dstSize;
+
+		inFhp = getFuseFHidx(&ourSuper, fi_in->fh);
+		outFhp = getFuseFHidx(&ourSuper, fi_out->fh);
+		src = inFhp ? getInode(&ourSuper, inFhp->inode) : NULL;
+		dst = outFhp ? getInode(&ourSuper, outFhp->inode) : NULL;
+		if ( !src || !dst || !(outFhp->openFlags & (O_RDWR|O_WRONLY)) )
+		{
+			sts = -EBADF;
+			break;
+		}
+		if ( S_ISDIR(src->mode) || S_ISDIR(dst->mode) )
+		{
+			sts = -EISDIR;
+			break;
+		}
+		srcSize = src->rwb.buff ? src->rwb.buffUsed : src->fsHeader->size;
+		dstSize = dst->rwb.buff ? dst->rwb.buffUsed : dst->fsHeader->size;
+		if ( offset_in >= srcSize )
+			break;				/* nothing to copy */
+		if ( size > srcSize - offset_in )
+			size = srcSize - offset_in;
+		if ( offset_out + size > INT32_MAX )
+		{
+			sts = -EFBIG;
+			break;
+		}
+		if (    src != dst && !offset_in && !offset_out && size == srcSize && !dstSize
+			 && src->inode_no > FSYS_INDEX_FREE && !(src->flags & MGWFS_INODE_DATA_DIRTY)
+		   )
+		{
+			/* Whole file into an empty one and what's on disk of the source
+			 * is current, so copy it there. */
+			uint32_t sectors = (srcSize + BYTES_PER_SECTOR - 1) / BYTES_PER_SECTOR;
+
+			if ( sectors > dst->fsHeader->clusters )
+			{
+				sts = allocateRPSectors("mgwfs_copy_file_range()", &ourSuper, dst, &dst->rwb, sectors, FREEM_FLAG_CONTIG);
+				if ( sts < 0 )		/* -ENOSPC */
+					break;
+			}
+			sts = copyFileSectors("mgwfs_copy_file_range()", &ourSuper, src, dst, sectors);
+			if ( sts < 0 )
+				break;
+			/* The destination's data is on disk now. Drop its buffer so the
+			 * write-back below only writes its header; it gets read back in
+			 * if it's used again before it's closed. */
+			if ( dst->rwb.buff )
+				free(dst->rwb.buff);
+			memset(&dst->rwb,0,sizeof(dst->rwb));
+			dst->fsHeader->size = srcSize;
+			dst->flags &= ~MGWFS_INODE_DATA_DIRTY;
+			/* This skipped writeWholeFile(), so nothing refreshed dst's cached checksum */
+			checksumCacheForget(&ourSuper, dst->inode_no);
+			releaseReservation(&ourSuper, dst);
+			addToDirty("mgwfs_copy_file_range()", &ourSuper, dst->inode_no);
+			sts = updateAllMetaData("mgwfs_copy_file_range()", &ourSuper);
+			if ( sts < 0 )
+				break;
+			perfCount(MGWFS_CTR_BYTES_COPIED, size);
+			sts = size;
+			break;
+		}
+		if ( (sts = loadFileBuffer("FUSE mgwfs_copy_file_range():", src)) < 0 || (sts = loadFileBuffer("FUSE mgwfs_copy_file_range():", dst)) < 0 )
+			break;
+		sts = reserveSectors("mgwfs_copy_file_range()", &ourSuper, dst, (offset_out + size + BYTES_PER_SECTOR - 1) / BYTES_PER_SECTOR);
+		if ( sts < 0 )		/* -ENOSPC */
+			break;
+		if ( offset_out + size > dst->rwb.buffSize )
+		{
+			sts = addToBuff(&dst->rwb, path_out, offset_out + size);
+			if ( sts < 0 )
+				break;
+		}
+		else if ( offset_out > dst->rwb.buffUsed )
+			memset(dst->rwb.buff + dst->rwb.buffUsed, 0, offset_out - dst->rwb.buffUsed);
+		/* src and dst may be the same file */
+		memmove(dst->rwb.buff + offset_out, src->rwb.buff + offset_in, size);
+		if ( offset_out + size > dst->rwb.buffUsed )
+			dst->rwb.buffUsed = offset_out + size;
+		dst->flags |= MGWFS_INODE_DATA_DIRTY;
+		perfCount(MGWFS_CTR_BYTES_WRITTEN, size);
+		sts = size;
+	} while ( 0 );
+	UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
+	return sts;
+}
+
 /*
   Comments from Claude which added this function:
   
   What I did
 
   1. Added the real mgwfst_utimens definition (fuse.c, just above the mgwfs_oper table). It follows the same shape as mgwfs_getattr: verbose logging, read_write guard (returns -EROFS on a read-only mount), findInode lookup under
-  rdMutex, and the -ENOENT log message on a miss. It correctly handles UTIME_NOW, UTIME_OMIT, and a NULL tv, stores the resolved mtime into inode->fsHeader.mtime, and calls addToDirty(...) to schedule the header for write-back — same
+  rdMutex, and the -ENOENT log message on a miss. It correctly handles UTIME_NOW, UTIME_OMIT, and a NULL tv, stores the resolved mtime into inode->fsHeader->mtime, and calls addToDirty(...) to schedule the header for write-back — same
   mechanism every other mutator here uses.
   2. Moved .utimens = mgwfst_utimens out of the #if 0 block so it's actually registered in the operations table.
 
@@ -1240,7 +1499,7 @@ static int mgwfs_truncate(const char *path, off_t offset, struct fuse_file_info
 
   - No atime storage. agcfsys.h only has uint32_t ctime/mtime, so the access time (tv[0]) is resolved but then dropped. This matches getattr, which never fills st_atime. Nanoseconds are also truncated since the format holds whole
   seconds only.
-  - updateAllMetaData() will clobber an explicit mtime. At mgwfs.c:1018 the flush path unconditionally does inode->fsHeader.mtime = time(NULL) for normal inodes. So once disk write-back actually works (writeFileHeader is still a stub
+  - updateAllMetaData() will clobber an explicit mtime. At mgwfs.c:1018 the flush path unconditionally does inode->fsHeader->mtime = time(NULL) for normal inodes. So once disk write-back actually works (writeFileHeader is still a stub
   returning EIO), a touch -d '2001-01-01' file would persist as now rather than the requested time. Within a live mount it's fine — getattr reads the in-memory header directly, so stat reflects the set time immediately. But the
   persisted value won't survive a flush of an explicit (non-now) timestamp.
 
@@ -1268,17 +1527,13 @@ static int mgwfst_utimens(const char *path, const struct timespec tv[2],
 	MgwfsInode_t *inode;
 
 	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
-	{
-		fprintf(ourSuper.logFile, "FUSE mgwfst_utimens(path='%s')\n", path);
-		fflush(ourSuper.logFile);
-	}
+		LOG_EVENT(LOG_EV_UTIMENS, path);
 	if ( !options.read_write )
 		return -EROFS;
 	LOCK_IT("rdMutex",&ourSuper,&rdMutex);
 	if ( (idx = findInode(&ourSuper, FSYS_INDEX_ROOT, path)) <= 0 )
 	{
-		fprintf(ourSuper.logFile, "FUSE mgwfst_utimens() returned -ENOENT because '%s' could not be found\n", path);
-		fflush(ourSuper.logFile);
+		LOG_EVENT(LOG_EV_UTIMENS_ENOENT, path);
 		ret = -ENOENT;
 	}
 	else
@@ -1286,7 +1541,7 @@ static int mgwfst_utimens(const char *path, const struct timespec tv[2],
 		time_t now = time(NULL);	/* used for UTIME_NOW and a NULL tv */
 		time_t atime, mtime;
 
-		inode = ourSuper.inodeList[idx];
+		inode = getInode(&ourSuper, idx);
 
 		/* Resolve access time (tv[0]). No atime field on media, so it is
 		 * computed for completeness but ultimately dropped. */
@@ -1309,7 +1564,7 @@ static int mgwfst_utimens(const char *path, const struct timespec tv[2],
 
 		if ( mtime != (time_t)-1 )
 		{
-			inode->fsHeader.mtime = (uint32_t)mtime;
+			inode->fsHeader->mtime = (uint32_t)mtime;
 			/* Tell the flush path this is the time we want kept, so it
 			 * won't be overwritten with "now". */
 			inode->flags |= MGWFS_INODE_MTIME_SET;
@@ -1343,17 +1598,13 @@ static int mgwfs_chmod(const char *path, mode_t mode, struct fuse_file_info *fi)
 	int idx, ret=0;
 
 	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
-	{
-		fprintf(ourSuper.logFile, "FUSE mgwfs_chmod(path='%s',mode=0%o)\n", path, mode);
-		fflush(ourSuper.logFile);
-	}
+		LOG_EVENT(LOG_EV_CHMOD, path, mode);
 	if ( !options.read_write )
 		return -EROFS;
 	LOCK_IT("rdMutex",&ourSuper,&rdMutex);
 	if ( (idx = findInode(&ourSuper, FSYS_INDEX_ROOT, path)) <= 0 )
 	{
-		fprintf(ourSuper.logFile, "FUSE mgwfs_chmod() returned -ENOENT because '%s' could not be found\n", path);
-		fflush(ourSuper.logFile);
+		LOG_EVENT(LOG_EV_CHMOD_ENOENT, path);
 		ret = -ENOENT;
 	}
 	/* No perms field on media; accept and ignore the requested mode. */
@@ -1376,17 +1627,13 @@ static int mgwfs_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_
 	int idx, ret=0;
 
 	if ( (ourSuper.verbose&VERBOSE_FUSE_CMD) )
-	{
-		fprintf(ourSuper.logFile, "FUSE mgwfs_chown(path='%s',uid=%d,gid=%d)\n", path, (int)uid, (int)gid);
-		fflush(ourSuper.logFile);
-	}
+		LOG_EVENT(LOG_EV_CHOWN, path, (long)uid, (long)gid);
 	if ( !options.read_write )
 		return -EROFS;
 	LOCK_IT("rdMutex",&ourSuper,&rdMutex);
 	if ( (idx = findInode(&ourSuper, FSYS_INDEX_ROOT, path)) <= 0 )
 	{
-		fprintf(ourSuper.logFile, "FUSE mgwfs_chown() returned -ENOENT because '%s' could not be found\n", path);
-		fflush(ourSuper.logFile);
+		LOG_EVENT(LOG_EV_CHOWN_ENOENT, path);
 		ret = -ENOENT;
 	}
 	/* No owner/group field on media; accept and ignore the requested ids. */
@@ -1397,7 +1644,7 @@ static int mgwfs_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_
 
 #define FILO_MAX_ENTRIES (16)
 
-static void buildBootFNPath(char *dst, int maxLen, MgwfsInode_t *inode)
+void buildBootFNPath(char *dst, int maxLen, MgwfsInode_t *inode)
 {
 	MgwfsInode_t *filo[FILO_MAX_ENTRIES];
 	int len=0, depth=0;
@@ -1408,7 +1655,7 @@ static void buildBootFNPath(char *dst, int maxLen, MgwfsInode_t *inode)
 		++depth;
 		if ( inode->idxParentInode == FSYS_INDEX_ROOT )
 			break;
-		inode = ourSuper.inodeList[inode->idxParentInode];
+		inode = getInode(&ourSuper, inode->idxParentInode);
 	}
 	if ( depth >= FILO_MAX_ENTRIES )
 		len += snprintf(dst+len,maxLen-len,"... /");
@@ -1420,17 +1667,6 @@ static void buildBootFNPath(char *dst, int maxLen, MgwfsInode_t *inode)
 	}
 }
 
-static uint32_t checksumBuffer(const uint32_t *ptr, int bytes)
-{
-	uint32_t cksum=0;
-	while ( bytes > 0 )
-	{
-		cksum += *ptr++;
-		bytes -= 4;
-	}
-	return cksum;
-}
-
 typedef struct
 {
 	uint32_t fid;
@@ -1441,22 +1677,29 @@ static int readForChecksum(const char *Title, MgwfsSuper_t *ourSuper, MgwfsInode
 {
 	int sts;
 
+	if ( inode->openRefs && inode->rwb.buff )
+	{
+		/* File is open; its shared buffer is the most current copy */
+		if ( inode->rwb.buffErr < 0 )
+			return inode->rwb.buffErr;
+		return inode->rwb.buffUsed;
+	}
 	if ( inode->rwb.buff )
 	{
 		free(inode->rwb.buff);
 		memset(&inode->rwb,0,sizeof(RwBuff_t));
 	}
-	inode->rwb.buff = (uint8_t *)malloc(inode->fsHeader.clusters*BYTES_PER_SECTOR);
+	inode->rwb.buff = (uint8_t *)malloc(inode->fsHeader->clusters*BYTES_PER_SECTOR);
 	if ( !inode->rwb.buff )
 	{
 		fprintf(stderr, "FUSE %s failed to malloc %d bytes to read %s. %s.\n",
-				Title, inode->fsHeader.clusters*BYTES_PER_SECTOR, inode->fileName, msg);
+				Title, inode->fsHeader->clusters*BYTES_PER_SECTOR, inode->fileName, msg);
 		return -ENOMEM;
 	}
-	inode->rwb.buffSize = inode->fsHeader.clusters*BYTES_PER_SECTOR;
-	inode->rwb.buffUsed = inode->fsHeader.size;
+	inode->rwb.buffSize = inode->fsHeader->clusters*BYTES_PER_SECTOR;
+	inode->rwb.buffUsed = inode->fsHeader->size;
 	inode->rwb.buffOffset = inode->rwb.buffUsed;
-	sts = readWholeFile(Title, ourSuper, inode->rwb.buff, inode->rwb.buffUsed, inode->fsHeader.pointers[0]);
+	sts = readWholeFile(Title, ourSuper, inode->rwb.buff, inode->rwb.buffUsed, inode->fsHeader->pointers[0], ioPurposeOf(inode));
 	if ( sts < 0 )
 	{
 		fprintf(stderr, "FUSE %s failed to read %d bytes from %s. %s.\n",
@@ -1466,17 +1709,49 @@ static int readForChecksum(const char *Title, MgwfsSuper_t *ourSuper, MgwfsInode
 	return sts;
 }
 
-/* This function walks nearly the entire list of inodes, reads each non-directory file
-   computes a checksum of the file's contents, stashes the result in an array
-   then writes that array to the file specified by 'path'. */
+/*
+ * Fill in 'job' to checksum 'inode'. An open file's shared buffer is the
+ * most current copy, so it is summed from memory; anything else is streamed
+ * off the disk by checksumFiles(). Returns 0 or a negative errno.
+ */
+static int setupChecksumJob(ChecksumJob_t *job, MgwfsInode_t *inode)
+{
+	memset(job, 0, sizeof(ChecksumJob_t));
+	job->inode = inode->inode_no;
+	if ( inode->openRefs && inode->rwb.buff )
+	{
+		RwBuff_t *rwb = &inode->rwb;
+		uint32_t pad = (4 - (rwb->buffUsed & 3)) & 3;
+
+		if ( rwb->buffErr < 0 )
+			return rwb->buffErr;
+		/* checksumBuffer() sums the whole last word of a ragged file, so
+		 * zero what's past EOF in it (rwb buffers are whole sectors) */
+		if ( pad && rwb->buffUsed + pad <= rwb->buffSize )
+			memset(rwb->buff + rwb->buffUsed, 0, pad);
+		job->data = rwb->buff;
+		job->size = rwb->buffUsed;
+	}
+	else
+	{
+		job->retPtr = inode->fsHeader->pointers[0];
+		job->size = inode->fsHeader->size;
+	}
+	return 0;
+}
+
+/* This function walks nearly the entire list of inodes, checksums the contents of each
+   non-directory file (see checksumFiles(); they are streamed off the disk by a pool of
+   threads), stashes the results in an array in fid order then writes that array to the
+   file specified by 'path'. */
 static int computeChecksumFile(const char *path)
 {
 	MgwfsInode_t *inode, *cksumInode;
 	CheckSum_t *existingCS=NULL, *cksumBuffTop, *cksumPtr;
-	int numExistingCS=0;
-	int sts, cksumListSize, cksumIdx, inodeIdx;
+	ChecksumJob_t *jobs;
+	int numExistingCS=0, numJobs, numThreads, numDone=0, numCached=0, ii;
+	int sts, cksumListSize, cksumIdx, inodeIdx, firstIdx;
 	static const char Title[] = "mgwfs_ioctl(checksum)";
-	uint32_t newCksum;
 	
 	if ( (ourSuper.verbose&(VERBOSE_FUSE_CMD|VERBOSE_CHECKSUMS)) )
 	{
@@ -1490,7 +1765,7 @@ static int computeChecksumFile(const char *path)
 		UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
 		return -ENOENT;
 	}
-	cksumInode = ourSuper.inodeList[cksumIdx];
+	cksumInode = getInode(&ourSuper, cksumIdx);
 	if ( S_ISDIR(cksumInode->mode) )
 	{
 		if ( (ourSuper.verbose&(VERBOSE_FUSE_CMD|VERBOSE_WRITES)) )
@@ -1502,14 +1777,22 @@ static int computeChecksumFile(const char *path)
 		UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
 		return -EINVAL;
 	}
-	if ( cksumInode->fsHeader.size )
+	if ( cksumInode->openRefs )
 	{
-		if ( (cksumInode->fsHeader.size&(sizeof(CheckSum_t)-1)) )
+		/* Its buffer is about to be replaced and written out from under the open handles */
+		fprintf(ourSuper.logFile, "FUSE %s %s (inode %d) returned -EBUSY because it is open\n",
+				Title, path, cksumIdx);
+		UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
+		return -EBUSY;
+	}
+	if ( cksumInode->fsHeader->size )
+	{
+		if ( (cksumInode->fsHeader->size&(sizeof(CheckSum_t)-1)) )
 		{
 			if ( (ourSuper.verbose&(VERBOSE_FUSE_CMD|VERBOSE_CHECKSUMS)) )
 			{
 				fprintf(ourSuper.logFile, "FUSE %s %s (inode %d) returned -EINVAL because file has invalid size of %d\n",
-						Title, path, cksumIdx, cksumInode->fsHeader.size);
+						Title, path, cksumIdx, cksumInode->fsHeader->size);
 			}
 			UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
 			return -EINVAL;
@@ -1524,89 +1807,111 @@ static int computeChecksumFile(const char *path)
 		if ( sts )
 		{
 			existingCS = (CheckSum_t *)cksumInode->rwb.buff;
-			numExistingCS = cksumInode->fsHeader.size/sizeof(CheckSum_t);
+			numExistingCS = cksumInode->fsHeader->size/sizeof(CheckSum_t);
 		}
 	}
 	if ( (ourSuper.verbose&(VERBOSE_FUSE_CMD|VERBOSE_CHECKSUMS)) )
 		fprintf(ourSuper.logFile, "FUSE %s %s (inode %d) has %ld existing entries\n",
-				Title, path, cksumIdx, cksumInode->fsHeader.size/sizeof(CheckSum_t));
+				Title, path, cksumIdx, cksumInode->fsHeader->size/sizeof(CheckSum_t));
 	if ( existingCS )
 	{
-		int ii;
+		/* One job per existing entry, so the results line up with them */
+		numJobs = numExistingCS;
+		jobs = (ChecksumJob_t *)calloc(numJobs ? numJobs : 1, sizeof(ChecksumJob_t));
+		if ( !jobs )
+		{
+			fprintf(stderr,"%s Out of memory allocating %ld bytes for checksum jobs\n", Title, numJobs*sizeof(ChecksumJob_t));
+			UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
+			return -ENOMEM;
+		}
 		for (ii=0; ii < numExistingCS; ++ii)
 		{
 			inodeIdx = existingCS[ii].fid&0x00FFFFFF;
-			if ( inodeIdx == cksumIdx )
-				continue;	/* Don't checksum the checksums file */
-			inode = ourSuper.inodeList[inodeIdx];
-			if ( inode )
+			inode = getInode(&ourSuper, inodeIdx);
+			/* Don't checksum the checksums file or directory files */
+			if ( inodeIdx == cksumIdx || !inode || S_ISDIR(inode->mode) )
+				jobs[ii].sts = 1;
+			else if ( (sts = setupChecksumJob(jobs + ii, inode)) < 0 )
+				jobs[ii].sts = sts;
+		}
+		numThreads = checksumFiles(&ourSuper, jobs, numJobs, 1, 0);
+		for (ii=0; ii < numExistingCS; ++ii)
+		{
+			if ( jobs[ii].sts > 0 )
+				continue;
+			inode = getInode(&ourSuper, jobs[ii].inode);
+			if ( jobs[ii].sts < 0 )
 			{
-				/* Don't checksum directory files */
-				if ( !S_ISDIR(inode->mode) )
-				{
-					uint32_t newCksum;
-					sts = readForChecksum(Title,&ourSuper,inode,"Skipped");
-					if ( sts < 0 )
-						continue;
-					newCksum = checksumBuffer((const uint32_t *)inode->rwb.buff, inode->rwb.buffUsed);
-					if ( (ourSuper.verbose&(VERBOSE_FUSE_CMD|VERBOSE_CHECKSUMS)) )
-					{
-						if ( newCksum == existingCS[ii].cksum )
-							fprintf(ourSuper.logFile, "FUSE %s checksumed %s (inode %d) cs: 0x%08X match existing\n",
-									Title, inode->fileName, inode->inode_no, existingCS[ii].cksum);
-						else
-							fprintf(ourSuper.logFile, "FUSE %s checksumed %s (inode %d) old cs: 0x%08X, new cs: 0x%08X\n",
-									Title, inode->fileName, inode->inode_no, existingCS[ii].cksum, newCksum);
-					}
-					existingCS[ii].cksum = newCksum;
-					free(inode->rwb.buff);
-					memset(&inode->rwb,0,sizeof(inode->rwb));
-				}
+				fprintf(stderr, "FUSE %s failed to read %d bytes from %s: %s. Skipped.\n",
+						Title, jobs[ii].size, inode->fileName, strerror(-jobs[ii].sts));
+				continue;
 			}
+			if ( (ourSuper.verbose&(VERBOSE_FUSE_CMD|VERBOSE_CHECKSUMS)) )
+			{
+				if ( jobs[ii].cksum == existingCS[ii].cksum )
+					fprintf(ourSuper.logFile, "FUSE %s checksumed %s (inode %d) cs: 0x%08X match existing\n",
+							Title, inode->fileName, inode->inode_no, existingCS[ii].cksum);
+				else
+					fprintf(ourSuper.logFile, "FUSE %s checksumed %s (inode %d) old cs: 0x%08X, new cs: 0x%08X\n",
+							Title, inode->fileName, inode->inode_no, existingCS[ii].cksum, jobs[ii].cksum);
+			}
+			existingCS[ii].cksum = jobs[ii].cksum;
+			++numDone;
+			numCached += jobs[ii].cached;
 		}
 	}
 	else
 	{
-		cksumListSize = ourSuper.numInodesUsed*sizeof(CheckSum_t);
-		cksumBuffTop = (CheckSum_t *)malloc(cksumListSize);
-		if ( !cksumBuffTop )
+		/* writeWholeFile() writes whole sectors, so the buffer has to cover them */
+		cksumListSize = (ourSuper.numInodesUsed*sizeof(CheckSum_t) + BYTES_PER_SECTOR - 1) & ~(BYTES_PER_SECTOR - 1);
+		cksumBuffTop = (CheckSum_t *)calloc(1, cksumListSize);
+		numJobs = ourSuper.numInodesUsed;
+		jobs = (ChecksumJob_t *)calloc(numJobs, sizeof(ChecksumJob_t));
+		if ( !cksumBuffTop || !jobs )
 		{
 			fprintf(stderr,"%s Out of memory allocating %d bytes for checksum file\n", Title, cksumListSize);
+			free(cksumBuffTop);
+			free(jobs);
 			UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
 			return -ENOMEM;
 		}
 		if ( (ourSuper.verbose&(VERBOSE_FUSE_CMD|VERBOSE_CHECKSUMS)) )
 			fprintf(ourSuper.logFile, "FUSE %s %s (inode %d) creating brand new file\n",
 					Title, path, cksumIdx);
-		cksumPtr = cksumBuffTop;
-		inodeIdx = FSYS_INDEX_ROOT + 1;
+		/* One job per inode, so the results come out in fid order */
+		firstIdx = FSYS_INDEX_ROOT + 1;
 		if ( (ourSuper.homeBlk.features&FSYS_FEATURES_JOURNAL) )
-			++inodeIdx;
-		for (; inodeIdx < ourSuper.numInodesUsed; ++inodeIdx )
+			++firstIdx;
+		for (inodeIdx=0; inodeIdx < numJobs; ++inodeIdx )
 		{
-			if ( inodeIdx == cksumIdx )
-				continue;	/* Don't checksum the checksums file */
-			inode = ourSuper.inodeList[inodeIdx];
-			if ( inode )
+			inode = getInode(&ourSuper, inodeIdx);
+			/* Don't checksum the checksums file or directory files */
+			if ( inodeIdx < firstIdx || inodeIdx == cksumIdx || !inode || S_ISDIR(inode->mode) )
+				jobs[inodeIdx].sts = 1;
+			else if ( (sts = setupChecksumJob(jobs + inodeIdx, inode)) < 0 )
+				jobs[inodeIdx].sts = sts;
+		}
+		numThreads = checksumFiles(&ourSuper, jobs, numJobs, 1, 0);
+		cksumPtr = cksumBuffTop;
+		for (inodeIdx=0; inodeIdx < numJobs; ++inodeIdx )
+		{
+			if ( jobs[inodeIdx].sts > 0 )
+				continue;
+			inode = getInode(&ourSuper, inodeIdx);
+			if ( jobs[inodeIdx].sts < 0 )
 			{
-				/* Don't checksum directory files */
-				if ( !S_ISDIR(inode->mode) )
-				{
-					
-					sts = readForChecksum(Title,&ourSuper,inode,"Skipped");
-					if ( sts < 0 )
-						continue;
-					cksumPtr->fid = (inode->inode_no & 0x00FFFFFF) | (inode->fsHeader.generation << 24);
-					newCksum = checksumBuffer((const uint32_t *)inode->rwb.buff, inode->rwb.buffUsed);
-					if ( (ourSuper.verbose&(VERBOSE_FUSE_CMD|VERBOSE_CHECKSUMS)) )
-						fprintf(ourSuper.logFile, "FUSE %s checksumed %s (inode %d) computed cs: 0x%08X\n",
-								Title, inode->fileName, inode->inode_no, newCksum);
-					cksumPtr->cksum = newCksum;
-					++cksumPtr;
-					free(inode->rwb.buff);
-					memset(&inode->rwb,0,sizeof(inode->rwb));
-				}
+				fprintf(stderr, "FUSE %s failed to read %d bytes from %s: %s. Skipped.\n",
+						Title, jobs[inodeIdx].size, inode->fileName, strerror(-jobs[inodeIdx].sts));
+				continue;
 			}
+			cksumPtr->fid = (inode->inode_no & 0x00FFFFFF) | (inode->fsHeader->generation << 24);
+			if ( (ourSuper.verbose&(VERBOSE_FUSE_CMD|VERBOSE_CHECKSUMS)) )
+				fprintf(ourSuper.logFile, "FUSE %s checksumed %s (inode %d) computed cs: 0x%08X\n",
+						Title, inode->fileName, inode->inode_no, jobs[inodeIdx].cksum);
+			cksumPtr->cksum = jobs[inodeIdx].cksum;
+			++cksumPtr;
+			++numDone;
+			numCached += jobs[inodeIdx].cached;
 		}
 		cksumInode->rwb.buff = (uint8_t *)cksumBuffTop; 	/* buffer gets free()'d in udpateAllMetaData() */
 		cksumInode->rwb.buffSize = cksumListSize;
@@ -1614,12 +1919,182 @@ static int computeChecksumFile(const char *path)
 		cksumInode->rwb.buffOffset = cksumInode->rwb.buffUsed;
 		cksumInode->rwb.buffErr = 0;
 	}
+	if ( (ourSuper.verbose&(VERBOSE_FUSE_CMD|VERBOSE_CHECKSUMS)) )
+		fprintf(ourSuper.logFile, "FUSE %s %s: checksummed %d files (%d unchanged since last time) using %d threads\n",
+				Title, path, numDone, numCached, numThreads);
+	free(jobs);
 	addToDirty(Title, &ourSuper, cksumInode->inode_no);
 	UNLOCK_IT("rdMutex",&ourSuper,&rdMutex);
 	updateAllMetaData(Title,&ourSuper);
+	/* The kernel didn't see the checksums file get rewritten */
+	invalidatePath(path);
 	return 0;
 }
 
+/* This function checks each entry of the checksums file 'path', starting at
+   vp->startEntry, against what its file holds now, and reports the ones that
+   don't match. Nothing is written, so it works on read-only mounts too. The
+   files are always read off the disk (the checksum cache is bypassed), since
+   the point is usually to prove the media is good. */
+static int verifyChecksumFile(const char *path, MgwfsIoctlVerify_t *vp)
+{
+	MgwfsInode_t *inode, *cksumInode;
+	CheckSum_t *entries;
+	ChecksumJob_t *jobs;
+	int sts, cksumIdx, numEntries, numJobs, ii;
+	struct timespec start, end;
+	static const char Title[] = "mgwfs_ioctl(verify)";
+
+	if ( (ourSuper.verbose&(VERBOSE_FUSE_CMD|VERBOSE_CHECKSUMS)) )
+	{
+		fprintf(ourSuper.logFile, "FUSE %s %s starting at entry %d\n", Title, path, vp->startEntry );
+		fflush(ourSuper.logFile);
+	}
+	if ( vp->version != MGWFS_VERIFY_VERSION )
+		return -EINVAL;
+	cksumIdx = findInode(&ourSuper,FSYS_INDEX_ROOT,path);
+	if ( !cksumIdx )
+		return -ENOENT;
+	cksumInode = getInode(&ourSuper, cksumIdx);
+	if ( S_ISDIR(cksumInode->mode) || (cksumInode->fsHeader->size&(sizeof(CheckSum_t)-1)) )
+		return -EINVAL;
+	sts = readForChecksum(Title,&ourSuper,cksumInode,"Cannot verify checksums");
+	if ( sts < 0 )
+		return sts;
+	entries = (CheckSum_t *)cksumInode->rwb.buff;
+	numEntries = sts/sizeof(CheckSum_t);
+	vp->numEntries = numEntries;
+	vp->nextEntry = vp->numChecked = vp->numMismatches = vp->numThreads = 0;
+	vp->bytesChecked = vp->usecs = 0;
+	numJobs = (int)vp->startEntry < numEntries ? numEntries - vp->startEntry : 0;
+	jobs = (ChecksumJob_t *)calloc(numJobs ? numJobs : 1, sizeof(ChecksumJob_t));
+	if ( !jobs )
+	{
+		if ( !cksumInode->openRefs )
+		{
+			free(cksumInode->rwb.buff);
+			memset(&cksumInode->rwb,0,sizeof(cksumInode->rwb));
+		}
+		return -ENOMEM;
+	}
+	for (ii=0; ii < numJobs; ++ii)
+	{
+		CheckSum_t *ent = entries + vp->startEntry + ii;
+
+		inode = getInode(&ourSuper, ent->fid&0x00FFFFFF);
+		if ( !inode || S_ISDIR(inode->mode) )
+			jobs[ii].sts = -ENOENT;
+		else if ( inode->fsHeader->generation != (ent->fid>>24) )
+			jobs[ii].sts = -ESTALE;		/* that fid has since been deleted and reused */
+		else if ( (sts = setupChecksumJob(jobs + ii, inode)) < 0 )
+			jobs[ii].sts = sts;
+		jobs[ii].expected = ent->cksum;	/* after setupChecksumJob(), which clears the job */
+	}
+	/* The workers stop taking jobs once mismatches[] would be full */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	vp->numThreads = checksumFiles(&ourSuper, jobs, numJobs, 0, MAX_VERIFY_MISMATCHES);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	vp->usecs = (end.tv_sec - start.tv_sec)*1000000LL + (end.tv_nsec - start.tv_nsec)/1000;
+	for (ii=0; ii < numJobs; ++ii)
+	{
+		CheckSum_t *ent = entries + vp->startEntry + ii;
+		MgwfsVerifyMismatch_t *mm;
+
+		if ( !jobs[ii].started )
+			break;
+		if ( !jobs[ii].sts && jobs[ii].cksum == ent->cksum )
+		{
+			++vp->numChecked;
+			vp->bytesChecked += jobs[ii].size;
+			continue;
+		}
+		/* Jobs already running when the last slot was taken can find more
+		 * than fit; those few are left for the next call to read again. */
+		if ( vp->numMismatches >= MAX_VERIFY_MISMATCHES )
+			break;
+		++vp->numChecked;
+		mm = vp->mismatches + vp->numMismatches++;
+		memset(mm, 0, sizeof(MgwfsVerifyMismatch_t));
+		mm->fid = ent->fid;
+		mm->expected = ent->cksum;
+		if ( jobs[ii].sts < 0 )
+			mm->error = -jobs[ii].sts;
+		else
+		{
+			mm->actual = jobs[ii].cksum;
+			vp->bytesChecked += jobs[ii].size;
+		}
+		if ( (inode = getInode(&ourSuper, ent->fid&0x00FFFFFF)) )
+			buildBootFNPath(mm->path, MAX_VERIFY_PATH-1, inode);
+		if ( (ourSuper.verbose&(VERBOSE_FUSE_CMD|VERBOSE_CHECKSUMS)) )
+			fprintf(ourSuper.logFile, "FUSE %s fid 0x%08X (%s) expected cs: 0x%08X, got 0x%08X (err %d)\n",
+					Title, mm->fid, mm->path, mm->expected, mm->actual, mm->error);
+	}
+	if ( ii < numJobs )
+		vp->nextEntry = vp->startEntry + ii;	/* the caller picks up from here */
+	free(jobs);
+	if ( !cksumInode->openRefs )
+	{
+		free(cksumInode->rwb.buff);
+		memset(&cksumInode->rwb,0,sizeof(cksumInode->rwb));
+	}
+	if ( (ourSuper.verbose&(VERBOSE_FUSE_CMD|VERBOSE_CHECKSUMS)) )
+		fprintf(ourSuper.logFile, "FUSE %s %s: checked %d of %d entries, %d mismatches, %ld bytes in %ld usecs using %d threads\n",
+				Title, path, vp->numChecked, numEntries, vp->numMismatches, vp->bytesChecked, vp->usecs, vp->numThreads);
+	return 0;
+}
+
+/* MGWFS_IOC_DEFRAG: the file at 'path', or with MGWFS_DEFRAG_ALL every file
+ * from dp->startInode on until dp->maxSectors have been moved. */
+static int defragFiles(const char *path, MgwfsIoctlDefrag_t *dp)
+{
+	static const char Title[] = "mgwfs_ioctl(defrag)";
+	MgwfsInode_t *inode;
+	uint64_t start = perfNow();
+	int idx, sts=0;
+
+	if ( dp->version != MGWFS_DEFRAG_VERSION )
+		return -EINVAL;
+	dp->nextInode = 0;
+	dp->filesChecked = dp->filesMoved = dp->filesBusy = dp->filesNoRoom = 0;
+	dp->rpsBefore = dp->rpsAfter = 0;
+	dp->sectorsMoved = 0;
+	if ( !(dp->flags&MGWFS_DEFRAG_ALL) )
+	{
+		if ( (idx = findInode(&ourSuper, FSYS_INDEX_ROOT, path)) <= 0 )
+			return -ENOENT;
+		++dp->filesChecked;
+		sts = defragFile(Title, &ourSuper, getInode(&ourSuper, idx), dp);
+	}
+	else
+	{
+		idx = dp->startInode > FSYS_INDEX_ROOT ? dp->startInode : FSYS_INDEX_ROOT;
+		for (; idx < ourSuper.numInodesUsed; ++idx)
+		{
+			if ( !(inode = getInode(&ourSuper, idx)) )
+				continue;
+			if ( dp->maxSectors && dp->sectorsMoved
+				 && dp->sectorsMoved + (uint64_t)inode->fsHeader->clusters*FSYS_MAX_ALTS > dp->maxSectors )
+			{
+				/* Might not fit in what's left of this call; leave it for the next one */
+				dp->nextInode = idx;
+				break;
+			}
+			++dp->filesChecked;
+			sts = defragFile(Title, &ourSuper, inode, dp);
+			if ( sts == -EBUSY )
+				sts = 0;	/* counted; carry on with the rest */
+			if ( sts < 0 )
+				break;
+		}
+	}
+	dp->usecs = (perfNow() - start)/1000;
+	if ( (ourSuper.verbose&(VERBOSE_FUSE_CMD|VERBOSE_WRITES)) )
+		fprintf(ourSuper.logFile, "FUSE %s %s: %d files checked, %d moved, %d busy, %d without room, %ld sectors moved in %ld usecs. Next inode %d\n",
+				Title, path, dp->filesChecked, dp->filesMoved, dp->filesBusy, dp->filesNoRoom, dp->sectorsMoved, dp->usecs, dp->nextInode);
+	return sts < 0 ? sts : 0;
+}
+
 static int mgwfs_ioctl(const char *path, int cmd, void *arg,
 					   struct fuse_file_info *fi, unsigned int flags, void *data)
 {
@@ -1673,7 +2148,7 @@ static int mgwfs_ioctl(const char *path, int cmd, void *arg,
 			{
 				for (ii=0; ii < ourSuper.numInodesUsed; ++ii)
 				{
-					inode = ourSuper.inodeList[ii];
+					inode = getInode(&ourSuper, ii);
 					if ( inode && (inode->flags&MGWFS_INODE_ANY_BOOT) )
 					{
 						int bootIdx = (inode->flags>>MGWFS_INODE_BOOT_IDX)&MGWFS_INODE_BOOT_MASK;
@@ -1707,7 +2182,7 @@ static int mgwfs_ioctl(const char *path, int cmd, void *arg,
 				sts = -ENOENT;
 				break;
 			}
-			inode = ourSuper.inodeList[idx];
+			inode = getInode(&ourSuper, idx);
 			cmd -= MGWFS_IOC_SETBOOT0;
 			if ( cmd && ourSuper.homeBlk.hb_major == 1 && (ourSuper.homeBlk.hb_minor < 6) )
 			{
@@ -1720,7 +2195,7 @@ static int mgwfs_ioctl(const char *path, int cmd, void *arg,
 			if ( ourSuper.bootIndicies[cmd] )
 			{
 				MgwfsInode_t *tmpInode;
-				tmpInode = ourSuper.inodeList[ourSuper.bootIndicies[cmd]];
+				tmpInode = getInode(&ourSuper, ourSuper.bootIndicies[cmd]);
 				tmpInode->flags &= ~(MGWFS_INODE_ANY_BOOT|(MGWFS_INODE_BOOT_MASK<<MGWFS_INODE_BOOT_IDX));
 			}
 			inode->flags &= ~(MGWFS_INODE_ANY_BOOT|(MGWFS_INODE_BOOT_MASK<<MGWFS_INODE_BOOT_IDX));
@@ -1752,6 +2227,33 @@ static int mgwfs_ioctl(const char *path, int cmd, void *arg,
 		else
 			sts = -EROFS;
 		break;
+	case MGWFS_IOC_VERIFYCHECKSUMS:
+		sts = verifyChecksumFile(path, (MgwfsIoctlVerify_t *)data);
+		break;
+	case MGWFS_IOC_GETPERF:
+		if ( ((MgwfsIoctlPerf_t *)data)->version != MGWFS_PERF_VERSION )
+			sts = -EINVAL;
+		else
+			perfSnapshot((MgwfsIoctlPerf_t *)data);
+		break;
+	case MGWFS_IOC_GETIO:
+		if ( ((MgwfsIoctlIo_t *)data)->version != MGWFS_IO_VERSION )
+			sts = -EINVAL;
+		else
+			ioSnapshot(&ourSuper, (MgwfsIoctlIo_t *)data);
+		break;
+	case MGWFS_IOC_FRAG:
+		if ( ((MgwfsIoctlFrag_t *)data)->version != MGWFS_FRAG_VERSION )
+			sts = -EINVAL;
+		else
+			sts = fragReport(&ourSuper, (MgwfsIoctlFrag_t *)data);
+		break;
+	case MGWFS_IOC_DEFRAG:
+		if ( options.read_write )
+			sts = defragFiles(path, (MgwfsIoctlDefrag_t *)data);
+		else
+			sts = -EROFS;
+		break;
 	default:
 		sts = -EINVAL;
 		break;
@@ -1762,33 +2264,225 @@ static int mgwfs_ioctl(const char *path, int cmd, void *arg,
 	return sts;
 }
 
+/*
+ * Each operation goes through one of these to have its latency counted for
+ * MGWFS_IOC_GETPERF (see perf.c). Timing here instead of in the handlers
+ * themselves keeps every early return counted.
+ */
+static int perf_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_getattr(path, stbuf, fi);
+	perfDone(MGWFS_PERF_GETATTR, start);
+	return sts;
+}
+
+static int perf_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_readdir(path, buf, filler, offset, fi, flags);
+	perfDone(MGWFS_PERF_READDIR, start);
+	return sts;
+}
+
+static int perf_open(const char *path, struct fuse_file_info *fi)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_open(path, fi);
+	perfDone(MGWFS_PERF_OPEN, start);
+	return sts;
+}
+
+static int perf_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_read(path, buf, size, offset, fi);
+	perfDone(MGWFS_PERF_READ, start);
+	return sts;
+}
+
+static int perf_release(const char *path, struct fuse_file_info *fi)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_release(path, fi);
+	perfDone(MGWFS_PERF_RELEASE, start);
+	return sts;
+}
+
+static int perf_statfs(const char *path, struct statvfs *stp)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_statfs(path, stp);
+	perfDone(MGWFS_PERF_STATFS, start);
+	return sts;
+}
+
+static int perf_access(const char *path, int flags)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_access(path, flags);
+	perfDone(MGWFS_PERF_ACCESS, start);
+	return sts;
+}
+
+static int perf_unlink(const char *path)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_unlink(path);
+	perfDone(MGWFS_PERF_UNLINK, start);
+	return sts;
+}
+
+static int perf_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_write(path, buf, size, offset, fi);
+	perfDone(MGWFS_PERF_WRITE, start);
+	return sts;
+}
+
+static int perf_flush(const char *path, struct fuse_file_info *fi)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_flush(path, fi);
+	perfDone(MGWFS_PERF_FLUSH, start);
+	return sts;
+}
+
+static int perf_fsync(const char *path, int arg, struct fuse_file_info *fi)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_fsync(path, arg, fi);
+	perfDone(MGWFS_PERF_FSYNC, start);
+	return sts;
+}
+
+static int perf_mkdir(const char *path, mode_t mode)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_mkdir(path, mode);
+	perfDone(MGWFS_PERF_MKDIR, start);
+	return sts;
+}
+
+static int perf_rmdir(const char *path)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_rmdir(path);
+	perfDone(MGWFS_PERF_RMDIR, start);
+	return sts;
+}
+
+static int perf_rename(const char *oldName, const char *newName, unsigned int flags)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_rename(oldName, newName, flags);
+	perfDone(MGWFS_PERF_RENAME, start);
+	return sts;
+}
+
+static int perf_create(const char *path, mode_t fMode, struct fuse_file_info *fi)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_create(path, fMode, fi);
+	perfDone(MGWFS_PERF_CREATE, start);
+	return sts;
+}
+
+static off_t perf_lseek(const char *path, off_t off, int whence, struct fuse_file_info *fi)
+{
+	uint64_t start = perfNow();
+	off_t sts = mgwfs_lseek(path, off, whence, fi);
+	perfDone(MGWFS_PERF_LSEEK, start);
+	return sts;
+}
+
+static int perf_truncate(const char *path, off_t offset, struct fuse_file_info *fi)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_truncate(path, offset, fi);
+	perfDone(MGWFS_PERF_TRUNCATE, start);
+	return sts;
+}
+
+static int perf_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fi)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_fallocate(path, mode, offset, length, fi);
+	perfDone(MGWFS_PERF_FALLOCATE, start);
+	return sts;
+}
+
+static ssize_t perf_copy_file_range(const char *path_in, struct fuse_file_info *fi_in, off_t offset_in,
+									const char *path_out, struct fuse_file_info *fi_out, off_t offset_out,
+									size_t size, int flags)
+{
+	uint64_t start = perfNow();
+	ssize_t sts = mgwfs_copy_file_range(path_in, fi_in, offset_in, path_out, fi_out, offset_out, size, flags);
+	perfDone(MGWFS_PERF_COPYFILERANGE, start);
+	return sts;
+}
+
+static int perf_utimens(const char *path, const struct timespec tv[2], struct fuse_file_info *fi)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfst_utimens(path, tv, fi);
+	perfDone(MGWFS_PERF_UTIMENS, start);
+	return sts;
+}
+
+static int perf_chmod(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_chmod(path, mode, fi);
+	perfDone(MGWFS_PERF_CHMOD, start);
+	return sts;
+}
+
+static int perf_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_info *fi)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_chown(path, uid, gid, fi);
+	perfDone(MGWFS_PERF_CHOWN, start);
+	return sts;
+}
+
+static int perf_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data)
+{
+	uint64_t start = perfNow();
+	int sts = mgwfs_ioctl(path, cmd, arg, fi, flags, data);
+	perfDone(MGWFS_PERF_IOCTL, start);
+	return sts;
+}
+
 const struct fuse_operations mgwfs_oper =
 {
 	.init       = mgwfs_init,
-	.getattr	= mgwfs_getattr,
-	.readdir	= mgwfs_readdir,
-	.open		= mgwfs_open,
-	.read		= mgwfs_read,
-	.release	= mgwfs_release,
-	.statfs		= mgwfs_statfs,
-	.access		= mgwfs_access,		// int (*access) (const char *, int);
-	.unlink		= mgwfs_unlink,		// int (*unlink) (const char *);
-	.write		= mgwfs_write,		// int (*write) (const char *, const char *, size_t, off_t, struct fuse_file_info *);
-	.flush		= mgwfs_flush,		// int (*flush) (const char *, struct fuse_file_info *);
-	.fsync		= mgwfs_fsync,		// int (*fsync) (const char *, int, struct fuse_file_info *);
+	.getattr	= perf_getattr,
+	.readdir	= perf_readdir,
+	.open		= perf_open,
+	.read		= perf_read,
+	.release	= perf_release,
+	.statfs		= perf_statfs,
+	.access		= perf_access,		// int (*access) (const char *, int);
+	.unlink		= perf_unlink,		// int (*unlink) (const char *);
+	.write		= perf_write,		// int (*write) (const char *, const char *, size_t, off_t, struct fuse_file_info *);
+	.flush		= perf_flush,		// int (*flush) (const char *, struct fuse_file_info *);
+	.fsync		= perf_fsync,		// int (*fsync) (const char *, int, struct fuse_file_info *);
 	.destroy	= mgwfs_destroy,	// void (*destroy) (void *private_data);
-	.mkdir		= mgwfs_mkdir,		// int (*mkdir) (const char *, mode_t);
-	.rmdir		= mgwfs_rmdir,		// int (*rmdir) (const char *);
-	.rename		= mgwfs_rename,		// int (*rename) (const char *oldName, const char *newName, unsigned int flags);
-	.create		= mgwfs_create,		// int (*create) (const char *, mode_t, struct fuse_file_info *);
-	.lseek		= mgwfs_lseek,		// off_t (*lseek) (const char *, off_t off, int whence, struct fuse_file_info *);
-	.truncate	= mgwfs_truncate,	// int (*truncate) (const char *, off_t, struct fuse_file_info *fi);
-	.utimens	= mgwfst_utimens,	// int (*utimens) (const char *, const struct timespec tv[2], struct fuse_file_info *fi);
-	.chmod		= mgwfs_chmod,		// int (*chmod) (const char *, mode_t, struct fuse_file_info *fi);
-	.chown		= mgwfs_chown,		// int (*chown) (const char *, uid_t, gid_t, struct fuse_file_info *fi);
-	.ioctl		= mgwfs_ioctl,		// int (*ioctl) (const char *, unsigned int cmd, void *arg, struct fuse_file_info *, unsigned int flags, void *data);
+	.mkdir		= perf_mkdir,		// int (*mkdir) (const char *, mode_t);
+	.rmdir		= perf_rmdir,		// int (*rmdir) (const char *);
+	.rename		= perf_rename,		// int (*rename) (const char *oldName, const char *newName, unsigned int flags);
+	.create		= perf_create,		// int (*create) (const char *, mode_t, struct fuse_file_info *);
+	.lseek		= perf_lseek,		// off_t (*lseek) (const char *, off_t off, int whence, struct fuse_file_info *);
+	.truncate	= perf_truncate,	// int (*truncate) (const char *, off_t, struct fuse_file_info *fi);
+	.utimens	= perf_utimens,		// int (*utimens) (const char *, const struct timespec tv[2], struct fuse_file_info *fi);
+	.chmod		= perf_chmod,		// int (*chmod) (const char *, mode_t, struct fuse_file_info *fi);
+	.chown		= perf_chown,		// int (*chown) (const char *, uid_t, gid_t, struct fuse_file_info *fi);
+	.ioctl		= perf_ioctl,		// int (*ioctl) (const char *, unsigned int cmd, void *arg, struct fuse_file_info *, unsigned int flags, void *data);
+	.fallocate	= perf_fallocate,	// int (*fallocate) (const char *, int, off_t, off_t, struct fuse_file_info *);
+	.copy_file_range = perf_copy_file_range,	// ssize_t (*copy_file_range) (const char *, struct fuse_file_info *, off_t, const char *, struct fuse_file_info *, off_t, size_t, int);
 #if 0
-	.fallocate	= mgwfs_fallocate,	// int (*fallocate) (const char *, int, off_t, off_t, struct fuse_file_info *);
 	.read_buf	= mgwfs_read_buf,	// int (*read_buf) (const char *, struct fuse_bufvec **bufp, size_t size, off_t off, struct fuse_file_info *);
 	.write_buf	= mgwfs_write_buf,	// int (*write_buf) (const char *, struct fuse_bufvec *buf, off_t off, struct fuse_file_info *);
 #endif
@@ -1811,11 +2505,6 @@ const struct fuse_operations mgwfs_oper =
 	int (*poll) (const char *, struct fuse_file_info *,
 		     struct fuse_pollhandle *ph, unsigned *reventsp);
 	int (*flock) (const char *, struct fuse_file_info *, int op);
-	ssize_t (*copy_file_range) (const char *path_in,
-				    struct fuse_file_info *fi_in,
-				    off_t offset_in, const char *path_out,
-				    struct fuse_file_info *fi_out,
-				    off_t offset_out, size_t size, int flags);
 #endif
 };
 
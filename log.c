@@ -0,0 +1,271 @@
+/*
+  log: Part of Atari/MidwayGamesWest filesystem using libfuse: Filesystem in Userspace
+
+  Copyright (C) 2025  Dave Shepperd <mgwfs@dshepperd.com>
+
+  This program can be distributed under the terms of the GNU GPLv2.
+  See the file COPYING.
+
+ Trace logging for the FUSE entry points. Formatting a line with fprintf()
+ and pushing it out with fflush() on every getattr() costs more than the
+ getattr() itself, so instead each event is dropped as a fixed size binary
+ record (timestamp, event number, a path and a few numbers) into a ring
+ owned by the calling thread. A background thread empties the rings,
+ formats the records and writes them to the log file. The hot path does
+ no formatting, takes no locks and makes no system calls.
+
+ Each ring has exactly one writer (its thread) and one reader (the drain
+ thread), so head and tail are the only shared state and a release store
+ on one paired with an acquire load on the other is all the
+ synchronization required. If a ring fills, new records are counted and
+ dropped rather than stalling the filesystem; the drain thread reports the
+ count.
+
+ Until logStart() is called (and again after logStop()) records are
+ formatted and written immediately by the caller.
+
+*/
+#include "mgwfs.h"
+#include <pthread.h>
+#include <time.h>
+
+#define LOG_RING_SIZE	(4096)		/* records in each ring. Must be a power of 2 */
+#define LOG_NAME_LEN	(64)		/* tail of the path kept in each record */
+#define LOG_IDLE_USECS	(10000)		/* drain thread naps this long when there's nothing to do */
+
+typedef struct
+{
+	uint64_t nsecs;					/* CLOCK_REALTIME when logged */
+	uint32_t event;					/* LOG_EV_xxx */
+	uint32_t spare;
+	long args[LOG_MAX_ARGS];
+	char name[LOG_NAME_LEN];
+} LogRecord_t;
+
+typedef struct LogRing_t
+{
+	struct LogRing_t *next;			/* next ring on the list of all rings */
+	uint32_t dropped;				/* records lost to a full ring (written by owner) */
+	uint32_t reported;				/* how many of those have been reported (drain thread) */
+	uint32_t head __attribute__((aligned(64)));	/* next record the owner fills */
+	uint32_t tail __attribute__((aligned(64)));	/* next record the drain thread empties */
+	LogRecord_t recs[LOG_RING_SIZE];
+} LogRing_t;
+
+/* Each format gets the record's name as its first argument followed by
+ * all LOG_MAX_ARGS args, so every conversion after the %s must be a long. */
+static const char *EventFormats[LOG_EV_MAX] =
+{
+	[LOG_EV_GETATTR] = "FUSE mgwfs_getattr(path='%s',stbuf)",
+	[LOG_EV_GETATTR_ENOENT] = "FUSE mgwfs_getattr() returned -ENOENT because '%s' could not be found",
+	[LOG_EV_READDIR] = "FUSE mgwfs_readdir(path='%s',buf=0x%lX,offset=%ld,fi,flags=0x%lX)",
+	[LOG_EV_READDIR_ENOENT] = "FUSE mgwfs_readdir() returned -ENOENT because '%s' could not be found",
+	[LOG_EV_READDIR_NOTDIR] = "FUSE mgwfs_readdir() returned -ENOENT because '%s' (inode %ld) is not a directory",
+	[LOG_EV_READDIR_ENTRY] = "FUSE mgwfs_readdir(): Uploaded '%s' (inode %ld). Next=%ld. fRet=%ld",
+	[LOG_EV_OPEN] = "FUSE mgwfs_open(path='%s',fi->fh=%ld, fi->flags=0x%lX)",
+	[LOG_EV_OPEN_EEXIST] = "FUSE mgwfs_open() returned -EEXIST because '%s' (inode %ld) already exists.",
+	[LOG_EV_OPEN_ENOENT] = "FUSE mgwfs_open() returned -ENOENT because '%s' could not be found",
+	[LOG_EV_OPEN_EISDIR] = "FUSE mgwfs_open() returned -EINVAL because '%s' (inode %ld) is a directory",
+	[LOG_EV_OPEN_OK] = "FUSE mgwfs_open(%s,0x%lX) returned success on open, inode %ld and FHidx %ld, rwBuffUsed=%ld, offset=%ld, rwBuffSize=%ld, openRefs=%ld",
+	[LOG_EV_OPEN_READERR] = "FUSE mgwfs_open('%s') readFile() returned error %ld.",
+	[LOG_EV_READ] = "FUSE mgwfs_read('%s', %ld, 0x%lX): rwBuffUsed=%ld, fhp->offset=%ld, rwBuffSize=%ld, rwBuffErr=%ld",
+	[LOG_EV_READ_COPY] = "FUSE mgwfs_read('%s', %ld, 0x%lX) cpyAmt=%ld, adjOffset=%ld, rwBuffUsed=%ld",
+	[LOG_EV_READ_NOTOPEN] = "FUSE mgwfs_read('%s', %ld, 0x%lX): not opened. Returned -EIO",
+	[LOG_EV_READ_BUFFERR] = "FUSE mgwfs_read('%s', %ld, 0x%lX): Found rwBuffErr=%ld",
+	[LOG_EV_READ_NOINODE] = "FUSE mgwfs_read('%s', %ld, 0x%lX): No inode found. Returned -EIO",
+	[LOG_EV_RELEASE] = "FUSE mgwfs_release(path='%s',fi->fh=%ld)",
+	[LOG_EV_STATFS] = "FUSE mgwfs_statfs('%s',0x%lX)",
+	[LOG_EV_UNLINK] = "FUSE mgwfs_unlink('%s')",
+	[LOG_EV_UNLINK_ENOENT] = "FUSE mgwfs_unlink('%s') returned ENOENT",
+	[LOG_EV_UNLINK_EISDIR] = "FUSE mgwfs_unlink() returned -EINVAL because '%s' (inode %ld) is a directory",
+	[LOG_EV_WRITE_BEFORE] = "FUSE mgwfs_write('%s',0x%lX,%ld,0x%lX,%ld): Before: rwBuff=0x%lX, rwBuffUsed=%ld, fhp->offset=%ld, rwBuffSize=%ld",
+	[LOG_EV_WRITE_ADDED] = "FUSE mgwfs_write('%s'): added (%ld bytes) at offset %ld, first %ld bytes: 0x%lX",
+	[LOG_EV_WRITE_AFTER] = "FUSE mgwfs_write('%s',0x%lX,%ld,0x%lX,%ld): After:  rwBuff=0x%lX, rwBuffUsed=%ld, fhp->offset=%ld, rwBuffSize=%ld",
+	[LOG_EV_WRITE_NOTOPEN] = "FUSE mgwfs_write('%s',0x%lX,%ld,0x%lX,%ld) returned -EPERM because has not been open()'d",
+	[LOG_EV_WRITE_EISDIR] = "FUSE mgwfs_write('%s') returned -EISDIR because writes to a directory are not allowed",
+	[LOG_EV_FLUSH] = "FUSE mgwfs_flush('%s',%ld): rwBuff=0x%lX, rwBuffUsed=%ld, fhp->offset=%ld, rwBuffSize=%ld",
+	[LOG_EV_FLUSH_NOTOPEN] = "FUSE mgwfs_flush('%s',%ld) returned -EPERM because has not been open()'d",
+	[LOG_EV_FSYNC] = "FUSE mgwfs_fsync(path='%s', fi->fh=%ld)",
+	[LOG_EV_MKDIR] = "FUSE mgwfs_mkdir('%s',0x%lX)",
+	[LOG_EV_MKDIR_DONE] = "FUSE mgwfs_mkdir('%s') returned %ld",
+	[LOG_EV_RMDIR] = "FUSE mgwfs_rmdir('%s')",
+	[LOG_EV_RMDIR_DONE] = "FUSE mgwfs_rmdir('%s') returned %ld",
+	[LOG_EV_CREATE] = "FUSE mgwfs_create('%s',0x%lX,%ld), idx=%ld, sts=%ld",
+	[LOG_EV_LSEEK] = "FUSE lseek_locked(%s,%ld,whence=%ld,%ld)",
+	[LOG_EV_TRUNCATE] = "FUSE mgwfs_truncate(%s,0x%lX,%ld)",
+	[LOG_EV_UTIMENS] = "FUSE mgwfst_utimens(path='%s')",
+	[LOG_EV_UTIMENS_ENOENT] = "FUSE mgwfst_utimens() returned -ENOENT because '%s' could not be found",
+	[LOG_EV_CHMOD] = "FUSE mgwfs_chmod(path='%s',mode=0%lo)",
+	[LOG_EV_CHMOD_ENOENT] = "FUSE mgwfs_chmod() returned -ENOENT because '%s' could not be found",
+	[LOG_EV_CHOWN] = "FUSE mgwfs_chown(path='%s',uid=%ld,gid=%ld)",
+	[LOG_EV_CHOWN_ENOENT] = "FUSE mgwfs_chown() returned -ENOENT because '%s' could not be found",
+	[LOG_EV_FALLOCATE] = "FUSE mgwfs_fallocate(%s,mode=0x%lX,0x%lX,0x%lX,%ld)",
+	[LOG_EV_COPY_FILE_RANGE] = "FUSE mgwfs_copy_file_range(%s,%ld,0x%lX,->%ld,0x%lX,0x%lX,flags=0x%lX)",
+};
+
+static LogRing_t *rings;			/* every thread's ring, newest first. Never shrinks. */
+static __thread LogRing_t *myRing;	/* this thread's ring */
+static pthread_t drainThread;
+static int draining;				/* non-zero while the drain thread owns the output */
+static int stopDrain;				/* tells the drain thread to finish up */
+
+static void fillRecord(LogRecord_t *rec, LogEvent_t event, const char *name, const long *args)
+{
+	struct timespec ts;
+	int len;
+
+	clock_gettime(CLOCK_REALTIME, &ts);	/* vdso, so no system call */
+	rec->nsecs = (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+	rec->event = event;
+	memcpy(rec->args, args, sizeof(rec->args));
+	if ( !name )
+		name = "";
+	len = strlen(name);
+	if ( len < LOG_NAME_LEN )
+		memcpy(rec->name, name, len+1);
+	else
+	{
+		/* Keep the end of the path; that's the part that says which file */
+		memcpy(rec->name, "...", 3);
+		memcpy(rec->name+3, name+len-(LOG_NAME_LEN-4), LOG_NAME_LEN-4);
+		rec->name[LOG_NAME_LEN-1] = 0;
+	}
+}
+
+static void formatRecord(FILE *fp, const LogRecord_t *rec)
+{
+	struct tm tm;
+	time_t secs = rec->nsecs/1000000000;
+	const char *fmt = "Unknown log event (%s)";
+
+	localtime_r(&secs, &tm);
+	fprintf(fp, "%02d:%02d:%02d.%06ld ", tm.tm_hour, tm.tm_min, tm.tm_sec, (long)(rec->nsecs%1000000000)/1000);
+	if ( rec->event < LOG_EV_MAX && EventFormats[rec->event] )
+		fmt = EventFormats[rec->event];
+	fprintf(fp, fmt, rec->name,
+			rec->args[0], rec->args[1], rec->args[2], rec->args[3],
+			rec->args[4], rec->args[5], rec->args[6], rec->args[7]);
+	fputc('\n', fp);
+}
+
+static LogRing_t *newRing(void)
+{
+	LogRing_t *rp;
+
+	if ( posix_memalign((void **)&rp, 64, sizeof(LogRing_t)) )
+		return NULL;
+	memset(rp, 0, sizeof(LogRing_t));
+	/* Push it on the list. The drain thread only ever walks the list, so a
+	 * compare and swap on the head is enough. */
+	rp->next = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+	while ( !__atomic_compare_exchange_n(&rings, &rp->next, rp, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE) )
+		;
+	myRing = rp;
+	return rp;
+}
+
+void logEventArgs(LogEvent_t event, const char *name, const long *args)
+{
+	LogRing_t *rp;
+	LogRecord_t *rec;
+	uint32_t head;
+
+	if ( !__atomic_load_n(&draining, __ATOMIC_ACQUIRE) )
+	{
+		LogRecord_t tmp;
+
+		fillRecord(&tmp, event, name, args);
+		formatRecord(ourSuper.logFile, &tmp);
+		return;
+	}
+	if ( !(rp = myRing) && !(rp = newRing()) )
+		return;
+	head = rp->head;
+	if ( head - __atomic_load_n(&rp->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE )
+	{
+		__atomic_store_n(&rp->dropped, rp->dropped+1, __ATOMIC_RELAXED);
+		return;
+	}
+	rec = rp->recs + (head&(LOG_RING_SIZE-1));
+	fillRecord(rec, event, name, args);
+	__atomic_store_n(&rp->head, head+1, __ATOMIC_RELEASE);
+}
+
+/* Format everything queued so far. Rings are drained one after another, so
+ * if more than one thread logs, their lines are not interleaved by time. */
+static int drainRings(FILE *fp)
+{
+	LogRing_t *rp;
+	int count=0;
+
+	for ( rp = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); rp; rp = rp->next )
+	{
+		uint32_t tail = rp->tail;
+		uint32_t head = __atomic_load_n(&rp->head, __ATOMIC_ACQUIRE);
+		uint32_t dropped;
+
+		while ( tail != head )
+		{
+			formatRecord(fp, rp->recs + (tail&(LOG_RING_SIZE-1)));
+			++tail;
+			++count;
+		}
+		__atomic_store_n(&rp->tail, tail, __ATOMIC_RELEASE);
+		dropped = __atomic_load_n(&rp->dropped, __ATOMIC_RELAXED);
+		if ( dropped != rp->reported )
+		{
+			fprintf(fp, "*** Log ring full. Dropped %u records\n", dropped-rp->reported);
+			rp->reported = dropped;
+			++count;
+		}
+	}
+	return count;
+}
+
+static void *drainLoop(void *arg)
+{
+	FILE *fp = (FILE *)arg;
+
+	while ( !__atomic_load_n(&stopDrain, __ATOMIC_ACQUIRE) )
+	{
+		int count = drainRings(fp);
+		/* Flushing here also pushes out anything written to the log
+		 * directly with fprintf(), which no longer flushes on its own. */
+		fflush(fp);
+		if ( !count )
+			usleep(LOG_IDLE_USECS);
+	}
+	return NULL;
+}
+
+/* Start the drain thread. Call this after fuse has daemonized (i.e. from
+ * the init callback) or the thread would be left behind in the parent. */
+int logStart(MgwfsSuper_t *ourSuper)
+{
+	int sts;
+
+	if ( draining )
+		return 0;
+	__atomic_store_n(&stopDrain, 0, __ATOMIC_RELEASE);
+	sts = pthread_create(&drainThread, NULL, drainLoop, ourSuper->logFile);
+	if ( sts )
+	{
+		fprintf(ourSuper->errFile, "Failed to start the log thread: %s. Logging synchronously.\n", strerror(sts));
+		return -sts;
+	}
+	__atomic_store_n(&draining, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* Stop the drain thread and write out whatever it left behind. Logging
+ * reverts to synchronous. Safe to call more than once. */
+void logStop(MgwfsSuper_t *ourSuper)
+{
+	if ( !draining )
+		return;
+	__atomic_store_n(&draining, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&stopDrain, 1, __ATOMIC_RELEASE);
+	pthread_join(drainThread, NULL);
+	drainRings(ourSuper->logFile);
+	fflush(ourSuper->logFile);
+}
@@ -12,6 +12,7 @@
 
 #include "mgwfs.h"
 #include "version.h"
+#include <time.h>
 
 #define FAKE_TIMESTAMP (850600800)	/* 1996-12-14 14:00:00 PDT */
 
@@ -20,15 +21,21 @@ static void helpEm(FILE *ofp, const char *progname)
 	fprintf(ofp, "Usage: %s [options] <mountpoint>\n", progname);
 	fprintf(ofp, "Filesystem specific options:\n"
 		   "--allocation=n  Specify the default allocation in sectors (default=100)\n"
+		   "--alloc=policy  Specify where new file space comes from: first, next, best or pool (default=best)\n"
 		   "--copies=n      Specify the default number of copies of each file to write (default=1)\n"
 		   "--log=<path>    Specify a path to a logfile (default=stdout)\n"
 		   "--image=<path>  Specify a path to filesystem file (required)\n"
 		   "--readwrite     Specify to allow writing (default is readonly)\n"
 		   "--rw            Specify to allow writing (default is readonly)\n"
 		   "--testpath=<path> Specify a test path into filesystem file (forces a -q)\n"
+		   "--walk=n        Time n passes of a find -ls style walk of the whole tree (forces a -q)\n"
+		   "--frag          Report how fragmented the free space and files are (forces a -q)\n"
 		   "--verbose=n 'n' is bit mask of verbose modes:\n"
 		   "            May be expressed with normal C syntax [i.e. prefix 0x or 0b for hex or binary]:\n"
 		   );
+#if !MGWFS_VERBOSE_MASK
+	fprintf(ofp, "    (none. Verbose output is compiled out of this build)\n");
+#else
 	fprintf(ofp, "    0x%05X = display some small details\n", VERBOSE_MINIMUM);
 	fprintf(ofp, "    0x%05X = display home block\n", VERBOSE_HOME);
 	fprintf(ofp, "    0x%05X = display file headers\n", VERBOSE_HEADERS);
@@ -50,6 +57,7 @@ static void helpEm(FILE *ofp, const char *progname)
 #if !NO_MUTEXES
 	fprintf(ofp, "    0x%05X = display details of locks/unlocks\n", VERBOSE_LOCKS);
 #endif
+#endif	/* MGWFS_VERBOSE_MASK */
 	fprintf(ofp,
 			"-v           Sets verbose flag to a value of 0x001\n"
 			"-q or --quit Quit before starting fuse stuff (i.e. just read home blocks, don't mount)\n"
@@ -68,6 +76,9 @@ static const struct fuse_opt option_spec[] =
 	OPTION( "--copies=%lu", copies ),
 	OPTION( "--image=%s", image ),
 	OPTION( "--testpath=%s", testPath ),
+	OPTION( "--walk=%lu", walk ),
+	OPTION( "--frag", frag ),
+	OPTION( "--alloc=%s", alloc ),
 	OPTION( "--log=%s", logFile ),
 	{ VerboseStr, -1, FUSE_OPT_KEY_OPT},
 	OPTION("-v", verbose ),
@@ -113,12 +124,81 @@ static uint32_t getLe(uint8_t *ptr)
 	return ans;
 }
 
+/*
+ * --walk is a metadata benchmark. It visits every name in the tree the way
+ * "find -ls" does through a read only mount (readdirplus each directory,
+ * which hands back the attributes too, so no getattr per name) but calls
+ * our handlers directly, so the time measured is ours alone and not the
+ * kernel's. Compare mgwfs against mgwfs-fast with it.
+ */
+typedef struct
+{
+	char **names;
+	mode_t *modes;			/* 0 if the filler wasn't given attributes */
+	int numNames;
+	int availNames;
+} WalkList_t;
+
+static int walkFiller(void *buf, const char *name, const struct stat *stbuf, off_t off, enum fuse_fill_dir_flags flags)
+{
+	WalkList_t *list = (WalkList_t *)buf;
+
+	if ( !strcmp(name,".") || !strcmp(name,"..") )
+		return 0;
+	if ( list->numNames >= list->availNames )
+	{
+		int newAvail = list->availNames ? list->availNames*2 : 64;
+		char **newNames = (char **)realloc(list->names, newAvail*sizeof(char *));
+		mode_t *newModes;
+
+		if ( !newNames )
+			return 1;
+		list->names = newNames;
+		newModes = (mode_t *)realloc(list->modes, newAvail*sizeof(mode_t));
+		if ( !newModes )
+			return 1;
+		list->modes = newModes;
+		list->availNames = newAvail;
+	}
+	list->modes[list->numNames] = (stbuf && (flags & FUSE_FILL_DIR_PLUS)) ? stbuf->st_mode : 0;
+	list->names[list->numNames++] = strdup(name);
+	return 0;
+}
+
+static long walkDir(const char *path)
+{
+	WalkList_t list;
+	long visited=0;
+	int ii;
+
+	memset(&list,0,sizeof(list));
+	mgwfs_oper.readdir(path, &list, walkFiller, 0, NULL, FUSE_READDIR_PLUS);
+	for (ii=0; ii < list.numNames; ++ii)
+	{
+		char child[1024];
+		struct stat st;
+
+		snprintf(child, sizeof(child), "%s/%s", strcmp(path,"/") ? path : "", list.names[ii]);
+		st.st_mode = list.modes[ii];
+		if ( st.st_mode || !mgwfs_oper.getattr(child, &st, NULL) )
+		{
+			++visited;
+			if ( S_ISDIR(st.st_mode) )
+				visited += walkDir(child);
+		}
+		free(list.names[ii]);
+	}
+	free(list.names);
+	free(list.modes);
+	return visited;
+}
+
 int main(int argc, char *argv[])
 {
 	int ii;
-	int ret;
+	int ret=0;
 	uint32_t ckSum;
-	MgwfsInode_t *inode, **inodePtr;
+	MgwfsInode_t *inode;
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
 	/* Parse options */
@@ -139,16 +219,18 @@ int main(int argc, char *argv[])
 	if ( options.show_help )
 	{
 		helpEm(stderr,argv[0]);
-		assert(fuse_opt_add_arg(&args, "--help") == 0);
+		if ( fuse_opt_add_arg(&args, "--help") )
+			return 1;
 		args.argv[0][0] = '\0';
 	}
 	else if ( options.show_version )
 	{
 		printf("%s version %s\n", argv[0], VERSION);
-		assert(fuse_opt_add_arg(&args, "--version") == 0);
+		if ( fuse_opt_add_arg(&args, "--version") )
+			return 1;
 		args.argv[0][0] = '\0';
 	}
-	if ( options.testPath )
+	if ( options.testPath || options.walk || options.frag )
 		options.quit = 1;
 	if ( options.logFile )
 	{
@@ -179,7 +261,15 @@ int main(int argc, char *argv[])
 			   options.allocation, options.copies, options.verbose, options.image, options.quit, options.read_write, options.logFile);
 	}
 	ourSuper.verbose = options.verbose;
+	if ( (options.verbose & ~(unsigned long)MGWFS_VERBOSE_MASK) )
+		fprintf(stderr, "Verbose output is compiled out of this build. --verbose=0x%lX ignored.\n", options.verbose);
 	ourSuper.defaultAllocation = options.allocation;
+	ourSuper.allocPolicy = MGWFS_ALLOC_DEFAULT;
+	if ( options.alloc && (ourSuper.allocPolicy = mgwfsAllocPolicy(options.alloc)) < 0 )
+	{
+		fprintf(stderr,"--alloc '%s' can only be first, next, best or pool\n", options.alloc);
+		return 1;
+	}
 	ourSuper.defaultCopies = options.copies;
 	ourSuper.imageName = options.image;
 	ourSuper.lowestCtime = -1;
@@ -201,6 +291,7 @@ int main(int argc, char *argv[])
 		do
 		{
 			int fLim, chkForBootFiles=0;
+			const char *name;
 			struct stat st;
 			off64_t maxHb;
 			off64_t sizeInSectors;
@@ -310,7 +401,7 @@ int main(int argc, char *argv[])
 					displayFileHeader(ourSuper.logFile, &ourSuper.indexSysHdr, 1 | (ourSuper.verbose & VERBOSE_RETPTRS));
 				ourSuper.numInodesAvailable = (ourSuper.indexSysHdr.clusters * 512) / (FSYS_MAX_ALTS * sizeof(uint32_t));
 				ourSuper.indexSys = (IndexSys_t *)calloc(ourSuper.indexSysHdr.clusters * 512, 1);
-				if ( readWholeFile("index.sys", &ourSuper, (uint8_t*)ourSuper.indexSys, ourSuper.indexSysHdr.size, ourSuper.indexSysHdr.pointers[0]) < 0 )
+				if ( readWholeFile("index.sys", &ourSuper, (uint8_t*)ourSuper.indexSys, ourSuper.indexSysHdr.size, ourSuper.indexSysHdr.pointers[0], MGWFS_IO_INDEX) < 0 )
 				{
 					fprintf(ourSuper.errFile,"Failed to read index.sys file\n");
 					if (ourSuper.errFile != stderr)
@@ -335,18 +426,8 @@ int main(int argc, char *argv[])
 				break;
 			}
 			/* First read all the fileheaders in the filesystem */
-			/* Get some memory to hold all the local inodes */
-			ourSuper.inodeList = (MgwfsInode_t **)calloc(ourSuper.numInodesAvailable, sizeof(MgwfsInode_t *));
-			if ( !ourSuper.inodeList )
-			{
-				fprintf(ourSuper.errFile, "Sorry. Not enough memory to hold %d inode pointers (%ld bytes)\n", ourSuper.numInodesAvailable, sizeof(MgwfsInode_t *) * ourSuper.numInodesAvailable);
-				if (ourSuper.errFile != stderr)
-					fprintf(stderr, "Sorry. Not enough memory to hold %d inode pointers (%ld bytes)\n", ourSuper.numInodesAvailable, sizeof(MgwfsInode_t *) * ourSuper.numInodesAvailable);
-				close(ourSuper.fd);
-				return 1;
-			}
-			inodePtr = ourSuper.inodeList;
-			inode = (MgwfsInode_t *)calloc(1,sizeof(MgwfsInode_t));
+			/* Inodes are handed out of chunks indexed by inode number (see newInode()) */
+			inode = newInode(&ourSuper, FSYS_INDEX_INDEX);
 			if ( !inode )
 			{
 				fprintf(ourSuper.errFile, "Sorry. Not enough memory to hold an inode for index.sys (%ld bytes)\n",
@@ -357,12 +438,11 @@ int main(int argc, char *argv[])
 				close(ourSuper.fd);
 				return 1;
 			}
-			memcpy(&inode->fsHeader, &ourSuper.indexSysHdr, sizeof(FsysHeader));
-			*inodePtr++ = inode;
+			memcpy(inode->fsHeader, &ourSuper.indexSysHdr, sizeof(FsysHeader));
 			ret = 0;
 			/*
 			 * index.sys is a dense array of per-inode header LBAs, terminated by
-			 * the first all-empty entry. We load it into inodeList[] with these
+			 * the first all-empty entry. We load it into the inode table with these
 			 * invariants, which the write path (findUnusedInode/updateAllMetaData)
 			 * depends on:
 			 *   - numInodesUsed is the HIGH-WATER MARK (index of the first empty
@@ -388,36 +468,35 @@ int main(int argc, char *argv[])
 				}
 				if ( (lbas->lba[0] & FSYS_EMPTYLBA_BIT) )
 					continue;						/* deleted slot: leave NULL (reusable hole) */
-				inode = (MgwfsInode_t *)calloc(1,sizeof(MgwfsInode_t));
+				inode = newInode(&ourSuper, ii);
 				if ( !inode )
 				{
 					fprintf(ourSuper.errFile, "Sorry. Not enough memory to hold an inode for file %d (%ld bytes)\n",
-							ii, sizeof(MgwfsInode_t));
+							ii, sizeof(MgwfsInode_t) + sizeof(FsysHeader));
 					close(ourSuper.fd);
 					return 1;
 				}
-				ourSuper.inodeList[ii] = inode;
 				snprintf(tmpName,sizeof(tmpName),"Inode %d", ii);
-				if ( getFileHeader(tmpName, &ourSuper, FSYS_ID_HEADER, lbas, &inode->fsHeader) )
+				if ( getFileHeader(tmpName, &ourSuper, FSYS_ID_HEADER, lbas, inode->fsHeader) )
 				{
 					inode->inode_no = ii;
-					if ( inode->fsHeader.mtime && inode->fsHeader.mtime < ourSuper.lowestMtime )
-						ourSuper.lowestMtime = inode->fsHeader.mtime;
-					if ( inode->fsHeader.ctime && inode->fsHeader.ctime < ourSuper.lowestCtime )
-						ourSuper.lowestCtime = inode->fsHeader.ctime;
-					if ( (inode->fsHeader.type == FSYS_TYPE_DIR) )
+					if ( inode->fsHeader->mtime && inode->fsHeader->mtime < ourSuper.lowestMtime )
+						ourSuper.lowestMtime = inode->fsHeader->mtime;
+					if ( inode->fsHeader->ctime && inode->fsHeader->ctime < ourSuper.lowestCtime )
+						ourSuper.lowestCtime = inode->fsHeader->ctime;
+					if ( (inode->fsHeader->type == FSYS_TYPE_DIR) )
 					{
 						inode->mode = S_IFDIR | 0555;
 					}
 					else
 						inode->mode =  S_IFREG | 0444;
 					if ( (ourSuper.verbose&VERBOSE_HEADERS) )
-						displayFileHeader(ourSuper.logFile, &inode->fsHeader, 1 | (ourSuper.verbose & VERBOSE_RETPTRS));
+						displayFileHeader(ourSuper.logFile, inode->fsHeader, 1 | (ourSuper.verbose & VERBOSE_RETPTRS));
 					else if ( (ourSuper.verbose&VERBOSE_MINIMUM) )
 						fprintf(ourSuper.logFile, "Loaded file header (inode) %4d, lbas: 0x%08X 0x%08X 0x%08X. Type=0x%X (%s)\n",
 							   ii,
 							   lbas->lba[0], lbas->lba[1], lbas->lba[2],
-							   inode->fsHeader.type,
+							   inode->fsHeader->type,
 							   S_ISDIR(inode->mode) ? "DIR":"REG");
 					memcpy(inode->fhSectors.lba,lbas,sizeof(IndexSys_t));
 					if ( chkForBootFiles )
@@ -451,9 +530,10 @@ int main(int argc, char *argv[])
 			 * whole table is in use. */
 			if ( ii >= ourSuper.numInodesAvailable )
 				ourSuper.numInodesUsed = ourSuper.numInodesAvailable;
+			seedFreeInodes(&ourSuper);
 			if ( (ourSuper.verbose&VERBOSE_MINIMUM) )
 			{
-				fprintf(ourSuper.logFile, "Inode info: inode size: %ld, inodesAvailable: %d, inodesUsed: %d\n", sizeof(MgwfsInode_t), ourSuper.numInodesAvailable, ourSuper.numInodesUsed);
+				fprintf(ourSuper.logFile, "Inode info: inode size: %ld (+%ld header), inodesAvailable: %d, inodesUsed: %d\n", sizeof(MgwfsInode_t), sizeof(FsysHeader), ourSuper.numInodesAvailable, ourSuper.numInodesUsed);
 			}
 			/* Put fake timestamps in the file headers that are missing them */
 			if ( ourSuper.lowestCtime == -1 )
@@ -468,41 +548,44 @@ int main(int argc, char *argv[])
 				ourSuper.homeBlk.ctime = ourSuper.lowestCtime;
 			if ( !ourSuper.homeBlk.mtime )
 				ourSuper.homeBlk.mtime = ourSuper.lowestMtime;
-			inodePtr = ourSuper.inodeList;
 			for (ii=0; ii < ourSuper.numInodesUsed; ++ii)
 			{
-				inode = *inodePtr++;
-				if ( !inode->fsHeader.ctime )
-					inode->fsHeader.ctime = ourSuper.lowestCtime;
-				if ( !inode->fsHeader.mtime )
-					inode->fsHeader.mtime = ourSuper.lowestMtime;
+				inode = getInode(&ourSuper, ii);
+				if ( !inode )
+					continue;				/* deleted slot */
+				if ( !inode->fsHeader->ctime )
+					inode->fsHeader->ctime = ourSuper.lowestCtime;
+				if ( !inode->fsHeader->mtime )
+					inode->fsHeader->mtime = ourSuper.lowestMtime;
 			}
 			/* The first 4 files don't actually belong to any directory and have no name, so fake it */
-			inodePtr = ourSuper.inodeList;
 			fLim = 4;
 			if ( !ourSuper.homeBlk.journal[0] )
 				fLim = 3;
-			for ( ii = 0; ii < fLim; ++ii, ++inodePtr )
+			for ( ii = 0; ii < fLim; ++ii )
 			{
 				static const char * const Names[] = 
 				{
 					"index.sys", "freemap.sys", "rootdir.sys", "journal.sys"
 				};
-				inode = *inodePtr;
-				strncpy(inode->fileName, Names[ii], MGWFS_FILENAME_MAXLEN);
-				inode->fnLen = strlen(inode->fileName);
+				inode = getInode(&ourSuper, ii);
+				if ( setInodeName(&ourSuper, inode, Names[ii], strlen(Names[ii])) < 0 )
+				{
+					ret = -1;
+					break;
+				}
 				inode->idxParentInode = FSYS_INDEX_ROOT;
 				inode->inode_no = ii;
-				inode->mode = (inode->fsHeader.type == FSYS_TYPE_DIR) ? S_IFDIR | 0555 : S_IFREG | 0444;
+				inode->mode = (inode->fsHeader->type == FSYS_TYPE_DIR) ? S_IFDIR | 0555 : S_IFREG | 0444;
 				/* But we need to read the contents of the freemap file */
 				if ( ii == FSYS_INDEX_FREE )
 				{
 					int jj;
 					FreeMap_t *freeMap = &ourSuper.freeMap;
 					FsysRetPtr *rp;
-					freeMap->rwBuff.buff = (uint8_t *)calloc(inode->fsHeader.clusters, 512);
-					freeMap->freeMapEntriesAvail = (inode->fsHeader.clusters*512 + sizeof(FsysRetPtr) - 1) / sizeof(FsysRetPtr);
-					if ( readWholeFile("freemap.sys", &ourSuper, freeMap->rwBuff.buff, inode->fsHeader.size, inode->fsHeader.pointers[0]) < 0 )
+					freeMap->rwBuff.buff = (uint8_t *)calloc(inode->fsHeader->clusters, 512);
+					freeMap->freeMapEntriesAvail = (inode->fsHeader->clusters*512 + sizeof(FsysRetPtr) - 1) / sizeof(FsysRetPtr);
+					if ( readWholeFile("freemap.sys", &ourSuper, freeMap->rwBuff.buff, inode->fsHeader->size, inode->fsHeader->pointers[0], MGWFS_IO_FREEMAP) < 0 )
 					{
 						fprintf(ourSuper.errFile,"Failed to read freemap.sys file\n");
 						ret = -1;
@@ -527,19 +610,24 @@ int main(int argc, char *argv[])
 					else if ( (ourSuper.verbose & VERBOSE_MINIMUM) )
 					{
 						fprintf(ourSuper.logFile, "Loaded %ld slots (%d bytes) of freemap\n",
-							   (inode->fsHeader.clusters * 512)/sizeof(FsysRetPtr),
-							   inode->fsHeader.clusters * 512
+							   (inode->fsHeader->clusters * 512)/sizeof(FsysRetPtr),
+							   inode->fsHeader->clusters * 512
 							   );
 					}
 				}
 			}
 			if ( ret < 0 )
 				break;
-			inode = ourSuper.inodeList[FSYS_INDEX_ROOT]; /* Point to the root directory */
+			inode = getInode(&ourSuper, FSYS_INDEX_ROOT); /* Point to the root directory */
 			inode->idxParentInode = FSYS_INDEX_ROOT;
 			unpackDir(&ourSuper, inode, 0); /* Create the entire filesystem directory tree */
 			if ( (ourSuper.verbose&VERBOSE_ITERATE) )
 				tree(&ourSuper, FSYS_INDEX_ROOT, 0 );
+			if ( !options.read_write )
+				freezeNamespace(&ourSuper); /* Nothing can rename or unlink from here on */
+			name = checksumInit(); /* Pick the checksum kernel for this CPU */
+			if ( (ourSuper.verbose&VERBOSE_CHECKSUMS) )
+				fprintf(ourSuper.logFile, "Checksums computed with the %s kernel\n", name);
 		} while ( 0 );
 	}
 	if ( ret >= 0 && options.testPath )
@@ -547,6 +635,29 @@ int main(int argc, char *argv[])
 		int idx = findInode(&ourSuper,FSYS_INDEX_ROOT,options.testPath);
 		fprintf(ourSuper.logFile,"getInode('%s') returned %d\n", options.testPath, idx);
 	}
+	if ( ret >= 0 && options.walk )
+	{
+		struct timespec start, end;
+		long visited=0, usecs;
+		unsigned long pass;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (pass=0; pass < options.walk; ++pass)
+			visited += walkDir("/");
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		usecs = (end.tv_sec-start.tv_sec)*1000000 + (end.tv_nsec-start.tv_nsec)/1000;
+		fprintf(ourSuper.logFile, "Walked %ld names in %lu passes in %ld usecs (%.3f usecs per name)\n",
+				visited, options.walk, usecs, visited ? (double)usecs/visited : 0.0);
+	}
+	if ( ret >= 0 && options.frag )
+	{
+		MgwfsIoctlFrag_t fr;
+
+		if ( fragReport(&ourSuper, &fr) < 0 )
+			fprintf(ourSuper.errFile, "Out of memory working out fragmentation\n");
+		else
+			fragShow(ourSuper.logFile, &fr);
+	}
 	fflush(ourSuper.logFile);
 	if ( ret >= 0 && !options.quit )
 	{
@@ -555,25 +666,26 @@ int main(int argc, char *argv[])
 		   filesystem shares mutable state via ourSuper and relies on
 		   single-threaded servicing rather than fine-grained locking. */
 		fuse_opt_add_arg(&args, "-s");
+		if ( options.read_write )
+		{
+			/* libfuse insists mgwfs_init()'s max_read matches the mount's */
+			char maxRead[32];
+
+			snprintf(maxRead, sizeof(maxRead), "-omax_read=%d", MGWFS_MAX_IO_SIZE);
+			fuse_opt_add_arg(&args, maxRead);
+		}
 		ret = fuse_main(args.argc, args.argv, &mgwfs_oper, NULL);
 		fuse_opt_free_args(&args);
 	}
+	logStop(&ourSuper);		/* in case fuse exited without calling destroy */
 	if ( options.logFile )
 		fclose(ourSuper.logFile);
 	if ( ourSuper.fd >= 0 )
 		close(ourSuper.fd);
+	thawNamespace(&ourSuper);
 	if ( ourSuper.indexSys )
 		free( ourSuper.indexSys );
-	if ( (inodePtr = ourSuper.inodeList) )
-	{
-		for (ii=0; ii < ourSuper.numInodesAvailable; ++ii, ++inodePtr)
-		{
-			if ( *inodePtr )
-				free(*inodePtr);
-			*inodePtr = NULL;
-		}
-		free(ourSuper.inodeList);
-	}
+	freeInodeStorage(&ourSuper);
 #if !NO_MUTEXES
 	mgwfs_destroy_mutex();
 	fuse_destroy_mutex();
@@ -10,6 +10,10 @@
 
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE (1)		/* for copy_file_range() */
+#endif
+
 #include "mgwfs.h"
 
 BootSector_t bootSect;
@@ -236,6 +240,7 @@ static int getHBSector(MgwfsSuper_t *ourSuper, off64_t sector, FsysHomeBlock *hb
 				strerror(errno));
 		return 2;
 	}
+	ioCount(ourSuper, MGWFS_IO_HOME, MGWFS_IO_READ, sector-ourSuper->baseSector, 1);
 	cksum = 0;
 	csp = lclSector;
 	for ( jj = 0; jj < BYTES_PER_SECTOR/4; ++jj )
@@ -419,6 +424,7 @@ int getFileHeader(const char *title, MgwfsSuper_t *ourSuper, uint32_t id, IndexS
 			fprintf(ourSuper->errFile,"Failed to read %ld byte file header at sector 0x%lX: %s\n", sizeof(FsysHeader), sector, strerror(errno));
 			continue;
 		}
+		ioCount(ourSuper, MGWFS_IO_HEADER, MGWFS_IO_READ, lbas->lba[ii], 1);
 		if ( lclFhp->id != id )
 		{
 			fprintf(ourSuper->errFile, "Sector at 0x%lX is not a file header:\n", sector);
@@ -464,7 +470,7 @@ int getFileHeader(const char *title, MgwfsSuper_t *ourSuper, uint32_t id, IndexS
 	return 1;
 }
 
-int readWholeFile(const char *title,  MgwfsSuper_t *ourSuper, uint8_t *dst, int bytes, FsysRetPtr *retPtr)
+static int doReadWholeFile(const char *title,  MgwfsSuper_t *ourSuper, uint8_t *dst, int bytes, FsysRetPtr *retPtr, int ioPurpose)
 {
 	off64_t sector, blkLimit;
 	int fd, ptrIdx=0, retSize=0;
@@ -505,11 +511,20 @@ int readWholeFile(const char *title,  MgwfsSuper_t *ourSuper, uint8_t *dst, int
 			fprintf(ourSuper->errFile,"Failed to read %ld bytes for %s. Instead got %ld: %s\n", limit, title, rdSts, strerror(errno));
 			return -1;
 		}
+		ioCount(ourSuper, ioPurpose, MGWFS_IO_READ, sector, (rdSts+BYTES_PER_SECTOR-1)/BYTES_PER_SECTOR);
 		retSize += rdSts;
 	}
 	return retSize;
 }
 
+int readWholeFile(const char *title,  MgwfsSuper_t *ourSuper, uint8_t *dst, int bytes, FsysRetPtr *retPtr, int ioPurpose)
+{
+	uint64_t start = perfNow();
+	int sts = doReadWholeFile(title, ourSuper, dst, bytes, retPtr, ioPurpose);
+	perfDone(MGWFS_PERF_READWHOLEFILE, start);
+	return sts;
+}
+
 void addToDirty(const char *title, MgwfsSuper_t *ourSuper, int idx)
 {
 	int ii, *dInodes;
@@ -655,6 +670,75 @@ static int allocateFHSectors( MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, Index
 	return 0;
 }
 
+/* Number of copies the file has, or will get if it has no sectors yet */
+static int inodeCopies(const MgwfsSuper_t *ourSuper, const MgwfsInode_t *inode)
+{
+	int altIdx, alts=0;
+
+	for (altIdx=0; altIdx < FSYS_MAX_ALTS; ++altIdx)
+	{
+		if ( inode->fsHeader->pointers[altIdx][0].nblocks )
+			++alts;
+	}
+	if ( alts < 1 )
+		alts = ourSuper->defaultCopies;
+	if ( alts < 1 )
+		alts = 1;
+	return alts;
+}
+
+/* Free sectors that haven't been promised to anybody. Anything that takes
+ * sectors from the freemap for a file other than the one they were promised
+ * to has to stay within this, or a file waiting to be written could find its
+ * space gone when it's flushed (usually in release(), where the error is
+ * lost). */
+static uint32_t unpromisedSectors(MgwfsSuper_t *ourSuper)
+{
+	uint32_t avail = mgwfsFreeSectorCount(ourSuper);
+
+	return avail > ourSuper->sectorsReserved ? avail - ourSuper->sectorsReserved : 0;
+}
+
+/*
+ * Delayed allocation. write() and friends only promise the file the sectors
+ * it is growing into: the promise is counted against what's free so a full
+ * disk is still reported right away as ENOSPC, but nothing is taken from the
+ * freemap. writeWholeFile() places the whole file at once when it's flushed,
+ * by which time its final size is known, so each copy can usually go down in
+ * a single piece instead of one piece per write.
+ */
+int reserveSectors(const char *title, MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, int sectors)
+{
+	uint32_t have = inode->fsHeader->clusters + inode->resvSectors;
+	uint32_t need, avail;
+
+	if ( sectors <= (int)have )
+		return 0;
+	need = (sectors - have)*inodeCopies(ourSuper, inode);
+	avail = mgwfsFreeSectorCount(ourSuper);
+	if ( unpromisedSectors(ourSuper) < need )
+	{
+		fprintf(ourSuper->logFile, "%s: reserveSectors(): No room to grow file '%s' to %d sectors (%d free, %d already promised). Returned ENOSPC\n",
+				title, inode->fileName, sectors, avail, ourSuper->sectorsReserved);
+		return -ENOSPC;
+	}
+	inode->resvSectors += sectors - have;
+	ourSuper->sectorsReserved += need;
+	return 0;
+}
+
+/* Give back whatever the file was promised; it's been placed or it's gone */
+void releaseReservation(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode)
+{
+	uint32_t total;
+
+	if ( !inode->resvSectors )
+		return;
+	total = inode->resvSectors*inodeCopies(ourSuper, inode);
+	ourSuper->sectorsReserved = total < ourSuper->sectorsReserved ? ourSuper->sectorsReserved - total : 0;
+	inode->resvSectors = 0;
+}
+
 /*
  * Ensure every copy (alternate) of 'inode' has retrieval pointers covering at
  * least 'sectors' sectors, allocating from the freemap as needed. A single
@@ -662,26 +746,40 @@ static int allocateFHSectors( MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, Index
  * space, or a contiguous extend that runs into an occupied region), so we loop:
  * each round grows the trailing RP when the new chunk abuts it, or starts a
  * fresh RP otherwise, until the copy is fully covered or we run out of space /
- * retrieval-pointer slots. Returns 0 on success or a negative errno.
+ * retrieval-pointer slots. With FREEM_FLAG_CONTIG in flags each copy first
+ * tries to get everything it is missing in one piece (so it reads back with a
+ * single seek) and only takes whatever pieces it can find if there is no such
+ * piece. Only what hasn't been promised to other files (see reserveSectors())
+ * can be taken; whatever was promised to this one is used first, and that
+ * much of the promise is given back. Returns 0 on success or a negative errno.
  */
-int allocateRPSectors( const char *title, MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, RwBuff_t *rwBuff, int sectors)
+int allocateRPSectors( const char *title, MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, RwBuff_t *rwBuff, int sectors, uint32_t flags)
 {
-	int altIdx, alts=0;
+	int altIdx, alts;
+	uint32_t need=0, promised;
 
 	(void)rwBuff;
-	/* Count the copies already present; fall back to the default for a new file. */
-	for (altIdx=0; altIdx < FSYS_MAX_ALTS; ++altIdx)
+	alts = inodeCopies(ourSuper, inode);
+	for (altIdx=0; altIdx < alts; ++altIdx)
 	{
-		if ( inode->fsHeader.pointers[altIdx][0].nblocks )
-			++alts;
+		int have=0, rpIdx;
+
+		for (rpIdx=0; rpIdx < FSYS_MAX_FHPTRS && inode->fsHeader->pointers[altIdx][rpIdx].nblocks; ++rpIdx)
+			have += inode->fsHeader->pointers[altIdx][rpIdx].nblocks;
+		if ( have < sectors )
+			need += sectors - have;
 	}
-	if ( alts < 1 )
-		alts = ourSuper->defaultCopies;
-	if ( alts < 1 )
-		alts = 1;
+	if ( need > unpromisedSectors(ourSuper) + inode->resvSectors*alts )
+	{
+		fprintf(ourSuper->logFile,"%s: allocateRPSectors(): No room to grow file '%s' to %d sectors (%u free, %u promised to other files). Returned ENOSPC\n",
+				title, inode->fileName, sectors, mgwfsFreeSectorCount(ourSuper), ourSuper->sectorsReserved - inode->resvSectors*alts);
+		return -ENOSPC;
+	}
+	/* What the file was promised up to its new size is now placed */
+	promised = inode->fsHeader->clusters + inode->resvSectors;
 	for (altIdx=0; altIdx < alts; ++altIdx)
 	{
-		FsysRetPtr *rps = inode->fsHeader.pointers[altIdx];
+		FsysRetPtr *rps = inode->fsHeader->pointers[altIdx];
 		int rpIdx, have;
 
 		/* How many sectors does this copy already cover, and where's the first
@@ -693,7 +791,7 @@ int allocateRPSectors( const char *title, MgwfsSuper_t *ourSuper, MgwfsInode_t *
 		{
 			MgwfsFoundFreeMap_t fMap;
 			FsysRetPtr *lastRP = rpIdx ? &rps[rpIdx-1] : NULL;
-			int added;
+			int added, found=0;
 
 			memset(&fMap, 0, sizeof(fMap));
 			if ( lastRP )
@@ -704,7 +802,19 @@ int allocateRPSectors( const char *title, MgwfsSuper_t *ourSuper, MgwfsInode_t *
 				fMap.hint.nblocks = lastRP->nblocks;
 			}
 			fMap.minSector = FSYS_COPY_ALG(altIdx, ourSuper->maxHb);
-			if ( !mgwfsFindFree(ourSuper, &fMap, sectors - have, 0) )
+			if ( (flags&FREEM_FLAG_CONTIG) )
+			{
+				found = mgwfsFindFree(ourSuper, &fMap, sectors - have, FREEM_FLAG_CONTIG);
+				if ( !found )
+				{
+					/* mgwfsFindFree() may have cleared minSector on its retry */
+					fMap.minSector = FSYS_COPY_ALG(altIdx, ourSuper->maxHb);
+					if ( (ourSuper->verbose&VERBOSE_WRITES) )
+						fprintf(ourSuper->logFile, "%s: allocateRPSectors('%s'): no single piece of %d sectors for copy %d; taking what there is\n",
+								title, inode->fileName, sectors - have, altIdx);
+				}
+			}
+			if ( !found && !mgwfsFindFree(ourSuper, &fMap, sectors - have, 0) )
 			{
 				fprintf(ourSuper->logFile,"%s: allocateRPSectors(): No room to grow file '%s' to %d sectors (copy %d had %d). Returned ENOSPC\n",
 						title, inode->fileName, sectors, altIdx, have);
@@ -747,11 +857,22 @@ int allocateRPSectors( const char *title, MgwfsSuper_t *ourSuper, MgwfsInode_t *
 		}
 	}
 	addToDirty("allocRPSectors()", ourSuper,FSYS_INDEX_FREE);
-	inode->fsHeader.clusters = sectors;
+	inode->fsHeader->clusters = sectors;
+	if ( inode->resvSectors )
+	{
+		uint32_t left = promised > (uint32_t)sectors ? promised - sectors : 0;
+
+		if ( left < inode->resvSectors )
+		{
+			releaseReservation(ourSuper, inode);
+			inode->resvSectors = left;
+			ourSuper->sectorsReserved += left*alts;
+		}
+	}
 	return 0;
 }
 
-int writeWholeFile(const char *title,  MgwfsSuper_t *ourSuper, MgwfsInode_t *inode)
+static int doWriteWholeFile(const char *title,  MgwfsSuper_t *ourSuper, MgwfsInode_t *inode)
 {
 	off64_t sector, blkLimit;
 	int needFH, ptrIdx=0, retSize=0;
@@ -761,6 +882,8 @@ int writeWholeFile(const char *title,  MgwfsSuper_t *ourSuper, MgwfsInode_t *ino
 	uint32_t sectors;
 	IndexSys_t *fhLBA;
 	RwBuff_t *rwBuff;
+	uint32_t cksum=0;
+	int haveCksum=0;
 	
 	rwBuff = &inode->rwb;
 	sectors = (rwBuff->buffUsed + BYTES_PER_SECTOR - 1) / BYTES_PER_SECTOR;
@@ -778,13 +901,54 @@ int writeWholeFile(const char *title,  MgwfsSuper_t *ourSuper, MgwfsInode_t *ino
 	 * without updating the home block, and the old copy would be read on the
 	 * next mount. */
 	needFH = inode->inode_no && (!inode->fhSectors.lba[0] || (inode->fhSectors.lba[0] & FSYS_EMPTYLBA_BIT));
+	if ( needFH)
+	{
+		// Need to allocate file header sectors
+		if ( allocateFHSectors(ourSuper,inode,fhLBA) < 0 )
+		{
+			fprintf(ourSuper->logFile,"writeWholeFile() returned from allocateFHSectors() with -1. Quit with -ENOSPC\n");
+			return -ENOSPC;
+		}
+	}
+	/* Whatever write() promised the file gets placed now, in one go */
+	releaseReservation(ourSuper, inode);
+	if ( sectors > inode->fsHeader->clusters )
+	{
+		int allocSectors = sectors;
+
+		if ( inode->inode_no == FSYS_INDEX_INDEX || S_ISDIR(inode->mode) )
+		{
+			/* index.sys and directories are written out again every time a
+			 * few more names are added. Growing them to the exact size each
+			 * time would add a sector, and often another retrieval pointer,
+			 * every time; once all of those were used up the new entries
+			 * couldn't be written at all. Grow them by half again (but at
+			 * least the default allocation) instead. */
+			uint32_t grow = inode->fsHeader->clusters/2;
+
+			if ( grow < (uint32_t)ourSuper->defaultAllocation )
+				grow = ourSuper->defaultAllocation;
+			if ( grow < FSYS_DEFAULT_EXTEND )
+				grow = FSYS_DEFAULT_EXTEND;
+			if ( allocSectors < (int)(inode->fsHeader->clusters + grow) )
+				allocSectors = inode->fsHeader->clusters + grow;
+		}
+		// Need to add more sectors to file
+		if ( allocateRPSectors("writeWholeFile()", ourSuper, inode, rwBuff, allocSectors, FREEM_FLAG_CONTIG) < 0 )
+		{
+			fprintf(ourSuper->logFile,"writeWholeFile() returned from allocateRPSectors() with -1. Quit with -ENOSPC\n");
+			return -ENOSPC;
+		}
+	}
+	/* Counted after the allocation above, which may have just given a new
+	 * file its copies */
 	if ( !needFH )
 	{
 		int ii;
 		copies = 0;
 		for (ii=0; ii < FSYS_MAX_ALTS; ++ii)
 		{
-			if ( !inode->fsHeader.pointers[ii][0].nblocks )
+			if ( !inode->fsHeader->pointers[ii][0].nblocks )
 				break;
 			++copies;
 		}
@@ -804,35 +968,28 @@ int writeWholeFile(const char *title,  MgwfsSuper_t *ourSuper, MgwfsInode_t *ino
 				,rwBuff->buffOffset
 				,rwBuff->buffSize
 				,sectors
-				,inode->fsHeader.clusters
+				,inode->fsHeader->clusters
 				,bytes
 				,copies
 				,needFH
 				);
 	}
-	if ( needFH)
+	if ( inode->inode_no > FSYS_INDEX_FREE && !S_ISDIR(inode->mode) )
 	{
-		// Need to allocate file header sectors
-		if ( allocateFHSectors(ourSuper,inode,fhLBA) < 0 )
-		{
-			fprintf(ourSuper->logFile,"writeWholeFile() returned from allocateFHSectors() with -1. Quit with -ENOSPC\n");
-			return -ENOSPC;
-		}
-	}
-	if ( sectors > inode->fsHeader.clusters )
-	{
-//		int newBuffSize;
-		// Need to add more sectors to file
-		if ( allocateRPSectors("writeWholeFile()", ourSuper, inode, rwBuff, sectors) < 0 )
-		{
-			fprintf(ourSuper->logFile,"writeWholeFile() returned from allocateRPSectors() with -1. Quit with -ENOSPC\n");
-			return -ENOSPC;
-		}
+		/* The data is right here, so take its checksum for the checksum
+		 * cache while we're at it. The sum takes in the whole last word,
+		 * so zero what's past EOF in it (it gets written out too). */
+		uint32_t pad = (4 - (rwBuff->buffUsed & 3)) & 3;
+
+		if ( pad && rwBuff->buffUsed + pad <= rwBuff->buffSize )
+			memset(rwBuff->buff + rwBuff->buffUsed, 0, pad);
+		cksum = checksumBuffer(rwBuff->buff, rwBuff->buffUsed);
+		haveCksum = 1;
 	}
 	/* write the file to disk */
 	for (copyCnt=0; copyCnt < copies; ++copyCnt)
 	{
-		retPtr = inode->fsHeader.pointers[copyCnt] + 0;
+		retPtr = inode->fsHeader->pointers[copyCnt] + 0;
 		ptrIdx = 0;
 		retSize = 0;
 		while ( retSize < bytes )
@@ -865,12 +1022,278 @@ int writeWholeFile(const char *title,  MgwfsSuper_t *ourSuper, MgwfsInode_t *ino
 						title, limit, inode->fileName, wrSts, strerror(errno));
 				return -EIO;
 			}
+			ioCount(ourSuper, ioPurposeOf(inode), MGWFS_IO_WRITE, sector, (limit+BYTES_PER_SECTOR-1)/BYTES_PER_SECTOR);
 			retSize += limit;
 		}
 	}
+	if ( haveCksum )
+		checksumCachePut(ourSuper, inode, cksum);
 	return retSize;
 }
 
+int writeWholeFile(const char *title,  MgwfsSuper_t *ourSuper, MgwfsInode_t *inode)
+{
+	uint64_t start = perfNow();
+	int sts = doWriteWholeFile(title, ourSuper, inode);
+	perfDone(MGWFS_PERF_WRITEWHOLEFILE, start);
+	return sts;
+}
+
+/* Set once copy_file_range() has said the image can't do it */
+static int noCopyRange;
+
+static int copySectorRun(const char *title, MgwfsSuper_t *ourSuper, uint32_t from, uint32_t to, uint32_t sectors, uint8_t **bouncePtr)
+{
+	off64_t inOff = ((off64_t)from + ourSuper->baseSector)*BYTES_PER_SECTOR;
+	off64_t outOff = ((off64_t)to + ourSuper->baseSector)*BYTES_PER_SECTOR;
+	size_t left = (size_t)sectors*BYTES_PER_SECTOR;
+	ssize_t sts;
+
+	while ( left && !noCopyRange )
+	{
+		/* Let the host filesystem do it (reflink, server side copy or at
+		 * worst an in-kernel copy) so the data never comes up here. */
+		sts = copy_file_range(ourSuper->fd, &inOff, ourSuper->fd, &outOff, left, 0);
+		if ( sts > 0 )
+		{
+			left -= sts;
+			continue;
+		}
+		if ( sts < 0 && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP && errno != ENOSYS )
+		{
+			fprintf(ourSuper->errFile, "%s: copy_file_range() from sector 0x%X to 0x%X failed: %s\n", title, from, to, strerror(errno));
+			return -EIO;
+		}
+		if ( (ourSuper->verbose&VERBOSE_WRITES) )
+			fprintf(ourSuper->logFile, "%s: copy_file_range() not available on the image (%s). Copying through memory.\n",
+					title, sts < 0 ? strerror(errno) : "returned 0");
+		noCopyRange = 1;
+	}
+	while ( left )
+	{
+		size_t limit = left > MGWFS_MAX_IO_SIZE ? MGWFS_MAX_IO_SIZE : left;
+
+		if ( !*bouncePtr && !(*bouncePtr = (uint8_t *)malloc(MGWFS_MAX_IO_SIZE)) )
+			return -ENOMEM;
+		if ( lseek64(ourSuper->fd, inOff, SEEK_SET) == (off64_t)-1 || (sts = read(ourSuper->fd, *bouncePtr, limit)) != (ssize_t)limit )
+		{
+			fprintf(ourSuper->errFile, "%s: Failed to read %ld bytes at sector 0x%lX: %s\n", title, limit, inOff/BYTES_PER_SECTOR - ourSuper->baseSector, strerror(errno));
+			return -EIO;
+		}
+		if ( lseek64(ourSuper->fd, outOff, SEEK_SET) == (off64_t)-1 || (sts = write(ourSuper->fd, *bouncePtr, limit)) != (ssize_t)limit )
+		{
+			fprintf(ourSuper->errFile, "%s: Failed to write %ld bytes at sector 0x%lX: %s\n", title, limit, outOff/BYTES_PER_SECTOR - ourSuper->baseSector, strerror(errno));
+			return -EIO;
+		}
+		inOff += limit;
+		outOff += limit;
+		left -= limit;
+	}
+	return 0;
+}
+
+/*
+ * Copy 'sectors' sectors from the pieces listed in srcRps[] to the ones in
+ * dstRps[] (each up to FSYS_MAX_FHPTRS long), straight from one place in the
+ * image to another. 'name' and copyCnt are only for the messages.
+ */
+static int copyRetPtrs(const char *title, MgwfsSuper_t *ourSuper, const FsysRetPtr *srcRps, const FsysRetPtr *dstRps,
+					   uint32_t sectors, const char *name, int copyCnt, uint8_t **bouncePtr)
+{
+	const FsysRetPtr *srcRp = srcRps, *dstRp = dstRps;
+	uint32_t srcUsed=0, dstUsed=0, done=0;
+	int sts;
+
+	while ( done < sectors )
+	{
+		uint32_t run = sectors - done;
+
+		if ( srcRp >= srcRps + FSYS_MAX_FHPTRS || !srcRp->nblocks
+			 || dstRp >= dstRps + FSYS_MAX_FHPTRS || !dstRp->nblocks )
+		{
+			fprintf(ourSuper->errFile, "%s: copying '%s' ran out of retrieval pointers at sector %d of %d\n",
+					title, name, done, sectors);
+			return -EIO;
+		}
+		if ( run > srcRp->nblocks - srcUsed )
+			run = srcRp->nblocks - srcUsed;
+		if ( run > dstRp->nblocks - dstUsed )
+			run = dstRp->nblocks - dstUsed;
+		if ( (ourSuper->verbose&VERBOSE_WRITES) )
+			fprintf(ourSuper->logFile, "%s: Copying %d sectors from 0x%08X to 0x%08X for copy %d of %s\n",
+					title, run, srcRp->start + srcUsed, dstRp->start + dstUsed, copyCnt, name);
+		sts = copySectorRun(title, ourSuper, srcRp->start + srcUsed, dstRp->start + dstUsed, run, bouncePtr);
+		if ( sts < 0 )
+			return sts;
+		ioCount(ourSuper, MGWFS_IO_DATA, MGWFS_IO_READ, srcRp->start + srcUsed, run);
+		ioCount(ourSuper, MGWFS_IO_DATA, MGWFS_IO_WRITE, dstRp->start + dstUsed, run);
+		done += run;
+		if ( (srcUsed += run) >= srcRp->nblocks )
+		{
+			++srcRp;
+			srcUsed = 0;
+		}
+		if ( (dstUsed += run) >= dstRp->nblocks )
+		{
+			++dstRp;
+			dstUsed = 0;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Copy the first 'sectors' sectors of src (from its copy 0, same as
+ * readWholeFile() would) into every copy of dst, straight from one place in
+ * the image to another. dst must already have that many sectors allocated.
+ * Neither file's read/write buffer is used.
+ */
+int copyFileSectors(const char *title, MgwfsSuper_t *ourSuper, const MgwfsInode_t *src, MgwfsInode_t *dst, uint32_t sectors)
+{
+	uint8_t *bounce=NULL;
+	int copyCnt, sts=0;
+
+	for (copyCnt=0; copyCnt < FSYS_MAX_ALTS && !sts && dst->fsHeader->pointers[copyCnt][0].nblocks; ++copyCnt)
+		sts = copyRetPtrs(title, ourSuper, src->fsHeader->pointers[0], dst->fsHeader->pointers[copyCnt], sectors, dst->fileName, copyCnt, &bounce);
+	if ( bounce )
+		free(bounce);
+	return sts;
+}
+
+/* Is inode 'idx' waiting in the dirty list to be written out? */
+static int inodeIsDirty(MgwfsSuper_t *ourSuper, int idx)
+{
+	int ii;
+
+	for (ii=0; ii < ourSuper->numDirtyInodes; ++ii)
+	{
+		if ( ourSuper->dirtyInodes[ii] == idx )
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * MGWFS_IOC_DEFRAG: move each copy of 'inode' that is in more than one piece
+ * into a single new piece in its copy region. It's done in an order that
+ * leaves a usable image wherever it stops:
+ *  1. the new pieces are taken and the data is copied into them,
+ *  2. the data is flushed and freemap.sys is written with both the old and
+ *     new pieces in use,
+ *  3. the file header is written pointing at the new pieces and flushed,
+ *  4. the old pieces are freed and freemap.sys is written again.
+ * A crash before 3 leaves the file as it was, one after 3 leaves it moved;
+ * either way the worst that happens is the pieces of one side are lost
+ * until the freemap is rebuilt. The header keeps its mtime.
+ *
+ * Returns 1 if anything was moved, 0 if there was nothing to do or no single
+ * piece was big enough, -EBUSY if the file is open or has changes not yet
+ * written out, or another negative errno. Counts what it did in *dp.
+ */
+int defragFile(const char *title, MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, MgwfsIoctlDefrag_t *dp)
+{
+	FsysRetPtr oldRps[FSYS_MAX_ALTS][FSYS_MAX_FHPTRS];
+	FsysRetPtr newRp[FSYS_MAX_ALTS];
+	uint32_t sectors, clusters;
+	uint8_t *bounce=NULL;
+	int altIdx, ii, moved=0, noRoom=0, rpsBefore=0, sts=0;
+
+	if ( inode->inode_no <= FSYS_INDEX_FREE || (inode->flags&MGWFS_INODE_JOURNAL) )
+		return 0;	/* index.sys and freemap.sys are found through the home block and each other */
+	if ( inode->openRefs || inode->rwb.buff || inode->resvSectors
+		 || (inode->flags&MGWFS_INODE_DATA_DIRTY) || inodeIsDirty(ourSuper, inode->inode_no) )
+	{
+		++dp->filesBusy;
+		return -EBUSY;
+	}
+	clusters = inode->fsHeader->clusters;
+	/* Only what's been written needs copying; the new piece still covers all of clusters */
+	sectors = (inode->fsHeader->size + BYTES_PER_SECTOR - 1)/BYTES_PER_SECTOR;
+	if ( sectors > clusters )
+		sectors = clusters;
+	memcpy(oldRps, inode->fsHeader->pointers, sizeof(oldRps));
+	memset(newRp, 0, sizeof(newRp));
+	for (altIdx=0; altIdx < FSYS_MAX_ALTS && oldRps[altIdx][0].nblocks; ++altIdx)
+	{
+		MgwfsFoundFreeMap_t fMap;
+
+		if ( !oldRps[altIdx][1].nblocks )
+			continue;		/* already in one piece */
+		memset(&fMap, 0, sizeof(fMap));
+		fMap.minSector = FSYS_COPY_ALG(altIdx, ourSuper->maxHb);
+		/* The old piece isn't given back until the header points at the new
+		 * one, so the new one can't use space promised to another file */
+		if ( clusters > unpromisedSectors(ourSuper) || !mgwfsFindFree(ourSuper, &fMap, clusters, FREEM_FLAG_CONTIG) )
+		{
+			if ( (ourSuper->verbose&VERBOSE_WRITES) )
+				fprintf(ourSuper->logFile, "%s: defragFile('%s'): no single piece of %d sectors for copy %d\n",
+						title, inode->fileName, clusters, altIdx);
+			noRoom = 1;
+			continue;
+		}
+		newRp[altIdx] = fMap.result;
+		sts = copyRetPtrs(title, ourSuper, oldRps[altIdx], newRp + altIdx, sectors, inode->fileName, altIdx, &bounce);
+		if ( sts < 0 )
+			break;
+		++moved;
+	}
+	if ( bounce )
+		free(bounce);
+	if ( sts < 0 || !moved )
+	{
+		/* Nothing points at the new pieces yet, so just give them back */
+		for (altIdx=0; altIdx < FSYS_MAX_ALTS; ++altIdx)
+		{
+			if ( newRp[altIdx].nblocks )
+				mgwfsFreeSectors(ourSuper, newRp + altIdx, 0);
+		}
+		if ( noRoom )
+			++dp->filesNoRoom;
+		return sts;
+	}
+	/* 2. The data and the new pieces' place in the freemap go down first */
+	fdatasync(ourSuper->fd);
+	addToDirty(title, ourSuper, FSYS_INDEX_FREE);
+	if ( (sts = updateAllMetaData(title, ourSuper)) < 0 )
+		return sts;
+	fdatasync(ourSuper->fd);
+	/* 3. Then the header that points at them */
+	for (altIdx=0; altIdx < FSYS_MAX_ALTS; ++altIdx)
+	{
+		if ( !newRp[altIdx].nblocks )
+			continue;
+		for (ii=0; ii < FSYS_MAX_FHPTRS && oldRps[altIdx][ii].nblocks; ++ii)
+			++rpsBefore;
+		memset(inode->fsHeader->pointers[altIdx], 0, sizeof(inode->fsHeader->pointers[altIdx]));
+		inode->fsHeader->pointers[altIdx][0] = newRp[altIdx];
+	}
+	if ( (sts = writeFileHeader(ourSuper, inode)) < 0 )
+		return sts;
+	fdatasync(ourSuper->fd);
+	/* 4. Now nothing uses the old pieces */
+	for (altIdx=0; altIdx < FSYS_MAX_ALTS; ++altIdx)
+	{
+		if ( !newRp[altIdx].nblocks )
+			continue;
+		for (ii=0; ii < FSYS_MAX_FHPTRS && oldRps[altIdx][ii].nblocks; ++ii)
+			mgwfsFreeSectors(ourSuper, &oldRps[altIdx][ii], 0);
+	}
+	addToDirty(title, ourSuper, FSYS_INDEX_FREE);
+	if ( (sts = updateAllMetaData(title, ourSuper)) < 0 )
+		return sts;
+	if ( (ourSuper->verbose&VERBOSE_WRITES) )
+		fprintf(ourSuper->logFile, "%s: defragFile('%s'): moved %d cop%s of %d sectors (%d retrieval pointers down to %d)%s\n",
+				title, inode->fileName, moved, moved == 1 ? "y" : "ies", clusters, rpsBefore, moved,
+				noRoom ? ". No room to move the rest" : "");
+	++dp->filesMoved;
+	if ( noRoom )
+		++dp->filesNoRoom;
+	dp->rpsBefore += rpsBefore;
+	dp->rpsAfter += moved;
+	dp->sectorsMoved += (uint64_t)sectors*moved;
+	return 1;
+}
+
 int fileOpen(const char *title, const char *path, MgwfsSuper_t *ourSuper, FuseFH_t *fhp)
 {
 	/* Nothing to do here yet. So just return 0 */
@@ -890,7 +1313,7 @@ static uint8_t *insertFilenameIntoDir(uint8_t *ptr, const MgwfsInode_t *inode, c
 	*ptr++ = inodeIdx&0xFF;
 	*ptr++ = (inodeIdx>>8)&0xFF;
 	*ptr++ = (inodeIdx>>16)&0xFF;
-	*ptr++ = inode->fsHeader.generation;
+	*ptr++ = inode->fsHeader->generation;
 	*ptr++ = fnLen+1;
 	memcpy(ptr,fileName,fnLen);
 	ptr += fnLen;
@@ -937,7 +1360,9 @@ static int writeHomeBlock(MgwfsSuper_t *ourSuper)
 			fprintf(ourSuper->errFile,"%s Failed to write %d bytes to sector 0x%X. Instead got %ld: %s\n",
 					Title, homeBlkP->hb_size, lba, wrSts, strerror(errno));
 			retSts = -EIO;
+			continue;
 		}
+		ioCount(ourSuper, MGWFS_IO_HOME, MGWFS_IO_WRITE, lba, 1);
 	}
 	fflush(ourSuper->logFile);
 	return retSts;
@@ -947,50 +1372,67 @@ int updateAllMetaData(const char *title, MgwfsSuper_t *ourSuper)
 {
 	int sts=0;
 	int inodeIdx, ii;
+	uint64_t start = perfNow();
 
 	LOCK_IT("wrMutex",ourSuper,&wrMutex);
 	while( (inodeIdx = popFmDirty(ourSuper)) >= 0)
 	{
-		MgwfsInode_t *inode, **iPtr;
+		MgwfsInode_t *inode;
 		IndexSys_t *fhLBAs;
+		RwBuff_t openView;
 		
-		inode = ourSuper->inodeList[inodeIdx];
+		inode = getInode(ourSuper, inodeIdx);
 		/* The slot may have been freed after it was marked dirty (e.g. rmdir
 		 * removes a directory that an earlier child-removal had already flagged).
 		 * Its now-empty entry is persisted when index.sys is rebuilt below, so
 		 * there's nothing to write back here; skip it rather than deref NULL. */
 		if ( !inode )
 			continue;
+		memset(&openView,0,sizeof(openView));
+		if ( inodeIdx <= FSYS_INDEX_FREE && inode->openRefs )
+		{
+			/* Somebody has index.sys or freemap.sys open. Set the copy they
+			 * read aside while the live contents are built and written. */
+			openView = inode->rwb;
+			memset(&inode->rwb,0,sizeof(inode->rwb));
+		}
 		switch (inodeIdx)
 		{
 		case FSYS_INDEX_INDEX:
 			if ( inode->rwb.buff )
 				free(inode->rwb.buff);
-			inode->rwb.buff = (uint8_t *)calloc(ourSuper->numInodesAvailable, sizeof(uint32_t) * FSYS_MAX_ALTS);
-			iPtr = ourSuper->inodeList;
+			/* writeWholeFile() writes whole sectors, so the buffer has to
+			 * reach the end of the last one. */
+			inode->rwb.buff = (uint8_t *)calloc(1, (ourSuper->numInodesAvailable*sizeof(IndexSys_t) + BYTES_PER_SECTOR-1) & ~(BYTES_PER_SECTOR-1));
 			fhLBAs = (IndexSys_t *)inode->rwb.buff;
 			for (ii=0; ii < ourSuper->numInodesUsed; ++ii)
 			{
-				inode = *iPtr++;
+				inode = getInode(ourSuper, ii);
 				if ( !inode )
 					fhLBAs->lba[0] = FSYS_EMPTYLBA_BIT;
 				else
 					memcpy(fhLBAs, inode->fhSectors.lba, sizeof(IndexSys_t));
 				++fhLBAs;
 			}
-			inode = ourSuper->inodeList[inodeIdx];
+			inode = getInode(ourSuper, inodeIdx);
 			inode->rwb.buffSize = ourSuper->numInodesAvailable * (sizeof(IndexSys_t));
 			inode->rwb.buffUsed = ii * sizeof(IndexSys_t);
 			inode->rwb.buffOffset = inode->rwb.buffUsed;
 			/* The index grew/shrank with numInodesUsed, so its header size must
 			 * track it; otherwise readWholeFile() reads a stale length on the
 			 * next mount and silently drops the newest inode entries. */
-			inode->fsHeader.size = inode->rwb.buffUsed;
+			inode->fsHeader->size = inode->rwb.buffUsed;
 			break;
 		case FSYS_INDEX_FREE:
 			inode->rwb.buff = ourSuper->freeMap.rwBuff.buff;
-			inode->rwb.buffSize = inode->fsHeader.clusters * FSYS_CLUSTER_SIZE;
-			inode->rwb.buffOffset = inode->fsHeader.size;
+			inode->rwb.buffSize = inode->fsHeader->clusters * FSYS_CLUSTER_SIZE;
+			/* Entries come and go as space is freed and allocated, so the size
+			 * has to follow them (plus the terminating one), the same as
+			 * index.sys above. Left at what it was at mount, the next mount
+			 * reads only that many entries and the space in the rest is lost. */
+			if ( (ourSuper->freeMap.freeMapEntriesUsed+1)*sizeof(FsysRetPtr) <= inode->fsHeader->clusters*BYTES_PER_SECTOR )
+				inode->fsHeader->size = (ourSuper->freeMap.freeMapEntriesUsed+1)*sizeof(FsysRetPtr);
+			inode->rwb.buffOffset = inode->fsHeader->size;
 			inode->rwb.buffUsed = inode->rwb.buffOffset;
 			break;
 		default:
@@ -1002,7 +1444,7 @@ int updateAllMetaData(const char *title, MgwfsSuper_t *ourSuper)
 			 * read the file back as empty. With no live buffer the previously
 			 * persisted size already on the header is the truth; leave it. */
 			if ( inode->rwb.buff )
-				inode->fsHeader.size = inode->rwb.buffUsed;
+				inode->fsHeader->size = inode->rwb.buffUsed;
 			break;
 		}
 		/* Don't restamp if utimens (or similar) already set an explicit
@@ -1011,8 +1453,8 @@ int updateAllMetaData(const char *title, MgwfsSuper_t *ourSuper)
 		if ( (inode->flags & MGWFS_INODE_MTIME_SET) )
 			inode->flags &= ~MGWFS_INODE_MTIME_SET;
 		else
-			inode->fsHeader.mtime = time(NULL);
-		if ( !inode->rwb.buff && inode->fsHeader.type == FSYS_TYPE_DIR )
+			inode->fsHeader->mtime = time(NULL);
+		if ( !inode->rwb.buff && inode->fsHeader->type == FSYS_TYPE_DIR )
 		{
 			/* Pack the directory contents into rwb.buff for write-back. This
 			 * covers empty directories too (idxChildTop == 0), e.g. a freshly
@@ -1026,10 +1468,20 @@ int updateAllMetaData(const char *title, MgwfsSuper_t *ourSuper)
 			UNLOCK_IT("wrMutex", ourSuper, &wrMutex);
 			sts = writeWholeFile("updateAllMetaData()", ourSuper, inode);
 			LOCK_IT("wrMutex", ourSuper, &wrMutex);
+			if ( sts >= 0 )
+				inode->flags &= ~MGWFS_INODE_DATA_DIRTY;
 		}
-		if ( inodeIdx > FSYS_INDEX_FREE && inode->rwb.buff )
-			free(inode->rwb.buff);
-		memset(&inode->rwb,0,sizeof(inode->rwb));
+		if ( inodeIdx > FSYS_INDEX_FREE && inode->openRefs )
+			;	/* Still open; the handles keep sharing the (now written) buffer */
+		else
+		{
+			/* freemap.sys's buffer belongs to ourSuper->freeMap; everything else was ours */
+			if ( inodeIdx != FSYS_INDEX_FREE && inode->rwb.buff )
+				free(inode->rwb.buff);
+			memset(&inode->rwb,0,sizeof(inode->rwb));
+		}
+		if ( openView.buff )
+			inode->rwb = openView;
 		if ( sts < 0 )
 			break;
 		sts = writeFileHeader(ourSuper,inode);
@@ -1042,15 +1494,24 @@ int updateAllMetaData(const char *title, MgwfsSuper_t *ourSuper)
 		sts = writeHomeBlock(ourSuper);
 	}
 	UNLOCK_IT("wrMutex", ourSuper, &wrMutex);
+	perfDone(MGWFS_PERF_UPDATEMETADATA, start);
 	return sts;
 }
 
 int fileClose(const char *title, MgwfsSuper_t *ourSuper, FuseFH_t *fhp)
 {
 	int sts=0;
-	if ( (fhp->openFlags&(O_RDWR|O_WRONLY)) )
+	MgwfsInode_t *inode = getInode(ourSuper, fhp->inode);
+
+	/* Only if the contents changed since they were last written. With the
+	 * writeback cache the kernel has usually pushed the data and set the
+	 * mtime (utimens) before the release, and that already wrote it out;
+	 * writing it again here would restamp the mtime with "now". A writer
+	 * writes it when it closes, and so does the last handle out whatever it
+	 * was opened for, so it's on the disk before freeFuseFHidx() drops it. */
+	if ( inode && (inode->flags & MGWFS_INODE_DATA_DIRTY)
+		 && ((fhp->openFlags&(O_RDWR|O_WRONLY)) || !inode->openRefs) )
 	{
-		MgwfsInode_t *inode = ourSuper->inodeList[fhp->inode];
 		addToDirty("fileClose()", ourSuper, inode->inode_no);
 		sts = updateAllMetaData(title,ourSuper);
 	}
@@ -1066,7 +1527,6 @@ void markInodeUnused(MgwfsSuper_t *ourSuper, MgwfsInode_t **inodePtr)
 {
 	MgwfsInode_t *inode = *inodePtr;
 	int idx = inode->inode_no;
-	RwBuff_t *rwb = &inode->rwb;
 	IndexSys_t *indexPtr;
 	FsysRetPtr tmp;
 	int ii, jj;
@@ -1087,66 +1547,296 @@ void markInodeUnused(MgwfsSuper_t *ourSuper, MgwfsInode_t **inodePtr)
 	}
 	for (ii=0; ii < FSYS_MAX_ALTS; ++ii)
 	{
-		FsysRetPtr *rp = inode->fsHeader.pointers[ii];
+		FsysRetPtr *rp = inode->fsHeader->pointers[ii];
 		for (jj=0; rp->nblocks && jj < FSYS_MAX_FHPTRS; ++jj, ++rp)
 			mgwfsFreeSectors(ourSuper, rp, TRUE);
 	}
 	addToDirty("markInodeUnused():", ourSuper, FSYS_INDEX_FREE);
-	if ( rwb->buff )
-		free(rwb->buff);
-	memset(rwb,0,sizeof(RwBuff_t));
-	free(inode);
-	ourSuper->inodeList[idx] = NULL;
+	releaseInode(ourSuper, inode);
 	*inodePtr = NULL;
 }
 
+/*
+ * Return the header slot for inode 'idx', allocating its chunk on first use.
+ * Slots are never moved or released until unmount, so an inode may keep a
+ * pointer to its slot. Returns NULL if out of memory.
+ */
+FsysHeader *getHeaderSlot(MgwfsSuper_t *ourSuper, int idx)
+{
+	int chunk = idx / MGWFS_HEADERS_PER_CHUNK;
+
+	if ( chunk >= ourSuper->numHdrChunks )
+	{
+		FsysHeader **newChunks;
+		int newNum = chunk + 1;
+
+		newChunks = (FsysHeader **)realloc(ourSuper->hdrChunks, newNum*sizeof(FsysHeader *));
+		if ( !newChunks )
+			return NULL;
+		memset(newChunks + ourSuper->numHdrChunks, 0, (newNum - ourSuper->numHdrChunks)*sizeof(FsysHeader *));
+		ourSuper->hdrChunks = newChunks;
+		ourSuper->numHdrChunks = newNum;
+	}
+	if ( !ourSuper->hdrChunks[chunk] )
+	{
+		ourSuper->hdrChunks[chunk] = (FsysHeader *)calloc(MGWFS_HEADERS_PER_CHUNK, sizeof(FsysHeader));
+		if ( !ourSuper->hdrChunks[chunk] )
+			return NULL;
+	}
+	return ourSuper->hdrChunks[chunk] + (idx % MGWFS_HEADERS_PER_CHUNK);
+}
+
+/*
+ * Give an inode the name 'name' (of 'len' bytes, not necessarily null
+ * terminated). Names are packed into ourSuper->names; a rename that fits
+ * in the old name's space reuses it, otherwise the old space is simply
+ * abandoned until unmount. Returns 0 or -ENOMEM.
+ */
+int setInodeName(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, const char *name, int len)
+{
+	MgwfsNameChunk_t *chunk = ourSuper->names;
+	char *dst;
+
+	if ( len > MGWFS_FILENAME_MAXLEN )
+		len = MGWFS_FILENAME_MAXLEN;
+	if ( inode->fnLen && len <= inode->fnLen )
+		dst = (char *)inode->fileName;
+	else
+	{
+		if ( !chunk || chunk->used + len + 1 > MGWFS_NAME_CHUNK_SIZE )
+		{
+			chunk = (MgwfsNameChunk_t *)malloc(sizeof(MgwfsNameChunk_t));
+			if ( !chunk )
+			{
+				fprintf(ourSuper->logFile, "setInodeName(): Out of memory saving name of inode %d\n", inode->inode_no);
+				return -ENOMEM;
+			}
+			chunk->used = 0;
+			chunk->next = ourSuper->names;
+			ourSuper->names = chunk;
+		}
+		dst = chunk->text + chunk->used;
+		chunk->used += len + 1;
+	}
+	memcpy(dst, name, len);
+	dst[len] = 0;
+	inode->fileName = dst;
+	inode->fnLen = len;
+	return 0;
+}
+
+/*
+ * Return the (possibly free) slot for inode 'idx', allocating its chunk on
+ * first use. Returns NULL if out of memory.
+ */
+static MgwfsInode_t *getInodeSlot(MgwfsSuper_t *ourSuper, int idx)
+{
+	int chunk = idx / MGWFS_INODES_PER_CHUNK;
+
+	if ( chunk >= ourSuper->numInodeChunks )
+	{
+		MgwfsInode_t **newChunks;
+		int newNum = chunk + 1;
+
+		newChunks = (MgwfsInode_t **)realloc(ourSuper->inodeChunks, newNum*sizeof(MgwfsInode_t *));
+		if ( !newChunks )
+			return NULL;
+		memset(newChunks + ourSuper->numInodeChunks, 0, (newNum - ourSuper->numInodeChunks)*sizeof(MgwfsInode_t *));
+		ourSuper->inodeChunks = newChunks;
+		ourSuper->numInodeChunks = newNum;
+	}
+	if ( !ourSuper->inodeChunks[chunk] )
+	{
+		ourSuper->inodeChunks[chunk] = (MgwfsInode_t *)calloc(MGWFS_INODES_PER_CHUNK, sizeof(MgwfsInode_t));
+		if ( !ourSuper->inodeChunks[chunk] )
+			return NULL;
+	}
+	return ourSuper->inodeChunks[chunk] + (idx % MGWFS_INODES_PER_CHUNK);
+}
+
+/*
+ * Claim slot 'idx' for a fresh, zeroed inode with a zeroed header. The slot
+ * must not be marked free (see findUnusedInode()). Returns NULL if out
+ * of memory.
+ */
+MgwfsInode_t *newInode(MgwfsSuper_t *ourSuper, int idx)
+{
+	MgwfsInode_t *inode;
+	FsysHeader *hdr;
+
+	hdr = getHeaderSlot(ourSuper, idx);
+	if ( !hdr )
+		return NULL;
+	inode = getInodeSlot(ourSuper, idx);
+	if ( !inode )
+		return NULL;
+	memset(hdr, 0, sizeof(FsysHeader));
+	memset(inode, 0, sizeof(MgwfsInode_t));
+	checksumCacheForget(ourSuper, idx);
+	inode->fsHeader = hdr;
+	inode->fileName = "";
+	inode->inode_no = idx;
+	inode->flags = MGWFS_INODE_INUSE;
+	return inode;
+}
+
+/* Make sure freeInodeMap has a bit for every slot below 'numSlots' */
+static int growFreeInodeMap(MgwfsSuper_t *ourSuper, int numSlots)
+{
+	int words = (numSlots + 63) / 64;
+	uint64_t *newMap;
+
+	if ( words <= ourSuper->freeInodeMapWords )
+		return 0;
+	newMap = (uint64_t *)realloc(ourSuper->freeInodeMap, words*sizeof(uint64_t));
+	if ( !newMap )
+		return -ENOMEM;
+	memset(newMap + ourSuper->freeInodeMapWords, 0, (words - ourSuper->freeInodeMapWords)*sizeof(uint64_t));
+	ourSuper->freeInodeMap = newMap;
+	ourSuper->freeInodeMapWords = words;
+	return 0;
+}
+
+static void markSlotFree(MgwfsSuper_t *ourSuper, int idx)
+{
+	int word = idx / 64;
+
+	if ( word >= ourSuper->freeInodeMapWords && growFreeInodeMap(ourSuper, idx + 1) < 0 )
+		return;			/* out of memory; the slot just won't be reused this mount */
+	ourSuper->freeInodeMap[word] |= 1ULL << (idx % 64);
+	if ( word < ourSuper->freeInodeHint )
+		ourSuper->freeInodeHint = word;
+}
+
+/*
+ * Take the lowest numbered free slot out of freeInodeMap. Returns its index
+ * or 0 if there are none. Words below freeInodeHint are known to be empty,
+ * so this doesn't rescan the full part of the table on every create.
+ */
+static int claimFreeSlot(MgwfsSuper_t *ourSuper)
+{
+	int word;
+
+	for ( word = ourSuper->freeInodeHint; word < ourSuper->freeInodeMapWords; ++word )
+	{
+		uint64_t bits = ourSuper->freeInodeMap[word];
+		if ( bits )
+		{
+			ourSuper->freeInodeMap[word] = bits & (bits - 1);
+			ourSuper->freeInodeHint = word;
+			return word*64 + __builtin_ctzll(bits);
+		}
+	}
+	ourSuper->freeInodeHint = word;
+	return 0;
+}
+
+/*
+ * Give an inode's slot back. Slots below the high-water mark are marked
+ * free for findUnusedInode() to hand out again.
+ */
+void releaseInode(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode)
+{
+	int idx = inode->inode_no;
+
+	if ( inode->rwb.buff )
+		free(inode->rwb.buff);
+	releaseReservation(ourSuper, inode);
+	memset(inode, 0, sizeof(MgwfsInode_t));
+	checksumCacheForget(ourSuper, idx);
+	if ( idx > FSYS_INDEX_JOURNAL && idx < ourSuper->numInodesUsed )
+		markSlotFree(ourSuper, idx);
+}
+
+/* Mark the deleted slots (holes) left in index.sys as free */
+void seedFreeInodes(MgwfsSuper_t *ourSuper)
+{
+	int idx;
+
+	growFreeInodeMap(ourSuper, ourSuper->numInodesAvailable);
+	for (idx=FSYS_INDEX_JOURNAL+1; idx < ourSuper->numInodesUsed; ++idx)
+	{
+		if ( !getInode(ourSuper, idx) )
+			markSlotFree(ourSuper, idx);
+	}
+}
+
+/* Release the inode and header tables, the free slot map, the checksum cache and the name arena at unmount */
+void freeInodeStorage(MgwfsSuper_t *ourSuper)
+{
+	int ii;
+
+	checksumCacheFree(ourSuper);
+	free(ourSuper->freeInodeMap);
+	ourSuper->freeInodeMap = NULL;
+	ourSuper->freeInodeMapWords = ourSuper->freeInodeHint = 0;
+	for (ii=0; ii < ourSuper->numInodeChunks; ++ii)
+		free(ourSuper->inodeChunks[ii]);
+	free(ourSuper->inodeChunks);
+	ourSuper->inodeChunks = NULL;
+	ourSuper->numInodeChunks = 0;
+	for (ii=0; ii < ourSuper->numHdrChunks; ++ii)
+		free(ourSuper->hdrChunks[ii]);
+	free(ourSuper->hdrChunks);
+	ourSuper->hdrChunks = NULL;
+	ourSuper->numHdrChunks = 0;
+	while ( ourSuper->names )
+	{
+		MgwfsNameChunk_t *next = ourSuper->names->next;
+		free(ourSuper->names);
+		ourSuper->names = next;
+	}
+}
+
 MgwfsInode_t *findUnusedInode(MgwfsSuper_t *ourSuper)
 {
 	int idx;
 	MgwfsInode_t *inode;
 	
-	for ( idx = FSYS_INDEX_JOURNAL + 1; idx < ourSuper->numInodesUsed; ++idx )
+	if ( (idx = claimFreeSlot(ourSuper)) )
 	{
-		if ( !ourSuper->inodeList[idx] )
-			break;
+		if ( (ourSuper->verbose&(VERBOSE_WRITES)) )
+			fprintf(ourSuper->logFile, "findUnusedInode(): Reused inode %d.\n", idx);
 	}
+	else
+		idx = ourSuper->numInodesUsed;
 	if ( idx >= ourSuper->numInodesAvailable )
 	{
-		MgwfsInode_t **inodePtr;
-#define INODE_ADDS (FSYS_DEFAULT_EXTEND*BYTES_PER_SECTOR/(sizeof(uint32_t)*FSYS_MAX_ALTS))
-		int newNum = ourSuper->numInodesAvailable+INODE_ADDS;
+		IndexSys_t *newIndex;
+#define INODE_ADDS ((int)(FSYS_DEFAULT_EXTEND*BYTES_PER_SECTOR/(sizeof(uint32_t)*FSYS_MAX_ALTS)))
+		int newNum = ourSuper->numInodesAvailable;
 
-		inodePtr = (MgwfsInode_t **)realloc(ourSuper->inodeList, newNum*sizeof(MgwfsInode_t));
-		if ( !inodePtr )
+		/* Grow by half again (at least INODE_ADDS) so a bulk create doesn't realloc and copy the whole index every few hundred files */
+		newNum += ( newNum/2 > INODE_ADDS ) ? newNum/2 : INODE_ADDS;
+		/* indexSys[] is indexed by inode number too, so it has to grow with the table */
+		newIndex = (IndexSys_t *)realloc(ourSuper->indexSys, newNum*sizeof(IndexSys_t));
+		if ( !newIndex )
 		{
-			fprintf(ourSuper->logFile, "findUnusedInode(): failed to allocate %ld bytes for more inodes\n", newNum*sizeof(MgwfsInode_t));
+			fprintf(ourSuper->logFile, "findUnusedInode(): failed to allocate %ld bytes for more inodes\n", newNum*sizeof(IndexSys_t));
 			fflush(ourSuper->logFile);
 			return NULL;
 		}
-		ourSuper->numInodesAvailable = newNum;
-		ourSuper->inodeList = inodePtr;
-		if ( (ourSuper->verbose&(VERBOSE_WRITES)) )
-			fprintf(ourSuper->logFile, "findUnusedInode(): Added an additional inode to list. inodesAvailable was %d, now is %d\n", ourSuper->numInodesUsed, ourSuper->numInodesUsed+1);
-	}
-	else
-	{
+		memset(newIndex + ourSuper->numInodesAvailable, 0, (newNum - ourSuper->numInodesAvailable)*sizeof(IndexSys_t));
+		ourSuper->indexSys = newIndex;
 		if ( (ourSuper->verbose&(VERBOSE_WRITES)) )
-			fprintf(ourSuper->logFile, "findUnusedInode(): Reused inode %d.\n", idx);
+			fprintf(ourSuper->logFile, "findUnusedInode(): Added %d inodes to list. inodesAvailable was %d, now is %d\n", newNum - ourSuper->numInodesAvailable, ourSuper->numInodesAvailable, newNum);
+		ourSuper->numInodesAvailable = newNum;
 	}
-	inode = (MgwfsInode_t *)calloc(1,sizeof(MgwfsInode_t));
+	inode = newInode(ourSuper, idx);
 	if ( !inode )
 	{
 		fprintf(ourSuper->logFile, "findUnusedInode(): failed to allocate an inode\n");
 		fflush(ourSuper->logFile);
+		if ( idx < ourSuper->numInodesUsed )
+			markSlotFree(ourSuper, idx);
 		return NULL;
 	}
-	inode->inode_no = idx;
-	inode->fsHeader.ctime = time(NULL);
-	inode->fsHeader.id = FSYS_ID_HEADER;
+	inode->fsHeader->ctime = time(NULL);
+	inode->fsHeader->id = FSYS_ID_HEADER;
 	/* insertFilenameIntoDir() stamps directory entries with generation 1, so
 	 * the header has to carry the same generation or the read path will reject
 	 * the entry ("bad generation") when the volume is next mounted. */
-	inode->fsHeader.generation = 1;
+	inode->fsHeader->generation = 1;
 	/* Reserve the file-header sectors now, at inode-allocation time, rather
 	 * than deferring to write-back. This way an out-of-space (or out-of-free-
 	 * map-entry) condition is reported to fileCreate()/mgwfs_mkdir() as ENOSPC
@@ -1157,7 +1847,7 @@ MgwfsInode_t *findUnusedInode(MgwfsSuper_t *ourSuper)
 	{
 		fprintf(ourSuper->logFile, "findUnusedInode(): no space to reserve header sectors for inode %d; returning ENOSPC\n", idx);
 		fflush(ourSuper->logFile);
-		free(inode);
+		releaseInode(ourSuper, inode);
 		return NULL;
 	}
 	/* If we are claiming a brand new slot at the end (rather than reusing a
@@ -1165,7 +1855,6 @@ MgwfsInode_t *findUnusedInode(MgwfsSuper_t *ourSuper)
 	 * index.sys writer only persists entries [0, numInodesUsed). */
 	if ( idx >= ourSuper->numInodesUsed )
 		ourSuper->numInodesUsed = idx + 1;
-	ourSuper->inodeList[idx] = inode;
 	addToDirty("findUnusedInode():", ourSuper, FSYS_INDEX_INDEX);
 	return inode;
 }
@@ -1176,9 +1865,9 @@ int fileExtend(const char *title, MgwfsSuper_t *ourSuper, FuseFH_t *fhp)
 	int newBuffSize;
 	RwBuff_t *rwBuff;
 	
-	inode = ourSuper->inodeList[fhp->inode];
-	inode->fsHeader.clusters += ourSuper->homeBlk.def_extend;
-	newBuffSize = inode->fsHeader.clusters * BYTES_PER_SECTOR;
+	inode = getInode(ourSuper, fhp->inode);
+	inode->fsHeader->clusters += ourSuper->homeBlk.def_extend;
+	newBuffSize = inode->fsHeader->clusters * BYTES_PER_SECTOR;
 	rwBuff = &inode->rwb;
 	if ( rwBuff->buffSize < newBuffSize )
 	{
@@ -1216,7 +1905,7 @@ static int insertIntoDir(MgwfsSuper_t *ourSuper, MgwfsInode_t *dirInode, MgwfsIn
 	fileInode->idxNextInode = idx;
 	if ( idx )
 	{
-		inode = ourSuper->inodeList[idx];
+		inode = getInode(ourSuper, idx);
 		if ( inode )
 			inode->idxPrevInode = fileInode->inode_no;
 	}
@@ -1251,12 +1940,16 @@ int fileCreate(const char *title, const char *path,  MgwfsSuper_t *ourSuper)
 		nameOnly = path;
 	else
 		++nameOnly;					/* step past the '/' to the bare filename */
-	strncpy(inode->fileName,nameOnly,sizeof(inode->fileName)-1);
-	inode->fileName[sizeof(inode->fileName)-1] = 0;
+	if ( setInodeName(ourSuper, inode, nameOnly, strlen(nameOnly)) < 0 )
+	{
+		free(tmpDir);
+		markInodeUnused(ourSuper,&inode);
+		return -ENOMEM;
+	}
 	/* A freshly allocated header is FSYS_TYPE_EMPTY (0); mark it a plain file
 	 * so it both reads back as a regular file (main.c derives st_mode from
 	 * this) and isn't mistaken for an unused header. */
-	inode->fsHeader.type = FSYS_TYPE_FILE;
+	inode->fsHeader->type = FSYS_TYPE_FILE;
 	inode->mode = S_IFREG | 0664;
 	dir = strrchr(tmpDir, '/');
 	if ( !dir || dir == tmpDir )
@@ -1270,7 +1963,7 @@ int fileCreate(const char *title, const char *path,  MgwfsSuper_t *ourSuper)
 	sts = findInode(ourSuper, FSYS_INDEX_ROOT, tmpDir);
 	if ( sts > 0 )
 	{
-		dirInode = ourSuper->inodeList[sts];
+		dirInode = getInode(ourSuper, sts);
 		if ( !dirInode )
 			sts = -ENOTDIR;
 		else
@@ -1293,6 +1986,8 @@ int fileCreate(const char *title, const char *path,  MgwfsSuper_t *ourSuper)
 	}
 	else
 	{
+		/* Gets laid down when it is closed, even if nothing is written */
+		inode->flags |= MGWFS_INODE_DATA_DIRTY;
 		sts = inode->inode_no;
 	}
 	fflush(ourSuper->logFile);
@@ -1407,7 +2102,7 @@ void verifyFreemap(MgwfsSuper_t *ourSuper)
 	FsysRetPtr *ourUsedMap, *rp, *rpMax;
 	uint32_t mlstrt;
 	IndexSys_t *indexPtr;
-	MgwfsInode_t *inodePtr, **inodePtrPtr;
+	MgwfsInode_t *inodePtr;
 	FsysRetPtr tmp, *missingList, *mlptr;
 	int missingListSize;
 	uint32_t totalFreeSectors, totalUsedSectors, totalMergedSectors, totalFakeFree=0;
@@ -1429,13 +2124,12 @@ void verifyFreemap(MgwfsSuper_t *ourSuper)
 	ourSuper->verbose = 0;
 	tmpSuper.logFile = ourSuper->logFile;
 	tmpSuper.errFile = ourSuper->errFile;
-	tmpSuper.inodeList = (MgwfsInode_t **)calloc(FSYS_INDEX_FREE+1, sizeof(MgwfsInode_t *));
-	tmpSuper.inodeList[FSYS_INDEX_INDEX] = (MgwfsInode_t *)calloc(1, sizeof(MgwfsInode_t));
-//	tmpSuper.inodeList[FSYS_INDEX_INDEX]->fsHeader.size = 0;
-	tmpSuper.inodeList[FSYS_INDEX_FREE] = (MgwfsInode_t *)calloc(1, sizeof(MgwfsInode_t));
-	tmpSuper.inodeList[FSYS_INDEX_FREE]->fsHeader.size = 0;
-	tmpSuper.inodeList[FSYS_INDEX_FREE]->fsHeader.clusters = 10;
-	tmpFreeMap->freeMapEntriesAvail = 8*(tmpSuper.inodeList[FSYS_INDEX_FREE]->fsHeader.clusters*BYTES_PER_SECTOR)/sizeof(FsysRetPtr);
+	newInode(&tmpSuper, FSYS_INDEX_INDEX);
+//	getInode(&tmpSuper, FSYS_INDEX_INDEX)->fsHeader->size = 0;
+	newInode(&tmpSuper, FSYS_INDEX_FREE);
+	getInode(&tmpSuper, FSYS_INDEX_FREE)->fsHeader->size = 0;
+	getInode(&tmpSuper, FSYS_INDEX_FREE)->fsHeader->clusters = 10;
+	tmpFreeMap->freeMapEntriesAvail = 8*(getInode(&tmpSuper, FSYS_INDEX_FREE)->fsHeader->clusters*BYTES_PER_SECTOR)/sizeof(FsysRetPtr);
 	ourUsedMap = (FsysRetPtr *)calloc(tmpFreeMap->freeMapEntriesAvail,sizeof(FsysRetPtr));
 	tmpFreeMap->rwBuff.buff = (uint8_t *)ourUsedMap;
 	tmpFreeMap->freeMapEntriesUsed = 0;
@@ -1460,15 +2154,14 @@ void verifyFreemap(MgwfsSuper_t *ourSuper)
 			}
 		}
 	}
-	inodePtrPtr = ourSuper->inodeList;
-	for ( idx = 0; idx < ourSuper->numInodesAvailable; ++idx )
+	for ( idx = 0; idx < ourSuper->numInodesUsed; ++idx )
 	{
-		if ( !(inodePtr = *inodePtrPtr++) )
-			break;
+		if ( !(inodePtr = getInode(ourSuper, idx)) )
+			continue;		/* deleted slot (or no journal) */
 		for (altIdx=0; altIdx < FSYS_MAX_ALTS; ++altIdx)
 		{
 			/* Add all the sectors of the file's contents */
-			rp = inodePtr->fsHeader.pointers[altIdx];
+			rp = inodePtr->fsHeader->pointers[altIdx];
 			rpMax = rp+FSYS_MAX_FHPTRS;
 			while ( rp < rpMax && rp->nblocks && rp->start )
 			{
@@ -1538,7 +2231,7 @@ void verifyFreemap(MgwfsSuper_t *ourSuper)
 	memcpy(tmpSuper.freeMap.rwBuff.buff, freeMap->rwBuff.buff, freeMap->freeMapEntriesAvail * sizeof(FsysRetPtr));
 	tmpFreeMap->freeMapEntriesUsed = freeMap->freeMapEntriesUsed;
 	/* Copy the actual freemap.sys fileheader to local */
-	tmpSuper.inodeList[FSYS_INDEX_FREE]->fsHeader = ourSuper->inodeList[FSYS_INDEX_FREE]->fsHeader;
+	*getInode(&tmpSuper, FSYS_INDEX_FREE)->fsHeader = *getInode(ourSuper, FSYS_INDEX_FREE)->fsHeader;
 	/* ourUsedMap holds list of used sectors */
 	fprintf(ourSuper->logFile, "Total of used entries list: %d, total of free entries: %d, total of potential both used+free: %d, total available: %d\n",
 			idx,
@@ -1576,9 +2269,7 @@ void verifyFreemap(MgwfsSuper_t *ourSuper)
 			);
 	free(tmpFreeMap->rwBuff.buff);
 	free(ourUsedMap);
-	free(tmpSuper.inodeList[FSYS_INDEX_INDEX]);
-	free(tmpSuper.inodeList[FSYS_INDEX_FREE]);
-	free(tmpSuper.inodeList);
+	freeInodeStorage(&tmpSuper);
 }
 
 /* This function will unpack a directory and create a linked list of MgwfsInode_t inodes contained therein */
@@ -1589,7 +2280,7 @@ int unpackDir(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, int nest)
 	MgwfsInode_t *prevInodePtr, *child=NULL;
 	static const char ErrTitle[] = "unpackDir(): ERROR:";
 	
-	if ( inode->fsHeader.type != FSYS_TYPE_DIR )
+	if ( inode->fsHeader->type != FSYS_TYPE_DIR )
 	{
 		/* The inode has to be a directory type else give up */
 		fprintf(ourSuper->logFile, "%sFile '%s' at inode %d is not a directory\n", ErrTitle, inode->fileName, inode->inode_no);
@@ -1615,15 +2306,15 @@ int unpackDir(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, int nest)
 		return -1;
 	}
 	/* Get a buffer big enough to hold the on-disk directory contents */
-	mem = dirContents = (uint8_t *)malloc(inode->fsHeader.size);
+	mem = dirContents = (uint8_t *)malloc(inode->fsHeader->size);
 	if ( !dirContents )
 	{
 		fprintf(ourSuper->logFile, "%sOut of memory allocating %d bytes to hold dir '%s' at inode %d\n",
-				ErrTitle, inode->fsHeader.size, inode->fileName, inode->inode_no);
+				ErrTitle, inode->fsHeader->size, inode->fileName, inode->inode_no);
 		return -1;
 	}
 	/* Fill the buffer with the file contents */
-	if ( readWholeFile(inode->fileName, ourSuper, dirContents, inode->fsHeader.size, inode->fsHeader.pointers[0] ) < 0 )
+	if ( readWholeFile(inode->fileName, ourSuper, dirContents, inode->fsHeader->size, inode->fsHeader->pointers[0], MGWFS_IO_DIR ) < 0 )
 	{
 		fprintf(ourSuper->logFile, "%sFailed to read directory file '%s' at inode 0x%04X\n", ErrTitle, inode->fileName, inode->inode_no);
 		free(dirContents);
@@ -1633,7 +2324,7 @@ int unpackDir(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, int nest)
 	prevInodePtr = inode;			/* remember the current inode pointer  */
 	nextPtr = &inode->idxChildTop;	/* point to place to put index should this inode be itself a directory */
 	prevIdx = 0;					/* There's no previous for the first entry in this directory */
-	while ( dirContents < mem+inode->fsHeader.size )
+	while ( dirContents < mem+inode->fsHeader->size )
 	{
 		int txtLen;
 		uint8_t gen;
@@ -1644,7 +2335,7 @@ int unpackDir(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, int nest)
 		dirContents += 3;
 		/* Get the generation number */
 		gen = *dirContents++;
-		if ( dirContents >= mem+inode->fsHeader.size )
+		if ( dirContents >= mem+inode->fsHeader->size )
 			break;				/* off end of buffer */
 		/* Get the null terminated filename length */
 		txtLen = *dirContents++;
@@ -1678,7 +2369,7 @@ int unpackDir(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, int nest)
 		 * or it names a slot that holds no loaded inode (e.g. a stale directory
 		 * entry left pointing at a since-freed inode), it's nfg. The NULL check
 		 * guards the dereference below. */
-		if ( fid >= ourSuper->numInodesAvailable || !ourSuper->inodeList[fid] )
+		if ( fid >= ourSuper->numInodesAvailable || !getInode(ourSuper, fid) )
 		{
 			fprintf(ourSuper->logFile, "%sFound file '%s' in dir '%s' with invalid/unallocated fid: %d. fid must be 0 < fid < %d and resolve to a live inode. Skipped\n",
 					ErrTitle, dirContents, inode->fileName, fid, ourSuper->numInodesAvailable);
@@ -1686,8 +2377,8 @@ int unpackDir(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, int nest)
 		else
 		{
 			/* Point to the MgwfsInode_t assigned to this file */
-			child = ourSuper->inodeList[fid];
-			if ( child->fsHeader.generation != gen )
+			child = getInode(ourSuper, fid);
+			if ( child->fsHeader->generation != gen )
 			{
 				/* The generation number doesn't match, so this entry is nfg */
 				fprintf(ourSuper->logFile,"%sFound file '%s' (fid %d) in dir '%s' (inode %d) with bad generation. Expected %d, was %d. Skipped\n",
@@ -1695,7 +2386,7 @@ int unpackDir(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, int nest)
 						dirContents, fid,
 						inode->fileName, inode->inode_no,
 						gen,
-						child->fsHeader.generation
+						child->fsHeader->generation
 						);
 			}
 			else if ( (strcmp((char *)dirContents,"..") && strcmp((char *)dirContents,".")) && (child->idxNextInode || child->idxChildTop || child->idxParentInode) )
@@ -1717,7 +2408,11 @@ int unpackDir(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, int nest)
 				if ( !skip )
 				{
 					/* Copy the filename into our inode */
-					strncpy(child->fileName, (char *)dirContents, MGWFS_FILENAME_MAXLEN);
+					if ( setInodeName(ourSuper, child, (char *)dirContents, strnlen((char *)dirContents, txtLen)) < 0 )
+					{
+						ret = -1;
+						break;
+					}
 					if ( (ourSuper->verbose&VERBOSE_DMPROOT) && !nest )
 					{
 						fprintf(ourSuper->logFile,"rootdir.sys: gen %02X, fid=0x%06X, len=%3d, %s\n",
@@ -1764,7 +2459,7 @@ int unpackDir(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, int nest)
 
 int tree(MgwfsSuper_t *ourSuper, int topIdx, int nest)
 {
-	MgwfsInode_t *inode=ourSuper->inodeList[topIdx];
+	MgwfsInode_t *inode=getInode(ourSuper, topIdx);
 	int ret, nextIdx;
 	
 	if ( !inode )
@@ -1800,7 +2495,7 @@ int tree(MgwfsSuper_t *ourSuper, int topIdx, int nest)
 		}
 		if ( !(nextIdx = inode->idxNextInode) )
 			break;
-		inode = ourSuper->inodeList[nextIdx];
+		inode = getInode(ourSuper, nextIdx);
 		if ( nextIdx == inode->idxNextInode )
 		{
 			fprintf(ourSuper->logFile, "ERROR: Infinite loop. fid=%d, next=%d\n", inode->inode_no, inode->idxNextInode);
@@ -1810,7 +2505,163 @@ int tree(MgwfsSuper_t *ourSuper, int topIdx, int nest)
 	return 0;
 }
 
-int findInode(MgwfsSuper_t *ourSuper, int topIdx, const char *path)
+/*
+ * Hash of a directory entry: FNV-1a over the name, seeded with the parent's
+ * inode index so the same name in different directories lands in different
+ * slots. Never returns 0.
+ */
+static uint32_t lookupHash(int parentIdx, const char *name, int len)
+{
+	uint32_t hash = 2166136261u ^ (uint32_t)parentIdx;
+	int ii;
+
+	for (ii=0; ii < len; ++ii)
+	{
+		hash ^= (uint8_t)name[ii];
+		hash *= 16777619u;
+	}
+	return hash ? hash : 1;
+}
+
+static int frozenFindChild(MgwfsSuper_t *ourSuper, int parentIdx, const char *name, int len)
+{
+	MgwfsLookup_t *tbl = ourSuper->frozen;
+	MgwfsLookupEnt_t *ent;
+	uint32_t hash, slot;
+
+	hash = lookupHash(parentIdx, name, len);
+	for ( slot = hash & tbl->mask; (ent = tbl->ents + slot)->idx; slot = (slot + 1) & tbl->mask )
+	{
+		MgwfsInode_t *inode;
+
+		if ( ent->hash != hash )
+			continue;
+		inode = getInode(ourSuper, ent->idx);
+		if (    inode->idxParentInode == parentIdx
+			 && !strncmp(inode->fileName, name, len)
+			 && !inode->fileName[len]
+		   )
+		{
+			return ent->idx;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Build the immutable name table for a read-only mount. Must be called after
+ * unpackDir() has populated the whole tree and before FUSE starts servicing
+ * requests. Returns 0 on success; on failure the mount simply keeps using the
+ * linear directory walk in findInode().
+ */
+int freezeNamespace(MgwfsSuper_t *ourSuper)
+{
+	MgwfsLookup_t *tbl;
+	int ii, entries=0;
+	uint32_t slots;
+
+	for (ii=FSYS_INDEX_ROOT; ii < ourSuper->numInodesUsed; ++ii)
+	{
+		MgwfsInode_t *inode = getInode(ourSuper, ii);
+		if ( inode && S_ISDIR(inode->mode) )
+			entries += inode->numInodes;
+	}
+	/* Keep the load factor at or below 50% so probe runs stay short */
+	for ( slots = 64; slots < (uint32_t)entries*2; slots <<= 1 )
+		;
+	tbl = (MgwfsLookup_t *)calloc(1, sizeof(MgwfsLookup_t));
+	if ( tbl )
+		tbl->ents = (MgwfsLookupEnt_t *)calloc(slots, sizeof(MgwfsLookupEnt_t));
+	if ( !tbl || !tbl->ents )
+	{
+		fprintf(ourSuper->logFile, "freezeNamespace(): Out of memory allocating %d lookup slots. Using directory walks instead.\n", slots);
+		free(tbl);
+		return -ENOMEM;
+	}
+	tbl->mask = slots - 1;
+	/* Enter names straight from each directory's child list, in list order,
+	 * so a lookup finds exactly what the directory walk would (including the
+	 * first of any duplicate names on a damaged volume). */
+	for (ii=FSYS_INDEX_ROOT; ii < ourSuper->numInodesUsed; ++ii)
+	{
+		MgwfsInode_t *dir = getInode(ourSuper, ii);
+		int child;
+
+		if ( !dir || !S_ISDIR(dir->mode) )
+			continue;
+		for ( child = dir->idxChildTop; child && tbl->numEnts < (int)slots/2; child = getInode(ourSuper, child)->idxNextInode )
+		{
+			MgwfsInode_t *inode = getInode(ourSuper, child);
+			uint32_t hash, slot;
+
+			if ( inode->idxParentInode != ii )
+				continue;
+			hash = lookupHash(ii, inode->fileName, inode->fnLen);
+			for ( slot = hash & tbl->mask; tbl->ents[slot].idx; slot = (slot + 1) & tbl->mask )
+				;
+			tbl->ents[slot].hash = hash;
+			tbl->ents[slot].idx = child;
+			++tbl->numEnts;
+		}
+	}
+	ourSuper->frozen = tbl;
+	if ( (ourSuper->verbose&VERBOSE_MINIMUM) )
+		fprintf(ourSuper->logFile, "freezeNamespace(): %d names in %d lookup slots\n", tbl->numEnts, slots);
+	return 0;
+}
+
+void thawNamespace(MgwfsSuper_t *ourSuper)
+{
+	MgwfsLookup_t *tbl = ourSuper->frozen;
+
+	ourSuper->frozen = NULL;
+	if ( tbl )
+	{
+		free(tbl->ents);
+		free(tbl);
+	}
+}
+
+/*
+ * findInode() for a frozen namespace: resolve an absolute path one component
+ * at a time through the lookup table, without copying components or walking
+ * sibling lists. Mirrors the results of the directory walk below, including
+ * a trailing '/' naming the directory itself.
+ */
+static int frozenFindInode(MgwfsSuper_t *ourSuper, const char *path)
+{
+	int idx = FSYS_INDEX_ROOT;
+
+	while ( *path == '/' && idx )
+	{
+		const char *name = path + 1;
+		const char *cp = strchr(name, '/');
+		int len = cp ? cp - name : (int)strlen(name);
+
+		if ( !len )
+		{
+			/* Only a trailing '/' is allowed; "//" names nothing */
+			if ( cp )
+				idx = 0;
+			break;
+		}
+		if ( len > MGWFS_FILENAME_MAXLEN )
+			idx = 0;
+		else
+			idx = frozenFindChild(ourSuper, idx, name, len);
+		if ( !cp )
+			break;
+		path = cp;
+	}
+	if ( (ourSuper->verbose & VERBOSE_LOOKUP) )
+	{
+		fprintf(ourSuper->logFile,"\tgetInode(): frozen lookup returned value of %d\n", idx );
+		fflush(ourSuper->logFile);
+	}
+	return idx;
+}
+
+static int doFindInode(MgwfsSuper_t *ourSuper, int topIdx, const char *path)
 {
 	char partPath[MGWFS_FILENAME_MAXLEN+1];
 	MgwfsInode_t *inode;
@@ -1823,6 +2674,8 @@ int findInode(MgwfsSuper_t *ourSuper, int topIdx, const char *path)
 		fprintf(ourSuper->logFile,"getInode(): Looking for '%s' from top idx %d\n" ,path, topIdx);
 		fflush(ourSuper->logFile);
 	}
+	if ( ourSuper->frozen && topIdx == FSYS_INDEX_ROOT && *path == '/' )
+		return frozenFindInode(ourSuper, path);
 	if ( *path == '/' )
 	{
 		++path;
@@ -1835,7 +2688,7 @@ int findInode(MgwfsSuper_t *ourSuper, int topIdx, const char *path)
 			}
 			return topIdx;
 		}
-		topIdx = ourSuper->inodeList[FSYS_INDEX_ROOT]->idxChildTop;
+		topIdx = getInode(ourSuper, FSYS_INDEX_ROOT)->idxChildTop;
 	}
 	cp = strchr(path,'/');
 	if ( !cp )
@@ -1852,7 +2705,7 @@ int findInode(MgwfsSuper_t *ourSuper, int topIdx, const char *path)
 		partPath[maxLen] = 0;
 		path = cp+1;
 	}
-	inode = ourSuper->inodeList[topIdx];
+	inode = getInode(ourSuper, topIdx);
 	do
 	{
 		if ( (ourSuper->verbose & VERBOSE_LOOKUP_ALL) )
@@ -1868,14 +2721,14 @@ int findInode(MgwfsSuper_t *ourSuper, int topIdx, const char *path)
 		}
 		if ( !inode->idxNextInode )
 			break;
-		inode = ourSuper->inodeList[inode->idxNextInode];
+		inode = getInode(ourSuper, inode->idxNextInode);
 	} while (1);
 	if ( ret && *path )
 	{
 		/* More stuff to look through. Though, this part has to be a directory */
-		inode = ourSuper->inodeList[ret];
+		inode = getInode(ourSuper, ret);
 		if ( inode->idxChildTop )
-			ret = findInode(ourSuper, inode->idxChildTop, path);
+			ret = doFindInode(ourSuper, inode->idxChildTop, path);
 		else
 		{
 			if ( (ourSuper->verbose & VERBOSE_LOOKUP) )
@@ -1895,6 +2748,14 @@ int findInode(MgwfsSuper_t *ourSuper, int topIdx, const char *path)
 	return ret;
 }
 
+int findInode(MgwfsSuper_t *ourSuper, int topIdx, const char *path)
+{
+	uint64_t start = perfNow();
+	int idx = doFindInode(ourSuper, topIdx, path);
+	perfDone(MGWFS_PERF_FINDINODE, start);
+	return idx;
+}
+
 #define FUSEFH_INCREMENTS (64)		/* Number of new FuseFH_t structures to get at one time */
 
 static FuseFH_t *getNewFuseFHidx(MgwfsSuper_t *ourSuper)
@@ -1937,9 +2798,13 @@ void freeFuseFHidx(MgwfsSuper_t *ourSuper, uint64_t idx)
 	if ( idx )
 	{
 		FuseFH_t *fhp = ourSuper->fuseFHs + (idx - 1);
-		if ( !(fhp->openFlags&(O_WRONLY|O_RDWR)) )
+		MgwfsInode_t *inode = getInode(ourSuper, fhp->inode);
+		/* The file's data is shared by all its open handles, so only the last
+		 * one out may drop it, whatever it was opened for. fileClose() has
+		 * already written it if it had changed; a flush made while the file
+		 * was still open (utimens, say) leaves the buffer behind for it. */
+		if ( inode && !inode->openRefs )
 		{
-			MgwfsInode_t *inode = ourSuper->inodeList[fhp->inode];
 			if ( inode->rwb.buff )
 				free(inode->rwb.buff);
 			memset(&inode->rwb,0,sizeof(inode->rwb));
@@ -1978,7 +2843,7 @@ int writeFileHeader(MgwfsSuper_t *super, MgwfsInode_t *inode)
 		fileID = FSYS_ID_INDEX;
 		lbas = (IndexSys_t *)super->homeBlk.index;
 	}
-	inode->fsHeader.id = fileID;
+	inode->fsHeader->id = fileID;
 	fd = super->fd;
 	for (alts=0; alts < FSYS_MAX_ALTS; ++alts)
 	{
@@ -2001,13 +2866,14 @@ int writeFileHeader(MgwfsSuper_t *super, MgwfsInode_t *inode)
 					bigSector, inode->fileName, strerror(errno));
 			continue;
 		}
-		sts = write(fd, (uint8_t *)&inode->fsHeader, sizeof(FsysHeader));
+		sts = write(fd, (uint8_t *)inode->fsHeader, sizeof(FsysHeader));
 		if ( sts != sizeof(FsysHeader) )
 		{
 			fprintf(super->errFile, "writeFileHeader(): Failed to write %ld byte file header of '%s' at sector 0x%X: %s\n",
 					sizeof(FsysHeader), inode->fileName, sector, strerror(errno));
 			continue;
 		}
+		ioCount(super, MGWFS_IO_HEADER, MGWFS_IO_WRITE, lbas->lba[alts], 1);
 		++wrote;
 	}
 	if ( !wrote )
@@ -2044,12 +2910,12 @@ int writeDirectory(MgwfsSuper_t *super, MgwfsInode_t *dir)
 #define DIR_ENTRY_BYTES(namelen) (5 + (namelen) + 1)
 	siz = DIR_ENTRY_BYTES(2) + DIR_ENTRY_BYTES(1) + 4;	/* "..", "." and trailing fid of 0 */
 	nxt = dir->idxChildTop;
-	top = super->inodeList[dir->inode_no];
+	top = getInode(super, dir->inode_no);
 	/* An empty directory has no children (idxChildTop == 0); it still gets the
 	 * two synthesized ".." / "." entries sized above, so just skip the walk. */
 	while ( nxt )
 	{
-		child = super->inodeList[nxt];
+		child = getInode(super, nxt);
 		siz += DIR_ENTRY_BYTES(strlen(child->fileName));
 		nxt = child->idxNextInode;
 	}
@@ -2068,12 +2934,12 @@ int writeDirectory(MgwfsSuper_t *super, MgwfsInode_t *dir)
 	}
 	dir->rwb.buffSize = alloc;
 	ptr = dir->rwb.buff;
-	ptr = insertFilenameIntoDir(ptr, super->inodeList[dir->idxParentInode], "..");
-	ptr = insertFilenameIntoDir(ptr, super->inodeList[dir->inode_no], ".");
+	ptr = insertFilenameIntoDir(ptr, getInode(super, dir->idxParentInode), "..");
+	ptr = insertFilenameIntoDir(ptr, getInode(super, dir->inode_no), ".");
 	nxt = dir->idxChildTop;
 	while ( nxt )
 	{
-		child = super->inodeList[nxt];
+		child = getInode(super, nxt);
 		ptr = insertFilenameIntoDir(ptr, child, child->fileName);
 		nxt = child->idxNextInode;
 	}
@@ -2087,7 +2953,7 @@ int writeDirectory(MgwfsSuper_t *super, MgwfsInode_t *dir)
 	 * step (which saw an empty buffer), so set the header size here from the
 	 * freshly packed contents; otherwise the header persists size 0 and the
 	 * directory reads back empty on the next mount. */
-	dir->fsHeader.size = dir->rwb.buffUsed;
+	dir->fsHeader->size = dir->rwb.buffUsed;
 	if ( (super->verbose&VERBOSE_WRITES) )
 	{
 		int blk, rp;
@@ -2100,10 +2966,10 @@ int writeDirectory(MgwfsSuper_t *super, MgwfsInode_t *dir)
 			for (rp=0; rp < FSYS_MAX_FHPTRS; ++rp)
 			{
 				fprintf(super->logFile, " 0x%X/0x%X"
-						,dir->fsHeader.pointers[blk][rp].start
-						,dir->fsHeader.pointers[blk][rp].nblocks
+						,dir->fsHeader->pointers[blk][rp].start
+						,dir->fsHeader->pointers[blk][rp].nblocks
 						 );
-				if ( !dir->fsHeader.pointers[blk][rp].start )
+				if ( !dir->fsHeader->pointers[blk][rp].start )
 					break;
 			}
 			fprintf(super->logFile,"\n");
@@ -24,10 +24,13 @@
 #include <errno.h>
 #include <stddef.h>
 #include <linux/magic.h>
+#include <linux/falloc.h>
 #include <sys/vfs.h>
 #include <sys/ioctl.h>
 #include <assert.h>
 #include <ctype.h>
+#include <limits.h>
+#include <time.h>
 #if !NO_MUTEXES
 #include <pthread.h>
 #endif
@@ -37,6 +40,7 @@ typedef uint32_t sector_t;
 #include "agcfsys.h"
 
 #define MGWFS_FILENAME_MAXLEN 255		/* Techincally, the spec says filenames could be 256 bytes long, but we limit them here */
+#define MGWFS_MAX_IO_SIZE (1024*1024)	/* largest read/write/readahead asked of the kernel on --rw mounts */
 #define MGWFS_MAX_NEST_LEVEL (64)		/* Arbitary limit on how deeply nested directories may go (just for sanity's sake) */
 
 #define n_elts(x) (int)(sizeof(x)/sizeof(x[0]))
@@ -56,6 +60,7 @@ typedef struct
 	uint32_t inode;			/* file ID of open file */
 	int instances;			/* number of times this file is open() */
 	int openFlags;			/* flags passed in on open() */
+	off_t offset;			/* this handle's file position (the data itself is shared in the inode's rwb) */
 } FuseFH_t;
 
 typedef struct
@@ -63,29 +68,47 @@ typedef struct
 	uint32_t lba[FSYS_MAX_ALTS];
 } IndexSys_t;
 
+/* The fields a stat() or directory walk needs come first and the whole
+ * struct is kept small: the file's 504 byte header lives in a chunked side
+ * table (see getHeaderSlot()) and its name in a shared string arena. */
 typedef struct MgwfsInode_t
 {
-	int idxParentInode;				/* Index to parent directory's inode (i.e. super->inodeList[xx]) */
-	int idxNextInode;				/* Index to next inode in this directory (i.e. super->inodeList[xx]) */
-	int idxPrevInode;				/* Index to previous inode in this directory (i.e. super->inodeList[xx]) */
+	int idxParentInode;				/* Index to parent directory's inode (i.e. getInode(super,xx)) */
+	int idxNextInode;				/* Index to next inode in this directory (i.e. getInode(super,xx)) */
+	int idxPrevInode;				/* Index to previous inode in this directory (i.e. getInode(super,xx)) */
 	int idxChildTop;				/* Index to list of inodes if this is a directory */
 	int numInodes;					/* number of inodes in this directory */
 	uint32_t inode_no;				/* file's local ID (relative to indexSys) */
-	IndexSys_t fhSectors;			/* on disk sector ID's to copies of FH (from index.sys) */
 	mode_t mode;					/* file's mode */
-	int fnLen;						/* Filename length */
-	FsysHeader fsHeader;			/* File's header */
-	RwBuff_t rwb;
 	uint32_t flags;					/* MGWFS_INODE_* bits (see below) */
-	char fileName[MGWFS_FILENAME_MAXLEN+1];	/* File's name */
+	FsysHeader *fsHeader;			/* File's header (in ourSuper->hdrChunks) */
+	const char *fileName;			/* File's name (in ourSuper->names, never NULL) */
+	int fnLen;						/* Filename length */
+	int openRefs;					/* number of open FuseFH_t's using rwb */
+	uint32_t resvSectors;			/* sectors (per copy) promised past fsHeader->clusters but not yet placed */
+	IndexSys_t fhSectors;			/* on disk sector ID's to copies of FH (from index.sys) */
+	RwBuff_t rwb;					/* file's contents while open, shared by every handle on it */
 } MgwfsInode_t;
 
+#define MGWFS_INODES_PER_CHUNK	(256)	/* Inodes allocated at a time. An inode never moves once handed out */
+#define MGWFS_HEADERS_PER_CHUNK	(256)	/* File headers allocated at a time. A header never moves once handed out */
+#define MGWFS_NAME_CHUNK_SIZE	(16384)	/* Bytes of filenames allocated at a time */
+
+typedef struct MgwfsNameChunk_t
+{
+	struct MgwfsNameChunk_t *next;
+	int used;						/* bytes of text[] handed out so far */
+	char text[MGWFS_NAME_CHUNK_SIZE];
+} MgwfsNameChunk_t;
+
 /* Bits for MgwfsInode_t.flags */
 #define MGWFS_INODE_BOOT_IDX	(0)		/* file's boot index (2 bits: value 0 to 3) */
 #define MGWFS_INODE_BOOT_MASK	(3)		/* file's boot index (2 bits: value 0 to 3) */
 #define MGWFS_INODE_ANY_BOOT	(1<<2)	/* file is set as a boot file (which file of 4 in bits 0&1)*/
 #define MGWFS_INODE_JOURNAL		(1<<3)	/* file is set as journal */
 #define MGWFS_INODE_MTIME_SET	(1<<4)	/* mtime was set explicitly (e.g. via utimens); do not restamp on flush */
+#define MGWFS_INODE_INUSE		(1<<5)	/* slot holds a live inode (clear = free, see getInode()) */
+#define MGWFS_INODE_DATA_DIRTY	(1<<6)	/* rwb.buff has changes not yet written to disk */
 
 enum
 {
@@ -113,28 +136,36 @@ enum
 	VERB_BIT_MAX
 };
 
-#define VERBOSE_MINIMUM		(1<<VERB_BIT_MINIMUM)	/* display the minimum */
-#define VERBOSE_HOME		(1<<VERB_BIT_HOME)		/* display home block */
-#define VERBOSE_HEADERS		(1<<VERB_BIT_HEADERS)	/* display file headers */
-#define VERBOSE_RETPTRS		(1<<VERB_BIT_RETPTRS)	/* display retrieval pointers in file headers */
-#define VERBOSE_READ		(1<<VERB_BIT_READ)		/* display read requests */
-#define VERBOSE_INDEX		(1<<VERB_BIT_INDEX)		/* display index.sys file and header */
-#define VERBOSE_FREE		(1<<VERB_BIT_FREE)		/* display free primitives */
-#define VERBOSE_FREEMAP		(1<<VERB_BIT_FREEMAP)	/* display freemap file and header */
-#define VERBOSE_VERIFY_FREEMAP	(1<<VERB_BIT_VERIFY_FREEMAP)	/* display freemap file and header */
-#define VERBOSE_DMPROOT		(1<<VERB_BIT_DMPROOT)	/* dump root directory contents and header */
-#define VERBOSE_UNPACK		(1<<VERB_BIT_UNPACK)	/* Display details during unpack() */
-#define VERBOSE_LOOKUP		(1<<VERB_BIT_LOOKUP)	/* Show instances of directory searches */
-#define VERBOSE_LOOKUP_ALL	(1<<VERB_BIT_LOOKUP_ALL)/* Show details doing directory searches */
-#define VERBOSE_ITERATE		(1<<VERB_BIT_ITERATE)	/* iterate directory tree */
-#define VERBOSE_FUSE		(1<<VERB_BIT_FUSE)		/* Show fuse stuff */
-#define VERBOSE_FUSE_CMD	(1<<VERB_BIT_FUSE_CMD)	/* Show fuse commands */
-#define VERBOSE_WRITES		(1<<VERB_BIT_WRITES)	/* Show details of anything related to file writes */
-#define VERBOSE_CHECKSUMS	(1<<VERB_BIT_CHECKSUMS)	/* Show details of reading+writing checksums file */
+/* Release builds (make mgwfs-fast) define MGWFS_VERBOSE_MASK as 0. That
+ * makes every VERBOSE_xxx a constant 0, so each (verbose&VERBOSE_xxx) test
+ * and the logging behind it is dropped by the compiler. */
+#ifndef MGWFS_VERBOSE_MASK
+#define MGWFS_VERBOSE_MASK	(~0)
+#endif
+#define VERB_MASK(bit)		((1<<(bit))&MGWFS_VERBOSE_MASK)
+
+#define VERBOSE_MINIMUM		VERB_MASK(VERB_BIT_MINIMUM)	/* display the minimum */
+#define VERBOSE_HOME		VERB_MASK(VERB_BIT_HOME)		/* display home block */
+#define VERBOSE_HEADERS		VERB_MASK(VERB_BIT_HEADERS)	/* display file headers */
+#define VERBOSE_RETPTRS		VERB_MASK(VERB_BIT_RETPTRS)	/* display retrieval pointers in file headers */
+#define VERBOSE_READ		VERB_MASK(VERB_BIT_READ)		/* display read requests */
+#define VERBOSE_INDEX		VERB_MASK(VERB_BIT_INDEX)		/* display index.sys file and header */
+#define VERBOSE_FREE		VERB_MASK(VERB_BIT_FREE)		/* display free primitives */
+#define VERBOSE_FREEMAP		VERB_MASK(VERB_BIT_FREEMAP)	/* display freemap file and header */
+#define VERBOSE_VERIFY_FREEMAP	VERB_MASK(VERB_BIT_VERIFY_FREEMAP)	/* display freemap file and header */
+#define VERBOSE_DMPROOT		VERB_MASK(VERB_BIT_DMPROOT)	/* dump root directory contents and header */
+#define VERBOSE_UNPACK		VERB_MASK(VERB_BIT_UNPACK)	/* Display details during unpack() */
+#define VERBOSE_LOOKUP		VERB_MASK(VERB_BIT_LOOKUP)	/* Show instances of directory searches */
+#define VERBOSE_LOOKUP_ALL	VERB_MASK(VERB_BIT_LOOKUP_ALL)/* Show details doing directory searches */
+#define VERBOSE_ITERATE		VERB_MASK(VERB_BIT_ITERATE)	/* iterate directory tree */
+#define VERBOSE_FUSE		VERB_MASK(VERB_BIT_FUSE)		/* Show fuse stuff */
+#define VERBOSE_FUSE_CMD	VERB_MASK(VERB_BIT_FUSE_CMD)	/* Show fuse commands */
+#define VERBOSE_WRITES		VERB_MASK(VERB_BIT_WRITES)	/* Show details of anything related to file writes */
+#define VERBOSE_CHECKSUMS	VERB_MASK(VERB_BIT_CHECKSUMS)	/* Show details of reading+writing checksums file */
 #if !NO_MUTEXES
-#define VERBOSE_LOCKS		(1<<VERB_BIT_LOCKS)		/* Show details of lock/unlock */
+#define VERBOSE_LOCKS		VERB_MASK(VERB_BIT_LOCKS)		/* Show details of lock/unlock */
 #endif
-#define VERBOSE_ANY			((1<<VERB_BIT_MAX)-1)	/* Any verbose bit */
+#define VERBOSE_ANY			(((1<<VERB_BIT_MAX)-1)&MGWFS_VERBOSE_MASK)	/* Any verbose bit */
 
 //#define MAX_DIRTY_INODE 100
 
@@ -150,12 +181,43 @@ typedef struct
 
 #define FREEMAP_RP_PTR(ptr) (FsysRetPtr *)(ptr->rwBuff.buff)
 
+/*
+ * Name lookup table used on read-only mounts. Once the directory tree has
+ * been unpacked and the mount can never change it, every (parent, name) pair
+ * is hashed into one open-addressed table, so each path component is one
+ * probe instead of a walk along the sibling list. The table is built once
+ * before FUSE starts and never written again; it is released only after
+ * fuse_main() returns.
+ */
+typedef struct
+{
+	uint32_t hash;			/* hash of parent index and name */
+	int idx;				/* inode index of the entry (0 = empty slot) */
+} MgwfsLookupEnt_t;
+
+typedef struct
+{
+	MgwfsLookupEnt_t *ents;	/* the slots */
+	uint32_t mask;			/* number of slots - 1 (always a power of 2) */
+	int numEnts;			/* number of slots in use */
+} MgwfsLookup_t;
+
 #define SPECIAL_DIRTY_INDEX 0x01	/* index.sys is dirty */
 #define SPECIAL_DIRTY_FREE	0x02	/* freemap.sys is dirty */
 #define SPECIAL_DIRTY_HOME	0x04	/* homeblock is dirty */
 
 #define MAX_NUM_BOOT_FILES (4)
 
+/* A file's last known checksum, good only while its header still matches */
+typedef struct
+{
+	uint32_t size;			/* fsHeader->size when the checksum was taken */
+	uint32_t mtime;			/* fsHeader->mtime when the checksum was taken */
+	uint32_t cksum;			/* the checksum */
+	uint8_t generation;		/* fsHeader->generation when the checksum was taken */
+	uint8_t valid;			/* non-zero if this entry holds anything */
+} MgwfsCksumCache_t;
+
 typedef struct MgwfsSuper_t
 {
 	int fd;					/* file descriptor used to read/write image file */
@@ -170,7 +232,11 @@ typedef struct MgwfsSuper_t
 	FsysHomeBlock homeBlk;	/* A copy of our home block from disk */
 	FsysHeader indexSysHdr;	/* copy of the file header of index.sys */
 	IndexSys_t *indexSys;	/* Contents of index.sys file */
-	MgwfsInode_t **inodeList;
+	MgwfsInode_t **inodeChunks; /* inodes, MGWFS_INODES_PER_CHUNK to a chunk, indexed by inode number */
+	int numInodeChunks;		/* number of entries in inodeChunks */
+	uint64_t *freeInodeMap;	/* one bit per inode slot, set if the slot is free (below numInodesUsed) */
+	int freeInodeMapWords;	/* number of words in freeInodeMap */
+	int freeInodeHint;		/* no bits are set in the words of freeInodeMap below this one */
 	int numInodesUsed;		/* number of items in list */
 	int numInodesAvailable; /* number of items available in list */
 	FreeMap_t freeMap;		/* Contents of freemap.sys file */
@@ -184,10 +250,32 @@ typedef struct MgwfsSuper_t
 	int numFuseFHs;			/* number of items available in fuseFHs */
 	uint32_t lowestCtime;	/* lowest non-zero ctime found anywhere */
 	uint32_t lowestMtime;	/* lowest non-zero ctime found anywhere */
+	MgwfsLookup_t *frozen;	/* immutable name table (read-only mounts only, else NULL) */
+	FsysHeader **hdrChunks;	/* file headers, MGWFS_HEADERS_PER_CHUNK to a chunk, indexed by inode number */
+	int numHdrChunks;		/* number of entries in hdrChunks */
+	MgwfsNameChunk_t *names; /* arena holding every inode's fileName */
+	MgwfsCksumCache_t *cksumCache; /* cached checksums, indexed by inode number */
+	int numCksumCache;		/* number of entries in cksumCache */
+	uint32_t sectorsReserved; /* every inode's resvSectors times its number of copies */
+	int allocPolicy;		/* which of AllocPolicies[] mgwfsFindFree() uses (MGWFS_ALLOC_xxx) */
+	uint32_t allocCursor[FSYS_MAX_ALTS]; /* next fit: where the last allocation in each copy region ended */
 } MgwfsSuper_t;
 
 #include "mgwfsctl.h"
 
+/* Inode 'idx', or NULL if that slot is free or out of range */
+static inline MgwfsInode_t *getInode(const MgwfsSuper_t *ss, int idx)
+{
+	MgwfsInode_t *chunk;
+
+	if ( (unsigned)idx >= (unsigned)(ss->numInodeChunks*MGWFS_INODES_PER_CHUNK) )
+		return NULL;
+	if ( !(chunk = ss->inodeChunks[idx/MGWFS_INODES_PER_CHUNK]) )
+		return NULL;
+	chunk += idx%MGWFS_INODES_PER_CHUNK;
+	return (chunk->flags & MGWFS_INODE_INUSE) ? chunk : NULL;
+}
+
 #if !NO_MUTEXES
 extern void mgwfs_destroy_mutex(void);
 extern void fuse_destroy_mutex(void);
@@ -277,8 +365,10 @@ extern void displayFileHeader(FILE *outp, FsysHeader *fhp, int retrievalsToo);
 extern void displayHomeBlock(FILE *outp, const FsysHomeBlock *homeBlkp, uint32_t cksum);
 extern int getHomeBlock(MgwfsSuper_t *ourSuper, off64_t maxHb, off64_t sizeInSectors, uint32_t *ckSumP);
 extern int getFileHeader(const char *title, MgwfsSuper_t *ourSuper, uint32_t id, IndexSys_t *lbas, FsysHeader *fhp);
-extern int readWholeFile(const char *title,  MgwfsSuper_t *ourSuper, uint8_t *dst, int bytes, FsysRetPtr *retPtr);
+extern int readWholeFile(const char *title,  MgwfsSuper_t *ourSuper, uint8_t *dst, int bytes, FsysRetPtr *retPtr, int ioPurpose);
 extern int writeWholeFile(const char *title,  MgwfsSuper_t *ourSuper, MgwfsInode_t *inode);
+extern int copyFileSectors(const char *title, MgwfsSuper_t *ourSuper, const MgwfsInode_t *src, MgwfsInode_t *dst, uint32_t sectors);
+extern int defragFile(const char *title, MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, MgwfsIoctlDefrag_t *dp);
 extern int flushFile(const char *title, MgwfsSuper_t *ourSuper, FuseFH_t *fhp);
 extern void dumpIndex(FILE *outp, IndexSys_t *indexBase, int bytes);
 extern int dumpFreemap(FILE *outp, const char *title, FsysRetPtr *rpBase, int maxEntries, uint32_t *totSectors );
@@ -287,22 +377,201 @@ extern void verifyFreemap(MgwfsSuper_t *ourSuper);
 extern int unpackDir(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, int nest);
 extern int tree(MgwfsSuper_t *ourSuper, int topIdx, int nest);
 extern int findInode(MgwfsSuper_t *ourSuper, int topIdx, const char *path);
+extern int freezeNamespace(MgwfsSuper_t *ourSuper);
+extern void thawNamespace(MgwfsSuper_t *ourSuper);
 extern int countSectors(FsysRetPtr *rp, int maxRps, uint32_t *totalSectors);
 extern FuseFH_t *getFuseFHidx(MgwfsSuper_t *ourSuper, uint64_t idx);
 extern void freeFuseFHidx(MgwfsSuper_t *ourSuper, uint64_t idx);
 extern int writeFileHeader(MgwfsSuper_t *super, MgwfsInode_t *inode);
 extern int writeDirectory(MgwfsSuper_t *super, MgwfsInode_t *dir);
-extern int allocateRPSectors(const char *title, MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, RwBuff_t *rwBuff, int sectors);
+extern int allocateRPSectors(const char *title, MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, RwBuff_t *rwBuff, int sectors, uint32_t flags);
+extern int reserveSectors(const char *title, MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, int sectors);
+extern void releaseReservation(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode);
 extern MgwfsInode_t *findUnusedInode(MgwfsSuper_t *super);
 extern void markInodeUnused(MgwfsSuper_t *ourSuper, MgwfsInode_t **inodePtr);
+extern MgwfsInode_t *newInode(MgwfsSuper_t *ourSuper, int idx);
+extern void releaseInode(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode);
+extern void seedFreeInodes(MgwfsSuper_t *ourSuper);
+extern FsysHeader *getHeaderSlot(MgwfsSuper_t *ourSuper, int idx);
+extern int setInodeName(MgwfsSuper_t *ourSuper, MgwfsInode_t *inode, const char *name, int len);
+extern void freeInodeStorage(MgwfsSuper_t *ourSuper);
 extern int updateAllMetaData(const char *title, MgwfsSuper_t *ourSuper);
 extern void addToDirty(const char *title, MgwfsSuper_t *super, int idx);
 
+/* Disk reads done off the main thread, added up so they can be handed to
+ * ioCountRun() afterwards (ioCount() isn't thread safe). */
+typedef struct
+{
+	uint32_t sector;		/* where the first read started */
+	uint32_t nextSector;	/* where the last read ended */
+	uint32_t sectors;		/* sectors read */
+	uint32_t calls;			/* pread()s done */
+	uint32_t sequential;	/* of those after the first, how many started where the one before ended */
+} MgwfsIoRun_t;
+
+/* functions in checksum.c */
+typedef struct
+{
+	int inode;				/* inode being checksummed (for the caller's use) */
+	uint32_t size;			/* bytes to checksum */
+	const uint8_t *data;	/* if not NULL, checksum this in memory copy instead of reading the disk */
+	const FsysRetPtr *retPtr;	/* else read the file through these (its copy 0 retrieval pointers) */
+	uint32_t cksum;			/* result */
+	int sts;				/* 0 if cksum is valid, else negative errno. Set > 0 beforehand to skip the job. */
+	int cached;				/* set by checksumFiles() if cksum came out of the checksum cache */
+	uint32_t expected;		/* what cksum should come out as (only used with a maxBad) */
+	int started;			/* set by checksumFiles() once a worker has taken the job */
+	MgwfsIoRun_t io;		/* what the worker read (for checksumFiles()'s use) */
+} ChecksumJob_t;
+
+extern const char *checksumInit(void);
+extern uint32_t checksumBuffer(const void *buf, int bytes);
+extern int checksumFiles(MgwfsSuper_t *ourSuper, ChecksumJob_t *jobs, int numJobs, int useCache, int maxBad);
+extern int checksumCacheGet(MgwfsSuper_t *ourSuper, const MgwfsInode_t *inode, uint32_t *cksum);
+extern void checksumCachePut(MgwfsSuper_t *ourSuper, const MgwfsInode_t *inode, uint32_t cksum);
+extern void checksumCacheForget(MgwfsSuper_t *ourSuper, int idx);
+extern void checksumCacheFree(MgwfsSuper_t *ourSuper);
+
+/* functions in log.c */
+typedef enum
+{
+	LOG_EV_GETATTR,
+	LOG_EV_GETATTR_ENOENT,
+	LOG_EV_READDIR,
+	LOG_EV_READDIR_ENOENT,
+	LOG_EV_READDIR_NOTDIR,
+	LOG_EV_READDIR_ENTRY,
+	LOG_EV_OPEN,
+	LOG_EV_OPEN_EEXIST,
+	LOG_EV_OPEN_ENOENT,
+	LOG_EV_OPEN_EISDIR,
+	LOG_EV_OPEN_OK,
+	LOG_EV_OPEN_READERR,
+	LOG_EV_READ,
+	LOG_EV_READ_COPY,
+	LOG_EV_READ_NOTOPEN,
+	LOG_EV_READ_BUFFERR,
+	LOG_EV_READ_NOINODE,
+	LOG_EV_RELEASE,
+	LOG_EV_STATFS,
+	LOG_EV_UNLINK,
+	LOG_EV_UNLINK_ENOENT,
+	LOG_EV_UNLINK_EISDIR,
+	LOG_EV_WRITE_BEFORE,
+	LOG_EV_WRITE_ADDED,
+	LOG_EV_WRITE_AFTER,
+	LOG_EV_WRITE_NOTOPEN,
+	LOG_EV_WRITE_EISDIR,
+	LOG_EV_FLUSH,
+	LOG_EV_FLUSH_NOTOPEN,
+	LOG_EV_FSYNC,
+	LOG_EV_MKDIR,
+	LOG_EV_MKDIR_DONE,
+	LOG_EV_RMDIR,
+	LOG_EV_RMDIR_DONE,
+	LOG_EV_CREATE,
+	LOG_EV_LSEEK,
+	LOG_EV_TRUNCATE,
+	LOG_EV_UTIMENS,
+	LOG_EV_UTIMENS_ENOENT,
+	LOG_EV_CHMOD,
+	LOG_EV_CHMOD_ENOENT,
+	LOG_EV_CHOWN,
+	LOG_EV_CHOWN_ENOENT,
+	LOG_EV_FALLOCATE,
+	LOG_EV_COPY_FILE_RANGE,
+	LOG_EV_MAX
+} LogEvent_t;
+
+#define LOG_MAX_ARGS	(8)		/* numeric args carried by each log record */
+
+extern void logEventArgs(LogEvent_t event, const char *name, const long *args);
+extern int logStart(MgwfsSuper_t *ourSuper);
+extern void logStop(MgwfsSuper_t *ourSuper);
+/* Queue a trace record: LOG_EVENT(LOG_EV_xxx, path, up to LOG_MAX_ARGS longs).
+ * Callers still test ourSuper.verbose first, same as with fprintf(). */
+#define LOG_EVENT(event, name, ...) logEventArgs((event), (name), (const long [LOG_MAX_ARGS]){ __VA_ARGS__ })
+
+/* functions in perf.c */
+extern MgwfsPerfOp_t perfOps[MGWFS_PERF_NUM_OPS];
+extern uint64_t perfCounters[MGWFS_CTR_NUM];
+extern void perfReset(void);
+extern void perfSnapshot(MgwfsIoctlPerf_t *pp);
+extern void ioCount(const MgwfsSuper_t *ourSuper, int purpose, int dir, uint32_t sector, uint32_t sectors);
+extern void ioCountRun(const MgwfsSuper_t *ourSuper, int purpose, int dir, const MgwfsIoRun_t *run);
+extern void ioSnapshot(const MgwfsSuper_t *ourSuper, MgwfsIoctlIo_t *iop);
+
+/* functions in frag.c */
+extern int fragReport(MgwfsSuper_t *ourSuper, MgwfsIoctlFrag_t *fr);
+
+static inline uint64_t perfNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);	/* vdso, so no system call */
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+/* Account one call of op that started at 'start' (from perfNow()). FUSE
+ * runs single threaded (-s), so the counters are bumped without atomics. */
+static inline void perfDone(int op, uint64_t start)
+{
+	uint64_t nsecs = perfNow() - start;
+	MgwfsPerfOp_t *pp = perfOps + op;
+	int bucket = nsecs ? 63 - __builtin_clzll(nsecs) : 0;
+
+	if ( bucket >= MGWFS_PERF_BUCKETS )
+		bucket = MGWFS_PERF_BUCKETS-1;
+	++pp->calls;
+	pp->totalNsecs += nsecs;
+	if ( nsecs > pp->maxNsecs )
+		pp->maxNsecs = nsecs;
+	++pp->buckets[bucket];
+}
+
+static inline void perfCount(int counter, uint64_t amount)
+{
+	perfCounters[counter] += amount;
+}
+
+/* Which MGWFS_IO_xxx bucket I/O to this inode's contents goes in */
+static inline int ioPurposeOf(const MgwfsInode_t *inode)
+{
+	if ( inode->inode_no == FSYS_INDEX_INDEX )
+		return MGWFS_IO_INDEX;
+	if ( inode->inode_no == FSYS_INDEX_FREE )
+		return MGWFS_IO_FREEMAP;
+	return S_ISDIR(inode->mode) ? MGWFS_IO_DIR : MGWFS_IO_DATA;
+}
+
 /* functions in freemap.c */
 #define FREEM_FLAG_MARK_DIRTY	(0x01)
+#define FREEM_FLAG_CONTIG		(0x02)	/* all the sectors asked for in one piece, or nothing */
 extern void mgwfsDumpFreeMap( MgwfsSuper_t *ourSuper, const char *title, const FreeMap_t *freeMapPtr );
 extern int mgwfsFindFree(MgwfsSuper_t *ourSuper, MgwfsFoundFreeMap_t *stuff, int numSectors, uint32_t flags );
 extern int mgwfsFreeSectors(MgwfsSuper_t *ourSuper, FsysRetPtr *retp, uint32_t flags);
+extern uint32_t mgwfsFreeSectorCount(const MgwfsSuper_t *ourSuper);
+
+/* Allocation policies (see freemap.c), selected with --alloc= */
+enum
+{
+	MGWFS_ALLOC_FIRST,		/* first piece at or after the copy's region with room */
+	MGWFS_ALLOC_NEXT,		/* first piece with room after the last allocation in the region */
+	MGWFS_ALLOC_BEST,		/* smallest piece with room */
+	MGWFS_ALLOC_POOL,		/* small requests best fit from the end of a piece, the rest next fit */
+	MGWFS_ALLOC_NUM
+};
+#define MGWFS_ALLOC_DEFAULT	MGWFS_ALLOC_BEST	/* fewest pieces in freemap -b */
+#define MGWFS_SMALL_ALLOC	(16)	/* sectors; requests this size or smaller are "small" to MGWFS_ALLOC_POOL */
+
+typedef struct
+{
+	const char *name;
+	int (*choose)(MgwfsSuper_t *ourSuper, uint32_t minSector, int numSectors, uint32_t *startPtr);
+} MgwfsAllocPolicy_t;
+
+extern const MgwfsAllocPolicy_t AllocPolicies[MGWFS_ALLOC_NUM];
+extern int mgwfsAllocPolicy(const char *name);
 /*
  * Command line options
  */
@@ -319,11 +588,15 @@ typedef struct
 	const char *image;
 	const char *logFile;
 	const char *testPath;
+	unsigned long walk;
+	const char *alloc;
+	unsigned long frag;
 } Options_t;
 
 extern Options_t options;
 
 /* Funcions in fuse.c */
 extern const struct fuse_operations mgwfs_oper;
+extern void buildBootFNPath(char *dst, int maxLen, MgwfsInode_t *inode);
 
 #endif /*__MGWFS_H__*/
@@ -0,0 +1,1039 @@
+/*
+  mgwfsck: offline consistency check of an Atari/MidwayGamesWest filesystem image.
+
+  Copyright (C) 2025  Dave Shepperd <mgwfs@dshepperd.com>
+
+  This program can be distributed under the terms of the GNU GPLv2.
+  See the file COPYING.
+
+ Reads an image (read only unless --repair) without mounting it and checks
+ that the pieces agree with each other: the home block alternates, index.sys,
+ every file header and its alternates, the retrieval pointers (nothing may
+ be in two places at once), the directory entries (fid, generation, "." and
+ "..", each file in exactly one directory) and freemap.sys against what the
+ headers say is in use.
+
+ Unlike verifyFreemap(), which builds a "used" list one retrieval pointer at
+ a time through mgwfsFreeSectors(), what's in use is kept in a bitmap of one
+ bit per sector, so every check is a single pass. The file headers are read
+ by a pool of threads with pread(); everything after that is in memory.
+
+ Each problem found is one line of the report (or one object of the --json
+ array) tagged with a fixed type name, so scripts can count or filter them.
+ --repair rewrites freemap.sys from the bitmap, which fixes the freemap
+ problems (free-in-use, lost and freemap); nothing else is changed.
+
+ Exit status follows fsck(8): 0 no problems, 1 problems found and all of
+ them repaired, 4 problems left, 8 the image could not be checked.
+
+ Build: see Makefile target 'mgwfsck'.
+*/
+#include "mgwfs.h"
+#include <getopt.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#define CK_MAX_WORKERS	(8)
+#define CK_CHUNK		(64)		/* inodes a worker claims at a time */
+#define CK_MAX_REPORTS	(100)		/* problems of each type shown; all are counted */
+#define CK_MAX_DEPTH	(64)		/* parent links followed to make a path */
+
+#define CK_EXIT_OK			(0)
+#define CK_EXIT_REPAIRED	(1)
+#define CK_EXIT_PROBLEMS	(4)
+#define CK_EXIT_ERROR		(8)
+
+typedef enum
+{
+	CK_HOME,			/* home block alternate missing or different */
+	CK_INDEX,			/* index.sys header or contents */
+	CK_HEADER,			/* file header contents (type, size v. clusters) */
+	CK_ALT,				/* file header alternate unreadable, wrong id or different */
+	CK_RETPTR,			/* retrieval pointer off the disk or copies of different sizes */
+	CK_OVERLAP,			/* sectors claimed by more than one header or pointer */
+	CK_DIRENT,			/* malformed directory */
+	CK_DANGLING,		/* directory entry naming an empty or out of range fid */
+	CK_GENERATION,		/* directory entry generation doesn't match the header */
+	CK_MULTILINK,		/* file in more than one directory */
+	CK_UNREACHABLE,		/* file in no directory */
+	CK_BOOT,			/* home block boot pointer that's not a file header */
+	CK_FREEMAP,			/* freemap.sys out of order, off the disk or copies differ */
+	CK_FREE_IN_USE,		/* sectors both free and in use */
+	CK_LOST,			/* sectors neither free nor in use */
+	CK_NUM_KINDS
+} CkKind_t;
+
+static const char *KindNames[CK_NUM_KINDS] =
+{
+	"home", "index", "header", "header-alt", "retptr", "overlap", "dir-entry",
+	"dangling", "generation", "multi-link", "unreachable", "boot", "freemap",
+	"free-in-use", "lost"
+};
+
+/* Per alternate results of the header scan */
+#define CK_ALT_LBA	(0x01)		/* lba is 0, empty or off the disk */
+#define CK_ALT_READ	(0x02)		/* pread failed */
+#define CK_ALT_ID	(0x04)		/* wrong id */
+#define CK_ALT_DIFF	(0x08)		/* good, but not the same as the one used */
+
+typedef struct
+{
+	uint32_t lba[FSYS_MAX_ALTS];	/* from index.sys */
+	uint8_t altSts[FSYS_MAX_ALTS];	/* CK_ALT_xxx */
+	int8_t good;					/* alternate hdr came from or -1 */
+	uint8_t live;					/* index.sys slot in use */
+	uint16_t links;					/* directory entries naming it ("." and ".." not included) */
+	int parent;						/* directory of the first of those */
+	char *name;						/* and its name there */
+	FsysHeader hdr;
+} CkInode_t;
+
+/* One run of sectors somebody claims, kept to name who else has them */
+typedef struct
+{
+	uint32_t start;
+	uint32_t nblocks;
+	int inode;
+	int8_t alt;						/* header alternate or data copy */
+	int8_t isHeader;
+} CkExtent_t;
+
+/* A run of sectors that were already in use when claimed again */
+typedef struct
+{
+	uint32_t start;
+	uint32_t nblocks;
+	int extent;						/* the claim that found them in use */
+} CkCollision_t;
+
+typedef struct
+{
+	MgwfsSuper_t super;
+	const char *image;
+	int json;
+	int numShown;
+	uint32_t maxLba;
+	int numInodes;					/* index.sys slots up to the first empty one */
+	CkInode_t *inodes;
+	uint64_t *used, *free;			/* one bit per sector */
+	CkExtent_t *extents;
+	int numExtents, maxExtents;
+	CkCollision_t *collisions;
+	int numCollisions, maxCollisions;
+	uint32_t counts[CK_NUM_KINDS];
+	uint64_t sectorsUsed, sectorsFree, sectorsLost;
+	int files, dirs;
+	int nextJob;					/* header scan pool */
+	int workers;
+} Ck_t;
+
+static const char *Prog = "mgwfsck";
+
+static void jsonString(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+	for (; *str; ++str)
+	{
+		if ( *str == '"' || *str == '\\' )
+			fprintf(fp, "\\%c", *str);
+		else if ( (unsigned char)*str < ' ' )
+			fprintf(fp, "\\u%04x", (unsigned char)*str);
+		else
+			fputc(*str, fp);
+	}
+	fputc('"', fp);
+}
+
+/* Count a problem and report it unless CK_MAX_REPORTS of its type already have been. */
+static void ckProblem(Ck_t *ck, CkKind_t kind, int inode, const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+static void ckProblem(Ck_t *ck, CkKind_t kind, int inode, const char *fmt, ...)
+{
+	char msg[512];
+	va_list ap;
+
+	if ( ++ck->counts[kind] > CK_MAX_REPORTS )
+		return;
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+	if ( ck->json )
+	{
+		printf("%s\n    {\"type\":\"%s\",\"inode\":%d,\"detail\":", ck->numShown ? "," : "", KindNames[kind], inode);
+		jsonString(stdout, msg);
+		printf("}");
+	}
+	else
+		printf("%-12s %7d  %s\n", KindNames[kind], inode, msg);
+	++ck->numShown;
+}
+
+/* The path of 'inode' from the names found in the directories */
+static const char *ckPath(Ck_t *ck, int inode, char *buf, size_t size)
+{
+	const char *names[CK_MAX_DEPTH];
+	int depth=0, ii;
+	size_t len=0;
+
+	while ( inode > FSYS_INDEX_ROOT && inode < ck->numInodes && ck->inodes[inode].name && depth < CK_MAX_DEPTH )
+	{
+		names[depth++] = ck->inodes[inode].name;
+		inode = ck->inodes[inode].parent;
+	}
+	if ( !depth )
+	{
+		snprintf(buf, size, inode == FSYS_INDEX_ROOT ? "/" : "<inode %d>", inode);
+		return buf;
+	}
+	buf[0] = 0;
+	for (ii=depth-1; ii >= 0 && len < size; --ii)
+		len += snprintf(buf+len, size-len, "/%s", names[ii]);
+	return buf;
+}
+
+static int ckRead(Ck_t *ck, uint32_t lba, void *dst, uint32_t sectors)
+{
+	ssize_t want = (ssize_t)sectors*BYTES_PER_SECTOR;
+
+	if ( !lba || lba >= ck->maxLba || sectors > ck->maxLba - lba )
+		return -ERANGE;
+	if ( pread(ck->super.fd, dst, want, ((off64_t)lba+ck->super.baseSector)*BYTES_PER_SECTOR) != want )
+		return -EIO;
+	return 0;
+}
+
+static int ckWrite(Ck_t *ck, uint32_t lba, const void *src, uint32_t sectors)
+{
+	ssize_t want = (ssize_t)sectors*BYTES_PER_SECTOR;
+
+	if ( !lba || lba >= ck->maxLba || sectors > ck->maxLba - lba )
+		return -ERANGE;
+	if ( pwrite(ck->super.fd, src, want, ((off64_t)lba+ck->super.baseSector)*BYTES_PER_SECTOR) != want )
+		return -EIO;
+	return 0;
+}
+
+/*
+ * Read 'bytes' of a file through one copy's retrieval pointers into 'dst',
+ * which has to have room for them rounded up to whole sectors. Unlike
+ * readWholeFile() it never goes past FSYS_MAX_FHPTRS pointers or off the
+ * disk, whatever the header says.
+ */
+static int ckReadFile(Ck_t *ck, const FsysRetPtr *rp, uint8_t *dst, uint32_t bytes)
+{
+	uint32_t sectors = (bytes+BYTES_PER_SECTOR-1)/BYTES_PER_SECTOR;
+	int rpIdx, sts;
+
+	for (rpIdx=0; sectors && rpIdx < FSYS_MAX_FHPTRS; ++rpIdx, ++rp)
+	{
+		uint32_t cnt;
+
+		if ( rp->nblocks <= 0 )
+			break;
+		cnt = (uint32_t)rp->nblocks < sectors ? (uint32_t)rp->nblocks : sectors;
+		if ( (sts = ckRead(ck, rp->start, dst, cnt)) )
+			return sts;
+		dst += cnt*BYTES_PER_SECTOR;
+		sectors -= cnt;
+	}
+	return sectors ? -ENODATA : 0;
+}
+
+/* Read the alternates of one header, keeping the first good one in ci->hdr */
+static void ckHeader(Ck_t *ck, CkInode_t *ci, uint32_t id)
+{
+	uint8_t sect[BYTES_PER_SECTOR];
+	FsysHeader *fhp = (FsysHeader *)sect;
+	int altIdx;
+
+	ci->good = -1;
+	for (altIdx=0; altIdx < FSYS_MAX_ALTS; ++altIdx)
+	{
+		if ( (ci->lba[altIdx] & FSYS_EMPTYLBA_BIT) || ci->lba[altIdx] >= ck->maxLba )
+			ci->altSts[altIdx] = CK_ALT_LBA;
+		else if ( ckRead(ck, ci->lba[altIdx], sect, 1) )
+			ci->altSts[altIdx] = ci->lba[altIdx] ? CK_ALT_READ : CK_ALT_LBA;
+		else if ( fhp->id != id )
+			ci->altSts[altIdx] = CK_ALT_ID;
+		else if ( ci->good < 0 )
+		{
+			ci->good = altIdx;
+			ci->hdr = *fhp;
+		}
+		else if ( memcmp(&ci->hdr, fhp, sizeof(FsysHeader)) )
+			ci->altSts[altIdx] = CK_ALT_DIFF;
+	}
+}
+
+static void *ckHeaderWorker(void *arg)
+{
+	Ck_t *ck = (Ck_t *)arg;
+	int first, ii;
+
+	while ( (first = __atomic_fetch_add(&ck->nextJob, CK_CHUNK, __ATOMIC_RELAXED)) < ck->numInodes )
+	{
+		for (ii=first; ii < first+CK_CHUNK && ii < ck->numInodes; ++ii)
+		{
+			if ( ii != FSYS_INDEX_INDEX && ck->inodes[ii].live )
+				ckHeader(ck, ck->inodes + ii, FSYS_ID_HEADER);
+		}
+	}
+	return NULL;
+}
+
+/* Read every file header (but index.sys's, which is already in) with a pool of threads */
+static void ckScanHeaders(Ck_t *ck)
+{
+	pthread_t threads[CK_MAX_WORKERS];
+	long numWorkers;
+	int ii, started;
+
+	numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+	if ( numWorkers > CK_MAX_WORKERS )
+		numWorkers = CK_MAX_WORKERS;
+	if ( numWorkers > (ck->numInodes+CK_CHUNK-1)/CK_CHUNK )
+		numWorkers = (ck->numInodes+CK_CHUNK-1)/CK_CHUNK;
+	if ( numWorkers < 1 )
+		numWorkers = 1;
+	ck->nextJob = 0;
+	for (started=0; started < numWorkers-1; ++started)
+	{
+		if ( pthread_create(threads + started, NULL, ckHeaderWorker, ck) )
+			break;			/* make do with what we've got */
+	}
+	ckHeaderWorker(ck);
+	for (ii=0; ii < started; ++ii)
+		pthread_join(threads[ii], NULL);
+	ck->workers = started + 1;
+}
+
+static inline int bitTest(const uint64_t *map, uint32_t bit)
+{
+	return (map[bit>>6] >> (bit&63)) & 1;
+}
+
+static inline void bitSet(uint64_t *map, uint32_t bit)
+{
+	map[bit>>6] |= (uint64_t)1 << (bit&63);
+}
+
+/*
+ * Claim nblocks sectors at start for 'inode'. Whatever in the range is
+ * already in use is remembered as a collision to be sorted out later.
+ * The caller has made sure the range is on the disk.
+ */
+static void ckClaim(Ck_t *ck, uint32_t start, uint32_t nblocks, int inode, int alt, int isHeader)
+{
+	uint32_t sector, end = start + nblocks, runStart=0;
+	int inRun=0;
+
+	if ( ck->numExtents >= ck->maxExtents )
+	{
+		ck->maxExtents = ck->maxExtents ? ck->maxExtents*2 : 4096;
+		ck->extents = (CkExtent_t *)realloc(ck->extents, ck->maxExtents*sizeof(CkExtent_t));
+		if ( !ck->extents )
+		{
+			fprintf(stderr, "%s: Out of memory\n", Prog);
+			exit(CK_EXIT_ERROR);
+		}
+	}
+	ck->extents[ck->numExtents].start = start;
+	ck->extents[ck->numExtents].nblocks = nblocks;
+	ck->extents[ck->numExtents].inode = inode;
+	ck->extents[ck->numExtents].alt = alt;
+	ck->extents[ck->numExtents].isHeader = isHeader;
+	for (sector=start; sector <= end; ++sector)
+	{
+		int busy;
+
+		/* Most of it is whole unused words */
+		if ( !inRun && !(sector&63) && end - sector >= 64 && !ck->used[sector>>6] )
+		{
+			ck->used[sector>>6] = ~(uint64_t)0;
+			sector += 63;
+			continue;
+		}
+		busy = sector < end && bitTest(ck->used, sector);
+		if ( busy && !inRun )
+		{
+			runStart = sector;
+			inRun = 1;
+		}
+		else if ( !busy && inRun )
+		{
+			if ( ck->numCollisions >= ck->maxCollisions )
+			{
+				ck->maxCollisions = ck->maxCollisions ? ck->maxCollisions*2 : 64;
+				ck->collisions = (CkCollision_t *)realloc(ck->collisions, ck->maxCollisions*sizeof(CkCollision_t));
+				if ( !ck->collisions )
+				{
+					fprintf(stderr, "%s: Out of memory\n", Prog);
+					exit(CK_EXIT_ERROR);
+				}
+			}
+			ck->collisions[ck->numCollisions].start = runStart;
+			ck->collisions[ck->numCollisions].nblocks = sector - runStart;
+			ck->collisions[ck->numCollisions].extent = ck->numExtents;
+			++ck->numCollisions;
+			inRun = 0;
+		}
+		if ( sector < end )
+			bitSet(ck->used, sector);
+	}
+	++ck->numExtents;
+}
+
+/* Report each collision with the earlier claims it ran into */
+static void ckOverlaps(Ck_t *ck)
+{
+	char path[256], otherPath[256];
+	int ii, jj;
+
+	for (ii=0; ii < ck->numCollisions; ++ii)
+	{
+		const CkCollision_t *col = ck->collisions + ii;
+		const CkExtent_t *ext = ck->extents + col->extent;
+
+		if ( ck->counts[CK_OVERLAP] >= CK_MAX_REPORTS )
+		{
+			++ck->counts[CK_OVERLAP];	/* not worth finding the other owner of */
+			continue;
+		}
+		for (jj=0; jj < col->extent; ++jj)
+		{
+			const CkExtent_t *other = ck->extents + jj;
+			uint32_t lo, hi;
+
+			lo = other->start > col->start ? other->start : col->start;
+			hi = other->start + other->nblocks < col->start + col->nblocks ? other->start + other->nblocks : col->start + col->nblocks;
+			if ( lo >= hi )
+				continue;
+			ckProblem(ck, CK_OVERLAP, ext->inode, "sectors 0x%X-0x%X of %s %d of %s are also %s %d of %s (inode %d)",
+					  lo, hi-1,
+					  ext->isHeader ? "header" : "copy", ext->alt,
+					  ckPath(ck, ext->inode, path, sizeof(path)),
+					  other->isHeader ? "header" : "copy", other->alt,
+					  ckPath(ck, other->inode, otherPath, sizeof(otherPath)), other->inode);
+		}
+	}
+}
+
+/* Report what the header scan found wrong with the alternates of 'inode' */
+static void ckAlternates(Ck_t *ck, int inode, const char *what)
+{
+	static const char *Why[] = { "", "has no usable lba", "could not be read", "has the wrong id", "", "", "", "", "does not match the others" };
+	CkInode_t *ci = ck->inodes + inode;
+	int altIdx;
+
+	for (altIdx=0; altIdx < FSYS_MAX_ALTS; ++altIdx)
+	{
+		if ( ci->altSts[altIdx] )
+			ckProblem(ck, inode == FSYS_INDEX_INDEX ? CK_INDEX : CK_ALT, inode, "%s header alternate %d at 0x%X %s",
+					  what, altIdx, ci->lba[altIdx], Why[ci->altSts[altIdx]]);
+	}
+}
+
+/* Claim the header and data sectors of a file and sanity check its header */
+static void ckFile(Ck_t *ck, int inode)
+{
+	CkInode_t *ci = ck->inodes + inode;
+	FsysHeader *fhp = &ci->hdr;
+	char path[256];
+	uint32_t copySectors[FSYS_MAX_ALTS];
+	int altIdx, rpIdx, copies=0;
+
+	for (altIdx=0; altIdx < FSYS_MAX_ALTS; ++altIdx)
+	{
+		if ( !(ci->altSts[altIdx] & CK_ALT_LBA) )
+			ckClaim(ck, ci->lba[altIdx], 1, inode, altIdx, 1);
+	}
+	if ( ci->good < 0 )
+		return;
+	if ( fhp->type == FSYS_TYPE_DIR )
+		++ck->dirs;
+	else if ( fhp->type == FSYS_TYPE_FILE || fhp->type == FSYS_TYPE_LINK || fhp->type == FSYS_TYPE_INDEX )
+		++ck->files;
+	else
+		ckProblem(ck, CK_HEADER, inode, "%s has an unknown type %d", ckPath(ck, inode, path, sizeof(path)), fhp->type);
+	for (altIdx=0; altIdx < FSYS_MAX_ALTS && fhp->pointers[altIdx][0].nblocks; ++altIdx)
+	{
+		const FsysRetPtr *rp = fhp->pointers[altIdx];
+
+		copySectors[altIdx] = 0;
+		for (rpIdx=0; rpIdx < FSYS_MAX_FHPTRS && rp[rpIdx].nblocks; ++rpIdx)
+		{
+			if ( !rp[rpIdx].start || rp[rpIdx].nblocks < 0 || rp[rpIdx].start >= ck->maxLba || (uint32_t)rp[rpIdx].nblocks > ck->maxLba - rp[rpIdx].start )
+			{
+				ckProblem(ck, CK_RETPTR, inode, "copy %d pointer %d of %s (0x%X/%d) is not on the disk",
+						  altIdx, rpIdx, ckPath(ck, inode, path, sizeof(path)), rp[rpIdx].start, rp[rpIdx].nblocks);
+				continue;
+			}
+			ckClaim(ck, rp[rpIdx].start, rp[rpIdx].nblocks, inode, altIdx, 0);
+			copySectors[altIdx] += rp[rpIdx].nblocks;
+		}
+		++copies;
+	}
+	for (altIdx=0; altIdx < copies; ++altIdx)
+	{
+		if ( (uint64_t)copySectors[altIdx]*BYTES_PER_SECTOR < fhp->size )
+			ckProblem(ck, CK_RETPTR, inode, "copy %d of %s has %u sectors, too few for %u bytes",
+					  altIdx, ckPath(ck, inode, path, sizeof(path)), copySectors[altIdx], fhp->size);
+		else if ( altIdx && copySectors[altIdx] != copySectors[0] )
+			ckProblem(ck, CK_RETPTR, inode, "copy %d of %s has %u sectors, copy 0 has %u",
+					  altIdx, ckPath(ck, inode, path, sizeof(path)), copySectors[altIdx], copySectors[0]);
+	}
+	if ( !copies && fhp->size )
+		ckProblem(ck, CK_RETPTR, inode, "%s has %u bytes and no retrieval pointers", ckPath(ck, inode, path, sizeof(path)), fhp->size);
+}
+
+static int isLive(const Ck_t *ck, uint32_t fid)
+{
+	return fid < (uint32_t)ck->numInodes && ck->inodes[fid].live && ck->inodes[fid].good >= 0;
+}
+
+/*
+ * Walk the directories down from the root. Each directory is read the
+ * first time an entry names it, so each is read once however it's linked.
+ */
+static void ckDirectories(Ck_t *ck)
+{
+	char path[256], otherPath[256];
+	int *queue, head=0, tail=0;
+
+	if ( !isLive(ck, FSYS_INDEX_ROOT) || ck->inodes[FSYS_INDEX_ROOT].hdr.type != FSYS_TYPE_DIR )
+	{
+		ckProblem(ck, CK_DIRENT, FSYS_INDEX_ROOT, "there is no root directory");
+		return;
+	}
+	queue = (int *)malloc(ck->numInodes*sizeof(int));
+	if ( !queue )
+	{
+		fprintf(stderr, "%s: Out of memory\n", Prog);
+		exit(CK_EXIT_ERROR);
+	}
+	queue[tail++] = FSYS_INDEX_ROOT;
+	ck->inodes[FSYS_INDEX_ROOT].links = 1;
+	ck->inodes[FSYS_INDEX_ROOT].parent = FSYS_INDEX_ROOT;
+	while ( head < tail )
+	{
+		int dirIdx = queue[head++];
+		CkInode_t *dir = ck->inodes + dirIdx;
+		uint32_t size = dir->hdr.size;
+		uint8_t *mem, *ptr, *end;
+		char dirPath[256];
+
+		/* What the entries' names are appended to */
+		if ( dirIdx == FSYS_INDEX_ROOT )
+			dirPath[0] = 0;
+		else
+			ckPath(ck, dirIdx, dirPath, sizeof(dirPath));
+
+		mem = (uint8_t *)malloc(size + BYTES_PER_SECTOR);
+		if ( !mem )
+		{
+			fprintf(stderr, "%s: Out of memory\n", Prog);
+			exit(CK_EXIT_ERROR);
+		}
+		if ( ckReadFile(ck, dir->hdr.pointers[0], mem, size) )
+		{
+			ckProblem(ck, CK_DIRENT, dirIdx, "could not read directory %s", ckPath(ck, dirIdx, path, sizeof(path)));
+			free(mem);
+			continue;
+		}
+		for (ptr=mem, end=mem+size; ptr+5 <= end; )
+		{
+			uint32_t fid = (ptr[2]<<16)|(ptr[1]<<8)|ptr[0];
+			uint8_t gen = ptr[3];
+			int txtLen = ptr[4];
+			const char *name = (const char *)ptr + 5;
+			CkInode_t *child;
+
+			ptr += 5;
+			if ( !fid && !(gen && txtLen) )
+				break;
+			if ( !txtLen || ptr + txtLen > end || name[txtLen-1] )
+			{
+				ckProblem(ck, CK_DIRENT, dirIdx, "directory %s has a bad entry at offset %ld; the rest of it is skipped",
+						  ckPath(ck, dirIdx, path, sizeof(path)), (long)(ptr - 5 - mem));
+				break;
+			}
+			ptr += txtLen;
+			if ( !isLive(ck, fid) )
+			{
+				ckProblem(ck, CK_DANGLING, dirIdx, "%s/%s names fid %u, which is not a file",
+						  dirPath, name, fid);
+				continue;
+			}
+			child = ck->inodes + fid;
+			if ( child->hdr.generation != gen )
+			{
+				ckProblem(ck, CK_GENERATION, fid, "%s/%s has generation %d, the header has %d",
+						  dirPath, name, gen, child->hdr.generation);
+				continue;
+			}
+			if ( !strcmp(name, ".") || !strcmp(name, "..") )
+			{
+				int want = name[1] ? dir->parent : dirIdx;
+
+				if ( (int)fid != want )
+					ckProblem(ck, CK_DIRENT, dirIdx, "'%s' in %s is fid %u, s/b %d",
+							  name, ckPath(ck, dirIdx, path, sizeof(path)), fid, want);
+				continue;
+			}
+			if ( ++child->links > 1 )
+			{
+				ckProblem(ck, CK_MULTILINK, fid, "%s/%s is also %s",
+						  dirPath, name, ckPath(ck, fid, otherPath, sizeof(otherPath)));
+				continue;
+			}
+			child->parent = dirIdx;
+			child->name = strdup(name);
+			if ( child->hdr.type == FSYS_TYPE_DIR )
+				queue[tail++] = fid;
+		}
+		free(mem);
+	}
+	free(queue);
+}
+
+/* Check freemap.sys against the used bitmap */
+static void ckFreemap(Ck_t *ck)
+{
+	CkInode_t *ci = ck->inodes + FSYS_INDEX_FREE;
+	FsysRetPtr *map, *copy;
+	uint32_t bytes, entries, ii, prevEnd=0, sector;
+	int altIdx;
+
+	if ( !isLive(ck, FSYS_INDEX_FREE) )
+	{
+		ckProblem(ck, CK_FREEMAP, FSYS_INDEX_FREE, "there is no freemap.sys");
+		return;
+	}
+	bytes = ci->hdr.size;
+	entries = bytes/sizeof(FsysRetPtr);
+	map = (FsysRetPtr *)calloc(1, bytes + BYTES_PER_SECTOR);
+	copy = (FsysRetPtr *)calloc(1, bytes + BYTES_PER_SECTOR);
+	if ( !map || !copy )
+	{
+		fprintf(stderr, "%s: Out of memory\n", Prog);
+		exit(CK_EXIT_ERROR);
+	}
+	if ( ckReadFile(ck, ci->hdr.pointers[0], (uint8_t *)map, bytes) )
+	{
+		ckProblem(ck, CK_FREEMAP, FSYS_INDEX_FREE, "could not read freemap.sys");
+		free(map);
+		free(copy);
+		return;
+	}
+	for (altIdx=1; altIdx < FSYS_MAX_ALTS && ci->hdr.pointers[altIdx][0].nblocks; ++altIdx)
+	{
+		if ( ckReadFile(ck, ci->hdr.pointers[altIdx], (uint8_t *)copy, bytes) || memcmp(map, copy, bytes) )
+			ckProblem(ck, CK_FREEMAP, FSYS_INDEX_FREE, "copy %d of freemap.sys does not match copy 0", altIdx);
+	}
+	for (ii=0; ii < entries && map[ii].nblocks; ++ii)
+	{
+		uint32_t start = map[ii].start, end, inUse=0;
+
+		if ( map[ii].nblocks < 0 || start >= ck->maxLba || (uint32_t)map[ii].nblocks > ck->maxLba - start )
+		{
+			ckProblem(ck, CK_FREEMAP, FSYS_INDEX_FREE, "entry %u (0x%X/%d) is not on the disk", ii, start, map[ii].nblocks);
+			continue;
+		}
+		end = start + map[ii].nblocks;
+		if ( start < prevEnd )
+			ckProblem(ck, CK_FREEMAP, FSYS_INDEX_FREE, "entry %u (0x%X/%d) is out of order or overlaps the one before", ii, start, map[ii].nblocks);
+		prevEnd = end;
+		for (sector=start; sector < end; ++sector)
+		{
+			if ( bitTest(ck->used, sector) )
+				++inUse;
+			else if ( !bitTest(ck->free, sector) )
+			{
+				bitSet(ck->free, sector);
+				++ck->sectorsFree;
+			}
+		}
+		if ( inUse )
+			ckProblem(ck, CK_FREE_IN_USE, FSYS_INDEX_FREE, "%u of the sectors in entry %u (0x%X/%d) are in use",
+					  inUse, ii, start, map[ii].nblocks);
+	}
+	/* What's in neither */
+	for (sector=0; sector < ck->maxLba; )
+	{
+		uint32_t runStart;
+
+		if ( !(sector&63) && sector + 64 <= ck->maxLba && (ck->used[sector>>6] | ck->free[sector>>6]) == ~(uint64_t)0 )
+		{
+			sector += 64;
+			continue;
+		}
+		if ( bitTest(ck->used, sector) || bitTest(ck->free, sector) )
+		{
+			++sector;
+			continue;
+		}
+		for (runStart=sector; sector < ck->maxLba && !bitTest(ck->used, sector) && !bitTest(ck->free, sector); ++sector)
+			;
+		ck->sectorsLost += sector - runStart;
+		ckProblem(ck, CK_LOST, -1, "sectors 0x%X-0x%X (%u) are neither free nor in use", runStart, sector-1, sector-runStart);
+	}
+	free(map);
+	free(copy);
+}
+
+/*
+ * Rewrite every copy of freemap.sys as the runs of sectors not in the used
+ * bitmap. If the list no longer fits in the file's size the size grows (up
+ * to the clusters it already has) and its header alternates are rewritten.
+ */
+static int ckRepairFreemap(Ck_t *ck)
+{
+	CkInode_t *ci = ck->inodes + FSYS_INDEX_FREE;
+	FsysHeader *fhp = &ci->hdr;
+	FsysRetPtr *map;
+	uint32_t sector, entries=0, maxEntries, bytes, newSize;
+	int altIdx, rpIdx, sts=0;
+
+	if ( !isLive(ck, FSYS_INDEX_FREE) || ck->counts[CK_OVERLAP] || ck->counts[CK_RETPTR] )
+	{
+		fprintf(stderr, "%s: Not rebuilding freemap.sys; its header or the retrieval pointers are bad\n", Prog);
+		return -EINVAL;
+	}
+	bytes = fhp->clusters*BYTES_PER_SECTOR;
+	maxEntries = bytes/sizeof(FsysRetPtr);
+	map = (FsysRetPtr *)calloc(1, bytes);
+	if ( !map )
+		return -ENOMEM;
+	for (sector=0; sector < ck->maxLba; )
+	{
+		uint32_t runStart;
+
+		if ( bitTest(ck->used, sector) )
+		{
+			++sector;
+			continue;
+		}
+		for (runStart=sector; sector < ck->maxLba && !bitTest(ck->used, sector); ++sector)
+			;
+		if ( entries + 1 >= maxEntries )
+		{
+			fprintf(stderr, "%s: The free list needs more than the %u entries freemap.sys has room for\n", Prog, maxEntries-1);
+			free(map);
+			return -ENOSPC;
+		}
+		map[entries].start = runStart;
+		map[entries].nblocks = sector - runStart;
+		++entries;
+	}
+	newSize = (entries+1)*sizeof(FsysRetPtr) > fhp->size ? bytes : fhp->size;
+	for (altIdx=0; altIdx < FSYS_MAX_ALTS && fhp->pointers[altIdx][0].nblocks && !sts; ++altIdx)
+	{
+		const FsysRetPtr *rp = fhp->pointers[altIdx];
+		uint8_t *src = (uint8_t *)map;
+		uint32_t left = fhp->clusters;
+
+		for (rpIdx=0; left && rpIdx < FSYS_MAX_FHPTRS && rp[rpIdx].nblocks && !sts; ++rpIdx)
+		{
+			uint32_t cnt = (uint32_t)rp[rpIdx].nblocks < left ? (uint32_t)rp[rpIdx].nblocks : left;
+
+			sts = ckWrite(ck, rp[rpIdx].start, src, cnt);
+			src += cnt*BYTES_PER_SECTOR;
+			left -= cnt;
+		}
+	}
+	if ( !sts && newSize != fhp->size )
+	{
+		uint8_t sect[BYTES_PER_SECTOR];
+
+		fhp->size = newSize;
+		memset(sect, 0, sizeof(sect));
+		memcpy(sect, fhp, sizeof(FsysHeader));
+		for (altIdx=0; altIdx < FSYS_MAX_ALTS && !sts; ++altIdx)
+		{
+			if ( !(ci->altSts[altIdx] & CK_ALT_LBA) )
+				sts = ckWrite(ck, ci->lba[altIdx], sect, 1);
+		}
+	}
+	if ( !sts && fsync(ck->super.fd) < 0 )
+		sts = -errno;
+	if ( sts )
+		fprintf(stderr, "%s: Failed to write freemap.sys: %s\n", Prog, strerror(-sts));
+	free(map);
+	return sts;
+}
+
+static uint32_t getLe(uint8_t *ptr)
+{
+	return (ptr[3]<<24)|(ptr[2]<<16)|(ptr[1]<<8)|ptr[0];
+}
+
+/* Find the home block and read index.sys. Returns 0 or an exit status. */
+static int ckLoad(Ck_t *ck, int readWrite)
+{
+	MgwfsSuper_t *super = &ck->super;
+	BootSector_t boot;
+	uint8_t sect[BYTES_PER_SECTOR];
+	CkInode_t index;
+	struct stat st;
+	off64_t maxHb, sizeInSectors;
+	IndexSys_t *lbas;
+	uint32_t ckSum, bytes;
+	int ii, good, altIdx;
+
+	super->logFile = stderr;
+	super->errFile = stderr;
+	if ( stat(ck->image, &st) < 0 || (super->fd = open(ck->image, readWrite ? O_RDWR : O_RDONLY)) < 0 )
+	{
+		fprintf(stderr, "%s: Unable to open '%s': %s\n", Prog, ck->image, strerror(errno));
+		return CK_EXIT_ERROR;
+	}
+	sizeInSectors = st.st_size/BYTES_PER_SECTOR;
+	if ( pread(super->fd, &boot, sizeof(boot), 0) != sizeof(boot) )
+	{
+		fprintf(stderr, "%s: Failed to read the boot sector of '%s'\n", Prog, ck->image);
+		return CK_EXIT_ERROR;
+	}
+	for (ii=0; ii < 4; ++ii)
+	{
+		if ( boot.parts[ii].status == 0x80 && boot.parts[ii].type == 0x8f )
+		{
+			super->baseSector = getLe(boot.parts[ii].abs_sect);
+			sizeInSectors = getLe(boot.parts[ii].num_sects);
+			break;
+		}
+	}
+	maxHb = sizeInSectors > FSYS_HB_RANGE ? FSYS_HB_RANGE : sizeInSectors;
+	super->maxHb = maxHb;
+	for (ii=0; ii < FSYS_MAX_ALTS; ++ii)
+		super->homeLbas[ii] = FSYS_HB_ALG(ii, maxHb);
+	if ( !(good = getHomeBlock(super, maxHb, sizeInSectors, &ckSum)) )
+	{
+		fprintf(stderr, "%s: No usable home block in '%s'\n", Prog, ck->image);
+		return CK_EXIT_ERROR;
+	}
+	ck->maxLba = super->homeBlk.max_lba ? super->homeBlk.max_lba : sizeInSectors;
+	if ( ck->maxLba > sizeInSectors )
+	{
+		ckProblem(ck, CK_HOME, -1, "max_lba 0x%X is past the end of the image (0x%lX sectors)", ck->maxLba, sizeInSectors);
+		ck->maxLba = sizeInSectors;
+	}
+	ck->used = (uint64_t *)calloc((ck->maxLba+63)/64, sizeof(uint64_t));
+	ck->free = (uint64_t *)calloc((ck->maxLba+63)/64, sizeof(uint64_t));
+	if ( !ck->used || !ck->free )
+	{
+		fprintf(stderr, "%s: Out of memory\n", Prog);
+		return CK_EXIT_ERROR;
+	}
+	/* Sector 0 is the boot sector; the home blocks are the only other sectors no file owns */
+	bitSet(ck->used, 0);
+	for (ii=0; ii < FSYS_MAX_ALTS; ++ii)
+	{
+		if ( !(good & (1<<ii)) )
+			ckProblem(ck, CK_HOME, -1, "home block %d at 0x%X is bad", ii, super->homeLbas[ii]);
+		else if ( ckRead(ck, super->homeLbas[ii], sect, 1) || memcmp(sect, &super->homeBlk, sizeof(FsysHomeBlock)) )
+			ckProblem(ck, CK_HOME, -1, "home block %d at 0x%X does not match the one used", ii, super->homeLbas[ii]);
+		if ( super->homeLbas[ii] && super->homeLbas[ii] < ck->maxLba )
+			ckClaim(ck, super->homeLbas[ii], 1, -1, ii, 1);
+	}
+	/* index.sys */
+	memset(&index, 0, sizeof(index));
+	memcpy(index.lba, super->homeBlk.index, sizeof(index.lba));
+	ckHeader(ck, &index, FSYS_ID_INDEX);
+	if ( index.good < 0 )
+	{
+		fprintf(stderr, "%s: No usable index.sys header in '%s'\n", Prog, ck->image);
+		return CK_EXIT_ERROR;
+	}
+	bytes = index.hdr.size;
+	lbas = (IndexSys_t *)calloc(1, bytes + BYTES_PER_SECTOR);
+	if ( !lbas || ckReadFile(ck, index.hdr.pointers[0], (uint8_t *)lbas, bytes) )
+	{
+		fprintf(stderr, "%s: Failed to read index.sys in '%s'\n", Prog, ck->image);
+		return CK_EXIT_ERROR;
+	}
+	for (altIdx=1; altIdx < FSYS_MAX_ALTS && index.hdr.pointers[altIdx][0].nblocks; ++altIdx)
+	{
+		IndexSys_t *copy = (IndexSys_t *)calloc(1, bytes + BYTES_PER_SECTOR);
+
+		if ( !copy || ckReadFile(ck, index.hdr.pointers[altIdx], (uint8_t *)copy, bytes) || memcmp(lbas, copy, bytes) )
+			ckProblem(ck, CK_INDEX, FSYS_INDEX_INDEX, "copy %d of index.sys does not match copy 0", altIdx);
+		free(copy);
+	}
+	/* Like the loader, the index ends at the first entry that's 0. Entry 0
+	 * is index.sys itself, but what counts is the home block's copy of it. */
+	for (ck->numInodes=1; ck->numInodes < (int)(bytes/sizeof(IndexSys_t)) && lbas[ck->numInodes].lba[0]; ++ck->numInodes)
+		;
+	ck->inodes = (CkInode_t *)calloc(ck->numInodes, sizeof(CkInode_t));
+	if ( !ck->inodes )
+	{
+		fprintf(stderr, "%s: Out of memory\n", Prog);
+		return CK_EXIT_ERROR;
+	}
+	for (ii=1; ii < ck->numInodes; ++ii)
+	{
+		memcpy(ck->inodes[ii].lba, lbas[ii].lba, sizeof(ck->inodes[ii].lba));
+		ck->inodes[ii].live = !(lbas[ii].lba[0] & FSYS_EMPTYLBA_BIT);
+		ck->inodes[ii].good = -1;
+		ck->inodes[ii].parent = -1;
+	}
+	if ( lbas[FSYS_INDEX_INDEX].lba[0] && memcmp(lbas[FSYS_INDEX_INDEX].lba, super->homeBlk.index, sizeof(index.lba)) )
+		ckProblem(ck, CK_INDEX, FSYS_INDEX_INDEX, "index.sys entry 0 does not point at the header in the home block");
+	index.live = 1;
+	index.parent = -1;
+	ck->inodes[FSYS_INDEX_INDEX] = index;
+	free(lbas);
+	return 0;
+}
+
+static void usage(FILE *fp)
+{
+	fprintf(fp,
+		"Usage: %s [options] <image>\n"
+		"  check an mgwfs image without mounting it.\n"
+		"\n"
+		"Options:\n"
+		" -h or --help      This message\n"
+		" --json            Report as a JSON object instead of one line per problem\n"
+		" --repair          Rewrite freemap.sys from what the file headers say is in use\n"
+		"\n"
+		"Each problem is reported as '<type> <inode> <detail>' (inode is -1 if none).\n"
+		"At most %d of each type are listed; all are counted. Exit status is 0 if\n"
+		"there's nothing wrong, 1 if everything wrong was repaired, 4 if problems are\n"
+		"left and 8 if the image could not be checked.\n"
+		, Prog, CK_MAX_REPORTS);
+}
+
+typedef enum
+{
+	OPT_HELP=1,
+	OPT_JSON,
+	OPT_REPAIR,
+	OPT_MAX
+} CkOptions_t;
+
+static const struct option LongOptions[] =
+{
+	{ "help", no_argument, NULL, OPT_HELP },
+	{ "json", no_argument, NULL, OPT_JSON },
+	{ "repair", no_argument, NULL, OPT_REPAIR },
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char *argv[])
+{
+	static Ck_t ck;
+	uint64_t start = perfNow();
+	uint32_t problems=0, left;
+	int optArg, repair=0, repaired=0, sts, ii, kind;
+
+	if ( argc > 0 && argv[0][0] )
+		Prog = argv[0];
+	while ( (optArg = getopt_long(argc, argv, "h", LongOptions, NULL)) >= 0 )
+	{
+		switch (optArg)
+		{
+		case OPT_HELP:
+		case 'h':
+			usage(stdout);
+			return CK_EXIT_ERROR;
+		case OPT_JSON:
+			ck.json = 1;
+			break;
+		case OPT_REPAIR:
+			repair = 1;
+			break;
+		default:
+			usage(stderr);
+			return CK_EXIT_ERROR;
+		}
+	}
+	if ( optind != argc-1 )
+	{
+		usage(stderr);
+		return CK_EXIT_ERROR;
+	}
+	ck.image = argv[optind];
+	if ( ck.json )
+	{
+		printf("{\n  \"image\":");
+		jsonString(stdout, ck.image);
+		printf(",\n  \"problems\":[");
+	}
+	if ( (sts = ckLoad(&ck, repair)) )
+	{
+		if ( ck.json )
+			printf("\n  ],\n  \"status\":%d\n}\n", sts);
+		return sts;
+	}
+	ckScanHeaders(&ck);
+	ckAlternates(&ck, FSYS_INDEX_INDEX, "index.sys");
+	for (ii=0; ii < ck.numInodes; ++ii)
+	{
+		if ( !ck.inodes[ii].live )
+			continue;
+		if ( ii != FSYS_INDEX_INDEX )
+			ckAlternates(&ck, ii, "file");
+		ckFile(&ck, ii);
+	}
+	ckDirectories(&ck);
+	/* The system files up to the journal are found through the home block, not a directory */
+	for (ii=FSYS_INDEX_JOURNAL+1; ii < ck.numInodes; ++ii)
+	{
+		if ( isLive(&ck, ii) && !ck.inodes[ii].links )
+			ckProblem(&ck, CK_UNREACHABLE, ii, "file of %u bytes (type %d) is in no directory", ck.inodes[ii].hdr.size, ck.inodes[ii].hdr.type);
+	}
+	for (ii=0; ii < 4; ++ii)
+	{
+		static const char *BootNames[] = { "boot", "boot1", "boot2", "boot3" };
+		const FsysHomeBlock *hb = &ck.super.homeBlk;
+		uint32_t lba = ii == 0 ? hb->boot[0] : ii == 1 ? hb->boot1[0] : ii == 2 ? hb->boot2[0] : hb->boot3[0];
+		int jj;
+
+		if ( !lba || (hb->hb_major <= 1 && hb->hb_minor < (ii ? 6 : 3)) )
+			continue;
+		for (jj=FSYS_INDEX_ROOT+1; jj < ck.numInodes && !(isLive(&ck, jj) && ck.inodes[jj].lba[0] == lba); ++jj)
+			;
+		if ( jj >= ck.numInodes )
+			ckProblem(&ck, CK_BOOT, -1, "home block %s pointer 0x%X is not a file header", BootNames[ii], lba);
+	}
+	ckOverlaps(&ck);
+	ckFreemap(&ck);
+	for (ii=0; ii < (int)(ck.maxLba+63)/64; ++ii)
+		ck.sectorsUsed += __builtin_popcountll(ck.used[ii]);
+	for (kind=0; kind < CK_NUM_KINDS; ++kind)
+		problems += ck.counts[kind];
+	left = problems;
+	if ( repair && (ck.counts[CK_FREEMAP] || ck.counts[CK_FREE_IN_USE] || ck.counts[CK_LOST]) && !ckRepairFreemap(&ck) )
+	{
+		repaired = 1;
+		left -= ck.counts[CK_FREEMAP] + ck.counts[CK_FREE_IN_USE] + ck.counts[CK_LOST];
+	}
+	sts = !problems ? CK_EXIT_OK : left ? CK_EXIT_PROBLEMS : CK_EXIT_REPAIRED;
+	if ( ck.json )
+	{
+		printf("\n  ],\n  \"counts\":{");
+		for (kind=0; kind < CK_NUM_KINDS; ++kind)
+			printf("%s\"%s\":%u", kind ? "," : "", KindNames[kind], ck.counts[kind]);
+		printf("},\n");
+		printf("  \"maxLba\":%u,\n  \"inodes\":%d,\n  \"files\":%d,\n  \"dirs\":%d,\n", ck.maxLba, ck.numInodes, ck.files, ck.dirs);
+		printf("  \"sectorsUsed\":%" PRIu64 ",\n  \"sectorsFree\":%" PRIu64 ",\n  \"sectorsLost\":%" PRIu64 ",\n",
+			   ck.sectorsUsed, ck.sectorsFree, ck.sectorsLost);
+		printf("  \"problems\":%u,\n  \"repaired\":%d,\n  \"workers\":%d,\n  \"usecs\":%" PRIu64 ",\n  \"status\":%d\n}\n",
+			   problems, repaired, ck.workers, (perfNow()-start)/1000, sts);
+	}
+	else
+	{
+		for (kind=0; kind < CK_NUM_KINDS; ++kind)
+		{
+			if ( ck.counts[kind] > CK_MAX_REPORTS )
+				printf("%-12s %7d  %u more not shown\n", KindNames[kind], -1, ck.counts[kind] - CK_MAX_REPORTS);
+		}
+		printf("image=%s maxLba=%u inodes=%d files=%d dirs=%d sectorsUsed=%" PRIu64 " sectorsFree=%" PRIu64 " sectorsLost=%" PRIu64 "\n",
+			   ck.image, ck.maxLba, ck.numInodes, ck.files, ck.dirs,
+			   ck.sectorsUsed, ck.sectorsFree, ck.sectorsLost);
+		printf("problems=%u repaired=%d workers=%d usecs=%" PRIu64 " status=%d\n",
+			   problems, repaired, ck.workers, (perfNow()-start)/1000, sts);
+	}
+	close(ck.super.fd);
+	return sts;
+}
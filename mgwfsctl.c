@@ -26,12 +26,17 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <sys/vfs.h>
+#include <time.h>
 #include <stdint.h>
 
 #include "mgwfsctl.h"
 
 static const char *Prog = "mgwfsctl";
 
+/* Sectors 'defrag' has moved per ioctl by default; about 4MB at a time
+ * keeps the mount responsive while it runs. */
+#define DEFRAG_SECTORS	(8192)
+
 static void usage(FILE *fp, int quietly)
 {
 	fprintf(fp,
@@ -46,12 +51,23 @@ static void usage(FILE *fp, int quietly)
 			"Optional options:\n"
 			" -h or --help                 This message\n"
 			" -f                           With 'stats' command, also report returns from statfs()\n"
+			" -r                           With 'perf' or 'io' command, zero the counters after reading them\n"
+			" -n <count>                   With 'top' command, stop after <count> updates\n"
+			" --json                       With 'top' command, print one line of JSON per update instead of a table\n"
+			" --all                        With 'defrag' command, do every file in the filesystem <path> is in\n"
+			" -m <sectors>                 With 'defrag' command, move at most about this many sectors per call (default %d, 0=no limit)\n"
 			"Commands:\n"
 			"  stats <path>                print live filesystem statistics\n"
 			"  getverbose <path>           print the current verbose flags (hex)\n"
 			"  setverbose <path> <v>       set the verbose flags; <v> may be decimal, 0x.. hex, or 0.. octal\n"
 			"  setboot <path> [<v>]        set the file pointed to by 'path' to boot image 'v' (v can be 0, 1, 2 or 3, defaults to 0)\n"
 			"  checksums <path>            compute checksums and store the results in <path>\n"
+			"  verify <path>               check the files against the checksums in <path> (exit status 1 if any are bad)\n"
+			"  perf <path>                 print call counts and latencies of each operation since mount (or the last -r)\n"
+			"  top <path>                  show operations, throughput and latencies live, once a second\n"
+			"  io <path>                   print sectors, calls and sequential share of disk I/O by purpose and disk region\n"
+			"  defrag <path>               move each copy of <path> that's in pieces into one piece (needs a --rw mount)\n"
+			"  frag <path>                 report free space fragmentation and the files in the most pieces\n"
 			"\n"
 			"Examples:\n"
 			"  %s stats /mnt/mgw\n"
@@ -60,7 +76,12 @@ static void usage(FILE *fp, int quietly)
 			"  %s setboot /mnt/mgw/FOO/bar\n"
 			"  %s setboot /mnt/mgw/SOMEWHERE/rainbow 1\n"
 			"  %s checksums /mnt/mgw/diags/checksums\n"
-			, Prog, Prog, Prog, Prog, Prog, Prog);
+			"  %s verify /mnt/mgw/diags/checksums\n"
+			"  %s -r perf /mnt/mgw\n"
+			"  %s --json -n 60 top /mnt/mgw\n"
+			"  %s --all defrag /mnt/mgw\n"
+			"  %s frag /mnt/mgw\n"
+			, DEFRAG_SECTORS, Prog, Prog, Prog, Prog, Prog, Prog, Prog, Prog, Prog, Prog, Prog);
 	}
 }
 
@@ -262,15 +283,466 @@ static int doChecksums(const char *path)
 	return 0;
 }
 
+static int doVerify(const char *path)
+{
+	MgwfsIoctlVerify_t *vp;
+	uint64_t bytes=0, usecs=0;
+	uint32_t checked=0, mismatches=0, threads=0, numEntries=0, ii;
+	int fd;
+
+	vp = (MgwfsIoctlVerify_t *)calloc(1, sizeof(MgwfsIoctlVerify_t));
+	if ( !vp )
+	{
+		fprintf(stderr, "%s: out of memory\n", Prog);
+		return 1;
+	}
+	fd = openPath(path);
+	if ( fd < 0 )
+	{
+		free(vp);
+		return 1;
+	}
+	do
+	{
+		vp->version = MGWFS_VERIFY_VERSION;
+		vp->startEntry = vp->nextEntry;
+		if ( ioctl(fd, MGWFS_IOC_VERIFYCHECKSUMS, vp) < 0 )
+		{
+			fprintf(stderr, "%s: MGWFS_IOC_VERIFYCHECKSUMS on '%s' failed: %s\n", Prog, path, strerror(errno));
+			close(fd);
+			free(vp);
+			return 1;
+		}
+		for (ii=0; ii < vp->numMismatches; ++ii)
+		{
+			MgwfsVerifyMismatch_t *mm = vp->mismatches + ii;
+			const char *name = mm->path[0] ? mm->path : "<no such file>";
+
+			if ( mm->error )
+				printf("ERROR    fid 0x%06X gen %3d %s: %s\n", mm->fid&0x00FFFFFF, mm->fid>>24, name, strerror(mm->error));
+			else
+				printf("MISMATCH fid 0x%06X gen %3d %s: expected 0x%08X, got 0x%08X\n",
+					   mm->fid&0x00FFFFFF, mm->fid>>24, name, mm->expected, mm->actual);
+		}
+		numEntries = vp->numEntries;
+		checked += vp->numChecked;
+		mismatches += vp->numMismatches;
+		bytes += vp->bytesChecked;
+		usecs += vp->usecs;
+		if ( vp->numThreads > threads )
+			threads = vp->numThreads;
+	} while ( vp->nextEntry );
+	close(fd);
+	free(vp);
+	printf("%" PRIu32 " of %" PRIu32 " entries checked, %" PRIu32 " bad. %.1f MB in %.2f seconds (%.1f MB/s) using %" PRIu32 " threads\n",
+		   checked, numEntries, mismatches, bytes/1e6, usecs/1e6, usecs ? bytes/(double)usecs : 0.0, threads);
+	return mismatches ? 1 : 0;
+}
+
+/* Latency (usecs) that 'pct' percent of the calls came in under. Only as
+ * good as the histogram: it's the top of the bucket the call landed in. */
+static double perfPercentile(const MgwfsPerfOp_t *op, uint32_t numBuckets, int pct)
+{
+	uint64_t want = (op->calls*pct + 99)/100, seen=0;
+	uint32_t ii;
+
+	for (ii=0; ii < numBuckets; ++ii)
+	{
+		seen += op->buckets[ii];
+		if ( seen >= want )
+			break;
+	}
+	if ( ii >= numBuckets-1 )
+		return op->maxNsecs/1000.0;
+	return (2ULL<<ii)/1000.0;
+}
+
+static int doPerf(const char *path, int reset)
+{
+	static const char *Names[] = { MGWFS_PERF_NAMES };
+	MgwfsIoctlPerf_t *pp;
+	uint32_t ii;
+	int fd, pass;
+
+	pp = (MgwfsIoctlPerf_t *)calloc(1, sizeof(MgwfsIoctlPerf_t));
+	if ( !pp )
+	{
+		fprintf(stderr, "%s: out of memory\n", Prog);
+		return 1;
+	}
+	fd = openPath(path);
+	if ( fd < 0 )
+	{
+		free(pp);
+		return 1;
+	}
+	pp->version = MGWFS_PERF_VERSION;
+	pp->flags = reset ? MGWFS_PERF_RESET : 0;
+	if ( ioctl(fd, MGWFS_IOC_GETPERF, pp) < 0 )
+	{
+		fprintf(stderr, "%s: MGWFS_IOC_GETPERF on '%s' failed: %s\n", Prog, path, strerror(errno));
+		close(fd);
+		free(pp);
+		return 1;
+	}
+	close(fd);
+	printf("Counting for %.1f seconds. Times are in usecs; p50 and p99 are histogram bucket limits.\n", pp->nsecs/1e9);
+	printf("%-18s %10s %10s %10s %10s %10s %10s\n", "operation", "calls", "total", "average", "p50", "p99", "max");
+	/* The operations first, then the internal stages under them */
+	for (pass=0; pass < 2; ++pass)
+	for (ii=0; ii < pp->numOps && ii < MGWFS_PERF_MAX_OPS; ++ii)
+	{
+		const MgwfsPerfOp_t *op = pp->ops + ii;
+		char unknown[16];
+		const char *name;
+
+		if ( pass != MGWFS_PERF_IS_STAGE(ii) )
+			continue;
+		if ( ii == MGWFS_PERF_FIRST_STAGE )
+			printf("(internal stages)\n");
+		if ( !op->calls )
+			continue;
+		if ( ii < sizeof(Names)/sizeof(Names[0]) )
+			name = Names[ii];
+		else
+		{
+			snprintf(unknown, sizeof(unknown), "op%u", ii);
+			name = unknown;
+		}
+		printf("%-18s %10" PRIu64 " %10.0f %10.2f %10.2f %10.2f %10.2f\n",
+			   name, op->calls, op->totalNsecs/1000.0, op->totalNsecs/1000.0/op->calls,
+			   perfPercentile(op, pp->numBuckets, 50), perfPercentile(op, pp->numBuckets, 99),
+			   op->maxNsecs/1000.0);
+	}
+	free(pp);
+	return 0;
+}
+
+static void showIoLine(const char *name, const MgwfsIoCount_t *counts)
+{
+	int dir;
+
+	printf("%-22s", name);
+	for (dir=0; dir < MGWFS_IO_NUM_DIRS; ++dir)
+	{
+		const MgwfsIoCount_t *cp = counts + dir;
+
+		if ( cp->calls )
+			printf(" %10" PRIu64 " %8" PRIu64 " %6.1f", cp->sectors, cp->calls, 100.0*cp->sequential/cp->calls);
+		else
+			printf(" %10s %8s %6s", "-", "-", "-");
+	}
+	printf("\n");
+}
+
+/* Show the disk I/O the daemon has done, split by what it was for
+ * and by which copy region of the disk it landed in. */
+static int doIo(const char *path, int reset)
+{
+	static const char *Names[] = { MGWFS_IO_NAMES };
+	MgwfsIoctlIo_t io;
+	MgwfsIoCount_t total[MGWFS_IO_NUM_DIRS];
+	uint32_t ii;
+	int fd, dir;
+
+	fd = openPath(path);
+	if ( fd < 0 )
+		return 1;
+	memset(&io, 0, sizeof(io));
+	io.version = MGWFS_IO_VERSION;
+	io.flags = reset ? MGWFS_IO_RESET : 0;
+	if ( ioctl(fd, MGWFS_IOC_GETIO, &io) < 0 )
+	{
+		fprintf(stderr, "%s: MGWFS_IOC_GETIO on '%s' failed: %s\n", Prog, path, strerror(errno));
+		close(fd);
+		return 1;
+	}
+	close(fd);
+	memset(total, 0, sizeof(total));
+	printf("Counting for %.1f seconds. seq%% is the share of calls that started where the previous one ended.\n", io.nsecs/1e9);
+	printf("%-22s %26s %26s\n", "", "---------- read ----------", "---------- write ---------");
+	printf("%-22s %10s %8s %6s %10s %8s %6s\n", "purpose", "sectors", "calls", "seq%", "sectors", "calls", "seq%");
+	for (ii=0; ii < io.numPurposes && ii < MGWFS_IO_MAX_PURPOSES; ++ii)
+	{
+		char unknown[16];
+
+		for (dir=0; dir < MGWFS_IO_NUM_DIRS; ++dir)
+		{
+			total[dir].sectors += io.purpose[ii][dir].sectors;
+			total[dir].calls += io.purpose[ii][dir].calls;
+			total[dir].sequential += io.purpose[ii][dir].sequential;
+		}
+		if ( ii >= sizeof(Names)/sizeof(Names[0]) )
+			snprintf(unknown, sizeof(unknown), "purpose%u", ii);
+		showIoLine(ii < sizeof(Names)/sizeof(Names[0]) ? Names[ii] : unknown, io.purpose[ii]);
+	}
+	showIoLine("(total)", total);
+	printf("%-22s\n", "region");
+	for (ii=0; ii < io.numRegions && ii < MGWFS_IO_MAX_REGIONS; ++ii)
+	{
+		char name[32];
+
+		snprintf(name, sizeof(name), "copy %u (0x%X-)", ii, io.regionStart[ii]);
+		showIoLine(name, io.region[ii]);
+	}
+	return 0;
+}
+
+/* One poll of the daemon for 'top' */
+typedef struct
+{
+	MgwfsIoctlPerf_t perf;
+	MgwfsIoctlStats_t stats;
+} TopSample_t;
+
+static int topSample(int fd, const char *path, TopSample_t *tp)
+{
+	memset(tp, 0, sizeof(TopSample_t));
+	tp->perf.version = MGWFS_PERF_VERSION;
+	if ( ioctl(fd, MGWFS_IOC_GETPERF, &tp->perf) < 0 )
+	{
+		fprintf(stderr, "%s: MGWFS_IOC_GETPERF on '%s' failed: %s\n", Prog, path, strerror(errno));
+		return -1;
+	}
+	if ( ioctl(fd, MGWFS_IOC_GETSTATS, &tp->stats) < 0 )
+	{
+		fprintf(stderr, "%s: MGWFS_IOC_GETSTATS on '%s' failed: %s\n", Prog, path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* Percentage of hits, or -1 if there were no lookups at all */
+static double hitRate(uint64_t hits, uint64_t misses)
+{
+	return hits+misses ? 100.0*hits/(hits+misses) : -1.0;
+}
+
+static void jsonRate(const char *key, double pct)
+{
+	if ( pct < 0 )
+		printf("\"%s\":null,", key);
+	else
+		printf("\"%s\":%.1f,", key, pct);
+}
+
+static void showRate(const char *title, double pct)
+{
+	if ( pct < 0 )
+		printf("%-22s %10s\n", title, "-");
+	else
+		printf("%-22s %9.1f%%\n", title, pct);
+}
+
+/* Show how the free space and the files are broken up (see fragShow()) */
+static int doFrag(const char *path)
+{
+	MgwfsIoctlFrag_t *fr;
+	int fd;
+
+	fr = (MgwfsIoctlFrag_t *)calloc(1, sizeof(MgwfsIoctlFrag_t));
+	if ( !fr )
+	{
+		fprintf(stderr, "%s: out of memory\n", Prog);
+		return 1;
+	}
+	fd = openPath(path);
+	if ( fd < 0 )
+	{
+		free(fr);
+		return 1;
+	}
+	fr->version = MGWFS_FRAG_VERSION;
+	if ( ioctl(fd, MGWFS_IOC_FRAG, fr) < 0 )
+	{
+		fprintf(stderr, "%s: MGWFS_IOC_FRAG on '%s' failed: %s\n", Prog, path, strerror(errno));
+		close(fd);
+		free(fr);
+		return 1;
+	}
+	close(fd);
+	fragShow(stdout, fr);
+	free(fr);
+	return 0;
+}
+
+/* Defragment one file, or every file a bit at a time until it's been
+ * through them all. */
+static int doDefrag(const char *path, int all, int maxSectors)
+{
+	MgwfsIoctlDefrag_t df;
+	uint64_t sectors=0, usecs=0;
+	uint32_t checked=0, moved=0, busy=0, noRoom=0, rpsBefore=0, rpsAfter=0, calls=0;
+	int fd;
+
+	fd = openPath(path);
+	if ( fd < 0 )
+		return 1;
+	memset(&df, 0, sizeof(df));
+	do
+	{
+		df.version = MGWFS_DEFRAG_VERSION;
+		df.flags = all ? MGWFS_DEFRAG_ALL : 0;
+		df.maxSectors = maxSectors;
+		df.startInode = df.nextInode;
+		if ( ioctl(fd, MGWFS_IOC_DEFRAG, &df) < 0 )
+		{
+			fprintf(stderr, "%s: MGWFS_IOC_DEFRAG on '%s' failed: %s\n", Prog, path, strerror(errno));
+			close(fd);
+			return 1;
+		}
+		++calls;
+		checked += df.filesChecked;
+		moved += df.filesMoved;
+		busy += df.filesBusy;
+		noRoom += df.filesNoRoom;
+		rpsBefore += df.rpsBefore;
+		rpsAfter += df.rpsAfter;
+		sectors += df.sectorsMoved;
+		usecs += df.usecs;
+	} while ( df.nextInode );
+	close(fd);
+	printf("%" PRIu32 " files checked, %" PRIu32 " moved (%" PRIu32 " retrieval pointers down to %" PRIu32 "), %" PRIu32 " busy, %" PRIu32 " without a big enough free piece.\n",
+		   checked, moved, rpsBefore, rpsAfter, busy, noRoom);
+	printf("%.1f MB moved in %.2f seconds over %" PRIu32 " call%s\n", sectors*512/1e6, usecs/1e6, calls, calls == 1 ? "" : "s");
+	return 0;
+}
+
+/* Poll the daemon once a second and show what happened in that second:
+ * operations and their latencies, bytes moved, how well the caches did,
+ * the dirty backlog, flush latency and how often the allocator ran. */
+static int doTop(const char *path, int json, int count)
+{
+	static const char *Names[] = { MGWFS_PERF_NAMES };
+	TopSample_t *samples, *prev, *curr, *tmp;
+	int fd, iter, pass, sts=0;
+	uint32_t ii;
+
+	samples = (TopSample_t *)calloc(2, sizeof(TopSample_t));
+	if ( !samples )
+	{
+		fprintf(stderr, "%s: out of memory\n", Prog);
+		return 1;
+	}
+	prev = samples;
+	curr = samples+1;
+	fd = openPath(path);
+	if ( fd < 0 || topSample(fd, path, prev) < 0 )
+	{
+		if ( fd >= 0 )
+			close(fd);
+		free(samples);
+		return 1;
+	}
+	for (iter=0; !count || iter < count; ++iter)
+	{
+		const uint64_t *pc, *cc;
+		uint64_t ops=0;
+		double secs, flushUsecs=0;
+		uint64_t flushCalls;
+
+		sleep(1);
+		if ( topSample(fd, path, curr) < 0 )
+		{
+			sts = 1;
+			break;
+		}
+		if ( curr->perf.nsecs <= prev->perf.nsecs )
+		{
+			/* Somebody zeroed the counters (perf -r); start over from here */
+			tmp = prev;
+			prev = curr;
+			curr = tmp;
+			continue;
+		}
+		secs = (curr->perf.nsecs - prev->perf.nsecs)/1e9;
+		pc = prev->perf.counters;
+		cc = curr->perf.counters;
+		for (ii=0; ii < curr->perf.numOps && ii < MGWFS_PERF_MAX_OPS; ++ii)
+		{
+			if ( !MGWFS_PERF_IS_STAGE(ii) )
+				ops += curr->perf.ops[ii].calls - prev->perf.ops[ii].calls;
+		}
+		flushCalls = curr->perf.ops[MGWFS_PERF_UPDATEMETADATA].calls - prev->perf.ops[MGWFS_PERF_UPDATEMETADATA].calls;
+		if ( flushCalls )
+			flushUsecs = (curr->perf.ops[MGWFS_PERF_UPDATEMETADATA].totalNsecs - prev->perf.ops[MGWFS_PERF_UPDATEMETADATA].totalNsecs)/1000.0/flushCalls;
+		if ( json )
+		{
+			int first=1;
+
+			printf("{\"time\":%ld,\"secs\":%.3f,\"ops_per_sec\":%.1f,\"read_bytes_per_sec\":%.0f,\"write_bytes_per_sec\":%.0f,\"copy_bytes_per_sec\":%.0f,",
+				   (long)time(NULL), secs, ops/secs,
+				   (cc[MGWFS_CTR_BYTES_READ]-pc[MGWFS_CTR_BYTES_READ])/secs,
+				   (cc[MGWFS_CTR_BYTES_WRITTEN]-pc[MGWFS_CTR_BYTES_WRITTEN])/secs,
+				   (cc[MGWFS_CTR_BYTES_COPIED]-pc[MGWFS_CTR_BYTES_COPIED])/secs);
+			jsonRate("open_hit_pct", hitRate(cc[MGWFS_CTR_OPEN_SHARED]-pc[MGWFS_CTR_OPEN_SHARED], cc[MGWFS_CTR_OPEN_LOADED]-pc[MGWFS_CTR_OPEN_LOADED]));
+			jsonRate("cksum_hit_pct", hitRate(cc[MGWFS_CTR_CKSUM_HITS]-pc[MGWFS_CTR_CKSUM_HITS], cc[MGWFS_CTR_CKSUM_MISSES]-pc[MGWFS_CTR_CKSUM_MISSES]));
+			printf("\"dirty_inodes\":%d,\"flush_avg_usecs\":%.2f,\"alloc_calls_per_sec\":%.1f,\"ops\":{",
+				   curr->stats.numDirtyInodes, flushUsecs,
+				   (curr->perf.ops[MGWFS_PERF_FINDFREE].calls - prev->perf.ops[MGWFS_PERF_FINDFREE].calls)/secs);
+			for (ii=0; ii < curr->perf.numOps && ii < sizeof(Names)/sizeof(Names[0]); ++ii)
+			{
+				uint64_t calls = curr->perf.ops[ii].calls - prev->perf.ops[ii].calls;
+				if ( !calls )
+					continue;
+				printf("%s\"%s\":{\"per_sec\":%.1f,\"avg_usecs\":%.2f}", first ? "" : ",", Names[ii], calls/secs,
+					   (curr->perf.ops[ii].totalNsecs - prev->perf.ops[ii].totalNsecs)/1000.0/calls);
+				first = 0;
+			}
+			printf("}}\n");
+		}
+		else
+		{
+			printf("\033[H\033[J");		/* home and clear the screen */
+			printf("mgwfs %s   (updated every second, ^C to quit)\n\n", path);
+			printf("%-22s %10.1f\n", "operations/sec", ops/secs);
+			printf("%-22s %10.1f\n", "read KB/sec", (cc[MGWFS_CTR_BYTES_READ]-pc[MGWFS_CTR_BYTES_READ])/secs/1024);
+			printf("%-22s %10.1f\n", "written KB/sec", (cc[MGWFS_CTR_BYTES_WRITTEN]-pc[MGWFS_CTR_BYTES_WRITTEN])/secs/1024);
+			printf("%-22s %10.1f\n", "copied KB/sec", (cc[MGWFS_CTR_BYTES_COPIED]-pc[MGWFS_CTR_BYTES_COPIED])/secs/1024);
+			showRate("open buffer hits", hitRate(cc[MGWFS_CTR_OPEN_SHARED]-pc[MGWFS_CTR_OPEN_SHARED], cc[MGWFS_CTR_OPEN_LOADED]-pc[MGWFS_CTR_OPEN_LOADED]));
+			showRate("checksum cache hits", hitRate(cc[MGWFS_CTR_CKSUM_HITS]-pc[MGWFS_CTR_CKSUM_HITS], cc[MGWFS_CTR_CKSUM_MISSES]-pc[MGWFS_CTR_CKSUM_MISSES]));
+			printf("%-22s %10d\n", "dirty inodes", curr->stats.numDirtyInodes);
+			printf("%-22s %10.2f\n", "flush usecs (avg)", flushUsecs);
+			printf("%-22s %10.1f\n", "allocator calls/sec", (curr->perf.ops[MGWFS_PERF_FINDFREE].calls - prev->perf.ops[MGWFS_PERF_FINDFREE].calls)/secs);
+			printf("\n%-18s %10s %12s\n", "operation", "calls/sec", "avg usecs");
+			for (pass=0; pass < 2; ++pass)
+			for (ii=0; ii < curr->perf.numOps && ii < sizeof(Names)/sizeof(Names[0]); ++ii)
+			{
+				uint64_t calls = curr->perf.ops[ii].calls - prev->perf.ops[ii].calls;
+
+				if ( pass != MGWFS_PERF_IS_STAGE(ii) )
+					continue;
+				if ( ii == MGWFS_PERF_FIRST_STAGE )
+					printf("(internal stages)\n");
+				if ( !calls )
+					continue;
+				printf("%-18s %10.1f %12.2f\n", Names[ii], calls/secs,
+					   (curr->perf.ops[ii].totalNsecs - prev->perf.ops[ii].totalNsecs)/1000.0/calls);
+			}
+		}
+		fflush(stdout);
+		tmp = prev;
+		prev = curr;
+		curr = tmp;
+	}
+	close(fd);
+	free(samples);
+	return sts;
+}
+
 typedef enum
 {
 	OPT_HELP=1,
+	OPT_JSON,
+	OPT_ALL,
 	OPT_MAX
 } Options_t;
 
 static const struct option LongOptions[] =
 {
 	{ "help", no_argument,	NULL, OPT_HELP },
+	{ "json", no_argument,	NULL, OPT_JSON },
+	{ "all", no_argument,	NULL, OPT_ALL },
 	{ NULL, 0, NULL, 0 }
 };
 
@@ -287,13 +759,13 @@ typedef enum
 int main(int argc, char *argv[])
 {
 	const char *arguments[ARG_MAX];
-	int optArg, doFSToo=0;
+	int optArg, doFSToo=0, doReset=0, doJson=0, count=0, doAll=0, maxSectors=DEFRAG_SECTORS;
 	
 	if ( argc > 0 && argv[0][0] )
 		Prog = argv[0];
 	while ( 1 )
 	{
-		optArg = getopt_long(argc, argv, "hf", LongOptions, NULL);
+		optArg = getopt_long(argc, argv, "hfrn:m:", LongOptions, NULL);
 		switch (optArg)
 		{
 		case OPT_HELP:
@@ -303,6 +775,21 @@ int main(int argc, char *argv[])
 		case 'f':
 			doFSToo = 1;
 			break;
+		case 'r':
+			doReset = 1;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'm':
+			maxSectors = atoi(optarg);
+			break;
+		case OPT_JSON:
+			doJson = 1;
+			break;
+		case OPT_ALL:
+			doAll = 1;
+			break;
 		case 0:
 			break;
 		default:
@@ -334,6 +821,18 @@ int main(int argc, char *argv[])
 		return doGetVerbose(arguments[ARG_PATH]);
 	if ( !strcmp(arguments[ARG_CMD], "checksums") )
 		return doChecksums(arguments[ARG_PATH]);
+	if ( !strcmp(arguments[ARG_CMD], "verify") )
+		return doVerify(arguments[ARG_PATH]);
+	if ( !strcmp(arguments[ARG_CMD], "perf") )
+		return doPerf(arguments[ARG_PATH], doReset);
+	if ( !strcmp(arguments[ARG_CMD], "io") )
+		return doIo(arguments[ARG_PATH], doReset);
+	if ( !strcmp(arguments[ARG_CMD], "top") )
+		return doTop(arguments[ARG_PATH], doJson, count);
+	if ( !strcmp(arguments[ARG_CMD], "frag") )
+		return doFrag(arguments[ARG_PATH]);
+	if ( !strcmp(arguments[ARG_CMD], "defrag") )
+		return doDefrag(arguments[ARG_PATH], doAll, maxSectors);
 	if ( !strcmp(arguments[ARG_CMD], "setverbose") )
 	{
 		if ( !arguments[ARG_ARG1] )
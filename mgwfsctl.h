@@ -1,7 +1,7 @@
 /*
   mgwfs_ioctl.h: ioctl(2) ABI shared between the mgwfs FUSE daemon and the
-  mgwfsctl userland helper. Keep this self-contained (only stdint/ioctl) so
-  the helper can include it without dragging in the whole filesystem.
+  mgwfsctl userland helper. Keep this self-contained (only stdio/stdint/ioctl)
+  so the helper can include it without dragging in the whole filesystem.
 
   Copyright (C) 2025  Dave Shepperd <mgwfs@dshepperd.com>
   This program can be distributed under the terms of the GNU GPLv2.
@@ -10,6 +10,7 @@
 #ifndef MGWFS_IOCTL_H_
 #define MGWFS_IOCTL_H_
 
+#include <stdio.h>
 #include <stdint.h>
 #include <sys/ioctl.h>
 
@@ -42,6 +43,258 @@ typedef struct
 	char bootFiles[MAX_NUM_BOOT_FILES][MAX_BOOT_FN_PATH];
 } MgwfsIoctlStats_t;
 
+/* MGWFS_IOC_VERIFYCHECKSUMS checks every entry of a checksums file against
+ * the files as they are now. A FUSE ioctl can't return more than its fixed
+ * size, so the mismatches come back MAX_VERIFY_MISMATCHES at a time: if
+ * nextEntry is non-zero, call again with startEntry set to it for the rest.
+ */
+#define MGWFS_VERIFY_VERSION	(1)
+#define MAX_VERIFY_MISMATCHES	(64)
+#define MAX_VERIFY_PATH			(112)
+
+typedef struct
+{
+	uint32_t fid;				/* entry's fid (inode number, generation in the top 8 bits) */
+	uint32_t expected;			/* checksum recorded in the checksums file */
+	uint32_t actual;			/* checksum of the file now (0 if error is set) */
+	int32_t  error;				/* 0 for a plain mismatch, else why the file couldn't be checked (errno) */
+	char path[MAX_VERIFY_PATH];	/* path of the file, if it exists */
+} MgwfsVerifyMismatch_t;
+
+typedef struct
+{
+	uint32_t version;			/* in: MGWFS_VERIFY_VERSION */
+	uint32_t startEntry;		/* in: first checksums file entry to check */
+	uint32_t numEntries;		/* out: total entries in the checksums file */
+	uint32_t nextEntry;			/* out: where to start the next call, 0 if all were checked */
+	uint32_t numChecked;		/* out: entries checked by this call */
+	uint32_t numMismatches;		/* out: entries in mismatches[] */
+	uint32_t numThreads;		/* out: threads that did the reading */
+	uint32_t reserved;
+	uint64_t bytesChecked;		/* out: file bytes read by this call */
+	uint64_t usecs;				/* out: microseconds spent reading and summing */
+	MgwfsVerifyMismatch_t mismatches[MAX_VERIFY_MISMATCHES];
+} MgwfsIoctlVerify_t;
+
+/* MGWFS_IOC_GETPERF returns a call count and a latency histogram for each
+ * FUSE operation and for the internal stages under them. Bucket b counts
+ * calls that took from 2^b up to 2^(b+1) nanoseconds; bucket 0 also holds
+ * anything quicker and the last bucket anything slower. Stage times are
+ * included in the times of the operations that called them. New ops are
+ * only ever added at the end, so an older mgwfsctl still reads the ones it
+ * knows about.
+ */
+#define MGWFS_PERF_VERSION		(1)
+#define MGWFS_PERF_BUCKETS		(32)
+#define MGWFS_PERF_MAX_OPS		(32)	/* room in the ioctl for this many */
+#define MGWFS_PERF_RESET		(0x01)	/* flags: zero the counters after reading them */
+
+enum
+{
+	MGWFS_PERF_GETATTR,
+	MGWFS_PERF_READDIR,
+	MGWFS_PERF_OPEN,
+	MGWFS_PERF_READ,
+	MGWFS_PERF_RELEASE,
+	MGWFS_PERF_STATFS,
+	MGWFS_PERF_ACCESS,
+	MGWFS_PERF_UNLINK,
+	MGWFS_PERF_WRITE,
+	MGWFS_PERF_FLUSH,
+	MGWFS_PERF_FSYNC,
+	MGWFS_PERF_MKDIR,
+	MGWFS_PERF_RMDIR,
+	MGWFS_PERF_RENAME,
+	MGWFS_PERF_CREATE,
+	MGWFS_PERF_LSEEK,
+	MGWFS_PERF_TRUNCATE,
+	MGWFS_PERF_UTIMENS,
+	MGWFS_PERF_CHMOD,
+	MGWFS_PERF_CHOWN,
+	MGWFS_PERF_IOCTL,
+	MGWFS_PERF_FINDINODE,		/* the rest are internal stages */
+	MGWFS_PERF_READWHOLEFILE,
+	MGWFS_PERF_WRITEWHOLEFILE,
+	MGWFS_PERF_UPDATEMETADATA,
+	MGWFS_PERF_FINDFREE,
+	MGWFS_PERF_FALLOCATE,
+	MGWFS_PERF_COPYFILERANGE,
+	MGWFS_PERF_NUM_OPS
+};
+
+#define MGWFS_PERF_FIRST_STAGE	MGWFS_PERF_FINDINODE
+#define MGWFS_PERF_LAST_STAGE	MGWFS_PERF_FINDFREE
+#define MGWFS_PERF_IS_STAGE(op)	((op) >= MGWFS_PERF_FIRST_STAGE && (op) <= MGWFS_PERF_LAST_STAGE)
+
+/* Plain event counters returned alongside the histograms. Also only ever
+ * added to at the end. */
+#define MGWFS_PERF_MAX_COUNTERS	(16)
+
+enum
+{
+	MGWFS_CTR_BYTES_READ,		/* bytes returned by read() */
+	MGWFS_CTR_BYTES_WRITTEN,	/* bytes taken by write() */
+	MGWFS_CTR_OPEN_SHARED,		/* opens that found the file's buffer already loaded */
+	MGWFS_CTR_OPEN_LOADED,		/* opens that had to read the file in */
+	MGWFS_CTR_CKSUM_HITS,		/* checksums answered from the checksum cache */
+	MGWFS_CTR_CKSUM_MISSES,		/* checksums that had to read the file */
+	MGWFS_CTR_BYTES_COPIED,		/* bytes copy_file_range() copied disk to disk */
+	MGWFS_CTR_NUM
+};
+
+#define MGWFS_PERF_NAMES \
+	"getattr", "readdir", "open", "read", "release", "statfs", "access", \
+	"unlink", "write", "flush", "fsync", "mkdir", "rmdir", "rename", \
+	"create", "lseek", "truncate", "utimens", "chmod", "chown", "ioctl", \
+	"findInode", "readWholeFile", "writeWholeFile", "updateAllMetaData", \
+	"mgwfsFindFree", "fallocate", "copy_file_range"
+
+typedef struct
+{
+	uint64_t calls;
+	uint64_t totalNsecs;
+	uint64_t maxNsecs;
+	uint32_t buckets[MGWFS_PERF_BUCKETS];
+} MgwfsPerfOp_t;
+
+typedef struct
+{
+	uint32_t version;			/* in: MGWFS_PERF_VERSION */
+	uint32_t flags;				/* in: MGWFS_PERF_xxx flags */
+	uint32_t numOps;			/* out: entries of ops[] filled in */
+	uint32_t numBuckets;		/* out: MGWFS_PERF_BUCKETS */
+	uint64_t nsecs;				/* out: nanoseconds the counters have been counting */
+	MgwfsPerfOp_t ops[MGWFS_PERF_MAX_OPS];
+	uint32_t numCounters;		/* out: entries of counters[] filled in */
+	uint32_t reserved;
+	uint64_t counters[MGWFS_PERF_MAX_COUNTERS];	/* out: MGWFS_CTR_xxx */
+} MgwfsIoctlPerf_t;
+
+/* MGWFS_IOC_GETIO returns how much disk I/O the daemon has done, split by
+ * what it was for and by which part of the disk it landed in. The regions
+ * are the thirds FSYS_COPY_ALG() places each copy of a file in. An I/O
+ * counts as sequential when it starts right where the previous one ended. */
+#define MGWFS_IO_VERSION		(1)
+#define MGWFS_IO_MAX_PURPOSES	(8)
+#define MGWFS_IO_MAX_REGIONS	(4)
+#define MGWFS_IO_RESET			(0x01)	/* flags: zero the counters after reading them */
+
+enum
+{
+	MGWFS_IO_HOME,				/* home blocks */
+	MGWFS_IO_HEADER,			/* file headers */
+	MGWFS_IO_INDEX,				/* index.sys */
+	MGWFS_IO_FREEMAP,			/* freemap.sys */
+	MGWFS_IO_DIR,				/* directory contents */
+	MGWFS_IO_DATA,				/* file contents */
+	MGWFS_IO_NUM_PURPOSES
+};
+
+#define MGWFS_IO_NAMES \
+	"home", "header", "index.sys", "freemap.sys", "directory", "data"
+
+enum
+{
+	MGWFS_IO_READ,
+	MGWFS_IO_WRITE,
+	MGWFS_IO_NUM_DIRS
+};
+
+typedef struct
+{
+	uint64_t sectors;			/* sectors moved */
+	uint64_t calls;				/* read()/write() calls (each after an lseek()) */
+	uint64_t sequential;		/* calls that started where the last one ended */
+} MgwfsIoCount_t;
+
+typedef struct
+{
+	uint32_t version;			/* in: MGWFS_IO_VERSION */
+	uint32_t flags;				/* in: MGWFS_IO_xxx flags */
+	uint32_t numPurposes;		/* out: MGWFS_IO_NUM_PURPOSES */
+	uint32_t numRegions;		/* out: FSYS_MAX_ALTS */
+	uint64_t nsecs;				/* out: nanoseconds the counters have been counting */
+	uint32_t regionStart[MGWFS_IO_MAX_REGIONS];	/* out: first sector of each region */
+	MgwfsIoCount_t purpose[MGWFS_IO_MAX_PURPOSES][MGWFS_IO_NUM_DIRS];
+	MgwfsIoCount_t region[MGWFS_IO_MAX_REGIONS][MGWFS_IO_NUM_DIRS];
+} MgwfsIoctlIo_t;
+
+/* MGWFS_IOC_DEFRAG moves each copy of a file that's in more than one piece
+ * into a single piece. Made on a file it does that file; with
+ * MGWFS_DEFRAG_ALL it does every file and directory. maxSectors bounds how
+ * much one call moves so a live mount isn't held up for long (a file is
+ * never split across calls, so one bigger than that is moved on its own):
+ * if nextInode is non-zero, call again with startInode set to it.
+ */
+#define MGWFS_DEFRAG_VERSION	(1)
+#define MGWFS_DEFRAG_ALL		(0x01)	/* flags: every file, not just the one the ioctl was made on */
+
+typedef struct
+{
+	uint32_t version;			/* in: MGWFS_DEFRAG_VERSION */
+	uint32_t flags;				/* in: MGWFS_DEFRAG_xxx flags */
+	uint32_t maxSectors;		/* in: sectors to move before returning (0 = no limit) */
+	uint32_t startInode;		/* in: with MGWFS_DEFRAG_ALL, first inode to look at */
+	uint32_t nextInode;			/* out: where to start the next call, 0 if all were done */
+	uint32_t filesChecked;		/* out: files looked at */
+	uint32_t filesMoved;		/* out: files with at least one copy moved */
+	uint32_t filesBusy;			/* out: files skipped because they're open or not yet written out */
+	uint32_t filesNoRoom;		/* out: files with a copy there was no single free piece big enough for */
+	uint32_t rpsBefore;			/* out: retrieval pointers the moved copies had */
+	uint32_t rpsAfter;			/* out: retrieval pointers they have now */
+	uint32_t reserved;
+	uint64_t sectorsMoved;		/* out: sectors copied */
+	uint64_t usecs;				/* out: microseconds this call took */
+} MgwfsIoctlDefrag_t;
+
+/* MGWFS_IOC_FRAG reports how fragmented the free space and the files are:
+ * a histogram of free piece sizes (bucket b holds pieces of 2^b up to
+ * 2^(b+1)-1 sectors), the free space in each copy region, the files in the
+ * most pieces and how many seeks reading every file would take. mgwfs
+ * --frag prints the same report without mounting (see fragShow()).
+ */
+#define MGWFS_FRAG_VERSION		(1)
+#define MGWFS_FRAG_BUCKETS		(24)
+#define MGWFS_FRAG_TOP_FILES	(16)
+#define MAX_FRAG_PATH			(112)
+
+typedef struct
+{
+	uint32_t inode;				/* file's inode number */
+	uint32_t copies;			/* copies of it on disk */
+	uint32_t rps;				/* retrieval pointers over all its copies */
+	uint32_t sectors;			/* sectors allocated to each copy */
+	uint64_t seekSectors;		/* sectors skipped over going from one piece to the next, all copies */
+	char path[MAX_FRAG_PATH];	/* path of the file */
+} MgwfsFragFile_t;
+
+typedef struct
+{
+	uint32_t version;			/* in: MGWFS_FRAG_VERSION */
+	uint32_t numBuckets;		/* out: MGWFS_FRAG_BUCKETS */
+	uint32_t numRegions;		/* out: FSYS_MAX_ALTS */
+	uint32_t freePieces;		/* out: entries in the freemap */
+	uint64_t freeSectors;		/* out: sectors in them */
+	uint32_t freeHist[MGWFS_FRAG_BUCKETS];		/* out: free pieces of each size */
+	uint64_t freeHistSectors[MGWFS_FRAG_BUCKETS];	/* out: sectors in those pieces */
+	uint32_t regionStart[MGWFS_IO_MAX_REGIONS];	/* out: first sector of each copy region */
+	uint32_t regionLargest[MGWFS_IO_MAX_REGIONS];	/* out: largest free run in each region */
+	uint64_t regionFree[MGWFS_IO_MAX_REGIONS];	/* out: free sectors in each region */
+	uint32_t numFiles;			/* out: files and directories looked at */
+	uint32_t filesFragmented;	/* out: ones with a copy in more than one piece */
+	uint32_t maxRps;			/* out: most pieces any one copy is in */
+	uint32_t numTop;			/* out: entries in top[] */
+	uint64_t totalPieces;		/* out: pieces of the first copy of every file */
+	uint64_t scanSeeks;			/* out: seeks to read the first copy of every file in inode order */
+	uint64_t scanSeekSectors;	/* out: sectors those seeks skip over */
+	uint64_t sortedSeeks;		/* out: seeks if the same pieces were read in disk order */
+	uint64_t usecs;				/* out: microseconds the analysis took */
+	MgwfsFragFile_t top[MGWFS_FRAG_TOP_FILES];	/* out: files in the most pieces, worst first */
+} MgwfsIoctlFrag_t;
+
+/* Print a MgwfsIoctlFrag_t (fragshow.c, linked into both mgwfs and mgwfsctl) */
+extern void fragShow(FILE *fp, const MgwfsIoctlFrag_t *fr);
+
 #define MGWFS_IOC_MAGIC 'M'
 #define MGWFS_IOC_GETSTATS		_IOR(MGWFS_IOC_MAGIC, 1, MgwfsIoctlStats_t)
 #define MGWFS_IOC_GETVERBOSE	_IOR(MGWFS_IOC_MAGIC, 2, uint32_t)
@@ -51,5 +304,10 @@ typedef struct
 #define MGWFS_IOC_SETBOOT2		_IOW(MGWFS_IOC_MAGIC, 6, char *)
 #define MGWFS_IOC_SETBOOT3		_IOW(MGWFS_IOC_MAGIC, 7, char *)
 #define MGWFS_IOC_CHECKSUMS		_IOW(MGWFS_IOC_MAGIC, 8, char *)
+#define MGWFS_IOC_VERIFYCHECKSUMS	_IOWR(MGWFS_IOC_MAGIC, 9, MgwfsIoctlVerify_t)
+#define MGWFS_IOC_GETPERF		_IOWR(MGWFS_IOC_MAGIC, 10, MgwfsIoctlPerf_t)
+#define MGWFS_IOC_GETIO			_IOWR(MGWFS_IOC_MAGIC, 11, MgwfsIoctlIo_t)
+#define MGWFS_IOC_DEFRAG		_IOWR(MGWFS_IOC_MAGIC, 12, MgwfsIoctlDefrag_t)
+#define MGWFS_IOC_FRAG			_IOWR(MGWFS_IOC_MAGIC, 13, MgwfsIoctlFrag_t)
 
 #endif /* MGWFS_IOCTL_H_ */
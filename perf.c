@@ -0,0 +1,129 @@
+/*
+  perf: Part of Atari/MidwayGamesWest filesystem using libfuse: Filesystem in Userspace
+
+  Copyright (C) 2025  Dave Shepperd <mgwfs@dshepperd.com>
+
+  This program can be distributed under the terms of the GNU GPLv2.
+  See the file COPYING.
+
+ Call counts and latency histograms for every FUSE operation and for the
+ internal stages under them, so a slow mount can be picked apart without
+ turning on verbose logging. The counting itself is perfNow()/perfDone()
+ in mgwfs.h; this just keeps the counters and hands them out through
+ MGWFS_IOC_GETPERF. The disk I/O counts handed out through MGWFS_IOC_GETIO
+ live here too.
+
+*/
+#include "mgwfs.h"
+
+MgwfsPerfOp_t perfOps[MGWFS_PERF_NUM_OPS];
+uint64_t perfCounters[MGWFS_CTR_NUM];
+static uint64_t perfSince;		/* when the counters were last zeroed */
+static MgwfsIoCount_t ioPurposes[MGWFS_IO_NUM_PURPOSES][MGWFS_IO_NUM_DIRS];
+static MgwfsIoCount_t ioRegions[FSYS_MAX_ALTS][MGWFS_IO_NUM_DIRS];
+static uint64_t ioSince;			/* 0 until the first I/O, so the mount itself counts */
+static uint32_t ioNextSector;		/* where the last I/O ended */
+
+_Static_assert(MGWFS_PERF_NUM_OPS <= MGWFS_PERF_MAX_OPS, "MgwfsIoctlPerf_t has no room for all the ops");
+_Static_assert(MGWFS_CTR_NUM <= MGWFS_PERF_MAX_COUNTERS, "MgwfsIoctlPerf_t has no room for all the counters");
+_Static_assert(MGWFS_IO_NUM_PURPOSES <= MGWFS_IO_MAX_PURPOSES, "MgwfsIoctlIo_t has no room for all the purposes");
+_Static_assert(FSYS_MAX_ALTS <= MGWFS_IO_MAX_REGIONS, "MgwfsIoctlIo_t has no room for all the regions");
+
+void perfReset(void)
+{
+	memset(perfOps, 0, sizeof(perfOps));
+	memset(perfCounters, 0, sizeof(perfCounters));
+	perfSince = perfNow();
+}
+
+/* Copy the counters out for MGWFS_IOC_GETPERF (zeroing them afterwards if
+ * MGWFS_PERF_RESET is set in pp->flags). */
+void perfSnapshot(MgwfsIoctlPerf_t *pp)
+{
+	uint64_t now = perfNow();
+
+	pp->numOps = MGWFS_PERF_NUM_OPS;
+	pp->numBuckets = MGWFS_PERF_BUCKETS;
+	pp->nsecs = now - perfSince;
+	memset(pp->ops, 0, sizeof(pp->ops));
+	memcpy(pp->ops, perfOps, sizeof(perfOps));
+	pp->numCounters = MGWFS_CTR_NUM;
+	memset(pp->counters, 0, sizeof(pp->counters));
+	memcpy(pp->counters, perfCounters, sizeof(perfCounters));
+	if ( (pp->flags & MGWFS_PERF_RESET) )
+		perfReset();
+}
+
+/* Region (copy area) a sector falls in. Sectors are relative to baseSector. */
+static int ioRegionOf(const MgwfsSuper_t *ourSuper, uint32_t sector)
+{
+	int region;
+
+	for (region=FSYS_MAX_ALTS-1; region > 0; --region)
+	{
+		if ( sector >= FSYS_COPY_ALG(region, ourSuper->maxHb) )
+			break;
+	}
+	return region;
+}
+
+/* Account one read() or write() of 'sectors' sectors starting at 'sector'
+ * (relative to baseSector). */
+void ioCount(const MgwfsSuper_t *ourSuper, int purpose, int dir, uint32_t sector, uint32_t sectors)
+{
+	MgwfsIoRun_t run;
+
+	run.sector = sector;
+	run.nextSector = sector + sectors;
+	run.sectors = sectors;
+	run.calls = 1;
+	run.sequential = 0;
+	ioCountRun(ourSuper, purpose, dir, &run);
+}
+
+/* Account a run of reads or writes added up somewhere else (see
+ * MgwfsIoRun_t). All of it goes in the region the first one was in. */
+void ioCountRun(const MgwfsSuper_t *ourSuper, int purpose, int dir, const MgwfsIoRun_t *run)
+{
+	MgwfsIoCount_t *pp = &ioPurposes[purpose][dir];
+	MgwfsIoCount_t *rp = &ioRegions[ioRegionOf(ourSuper, run->sector)][dir];
+	uint32_t seq;
+
+	if ( !run->calls )
+		return;
+	seq = (run->sector == ioNextSector) + run->sequential;
+	if ( !ioSince )
+		ioSince = perfNow();
+	pp->sectors += run->sectors;
+	pp->calls += run->calls;
+	pp->sequential += seq;
+	rp->sectors += run->sectors;
+	rp->calls += run->calls;
+	rp->sequential += seq;
+	ioNextSector = run->nextSector;
+}
+
+/* Copy the I/O counts out for MGWFS_IOC_GETIO (zeroing them afterwards if
+ * MGWFS_IO_RESET is set in iop->flags). */
+void ioSnapshot(const MgwfsSuper_t *ourSuper, MgwfsIoctlIo_t *iop)
+{
+	uint64_t now = perfNow();
+	int ii;
+
+	iop->numPurposes = MGWFS_IO_NUM_PURPOSES;
+	iop->numRegions = FSYS_MAX_ALTS;
+	iop->nsecs = ioSince ? now - ioSince : 0;
+	memset(iop->regionStart, 0, sizeof(iop->regionStart));
+	for (ii=1; ii < FSYS_MAX_ALTS; ++ii)
+		iop->regionStart[ii] = FSYS_COPY_ALG(ii, ourSuper->maxHb);
+	memset(iop->purpose, 0, sizeof(iop->purpose));
+	memcpy(iop->purpose, ioPurposes, sizeof(ioPurposes));
+	memset(iop->region, 0, sizeof(iop->region));
+	memcpy(iop->region, ioRegions, sizeof(ioRegions));
+	if ( (iop->flags & MGWFS_IO_RESET) )
+	{
+		memset(ioPurposes, 0, sizeof(ioPurposes));
+		memset(ioRegions, 0, sizeof(ioRegions));
+		ioSince = now;
+	}
+}